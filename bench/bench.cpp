@@ -0,0 +1,511 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <google/protobuf/util/message_differencer.h>
+#include "sw/redis-protobuf/errors.h"
+#include "sw/redis-protobuf/redis_protobuf.h"
+#include "sw/redis-protobuf/field_ref.h"
+#include "sw/redis-protobuf/proto_value.h"
+#include "sw/redis-protobuf/utils.h"
+#include "sw/redis-protobuf/wire_scanner.h"
+#include "fake_redis.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+using namespace sw::redis::pb::bench;
+
+// A message type with fields of all kinds, defined in
+// docker/google/protobuf/test_messages_proto3.proto.
+const std::string TYPE = "protobuf_test_messages::proto3::TestAllTypesProto3";
+
+// Create a JSON message, whose size grows with *elements*, i.e. the number of
+// elements of each repeated field.
+std::string make_json(int elements) {
+    std::string json = R"({"optionalInt32":1,"optionalString":"redis-protobuf",)"
+        R"("optionalNestedMessage":{"a":1})";
+
+    std::string ints;
+    std::string strs;
+    std::string msgs;
+    for (int idx = 0; idx != elements; ++idx) {
+        const char *sep = (idx == 0 ? "" : ",");
+        auto num = std::to_string(idx);
+        ints += sep + num;
+        strs += sep + std::string("\"str-") + num + "\"";
+        msgs += sep + std::string("{\"a\":") + num + "}";
+    }
+
+    json += R"(,"repeatedInt32":[)" + ints + "]";
+    json += R"(,"repeatedString":[)" + strs + "]";
+    json += R"(,"repeatedNestedMessage":[)" + msgs + "]}";
+
+    return json;
+}
+
+std::string key_name(int elements) {
+    return "key-" + std::to_string(elements);
+}
+
+// Set a key with a message of the given size, and return the key name.
+std::string set_key(int elements) {
+    auto key = key_name(elements);
+
+    if (!Command({"PB.SET", key, TYPE, make_json(elements)}).run()) {
+        throw std::runtime_error("failed to set " + key + ": " + FakeRedis::instance().last_error());
+    }
+
+    return key;
+}
+
+gp::Message& key_msg(const std::string &key) {
+    auto *value = static_cast<ProtoValue *>(FakeRedis::instance().value(key));
+    if (value == nullptr) {
+        throw std::runtime_error("no such key: " + key);
+    }
+
+    return value->msg();
+}
+
+// Whether the scanned *field* equals the field of the parsed *msg*.
+bool same_value(const gp::Message &msg, const gp::FieldDescriptor &desc, const WireField &field) {
+    const auto *reflection = msg.GetReflection();
+    switch (desc.cpp_type()) {
+    case gp::FieldDescriptor::CPPTYPE_INT32:
+        return reflection->GetInt32(msg, &desc) == field.int_val;
+
+    case gp::FieldDescriptor::CPPTYPE_INT64:
+        return reflection->GetInt64(msg, &desc) == field.int_val;
+
+    case gp::FieldDescriptor::CPPTYPE_UINT32:
+        return reflection->GetUInt32(msg, &desc) == field.uint_val;
+
+    case gp::FieldDescriptor::CPPTYPE_UINT64:
+        return reflection->GetUInt64(msg, &desc) == field.uint_val;
+
+    case gp::FieldDescriptor::CPPTYPE_DOUBLE:
+        return reflection->GetDouble(msg, &desc) == field.double_val;
+
+    case gp::FieldDescriptor::CPPTYPE_FLOAT:
+        return reflection->GetFloat(msg, &desc) == field.float_val;
+
+    case gp::FieldDescriptor::CPPTYPE_BOOL:
+        return reflection->GetBool(msg, &desc) == (field.int_val != 0);
+
+    case gp::FieldDescriptor::CPPTYPE_ENUM:
+        return reflection->GetEnumValue(msg, &desc) == field.int_val;
+
+    case gp::FieldDescriptor::CPPTYPE_STRING:
+        return reflection->GetString(msg, &desc) == field.bytes;
+
+    default:
+        return reflection->GetMessage(msg, &desc).SerializeAsString() == field.bytes;
+    }
+}
+
+// Lazy values are read with WireScanner, and it must answer the same as the
+// parsed message. Fields not set in *json* are scanned with their default
+// values, e.g. proto2 defaults, and enums whose first value is not 0. The later
+// member of a oneof clears the earlier one, and an unknown value of a closed
+// enum, i.e. 100 of NestedEnum, is ignored.
+void check_wire_scanner() {
+    const std::string type = "protobuf_unittest.TestAllTypes";
+    const std::string key = "wire-scanner";
+
+    std::string wire;
+    MsgUPtr msg;
+    for (const auto *json : {R"({"optionalInt32":1,"defaultInt64":7,"oneofUint32":5,)"
+                R"("optionalNestedEnum":"BAZ"})", R"({"oneofString":"str"})"}) {
+        if (!Command({"PB.SET", key, type, json}).run()) {
+            throw std::runtime_error("failed to set " + key + ": " + FakeRedis::instance().last_error());
+        }
+
+        const auto &value = key_msg(key);
+        wire += value.SerializeAsString();
+        if (!msg) {
+            msg.reset(value.New());
+        }
+    }
+
+    // optional_nested_enum = 100, i.e. tag of field 21 with varint wire type, and the value.
+    wire += std::string("\xA8\x01\x64", 3);
+
+    FakeRedis::instance().del(key);
+
+    if (!msg->ParseFromString(wire)) {
+        throw std::runtime_error("failed to parse the wire bytes of " + type);
+    }
+
+    for (const auto *name : {"optional_int32", "optional_nested_enum", "optional_nested_message",
+                "oneof_uint32", "oneof_string",
+                "default_int32", "default_int64", "default_uint64", "default_sint32",
+                "default_float", "default_double", "default_bool", "default_string",
+                "default_bytes", "default_nested_enum", "default_foreign_enum"}) {
+        Path path{StringView(type + "." + name)};
+        auto fields = path.resolve(*msg->GetDescriptor());
+        auto field = WireScanner(*fields).scan(StringView(wire));
+        if (!same_value(*msg, *(fields->back().desc), field)) {
+            throw std::runtime_error(std::string("wire scanner mismatch: ") + name);
+        }
+    }
+}
+
+// PB.RELOAD blocks the client, and runs in the worker pool. The task is
+// freed by the free_privdata callback of the blocked client, which Redis
+// calls with a context.
+void check_blocked_client() {
+    auto replies = FakeRedis::instance().replies();
+    if (!Command({"PB.RELOAD"}).run()) {
+        throw std::runtime_error("failed to reload: " + FakeRedis::instance().last_error());
+    }
+
+    if (FakeRedis::instance().replies() != replies + 1) {
+        throw std::runtime_error("blocked client is not replied");
+    }
+}
+
+// PB.PATCH applies operations in place. If one of them fails late, e.g. INCR
+// overflows, those that have been applied are undone.
+void check_patch_rollback() {
+    const std::string key = "patch-rollback";
+    if (!Command({"PB.SET", key, TYPE, R"({"optionalInt32":2147483647,"repeatedInt32":[1,2],)"
+                R"("optionalNestedMessage":{"a":1},"oneofUint32":7,"mapInt32Int32":{"1":2}})"}).run()) {
+        throw std::runtime_error("failed to set " + key + ": " + FakeRedis::instance().last_error());
+    }
+
+    const auto &msg = key_msg(key);
+    MsgUPtr old(msg.New());
+    old->CopyFrom(msg);
+
+    if (Command({"PB.PATCH", key,
+                "SET", TYPE + ".oneof_string", "str",
+                "APPEND", TYPE + ".repeated_int32", "3",
+                "DEL", TYPE + ".repeated_int32[0]",
+                "MERGE", TYPE + ".optional_nested_message", R"({"a":2})",
+                "SET", TYPE + ".map_int32_int32[1]", "3",
+                "SET", TYPE + ".map_int32_int32[5]", "6",
+                "SET", TYPE + ".recursive_message.optional_int32", "1",
+                "INCR", TYPE + ".optional_int32", "1"}).run()) {
+        throw std::runtime_error("PB.PATCH should fail with overflow");
+    }
+
+    if (!gp::util::MessageDifferencer::Equals(*old, key_msg(key))) {
+        throw std::runtime_error("PB.PATCH is not undone");
+    }
+
+    FakeRedis::instance().del(key);
+}
+
+void run_command(benchmark::State &state, const std::vector<std::string> &argv) {
+    Command cmd(argv);
+    for (auto _ : state) {
+        if (!cmd.run()) {
+            state.SkipWithError(FakeRedis::instance().last_error().c_str());
+            break;
+        }
+    }
+}
+
+// Parse *input* with *parse*. Invalid inputs, e.g. overflow, throw Error,
+// which is part of the measured cost.
+template <typename Parse>
+void parse_input(benchmark::State &state, Parse parse, const std::string &input) {
+    StringView sv(input.data(), input.size());
+    for (auto _ : state) {
+        try {
+            benchmark::DoNotOptimize(parse(sv));
+        } catch (const Error &) {
+        }
+    }
+}
+
+void BM_SvToInt32(benchmark::State &state, const std::string &input) {
+    parse_input(state, util::sv_to_int32, input);
+}
+BENCHMARK_CAPTURE(BM_SvToInt32, valid, std::string("-1234567890"));
+BENCHMARK_CAPTURE(BM_SvToInt32, overflow, std::string("2147483648"));
+BENCHMARK_CAPTURE(BM_SvToInt32, invalid, std::string("12345abc"));
+
+void BM_SvToInt64(benchmark::State &state, const std::string &input) {
+    parse_input(state, util::sv_to_int64, input);
+}
+BENCHMARK_CAPTURE(BM_SvToInt64, valid, std::string("-1234567890123456789"));
+BENCHMARK_CAPTURE(BM_SvToInt64, overflow, std::string("9223372036854775808"));
+BENCHMARK_CAPTURE(BM_SvToInt64, invalid, std::string("12345abc"));
+
+void BM_SvToUint64(benchmark::State &state, const std::string &input) {
+    parse_input(state, util::sv_to_uint64, input);
+}
+BENCHMARK_CAPTURE(BM_SvToUint64, valid, std::string("12345678901234567890"));
+BENCHMARK_CAPTURE(BM_SvToUint64, overflow, std::string("18446744073709551616"));
+BENCHMARK_CAPTURE(BM_SvToUint64, invalid, std::string("-1"));
+
+void BM_SvToDouble(benchmark::State &state, const std::string &input) {
+    parse_input(state, util::sv_to_double, input);
+}
+BENCHMARK_CAPTURE(BM_SvToDouble, valid, std::string("-12345.6789e10"));
+BENCHMARK_CAPTURE(BM_SvToDouble, overflow, std::string("1e400"));
+BENCHMARK_CAPTURE(BM_SvToDouble, invalid, std::string("12.5abc"));
+
+void BM_SvToFloat(benchmark::State &state, const std::string &input) {
+    parse_input(state, util::sv_to_float, input);
+}
+BENCHMARK_CAPTURE(BM_SvToFloat, valid, std::string("-12345.67"));
+BENCHMARK_CAPTURE(BM_SvToFloat, overflow, std::string("1e40"));
+BENCHMARK_CAPTURE(BM_SvToFloat, invalid, std::string("12.5abc"));
+
+void BM_SvToBool(benchmark::State &state, const std::string &input) {
+    parse_input(state, util::sv_to_bool, input);
+}
+BENCHMARK_CAPTURE(BM_SvToBool, word, std::string("false"));
+BENCHMARK_CAPTURE(BM_SvToBool, number, std::string("1"));
+BENCHMARK_CAPTURE(BM_SvToBool, overflow, std::string("9223372036854775808"));
+BENCHMARK_CAPTURE(BM_SvToBool, invalid, std::string("yes"));
+
+// With the default options, paths are looked up from the path cache. Run with
+// `-- --PATH-CACHE-SIZE 0` to measure parsing paths.
+void BM_Path(benchmark::State &state) {
+    const std::string path = TYPE + ".repeated_nested_message[10].a";
+    for (auto _ : state) {
+        Path p{StringView(path)};
+        benchmark::DoNotOptimize(p);
+    }
+}
+BENCHMARK(BM_Path);
+
+void BM_FieldRef(benchmark::State &state) {
+    auto elements = static_cast<int>(state.range(0));
+    auto key = set_key(elements);
+    const auto &msg = key_msg(key);
+
+    const std::string path_str = TYPE + ".repeated_nested_message["
+        + std::to_string(elements / 2) + "].a";
+    Path path{StringView(path_str)};
+
+    for (auto _ : state) {
+        ConstFieldRef field(&msg, path);
+        benchmark::DoNotOptimize(field);
+    }
+}
+BENCHMARK(BM_FieldRef)->Range(8, 4096);
+
+// Get a field of a lazy value, i.e. a serialized message, by scanning its wire
+// bytes, without parsing the whole message.
+void BM_WireScan(benchmark::State &state) {
+    auto key = set_key(static_cast<int>(state.range(0)));
+    const auto &msg = key_msg(key);
+    auto wire = msg.SerializeAsString();
+
+    Path path{StringView(TYPE + ".optional_nested_message.a")};
+    auto fields = path.resolve(*msg.GetDescriptor());
+
+    for (auto _ : state) {
+        auto field = WireScanner(*fields).scan(StringView(wire));
+        benchmark::DoNotOptimize(field);
+    }
+
+    state.SetBytesProcessed(state.iterations() * wire.size());
+}
+BENCHMARK(BM_WireScan)->Range(8, 4096);
+
+// Get the same field of the same lazy value, by parsing it, and reading
+// the field with ConstFieldRef.
+void BM_ConstFieldRefGet(benchmark::State &state) {
+    auto key = set_key(static_cast<int>(state.range(0)));
+    const auto &msg = key_msg(key);
+    auto wire = msg.SerializeAsString();
+
+    Path path{StringView(TYPE + ".optional_nested_message.a")};
+    MsgUPtr parsed(msg.New());
+
+    for (auto _ : state) {
+        if (!parsed->ParseFromString(wire)) {
+            state.SkipWithError("failed to parse message");
+            break;
+        }
+
+        ConstFieldRef field(parsed.get(), path);
+        benchmark::DoNotOptimize(field.get<gp::FieldDescriptor::CPPTYPE_INT32>());
+    }
+
+    state.SetBytesProcessed(state.iterations() * wire.size());
+}
+BENCHMARK(BM_ConstFieldRefGet)->Range(8, 4096);
+
+// Drive SetCommand::_set_field with a scalar field.
+void BM_SetScalar(benchmark::State &state) {
+    auto key = set_key(static_cast<int>(state.range(0)));
+
+    run_command(state, {"PB.SET", key, TYPE + ".optional_int32", "123"});
+}
+BENCHMARK(BM_SetScalar)->Range(8, 4096);
+
+void BM_SetArrayElement(benchmark::State &state) {
+    auto elements = static_cast<int>(state.range(0));
+    auto key = set_key(elements);
+
+    run_command(state, {"PB.SET",
+            key,
+            TYPE + ".repeated_int32[" + std::to_string(elements / 2) + "]",
+            "123"});
+}
+BENCHMARK(BM_SetArrayElement)->Range(8, 4096);
+
+// Drive GetCommand::_get_field with a scalar field.
+void BM_GetScalar(benchmark::State &state) {
+    auto key = set_key(static_cast<int>(state.range(0)));
+
+    run_command(state, {"PB.GET", key, TYPE + ".optional_int32"});
+}
+BENCHMARK(BM_GetScalar)->Range(8, 4096);
+
+void BM_GetNested(benchmark::State &state) {
+    auto key = set_key(static_cast<int>(state.range(0)));
+
+    run_command(state, {"PB.GET", key, TYPE + ".optional_nested_message.a"});
+}
+BENCHMARK(BM_GetNested)->Range(8, 4096);
+
+void BM_GetBinary(benchmark::State &state) {
+    auto key = set_key(static_cast<int>(state.range(0)));
+
+    run_command(state, {"PB.GET", key, "--FORMAT", "BINARY", TYPE});
+}
+BENCHMARK(BM_GetBinary)->Range(8, 4096);
+
+void BM_MsgToJson(benchmark::State &state) {
+    auto key = set_key(static_cast<int>(state.range(0)));
+    const auto &msg = key_msg(key);
+
+    std::size_t bytes = 0;
+    for (auto _ : state) {
+        auto json = util::msg_to_json(msg);
+        bytes += json.size();
+        benchmark::DoNotOptimize(json);
+    }
+
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_MsgToJson)->Range(8, 4096);
+
+void BM_JsonToMsg(benchmark::State &state) {
+    auto key = set_key(static_cast<int>(state.range(0)));
+    auto json = make_json(static_cast<int>(state.range(0)));
+    auto &msg = key_msg(key);
+
+    for (auto _ : state) {
+        msg.Clear();
+        util::json_to_msg(StringView(json.data(), json.size()), msg);
+    }
+
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_JsonToMsg)->Range(8, 4096);
+
+void BM_RdbSave(benchmark::State &state) {
+    auto key = set_key(static_cast<int>(state.range(0)));
+    auto &redis = FakeRedis::instance();
+    auto *value = redis.value(key);
+
+    // Save the type dictionary, which is referenced by saved values.
+    redis.rdb_save_aux();
+
+    std::size_t bytes = 0;
+    for (auto _ : state) {
+        auto rdb = redis.rdb_save(value);
+        bytes += rdb.size();
+        benchmark::DoNotOptimize(rdb);
+    }
+
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_RdbSave)->Range(8, 4096);
+
+void BM_RdbLoad(benchmark::State &state) {
+    auto key = set_key(static_cast<int>(state.range(0)));
+    auto &redis = FakeRedis::instance();
+
+    redis.rdb_load_aux(redis.rdb_save_aux());
+    auto rdb = redis.rdb_save(redis.value(key));
+
+    for (auto _ : state) {
+        auto *value = redis.rdb_load(rdb);
+        benchmark::DoNotOptimize(value);
+        redis.free_value(value);
+    }
+
+    state.SetBytesProcessed(state.iterations() * rdb.size());
+}
+BENCHMARK(BM_RdbLoad)->Range(8, 4096);
+
+}
+
+// Arguments that are not benchmark flags are passed to the module as module
+// options, e.g. redis-protobuf-bench --benchmark_filter=Get -- --LAZY
+int main(int argc, char **argv) {
+    benchmark::Initialize(&argc, argv);
+
+    std::vector<std::string> args;
+    auto has_dir = false;
+    auto has_async = false;
+    for (int idx = 1; idx < argc; ++idx) {
+        if (std::strcmp(argv[idx], "--") == 0) {
+            continue;
+        }
+
+        if (util::str_case_equal(argv[idx], "--DIR")) {
+            has_dir = true;
+        }
+
+        if (util::str_case_equal(argv[idx], "--ASYNC-JSON-THRESHOLD")) {
+            has_async = true;
+        }
+
+        args.push_back(argv[idx]);
+    }
+
+    if (!has_dir) {
+        args.insert(args.begin(), {"--DIR", REDIS_PROTOBUF_BENCH_PROTO_DIR});
+    }
+
+    if (!has_async) {
+        // Create the worker pool, so that blocked clients are checked, but
+        // keep benchmarked JSON conversions synchronous.
+        args.insert(args.end(), {"--ASYNC-JSON-THRESHOLD", "1073741824"});
+    }
+
+    try {
+        FakeRedis::instance().load(args);
+
+        check_wire_scanner();
+
+        check_blocked_client();
+
+        check_patch_rollback();
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+
+    return 0;
+}
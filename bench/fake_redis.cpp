@@ -0,0 +1,668 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "fake_redis.h"
+#include <cctype>
+#include <cstdarg>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include "sw/redis-protobuf/module_entry.h"
+
+// Definitions of the opaque types. RedisModule_Init reads the GetApi
+// function from the first pointer of the context.
+struct RedisModuleCtx {
+    void *get_api;
+
+    // Private data of the blocked client, whose reply callback is running.
+    void *blocked_privdata;
+};
+
+struct RedisModuleString {
+    std::string str;
+};
+
+struct RedisModuleKey {
+    std::string name;
+};
+
+struct RedisModuleType {
+    int encver;
+    RedisModuleTypeMethods methods;
+};
+
+struct RedisModuleIO {
+    std::string buf;
+    std::size_t pos = 0;
+};
+
+struct RedisModuleBlockedClient {
+    RedisModuleCmdFunc reply_callback = nullptr;
+
+    void (*free_privdata)(RedisModuleCtx *, void *) = nullptr;
+
+    void *privdata = nullptr;
+
+    bool unblocked = false;
+};
+
+namespace {
+
+struct Entry {
+    RedisModuleType *type = nullptr;
+    void *value = nullptr;
+};
+
+struct State {
+    std::unordered_map<std::string, RedisModuleCmdFunc> commands;
+
+    std::unordered_map<std::string, Entry> keyspace;
+
+    RedisModuleType type;
+
+    uint64_t replies = 0;
+
+    std::string error;
+
+    // Clients blocked by the running command. Worker threads unblock them,
+    // and the main thread replies to them, the same as Redis.
+    std::deque<RedisModuleBlockedClient *> blocked;
+
+    std::mutex blocked_mutex;
+
+    std::condition_variable blocked_cv;
+};
+
+State& state() {
+    static State s;
+
+    return s;
+}
+
+std::string to_upper(std::string str) {
+    for (auto &ch : str) {
+        ch = static_cast<char>(std::toupper(static_cast<unsigned char>(ch)));
+    }
+
+    return str;
+}
+
+void* fake_Alloc(size_t bytes) {
+    return std::malloc(bytes);
+}
+
+void* fake_Calloc(size_t nmemb, size_t size) {
+    return std::calloc(nmemb, size);
+}
+
+void* fake_Realloc(void *ptr, size_t bytes) {
+    return std::realloc(ptr, bytes);
+}
+
+void fake_Free(void *ptr) {
+    std::free(ptr);
+}
+
+char* fake_Strdup(const char *str) {
+    auto len = std::strlen(str);
+    auto *dup = static_cast<char *>(std::malloc(len + 1));
+    std::memcpy(dup, str, len + 1);
+
+    return dup;
+}
+
+int fake_CreateCommand(RedisModuleCtx *ctx,
+        const char *name,
+        RedisModuleCmdFunc cmdfunc,
+        const char *strflags,
+        int firstkey,
+        int lastkey,
+        int keystep) {
+    state().commands[to_upper(name)] = cmdfunc;
+
+    return REDISMODULE_OK;
+}
+
+void fake_SetModuleAttribs(RedisModuleCtx *ctx, const char *name, int ver, int apiver) {}
+
+int fake_IsModuleNameBusy(const char *name) {
+    return 0;
+}
+
+int fake_WrongArity(RedisModuleCtx *ctx) {
+    ++state().replies;
+    state().error = "wrong number of arguments";
+
+    return REDISMODULE_OK;
+}
+
+int fake_ReplyWithLongLong(RedisModuleCtx *ctx, long long ll) {
+    ++state().replies;
+
+    return REDISMODULE_OK;
+}
+
+int fake_ReplyWithError(RedisModuleCtx *ctx, const char *err) {
+    ++state().replies;
+    state().error = err;
+
+    return REDISMODULE_OK;
+}
+
+int fake_ReplyWithSimpleString(RedisModuleCtx *ctx, const char *msg) {
+    ++state().replies;
+
+    return REDISMODULE_OK;
+}
+
+int fake_ReplyWithArray(RedisModuleCtx *ctx, long len) {
+    ++state().replies;
+
+    return REDISMODULE_OK;
+}
+
+int fake_ReplyWithStringBuffer(RedisModuleCtx *ctx, const char *buf, size_t len) {
+    ++state().replies;
+
+    return REDISMODULE_OK;
+}
+
+int fake_ReplyWithString(RedisModuleCtx *ctx, RedisModuleString *str) {
+    ++state().replies;
+
+    return REDISMODULE_OK;
+}
+
+int fake_ReplyWithNull(RedisModuleCtx *ctx) {
+    ++state().replies;
+
+    return REDISMODULE_OK;
+}
+
+int fake_ReplyWithDouble(RedisModuleCtx *ctx, double d) {
+    ++state().replies;
+
+    return REDISMODULE_OK;
+}
+
+int fake_ReplicateVerbatim(RedisModuleCtx *ctx) {
+    return REDISMODULE_OK;
+}
+
+int fake_GetContextFlags(RedisModuleCtx *ctx) {
+    return 0;
+}
+
+int fake_NotifyKeyspaceEvent(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key) {
+    return REDISMODULE_OK;
+}
+
+RedisModuleBlockedClient* fake_BlockClient(RedisModuleCtx *ctx,
+        RedisModuleCmdFunc reply_callback,
+        RedisModuleCmdFunc timeout_callback,
+        void (*free_privdata)(RedisModuleCtx *, void *),
+        long long timeout_ms) {
+    auto *bc = new RedisModuleBlockedClient;
+    bc->reply_callback = reply_callback;
+    bc->free_privdata = free_privdata;
+
+    auto &s = state();
+    std::lock_guard<std::mutex> lock(s.blocked_mutex);
+    s.blocked.push_back(bc);
+
+    return bc;
+}
+
+int fake_UnblockClient(RedisModuleBlockedClient *bc, void *privdata) {
+    auto &s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.blocked_mutex);
+        bc->privdata = privdata;
+        bc->unblocked = true;
+    }
+
+    s.blocked_cv.notify_all();
+
+    return REDISMODULE_OK;
+}
+
+int fake_AbortBlock(RedisModuleBlockedClient *bc) {
+    auto &s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.blocked_mutex);
+        for (auto iter = s.blocked.begin(); iter != s.blocked.end(); ++iter) {
+            if (*iter == bc) {
+                s.blocked.erase(iter);
+                break;
+            }
+        }
+    }
+
+    delete bc;
+
+    return REDISMODULE_OK;
+}
+
+void* fake_GetBlockedClientPrivateData(RedisModuleCtx *ctx) {
+    return ctx->blocked_privdata;
+}
+
+// Wait until clients blocked by the last command are unblocked, and reply to
+// them. Same as Redis, the reply callback and free_privdata are called with
+// a context, which is not the context of the command.
+void handle_blocked_clients() {
+    auto &s = state();
+    while (true) {
+        RedisModuleBlockedClient *bc = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(s.blocked_mutex);
+            if (s.blocked.empty()) {
+                break;
+            }
+
+            bc = s.blocked.front();
+            s.blocked_cv.wait(lock, [bc]() { return bc->unblocked; });
+            s.blocked.pop_front();
+        }
+
+        RedisModuleCtx ctx = {sw::redis::pb::bench::FakeRedis::instance().ctx()->get_api, bc->privdata};
+        if (bc->reply_callback != nullptr) {
+            bc->reply_callback(&ctx, nullptr, 0);
+        }
+
+        if (bc->free_privdata != nullptr) {
+            bc->free_privdata(&ctx, bc->privdata);
+        }
+
+        delete bc;
+    }
+}
+
+RedisModuleString* fake_CreateString(RedisModuleCtx *ctx, const char *ptr, size_t len) {
+    return new RedisModuleString{std::string(ptr, len)};
+}
+
+void fake_FreeString(RedisModuleCtx *ctx, RedisModuleString *str) {
+    delete str;
+}
+
+const char* fake_StringPtrLen(const RedisModuleString *str, size_t *len) {
+    if (len != nullptr) {
+        *len = str->str.size();
+    }
+
+    return str->str.data();
+}
+
+void* fake_OpenKey(RedisModuleCtx *ctx, RedisModuleString *keyname, int mode) {
+    const auto &keyspace = state().keyspace;
+    if ((mode & REDISMODULE_WRITE) == 0 && keyspace.find(keyname->str) == keyspace.end()) {
+        // The same as Redis, opening a non-existent key for reading returns NULL.
+        return nullptr;
+    }
+
+    return new RedisModuleKey{keyname->str};
+}
+
+void fake_CloseKey(RedisModuleKey *kp) {
+    delete kp;
+}
+
+Entry* find_entry(RedisModuleKey *kp) {
+    if (kp == nullptr) {
+        return nullptr;
+    }
+
+    auto &keyspace = state().keyspace;
+    auto iter = keyspace.find(kp->name);
+    if (iter == keyspace.end()) {
+        return nullptr;
+    }
+
+    return &(iter->second);
+}
+
+int fake_KeyType(RedisModuleKey *kp) {
+    if (find_entry(kp) == nullptr) {
+        return REDISMODULE_KEYTYPE_EMPTY;
+    }
+
+    return REDISMODULE_KEYTYPE_MODULE;
+}
+
+int fake_SetExpire(RedisModuleKey *key, mstime_t expire) {
+    return REDISMODULE_OK;
+}
+
+RedisModuleType* fake_CreateDataType(RedisModuleCtx *ctx,
+        const char *name,
+        int encver,
+        RedisModuleTypeMethods *typemethods) {
+    auto &type = state().type;
+    type.encver = encver;
+    type.methods = *typemethods;
+
+    return &type;
+}
+
+void free_entry(Entry &entry) {
+    if (entry.value != nullptr && entry.type->methods.free != nullptr) {
+        entry.type->methods.free(entry.value);
+    }
+
+    entry.value = nullptr;
+}
+
+int fake_ModuleTypeSetValue(RedisModuleKey *key, RedisModuleType *mt, void *value) {
+    auto &entry = state().keyspace[key->name];
+    free_entry(entry);
+
+    entry.type = mt;
+    entry.value = value;
+
+    return REDISMODULE_OK;
+}
+
+RedisModuleType* fake_ModuleTypeGetType(RedisModuleKey *key) {
+    auto *entry = find_entry(key);
+
+    return entry == nullptr ? nullptr : entry->type;
+}
+
+void* fake_ModuleTypeGetValue(RedisModuleKey *key) {
+    auto *entry = find_entry(key);
+
+    return entry == nullptr ? nullptr : entry->value;
+}
+
+void fake_SaveUnsigned(RedisModuleIO *io, uint64_t value) {
+    io->buf.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+uint64_t fake_LoadUnsigned(RedisModuleIO *io) {
+    uint64_t value = 0;
+    if (io->pos + sizeof(value) <= io->buf.size()) {
+        std::memcpy(&value, io->buf.data() + io->pos, sizeof(value));
+        io->pos += sizeof(value);
+    }
+
+    return value;
+}
+
+void fake_SaveStringBuffer(RedisModuleIO *io, const char *str, size_t len) {
+    fake_SaveUnsigned(io, len);
+    io->buf.append(str, len);
+}
+
+char* fake_LoadStringBuffer(RedisModuleIO *io, size_t *lenptr) {
+    auto len = fake_LoadUnsigned(io);
+    if (io->pos + len > io->buf.size()) {
+        return nullptr;
+    }
+
+    auto *str = static_cast<char *>(std::malloc(len == 0 ? 1 : len));
+    std::memcpy(str, io->buf.data() + io->pos, len);
+    io->pos += len;
+
+    *lenptr = len;
+
+    return str;
+}
+
+void record_error(const char *fmt, va_list args) {
+    char buf[1024];
+    std::vsnprintf(buf, sizeof(buf), fmt, args);
+
+    state().error = buf;
+}
+
+void fake_Log(RedisModuleCtx *ctx, const char *level, const char *fmt, ...) {
+    if (std::strcmp(level, "warning") != 0) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    record_error(fmt, args);
+    va_end(args);
+}
+
+void fake_LogIOError(RedisModuleIO *io, const char *levelstr, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    record_error(fmt, args);
+    va_end(args);
+}
+
+#define FAKE_API(name) {"RedisModule_" #name, reinterpret_cast<void *>(fake_##name)}
+
+int fake_GetApi(const char *name, void *func) {
+    static const std::unordered_map<std::string, void *> apis = {
+        FAKE_API(Alloc),
+        FAKE_API(Calloc),
+        FAKE_API(Realloc),
+        FAKE_API(Free),
+        FAKE_API(Strdup),
+        FAKE_API(CreateCommand),
+        FAKE_API(SetModuleAttribs),
+        FAKE_API(IsModuleNameBusy),
+        FAKE_API(WrongArity),
+        FAKE_API(ReplyWithLongLong),
+        FAKE_API(ReplyWithError),
+        FAKE_API(ReplyWithSimpleString),
+        FAKE_API(ReplyWithArray),
+        FAKE_API(ReplyWithStringBuffer),
+        FAKE_API(ReplyWithString),
+        FAKE_API(ReplyWithNull),
+        FAKE_API(ReplyWithDouble),
+        FAKE_API(ReplicateVerbatim),
+        FAKE_API(GetContextFlags),
+        FAKE_API(NotifyKeyspaceEvent),
+        FAKE_API(BlockClient),
+        FAKE_API(UnblockClient),
+        FAKE_API(AbortBlock),
+        FAKE_API(GetBlockedClientPrivateData),
+        FAKE_API(CreateString),
+        FAKE_API(FreeString),
+        FAKE_API(StringPtrLen),
+        FAKE_API(OpenKey),
+        FAKE_API(CloseKey),
+        FAKE_API(KeyType),
+        FAKE_API(SetExpire),
+        FAKE_API(CreateDataType),
+        FAKE_API(ModuleTypeSetValue),
+        FAKE_API(ModuleTypeGetType),
+        FAKE_API(ModuleTypeGetValue),
+        FAKE_API(SaveUnsigned),
+        FAKE_API(LoadUnsigned),
+        FAKE_API(SaveStringBuffer),
+        FAKE_API(LoadStringBuffer),
+        FAKE_API(Log),
+        FAKE_API(LogIOError)
+    };
+
+    auto iter = apis.find(name);
+    if (iter == apis.end()) {
+        return REDISMODULE_ERR;
+    }
+
+    *static_cast<void **>(func) = iter->second;
+
+    return REDISMODULE_OK;
+}
+
+#undef FAKE_API
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+namespace bench {
+
+FakeRedis& FakeRedis::instance() {
+    static FakeRedis redis;
+
+    return redis;
+}
+
+void FakeRedis::load(const std::vector<std::string> &args) {
+    std::vector<RedisModuleString> strs;
+    strs.reserve(args.size());
+    for (const auto &arg : args) {
+        strs.push_back(RedisModuleString{arg});
+    }
+
+    std::vector<RedisModuleString *> argv;
+    for (auto &str : strs) {
+        argv.push_back(&str);
+    }
+
+    if (RedisModule_OnLoad(ctx(), argv.data(), static_cast<int>(argv.size())) != REDISMODULE_OK) {
+        throw std::runtime_error("failed to load module: " + last_error());
+    }
+}
+
+RedisModuleCtx* FakeRedis::ctx() {
+    static RedisModuleCtx ctx{reinterpret_cast<void *>(fake_GetApi), nullptr};
+
+    return &ctx;
+}
+
+void* FakeRedis::value(const std::string &key) const {
+    const auto &keyspace = state().keyspace;
+    auto iter = keyspace.find(key);
+    if (iter == keyspace.end()) {
+        return nullptr;
+    }
+
+    return iter->second.value;
+}
+
+void FakeRedis::del(const std::string &key) {
+    auto &keyspace = state().keyspace;
+    auto iter = keyspace.find(key);
+    if (iter != keyspace.end()) {
+        free_entry(iter->second);
+        keyspace.erase(iter);
+    }
+}
+
+std::string FakeRedis::rdb_save_aux() const {
+    RedisModuleIO io;
+    state().type.methods.aux_save(&io, REDISMODULE_AUX_BEFORE_RDB);
+
+    return std::move(io.buf);
+}
+
+void FakeRedis::rdb_load_aux(const std::string &rdb) const {
+    const auto &type = state().type;
+
+    RedisModuleIO io;
+    io.buf = rdb;
+
+    if (type.methods.aux_load(&io, type.encver, REDISMODULE_AUX_BEFORE_RDB) != REDISMODULE_OK) {
+        throw std::runtime_error("failed to load aux data: " + last_error());
+    }
+}
+
+std::string FakeRedis::rdb_save(void *value) const {
+    RedisModuleIO io;
+    state().type.methods.rdb_save(&io, value);
+
+    return std::move(io.buf);
+}
+
+void* FakeRedis::rdb_load(const std::string &rdb) const {
+    const auto &type = state().type;
+
+    RedisModuleIO io;
+    io.buf = rdb;
+
+    auto *value = type.methods.rdb_load(&io, type.encver);
+    if (value == nullptr) {
+        throw std::runtime_error("failed to load value: " + last_error());
+    }
+
+    return value;
+}
+
+void FakeRedis::free_value(void *value) const {
+    state().type.methods.free(value);
+}
+
+uint64_t FakeRedis::replies() const {
+    return state().replies;
+}
+
+const std::string& FakeRedis::last_error() const {
+    return state().error;
+}
+
+void FakeRedis::clear_error() {
+    state().error.clear();
+}
+
+Command::Command(const std::vector<std::string> &argv) {
+    if (argv.empty()) {
+        throw std::runtime_error("empty command");
+    }
+
+    const auto &commands = state().commands;
+    auto iter = commands.find(to_upper(argv.front()));
+    if (iter == commands.end()) {
+        throw std::runtime_error("unknown command: " + argv.front());
+    }
+
+    _func = iter->second;
+
+    for (const auto &arg : argv) {
+        _argv.push_back(new RedisModuleString{arg});
+    }
+}
+
+Command::~Command() {
+    for (auto *arg : _argv) {
+        delete arg;
+    }
+}
+
+bool Command::run() const {
+    auto &redis = FakeRedis::instance();
+    redis.clear_error();
+
+    _func(redis.ctx(), const_cast<RedisModuleString **>(_argv.data()), static_cast<int>(_argv.size()));
+
+    handle_blocked_clients();
+
+    return redis.last_error().empty();
+}
+
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,108 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_BENCH_FAKE_REDIS_H
+#define SEWENEW_REDISPROTOBUF_BENCH_FAKE_REDIS_H
+
+#include <string>
+#include <vector>
+#include "sw/redis-protobuf/module_api.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+namespace bench {
+
+// An in-process stand-in for the Redis module API, so that the module's code
+// paths can be benchmarked without a Redis server. It implements only the
+// APIs used by the module's commands, RDB saving and RDB loading. Other APIs
+// are left null, i.e. the same as an old Redis that does not export them.
+class FakeRedis {
+public:
+    static FakeRedis& instance();
+
+    // Load the module with module options, e.g. {"--DIR", "/path/to/proto"}.
+    void load(const std::vector<std::string> &args);
+
+    RedisModuleCtx* ctx();
+
+    // Value of *key*, or nullptr if *key* doesn't exist.
+    void* value(const std::string &key) const;
+
+    void del(const std::string &key);
+
+    // Save the auxiliary data, i.e. the type dictionary, which should be
+    // saved before any value, and return the saved bytes.
+    std::string rdb_save_aux() const;
+
+    void rdb_load_aux(const std::string &rdb) const;
+
+    // Save the value with the RDB callbacks of the module type, and return
+    // the saved bytes.
+    std::string rdb_save(void *value) const;
+
+    // Load a value from bytes returned by rdb_save. The caller should free
+    // the value with free_value.
+    void* rdb_load(const std::string &rdb) const;
+
+    void free_value(void *value) const;
+
+    // Number of replies since the module is loaded.
+    uint64_t replies() const;
+
+    // Error message of the last error reply, or empty if no error.
+    const std::string& last_error() const;
+
+    void clear_error();
+};
+
+// A command with pre-created arguments, so that creating arguments is not
+// measured when the command is run.
+class Command {
+public:
+    explicit Command(const std::vector<std::string> &argv);
+
+    Command(const Command &) = delete;
+    Command& operator=(const Command &) = delete;
+
+    Command(Command &&) = delete;
+    Command& operator=(Command &&) = delete;
+
+    ~Command();
+
+    // Run the command, and return false if it replies with an error. If the
+    // command blocks the client, wait until it's unblocked by a worker thread,
+    // and then reply to it.
+    bool run() const;
+
+private:
+    RedisModuleCmdFunc _func = nullptr;
+
+    std::vector<RedisModuleString *> _argv;
+};
+
+}
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_BENCH_FAKE_REDIS_H
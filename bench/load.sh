@@ -0,0 +1,86 @@
+#!/usr/bin/env bash
+
+# End-to-end load generator for PB.GET and PB.SET with redis-benchmark.
+# It requires a running Redis with redis-protobuf loaded, and the protos
+# in docker directory, e.g.
+#     loadmodule /path/to/libredis-protobuf.so --DIR /path/to/redis-protobuf/docker
+#
+# Usage: load.sh [-h host] [-p port] [-n requests] [-c clients] [-P pipeline] [sizes...]
+# Each size is the number of elements of each repeated field of the message.
+
+set -e
+
+HOST=127.0.0.1
+PORT=6379
+REQUESTS=100000
+CLIENTS=50
+PIPELINE=1
+
+while getopts "h:p:n:c:P:" opt; do
+    case $opt in
+        h) HOST=$OPTARG ;;
+        p) PORT=$OPTARG ;;
+        n) REQUESTS=$OPTARG ;;
+        c) CLIENTS=$OPTARG ;;
+        P) PIPELINE=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+
+shift $((OPTIND - 1))
+
+SIZES=${@:-8 64 512 4096}
+
+TYPE="protobuf_test_messages::proto3::TestAllTypesProto3"
+
+# Same message as make_json in bench.cpp.
+make_json() {
+    local elements=$1
+    local ints="" strs="" msgs="" sep=""
+    for ((idx = 0; idx < elements; ++idx)); do
+        ints+="$sep$idx"
+        strs+="$sep\"str-$idx\""
+        msgs+="$sep{\"a\":$idx}"
+        sep=","
+    done
+
+    printf '{"optionalInt32":1,"optionalString":"redis-protobuf","optionalNestedMessage":{"a":1},'
+    printf '"repeatedInt32":[%s],"repeatedString":[%s],"repeatedNestedMessage":[%s]}' "$ints" "$strs" "$msgs"
+}
+
+# Run a command with redis-benchmark, and print its ops/s.
+ops() {
+    redis-benchmark -h "$HOST" -p "$PORT" -n "$REQUESTS" -c "$CLIENTS" -P "$PIPELINE" -q "$@" \
+        | tr '\r' '\n' \
+        | sed -n 's/.*: \([0-9.]*\) requests per second.*/\1/p' \
+        | tail -1
+}
+
+printf "%-8s %-10s %-24s %s\n" "size" "bytes" "command" "ops/s"
+
+for size in $SIZES; do
+    key="pb-load-$size"
+    json=$(make_json "$size")
+
+    redis-cli -h "$HOST" -p "$PORT" PB.SET "$key" "$TYPE" "$json" > /dev/null
+
+    # Size of the JSON message.
+    bytes=${#json}
+
+    printf "%-8s %-10s %-24s %s\n" "$size" "$bytes" "PB.SET scalar" \
+        "$(ops PB.SET "$key" "$TYPE.optional_int32" 123)"
+
+    printf "%-8s %-10s %-24s %s\n" "$size" "$bytes" "PB.SET message" \
+        "$(ops PB.SET "$key" "$TYPE" "$json")"
+
+    printf "%-8s %-10s %-24s %s\n" "$size" "$bytes" "PB.GET scalar" \
+        "$(ops PB.GET "$key" "$TYPE.optional_int32")"
+
+    printf "%-8s %-10s %-24s %s\n" "$size" "$bytes" "PB.GET binary" \
+        "$(ops PB.GET "$key" --FORMAT BINARY "$TYPE")"
+
+    printf "%-8s %-10s %-24s %s\n" "$size" "$bytes" "PB.GET json" \
+        "$(ops PB.GET "$key" --FORMAT JSON "$TYPE")"
+
+    redis-cli -h "$HOST" -p "$PORT" DEL "$key" > /dev/null
+done
@@ -0,0 +1,458 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "agg_command.h"
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include "errors.h"
+#include "redis_protobuf.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+// Kernels keep several independent accumulators, i.e. lanes, and have no
+// branch in the loop body, so that the compiler can vectorize them with SIMD
+// instructions of the target, without reordering additions of a single
+// floating point accumulator.
+constexpr std::size_t LANES = 4;
+
+// Sum of integers. Each element is split into its high 32 bits and low 32 bits,
+// which are summed separately, so that partial sums of an array never overflow,
+// and the overflow of the total sum is checked once per array.
+struct IntSum {
+    int64_t hi = 0;
+
+    // Normalized to be less than 2^32.
+    uint64_t lo = 0;
+};
+
+template <typename T>
+void add_sum(const T *data, std::size_t size, IntSum &sum);
+
+template <typename T>
+void add_sum(const T *data, std::size_t size, double &sum);
+
+double to_double(const IntSum &sum);
+
+double to_double(double sum);
+
+void reply_with_sum(RedisModuleCtx *ctx, const IntSum &sum);
+
+void reply_with_sum(RedisModuleCtx *ctx, double sum);
+
+// Return the min element, if *Min* is true, or the max element otherwise.
+// *size* must be larger than 0.
+template <bool Min, typename T>
+T extreme(const T *data, std::size_t size);
+
+template <typename T>
+void reply_with_number(RedisModuleCtx *ctx, T val, std::true_type);
+
+template <typename T>
+void reply_with_number(RedisModuleCtx *ctx, T val, std::false_type);
+
+void reply_with_double(RedisModuleCtx *ctx, double val);
+
+template <typename T>
+class Aggregator {
+public:
+    using Sum = typename std::conditional<std::is_floating_point<T>::value, double, IntSum>::type;
+
+    // Only compute the aggregations that are required, so that, e.g. MIN
+    // doesn't fail, even if the sum overflows.
+    void add(const T *data, std::size_t size, bool sum, bool min, bool max) {
+        if (size == 0) {
+            return;
+        }
+
+        if (sum) {
+            add_sum(data, size, _sum);
+        }
+
+        if (min) {
+            auto val = extreme<true>(data, size);
+            _min = (_count == 0 || val < _min) ? val : _min;
+        }
+
+        if (max) {
+            auto val = extreme<false>(data, size);
+            _max = (_count == 0 || val > _max) ? val : _max;
+        }
+
+        _count += size;
+    }
+
+    std::size_t count() const {
+        return _count;
+    }
+
+    const Sum& sum() const {
+        return _sum;
+    }
+
+    T min() const {
+        return _min;
+    }
+
+    T max() const {
+        return _max;
+    }
+
+private:
+    std::size_t _count = 0;
+
+    Sum _sum{};
+
+    T _min{};
+
+    T _max{};
+};
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int AggCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+
+        switch (_elem_type(args.path)) {
+        case gp::FieldDescriptor::CPPTYPE_INT32:
+            _aggregate<int32_t>(ctx, argv, argc, args);
+            break;
+
+        case gp::FieldDescriptor::CPPTYPE_INT64:
+            _aggregate<int64_t>(ctx, argv, argc, args);
+            break;
+
+        case gp::FieldDescriptor::CPPTYPE_UINT32:
+            _aggregate<uint32_t>(ctx, argv, argc, args);
+            break;
+
+        case gp::FieldDescriptor::CPPTYPE_UINT64:
+            _aggregate<uint64_t>(ctx, argv, argc, args);
+            break;
+
+        case gp::FieldDescriptor::CPPTYPE_DOUBLE:
+            _aggregate<double>(ctx, argv, argc, args);
+            break;
+
+        case gp::FieldDescriptor::CPPTYPE_FLOAT:
+            _aggregate<float>(ctx, argv, argc, args);
+            break;
+
+        default:
+            throw Error("not a numeric array");
+        }
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+AggCommand::Args AggCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc < 4) {
+        throw WrongArityError();
+    }
+
+    Args args;
+    args.op = _parse_op(StringView(argv[1]));
+    args.path = Path(argv[2]);
+    args.key_pos = 3;
+
+    return args;
+}
+
+AggCommand::Args::Op AggCommand::_parse_op(const StringView &op) const {
+    if (util::str_case_equal(op, "SUM")) {
+        return Args::Op::SUM;
+    } else if (util::str_case_equal(op, "MIN")) {
+        return Args::Op::MIN;
+    } else if (util::str_case_equal(op, "MAX")) {
+        return Args::Op::MAX;
+    } else if (util::str_case_equal(op, "AVG")) {
+        return Args::Op::AVG;
+    } else if (util::str_case_equal(op, "COUNT")) {
+        return Args::Op::COUNT;
+    } else {
+        throw Error("unknown aggregation: " + util::sv_to_string(op));
+    }
+}
+
+gp::FieldDescriptor::CppType AggCommand::_elem_type(const Path &path) const {
+    if (path.empty()) {
+        throw Error("not a numeric array");
+    }
+
+    const auto *desc = RedisProtobuf::instance().proto_factory()->descriptor(path.type());
+    if (desc == nullptr) {
+        throw Error("unknown protobuf type: " + path.type());
+    }
+
+    auto fields = path.resolve(*desc);
+    assert(!fields->empty());
+
+    const auto &field = fields->back();
+    if (!field.desc->is_repeated() || field.desc->is_map() || field.arr_idx >= 0) {
+        throw Error("not a numeric array");
+    }
+
+    return field.desc->cpp_type();
+}
+
+template <typename T>
+void AggCommand::_aggregate(RedisModuleCtx *ctx,
+        RedisModuleString **argv,
+        int argc,
+        const Args &args) const {
+    auto &module = RedisProtobuf::instance();
+    const auto &path = args.path;
+
+    auto sum = (args.op == Args::Op::SUM || args.op == Args::Op::AVG);
+    auto min = (args.op == Args::Op::MIN);
+    auto max = (args.op == Args::Op::MAX);
+
+    auto elem_type = _elem_type(path);
+
+    Aggregator<T> agg;
+    for (auto idx = args.key_pos; idx != argc; ++idx) {
+        auto key = api::open_key(ctx, argv[idx], api::KeyMode::READONLY);
+        if (!api::key_exists(key.get(), module.type())) {
+            continue;
+        }
+
+        auto *value = api::get_value_by_key(key.get());
+        assert(value != nullptr);
+
+        if (value->descriptor()->full_name() != path.type()) {
+            throw Error("type mismatch");
+        }
+
+        ConstFieldRef field(&(value->msg()), path);
+
+        // The field of an old generation of schemas might be of another type.
+        if (!field.is_array() || field.is_array_element()
+                || field.type() != elem_type) {
+            throw Error("type mismatch");
+        }
+
+        // Aggregate the underlying storage, or the slice of it, directly.
+        const auto &arr = field.get_repeated_field<T>();
+        agg.add(arr.data() + field.range_begin(), field.size(), sum, min, max);
+    }
+
+    using IsFloating = typename std::is_floating_point<T>::type;
+
+    switch (args.op) {
+    case Args::Op::SUM:
+        reply_with_sum(ctx, agg.sum());
+        break;
+
+    case Args::Op::MIN:
+        if (agg.count() == 0) {
+            RedisModule_ReplyWithNull(ctx);
+        } else {
+            reply_with_number(ctx, agg.min(), IsFloating());
+        }
+        break;
+
+    case Args::Op::MAX:
+        if (agg.count() == 0) {
+            RedisModule_ReplyWithNull(ctx);
+        } else {
+            reply_with_number(ctx, agg.max(), IsFloating());
+        }
+        break;
+
+    case Args::Op::AVG:
+        if (agg.count() == 0) {
+            RedisModule_ReplyWithNull(ctx);
+        } else {
+            reply_with_double(ctx, to_double(agg.sum()) / agg.count());
+        }
+        break;
+
+    case Args::Op::COUNT:
+        RedisModule_ReplyWithLongLong(ctx, agg.count());
+        break;
+
+    default:
+        assert(false);
+    }
+}
+
+}
+
+}
+
+}
+
+namespace {
+
+template <typename T>
+void add_sum(const T *data, std::size_t size, IntSum &sum) {
+    static_assert(std::is_integral<T>::value, "not an integer type");
+
+    using Wide = typename std::conditional<std::is_signed<T>::value, int64_t, uint64_t>::type;
+
+    // A RepeatedField has less than 2^31 elements, so that each lane of *lo*
+    // is less than 2^62, and each lane of *hi* is in [-2^61, 2^61].
+    int64_t hi[LANES] = {0};
+    uint64_t lo[LANES] = {0};
+
+    std::size_t idx = 0;
+    for (; idx + LANES <= size; idx += LANES) {
+        for (std::size_t lane = 0; lane != LANES; ++lane) {
+            auto val = static_cast<Wide>(data[idx + lane]);
+            hi[lane] += static_cast<int64_t>(val >> 32);
+            lo[lane] += static_cast<uint64_t>(val) & 0xFFFFFFFFULL;
+        }
+    }
+
+    for (; idx != size; ++idx) {
+        auto val = static_cast<Wide>(data[idx]);
+        hi[0] += static_cast<int64_t>(val >> 32);
+        lo[0] += static_cast<uint64_t>(val) & 0xFFFFFFFFULL;
+    }
+
+    for (std::size_t lane = 0; lane != LANES; ++lane) {
+        sum.hi += hi[lane] + static_cast<int64_t>(lo[lane] >> 32);
+        sum.lo += lo[lane] & 0xFFFFFFFFULL;
+    }
+
+    sum.hi += static_cast<int64_t>(sum.lo >> 32);
+    sum.lo &= 0xFFFFFFFFULL;
+
+    // sum.hi * 2^32 + sum.lo fits in int64_t, iff sum.hi fits in int32_t. Check it
+    // for each array, so that sum.hi never overflows, however many keys there are.
+    if (sum.hi < std::numeric_limits<int32_t>::min()
+            || sum.hi > std::numeric_limits<int32_t>::max()) {
+        throw Error("sum overflows");
+    }
+}
+
+template <typename T>
+void add_sum(const T *data, std::size_t size, double &sum) {
+    static_assert(std::is_floating_point<T>::value, "not a floating point type");
+
+    double lanes[LANES] = {0};
+
+    std::size_t idx = 0;
+    for (; idx + LANES <= size; idx += LANES) {
+        for (std::size_t lane = 0; lane != LANES; ++lane) {
+            lanes[lane] += data[idx + lane];
+        }
+    }
+
+    for (; idx != size; ++idx) {
+        lanes[0] += data[idx];
+    }
+
+    for (std::size_t lane = 0; lane != LANES; ++lane) {
+        sum += lanes[lane];
+    }
+}
+
+double to_double(const IntSum &sum) {
+    return static_cast<double>(sum.hi) * 4294967296.0 + static_cast<double>(sum.lo);
+}
+
+double to_double(double sum) {
+    return sum;
+}
+
+void reply_with_sum(RedisModuleCtx *ctx, const IntSum &sum) {
+    // Overflow has been checked by add_sum.
+    assert(sum.hi >= std::numeric_limits<int32_t>::min()
+            && sum.hi <= std::numeric_limits<int32_t>::max());
+
+    auto val = sum.hi * (INT64_C(1) << 32) + static_cast<int64_t>(sum.lo);
+
+    RedisModule_ReplyWithLongLong(ctx, val);
+}
+
+void reply_with_sum(RedisModuleCtx *ctx, double sum) {
+    reply_with_double(ctx, sum);
+}
+
+template <bool Min, typename T>
+T extreme(const T *data, std::size_t size) {
+    assert(size > 0);
+
+    T lanes[LANES];
+    for (std::size_t lane = 0; lane != LANES; ++lane) {
+        lanes[lane] = data[0];
+    }
+
+    std::size_t idx = 0;
+    for (; idx + LANES <= size; idx += LANES) {
+        for (std::size_t lane = 0; lane != LANES; ++lane) {
+            auto val = data[idx + lane];
+            if (Min) {
+                lanes[lane] = val < lanes[lane] ? val : lanes[lane];
+            } else {
+                lanes[lane] = val > lanes[lane] ? val : lanes[lane];
+            }
+        }
+    }
+
+    auto res = lanes[0];
+    for (std::size_t lane = 1; lane != LANES; ++lane) {
+        res = Min ? (lanes[lane] < res ? lanes[lane] : res) : (lanes[lane] > res ? lanes[lane] : res);
+    }
+
+    for (; idx != size; ++idx) {
+        res = Min ? (data[idx] < res ? data[idx] : res) : (data[idx] > res ? data[idx] : res);
+    }
+
+    return res;
+}
+
+template <typename T>
+void reply_with_number(RedisModuleCtx *ctx, T val, std::true_type) {
+    reply_with_double(ctx, val);
+}
+
+template <typename T>
+void reply_with_number(RedisModuleCtx *ctx, T val, std::false_type) {
+    // Same as PB.GET, uint64 is replied as long long.
+    RedisModule_ReplyWithLongLong(ctx, static_cast<long long>(val));
+}
+
+void reply_with_double(RedisModuleCtx *ctx, double val) {
+    // Same format as PB.GET.
+    auto str = std::to_string(val);
+    RedisModule_ReplyWithSimpleString(ctx, str.data());
+}
+
+}
@@ -0,0 +1,80 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_AGG_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_AGG_COMMANDS_H
+
+#include "module_api.h"
+#include "utils.h"
+#include "field_ref.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.AGG SUM|MIN|MAX|AVG|COUNT path key [key ...]
+// return:  Aggregation of the numeric array at path, across all keys. SUM of
+//          an integer array is an integer reply, SUM of a floating point array
+//          and AVG are simple string replies. MIN and MAX are of the same type
+//          as the elements, and they're nil replies, if there's no element,
+//          so is AVG. COUNT is an integer reply. Keys that don't exist are skipped.
+// error:   If the path is not a numeric array, or type mismatch, or the
+//          integer sum of SUM or AVG overflows, return an error reply.
+class AggCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    struct Args {
+        enum class Op {
+            SUM = 0,
+            MIN,
+            MAX,
+            AVG,
+            COUNT
+        };
+
+        Op op = Op::SUM;
+
+        Path path;
+
+        // Position of the first key.
+        int key_pos = 0;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    Args::Op _parse_op(const StringView &op) const;
+
+    // Type of the array elements, with the current schemas.
+    gp::FieldDescriptor::CppType _elem_type(const Path &path) const;
+
+    template <typename T>
+    void _aggregate(RedisModuleCtx *ctx,
+            RedisModuleString **argv,
+            int argc,
+            const Args &args) const;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_AGG_COMMANDS_H
@@ -15,8 +15,148 @@
  *************************************************************************/
 
 #include "append_command.h"
+#include <cstring>
+#include <limits>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 #include "errors.h"
 #include "redis_protobuf.h"
+#include "metrics.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+class PackedError : public Error {
+public:
+    PackedError() : Error("invalid packed encoding") {}
+};
+
+// Parse *val* and append it to the array of C++ type *T*.
+template <gp::FieldDescriptor::CppType T>
+struct AddElement {
+    static void call(MutableFieldRef &field, const StringView &val) {
+        field.add<T>(CppTypeTraits<T>::parse(val));
+    }
+};
+
+template <>
+struct AddElement<gp::FieldDescriptor::CPPTYPE_MESSAGE> {
+    static void call(MutableFieldRef &field, const StringView &val) {
+        auto msg = RedisProtobuf::instance().proto_factory()->create(field.msg_descriptor(), val);
+        assert(msg);
+
+        field.add_msg(*msg);
+    }
+};
+
+// Return the number of varints in *blob*. Each varint ends with a byte whose
+// most significant bit is 0.
+int count_varints(const StringView &blob) {
+    if (blob.size() > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+        throw Error("packed blob is too large");
+    }
+
+    const auto *ptr = reinterpret_cast<const unsigned char *>(blob.data());
+    const auto *end = ptr + blob.size();
+    if (ptr != end && (*(end - 1) & 0x80) != 0) {
+        // The last varint is truncated.
+        throw PackedError();
+    }
+
+    int cnt = 0;
+    for (; ptr != end; ++ptr) {
+        if ((*ptr & 0x80) == 0) {
+            ++cnt;
+        }
+    }
+
+    return cnt;
+}
+
+// Reserve space for all elements, and decode them into the array in one pass.
+// If *blob* is invalid, the array is truncated to its original size.
+template <typename T, typename Decoder>
+void append_varints(gp::RepeatedField<T> &arr, const StringView &blob, Decoder decode) {
+    auto cnt = count_varints(blob);
+    auto old_size = arr.size();
+    if (cnt > std::numeric_limits<int>::max() - old_size) {
+        throw Error("packed blob is too large");
+    }
+
+    arr.Reserve(old_size + cnt);
+
+    gp::io::CodedInputStream input(reinterpret_cast<const gp::uint8 *>(blob.data()),
+            static_cast<int>(blob.size()));
+    for (auto idx = 0; idx != cnt; ++idx) {
+        gp::uint64 val = 0;
+        if (!input.ReadVarint64(&val)) {
+            arr.Truncate(old_size);
+            throw PackedError();
+        }
+
+        arr.AddAlreadyReserved(decode(val));
+    }
+}
+
+void append_enums(gp::RepeatedField<int> &arr,
+        const gp::FieldDescriptor &desc,
+        const StringView &blob) {
+    auto old_size = arr.size();
+    append_varints(arr, blob, [](uint64_t val) { return static_cast<int>(val); });
+
+    if (desc.file()->syntax() != gp::FileDescriptor::SYNTAX_PROTO2) {
+        // Open enum, i.e. unknown values are kept as is.
+        return;
+    }
+
+    const auto *enum_desc = desc.enum_type();
+    assert(enum_desc != nullptr);
+
+    for (auto idx = old_size; idx != arr.size(); ++idx) {
+        if (enum_desc->FindValueByNumber(arr.Get(idx)) == nullptr) {
+            arr.Truncate(old_size);
+            throw Error("unknown enum value: " + std::to_string(arr.Get(idx)));
+        }
+    }
+}
+
+void read_little_endian(const gp::uint8 *ptr, gp::uint32 &val) {
+    gp::io::CodedInputStream::ReadLittleEndian32FromArray(ptr, &val);
+}
+
+void read_little_endian(const gp::uint8 *ptr, gp::uint64 &val) {
+    gp::io::CodedInputStream::ReadLittleEndian64FromArray(ptr, &val);
+}
+
+// *Wire* is the unsigned integer type with the same width as *T*.
+template <typename Wire, typename T>
+void append_fixed(gp::RepeatedField<T> &arr, const StringView &blob) {
+    static_assert(sizeof(Wire) == sizeof(T), "width of wire type mismatch");
+
+    if (blob.size() % sizeof(Wire) != 0) {
+        throw PackedError();
+    }
+
+    auto cnt = blob.size() / sizeof(Wire);
+    if (cnt > static_cast<std::size_t>(std::numeric_limits<int>::max() - arr.size())) {
+        throw Error("packed blob is too large");
+    }
+
+    arr.Reserve(arr.size() + static_cast<int>(cnt));
+
+    const auto *ptr = reinterpret_cast<const gp::uint8 *>(blob.data());
+    for (std::size_t idx = 0; idx != cnt; ++idx, ptr += sizeof(Wire)) {
+        Wire wire = 0;
+        read_little_endian(ptr, wire);
+
+        T val;
+        std::memcpy(&val, &wire, sizeof(val));
+        arr.AddAlreadyReserved(val);
+    }
+}
+
+}
 
 namespace sw {
 
@@ -40,30 +180,40 @@ int AppendCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
         auto &module = RedisProtobuf::instance();
 
         long long len = 0;
+        std::vector<std::string> binary_msgs;
         if (!api::key_exists(key.get(), module.type())) {
-            auto msg = module.proto_factory()->create(path.type());
-            MutableFieldRef field(msg.get(), path);
-            len = _append(field, args.elements);
+            auto value = module.proto_factory()->create_value(path.type());
+            MutableFieldRef field(&(value->msg()), path);
+            len = _append(field, args);
+            binary_msgs = _binary_msgs(field, args);
+
+            module.after_write(ctx, args.key_name, *value);
 
             if (RedisModule_ModuleTypeSetValue(key.get(),
                         module.type(),
-                        msg.get()) != REDISMODULE_OK) {
+                        value.get()) != REDISMODULE_OK) {
                 throw Error("failed to set message");
             }
 
-            msg.release();
+            value.release();
         } else {
-            auto *msg = api::get_msg_by_key(key.get());
-            assert(msg != nullptr);
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
+
+            MutableFieldRef field(&(value->msg()), path);
+            len = _append(field, args);
+
+            // Serialize them before *after_write*, which might compact the value.
+            binary_msgs = _binary_msgs(field, args);
 
-            MutableFieldRef field(msg, path);
-            // TODO: create a new message, and append to that message, then swap to this message.
-            len = _append(field, args.elements);
+            module.after_write(ctx, args.key_name, *value);
         }
 
+        module.notify(ctx, "append", args.key_name, path);
+
         RedisModule_ReplyWithLongLong(ctx, len);
 
-        RedisModule_ReplicateVerbatim(ctx);
+        _replicate(ctx, argv, binary_msgs);
 
         return REDISMODULE_OK;
     } catch (const WrongArityError &err) {
@@ -84,21 +234,54 @@ AppendCommand::Args AppendCommand::_parse_args(RedisModuleString **argv, int arg
 
     Args args;
     args.key_name = argv[1];
-    args.path = Path(argv[2]);
-    args.elements.reserve(argc - 3);
 
-    for (auto idx = 3; idx != argc; ++idx) {
+    auto pos = 2;
+    if (util::str_case_equal(StringView(argv[pos]), "--PACKED")) {
+        if (argc != 5) {
+            throw WrongArityError();
+        }
+
+        args.packed = true;
+        ++pos;
+    }
+
+    args.path = Path(argv[pos]);
+    ++pos;
+
+    args.elements.reserve(argc - pos);
+
+    for (auto idx = pos; idx != argc; ++idx) {
         args.elements.emplace_back(argv[idx]);
     }
 
     return args;
 }
 
+long long AppendCommand::_append(MutableFieldRef &field, const Args &args) const {
+    LatencyTimer timer(Phase::MUTATE);
+
+    if (args.packed) {
+        assert(args.elements.size() == 1);
+
+        return _append_packed(field, args.elements.front());
+    }
+
+    return _append(field, args.elements);
+}
+
 long long AppendCommand::_append(MutableFieldRef &field,
         const std::vector<StringView> &elements) const {
     if (field.is_array() && !field.is_array_element()) {
-        for (const auto &ele : elements) {
-            _append_arr(field, ele);
+        // If any element is invalid, remove those that have been appended,
+        // so that the array is left unchanged.
+        auto old_size = field.size();
+        try {
+            for (const auto &ele : elements) {
+                _append_arr(field, ele);
+            }
+        } catch (const Error &) {
+            field.truncate(old_size);
+            throw;
         }
 
         return field.size();
@@ -112,76 +295,165 @@ long long AppendCommand::_append(MutableFieldRef &field,
 void AppendCommand::_append_arr(MutableFieldRef &field, const StringView &val) const {
     assert(field.is_array() && !field.is_array_element());
 
-    switch (field.type()) {
-    case gp::FieldDescriptor::CPPTYPE_INT32:
-        field.add_int32(util::sv_to_int32(val));
+    dispatch<AddElement>(field.type(), field, val);
+}
+
+long long AppendCommand::_append_str(MutableFieldRef &field,
+        const std::vector<StringView> &elements) const {
+    std::string str;
+    for (const auto &ele : elements) {
+        str += std::string(ele.data(), ele.size());
+    }
+
+    if (field.is_array_element()) {
+        str = field.get_repeated<gp::FieldDescriptor::CPPTYPE_STRING>() + str;
+        field.set_repeated<gp::FieldDescriptor::CPPTYPE_STRING>(str);
+    } else {
+        // TODO: map element
+        str = field.get<gp::FieldDescriptor::CPPTYPE_STRING>() + str;
+        field.set<gp::FieldDescriptor::CPPTYPE_STRING>(str);
+    }
+
+    return str.size();
+}
+
+long long AppendCommand::_append_packed(MutableFieldRef &field, const StringView &blob) const {
+    if (!field.is_array() || field.is_array_element()) {
+        throw Error("not an array");
+    }
+
+    const auto *desc = field.descriptor();
+    assert(desc != nullptr);
+
+    switch (desc->type()) {
+    case gp::FieldDescriptor::TYPE_INT32:
+        append_varints(*field.mutable_repeated_field<int32_t>(), blob,
+                [](uint64_t val) { return static_cast<int32_t>(val); });
+        break;
+
+    case gp::FieldDescriptor::TYPE_INT64:
+        append_varints(*field.mutable_repeated_field<int64_t>(), blob,
+                [](uint64_t val) { return static_cast<int64_t>(val); });
+        break;
+
+    case gp::FieldDescriptor::TYPE_UINT32:
+        append_varints(*field.mutable_repeated_field<uint32_t>(), blob,
+                [](uint64_t val) { return static_cast<uint32_t>(val); });
+        break;
+
+    case gp::FieldDescriptor::TYPE_UINT64:
+        append_varints(*field.mutable_repeated_field<uint64_t>(), blob,
+                [](uint64_t val) { return val; });
+        break;
+
+    case gp::FieldDescriptor::TYPE_SINT32:
+        append_varints(*field.mutable_repeated_field<int32_t>(), blob,
+                [](uint64_t val) {
+                    return gp::internal::WireFormatLite::ZigZagDecode32(static_cast<uint32_t>(val));
+                });
         break;
 
-    case gp::FieldDescriptor::CPPTYPE_INT64:
-        field.add_int64(util::sv_to_int64(val));
+    case gp::FieldDescriptor::TYPE_SINT64:
+        append_varints(*field.mutable_repeated_field<int64_t>(), blob,
+                [](uint64_t val) { return gp::internal::WireFormatLite::ZigZagDecode64(val); });
         break;
 
-    case gp::FieldDescriptor::CPPTYPE_UINT32:
-        field.add_uint32(util::sv_to_uint32(val));
+    case gp::FieldDescriptor::TYPE_BOOL:
+        append_varints(*field.mutable_repeated_field<bool>(), blob,
+                [](uint64_t val) { return val != 0; });
         break;
 
-    case gp::FieldDescriptor::CPPTYPE_UINT64:
-        field.add_uint64(util::sv_to_uint64(val));
+    case gp::FieldDescriptor::TYPE_ENUM:
+        append_enums(*field.mutable_repeated_field<int>(), *desc, blob);
         break;
 
-    case gp::FieldDescriptor::CPPTYPE_DOUBLE:
-        field.add_double(util::sv_to_double(val));
+    case gp::FieldDescriptor::TYPE_FIXED32:
+        append_fixed<uint32_t>(*field.mutable_repeated_field<uint32_t>(), blob);
         break;
 
-    case gp::FieldDescriptor::CPPTYPE_FLOAT:
-        field.add_float(util::sv_to_float(val));
+    case gp::FieldDescriptor::TYPE_SFIXED32:
+        append_fixed<uint32_t>(*field.mutable_repeated_field<int32_t>(), blob);
         break;
 
-    case gp::FieldDescriptor::CPPTYPE_BOOL:
-        field.add_bool(util::sv_to_bool(val));
+    case gp::FieldDescriptor::TYPE_FLOAT:
+        append_fixed<uint32_t>(*field.mutable_repeated_field<float>(), blob);
         break;
 
-    case gp::FieldDescriptor::CPPTYPE_ENUM:
-        field.add_enum(util::sv_to_int32(val));
+    case gp::FieldDescriptor::TYPE_FIXED64:
+        append_fixed<uint64_t>(*field.mutable_repeated_field<uint64_t>(), blob);
         break;
 
-    case gp::FieldDescriptor::CPPTYPE_STRING:
-        field.add_string(util::sv_to_string(val));
+    case gp::FieldDescriptor::TYPE_SFIXED64:
+        append_fixed<uint64_t>(*field.mutable_repeated_field<int64_t>(), blob);
         break;
 
-    case gp::FieldDescriptor::CPPTYPE_MESSAGE:
-        _add_msg(field, val);
+    case gp::FieldDescriptor::TYPE_DOUBLE:
+        append_fixed<uint64_t>(*field.mutable_repeated_field<double>(), blob);
         break;
 
     default:
-        throw Error("unknown type");
+        throw Error("packed encoding only supports array of scalar type");
     }
+
+    return field.size();
 }
 
-long long AppendCommand::_append_str(MutableFieldRef &field,
-        const std::vector<StringView> &elements) const {
-    std::string str;
-    for (const auto &ele : elements) {
-        str += std::string(ele.data(), ele.size());
+std::vector<std::string> AppendCommand::_binary_msgs(const MutableFieldRef &field,
+        const Args &args) const {
+    std::vector<std::string> binary_msgs;
+    if (args.packed
+            || !field.is_array()
+            || field.is_array_element()
+            || field.type() != gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+        return binary_msgs;
     }
 
-    if (field.is_array_element()) {
-        str = field.get_repeated_string() + str;
-        field.set_repeated_string(str);
-    } else {
-        // TODO: map element
-        str = field.get_string() + str;
-        field.set_string(str);
+    auto &module = RedisProtobuf::instance();
+    auto has_json = false;
+    for (const auto &ele : args.elements) {
+        if (module.replicate_binary(ele)) {
+            has_json = true;
+            break;
+        }
     }
 
-    return str.size();
+    if (!has_json) {
+        return binary_msgs;
+    }
+
+    // Appended messages are at the end of the array.
+    auto size = field.size();
+    auto cnt = static_cast<int>(args.elements.size());
+    assert(size >= cnt);
+
+    binary_msgs.reserve(cnt);
+    for (auto idx = size - cnt; idx != size; ++idx) {
+        binary_msgs.push_back(util::msg_to_binary(field.get_array_element(idx).get_repeated_msg()));
+    }
+
+    return binary_msgs;
 }
 
-void AppendCommand::_add_msg(MutableFieldRef &field, const StringView &val) const {
-    auto msg = RedisProtobuf::instance().proto_factory()->create(field.msg_type(), val);
-    assert(msg);
+void AppendCommand::_replicate(RedisModuleCtx *ctx,
+        RedisModuleString **argv,
+        const std::vector<std::string> &binary_msgs) const {
+    if (binary_msgs.empty()) {
+        RedisModule_ReplicateVerbatim(ctx);
+        return;
+    }
 
-    field.add_msg(*msg);
+    // PB.APPEND key path msg [msg ...], since --PACKED doesn't apply to messages.
+    std::vector<RedisModuleString *> new_argv = {argv[1], argv[2]};
+    new_argv.reserve(2 + binary_msgs.size());
+    for (const auto &msg : binary_msgs) {
+        new_argv.push_back(RedisModule_CreateString(ctx, msg.data(), msg.size()));
+    }
+
+    RedisModule_Replicate(ctx, "PB.APPEND", "v", new_argv.data(), new_argv.size());
+
+    for (auto idx = 2u; idx < new_argv.size(); ++idx) {
+        RedisModule_FreeString(ctx, new_argv[idx]);
+    }
 }
 
 }
@@ -30,10 +30,13 @@ namespace redis {
 namespace pb {
 
 // command: PB.APPEND key path element [element, element...]
+//          PB.APPEND key --PACKED path blob
 // return:  Integer reply: return the length of the array after the append operations.
 //          Or return the length of the string after the append operations.
 // error:   If the path doesn't exist, or the corresponding field is not an array, or
-//          a string, return an error reply.
+//          a string, return an error reply. With --PACKED, if the field is not
+//          an array of scalar type, or *blob* is not a valid packed encoding,
+//          return an error reply, and the array is left unchanged.
 class AppendCommand {
 public:
     int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
@@ -43,17 +46,34 @@ private:
         RedisModuleString *key_name;
         Path path;
         std::vector<StringView> elements;
+
+        // If true, *elements* has only one element, i.e. the blob of packed encoding.
+        bool packed = false;
     };
 
     Args _parse_args(RedisModuleString **argv, int argc) const;
 
+    long long _append(MutableFieldRef &field, const Args &args) const;
+
     long long _append(MutableFieldRef &field, const std::vector<StringView> &elements) const;
 
+    // Decode *blob* with the packed encoding of the field, and append all elements at once.
+    long long _append_packed(MutableFieldRef &field, const StringView &blob) const;
+
     void _append_arr(MutableFieldRef &field, const StringView &val) const;
 
     long long _append_str(MutableFieldRef &field, const std::vector<StringView> &elements) const;
 
-    void _add_msg(MutableFieldRef &field, const StringView &val) const;
+    // If messages are appended with JSON values, and --REPLICATE-EFFECTS is enabled,
+    // return the binary form of these messages. Otherwise, return an empty vector.
+    std::vector<std::string> _binary_msgs(const MutableFieldRef &field, const Args &args) const;
+
+    // Replicate the command verbatim, or with the binary form of messages.
+    void _replicate(RedisModuleCtx *ctx,
+            RedisModuleString **argv,
+            const std::vector<std::string> &binary_msgs) const;
+
+    friend class PatchCommand;
 };
 
 }
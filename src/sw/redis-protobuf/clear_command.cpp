@@ -17,6 +17,7 @@
 #include "clear_command.h"
 #include "errors.h"
 #include "redis_protobuf.h"
+#include "metrics.h"
 
 namespace sw {
 
@@ -30,14 +31,20 @@ int ClearCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) c
 
         auto args = _parse_args(argv, argc);
 
-        auto key = api::open_key(ctx, args.key_name, api::KeyMode::READONLY);
-        if (!api::key_exists(key.get(), RedisProtobuf::instance().type())) {
+        auto &module = RedisProtobuf::instance();
+        // Open it for writing, so that Redis invalidates the key for clients
+        // with client side caching, i.e. CLIENT TRACKING, when it is closed.
+        auto key = api::open_key(ctx, args.key_name, api::KeyMode::WRITEONLY);
+        if (!api::key_exists(key.get(), module.type())) {
             RedisModule_ReplyWithLongLong(ctx, 0);
         } else {
-            auto *msg = api::get_msg_by_key(key.get());
-            assert(msg != nullptr);
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
 
-            _clear(*msg, args.path);
+            _clear(value->msg(), args.path);
+
+            module.after_write(ctx, args.key_name, *value);
+            module.notify(ctx, "clear", args.key_name, args.path);
 
             RedisModule_ReplyWithLongLong(ctx, 1);
         }
@@ -65,6 +72,8 @@ ClearCommand::Args ClearCommand::_parse_args(RedisModuleString **argv, int argc)
 }
 
 void ClearCommand::_clear(gp::Message &msg, const Path &path) const {
+    LatencyTimer timer(Phase::MUTATE);
+
     if (path.empty()) {
         // Clear the message.
         msg.Clear();
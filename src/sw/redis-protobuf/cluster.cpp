@@ -0,0 +1,342 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "cluster.h"
+#include <cassert>
+#include <algorithm>
+#include <array>
+#include "errors.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+using Crc16Table = std::array<uint16_t, 256>;
+
+// CRC16-CCITT (XMODEM), which is used by Redis Cluster.
+Crc16Table make_crc16_table();
+
+uint16_t crc16(const char *buf, std::size_t len);
+
+// Reply with the reply at [*ptr*, *end*), and return the end of it. If *ctx*
+// is nullptr, only validate the reply.
+const char* reply_with_proto(RedisModuleCtx *ctx, const char *ptr, const char *end);
+
+// Return the line at [*ptr*, *end*) without the trailing CRLF,
+// and move *ptr* to the next line.
+StringView read_line(const char *&ptr, const char *end);
+
+long long line_to_integer(const StringView &line);
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+namespace cluster {
+
+bool enabled(RedisModuleCtx *ctx) {
+    if (RedisModule_GetContextFlags == nullptr
+            || RedisModule_RegisterClusterMessageReceiver == nullptr
+            || RedisModule_SendClusterMessage == nullptr
+            || RedisModule_GetMyClusterID == nullptr
+            || RedisModule_CreateTimer == nullptr) {
+        return false;
+    }
+
+    return (RedisModule_GetContextFlags(ctx) & REDISMODULE_CTX_FLAGS_CLUSTER) != 0;
+}
+
+uint16_t key_slot(const StringView &key) {
+    const auto *data = key.data();
+    auto size = key.size();
+
+    // Only hash the part between the first '{' and the following '}', if it's not empty.
+    const auto *end = data + size;
+    const auto *open = std::find(data, end, '{');
+    if (open != end) {
+        const auto *close = std::find(open + 1, end, '}');
+        if (close != end && close != open + 1) {
+            data = open + 1;
+            size = close - data;
+        }
+    }
+
+    return crc16(data, size) & (SLOTS - 1);
+}
+
+std::string my_id() {
+    const auto *id = RedisModule_GetMyClusterID();
+    if (id == nullptr) {
+        throw Error("failed to get cluster node id");
+    }
+
+    // The ID is NOT null-terminated.
+    return std::string(id, REDISMODULE_NODE_ID_LEN);
+}
+
+SlotMap::SlotMap(RedisModuleCtx *ctx) {
+    assert(ctx != nullptr);
+
+    auto *reply = RedisModule_Call(ctx, "CLUSTER", "c", "SLOTS");
+    if (reply == nullptr) {
+        throw Error("failed to get cluster slots");
+    }
+
+    try {
+        _parse(reply);
+    } catch (const Error &) {
+        RedisModule_FreeCallReply(reply);
+        throw;
+    }
+
+    RedisModule_FreeCallReply(reply);
+
+    std::sort(_ranges.begin(), _ranges.end(),
+            [](const Range &lhs, const Range &rhs) { return lhs.start < rhs.start; });
+}
+
+const std::string* SlotMap::owner(uint16_t slot) const {
+    // The last range whose start is not greater than *slot*.
+    auto iter = std::upper_bound(_ranges.begin(), _ranges.end(), slot,
+            [](uint16_t s, const Range &range) { return s < range.start; });
+    if (iter == _ranges.begin()) {
+        return nullptr;
+    }
+
+    --iter;
+    if (slot > iter->end) {
+        return nullptr;
+    }
+
+    return &_nodes[iter->node];
+}
+
+void SlotMap::_parse(RedisModuleCallReply *reply) {
+    if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY) {
+        throw Error("invalid reply of CLUSTER SLOTS");
+    }
+
+    auto num = RedisModule_CallReplyLength(reply);
+    _ranges.reserve(num);
+    for (std::size_t idx = 0; idx != num; ++idx) {
+        // Each element is [start, end, [ip, port, id], replicas...].
+        auto *range = RedisModule_CallReplyArrayElement(reply, idx);
+        if (range == nullptr
+                || RedisModule_CallReplyType(range) != REDISMODULE_REPLY_ARRAY
+                || RedisModule_CallReplyLength(range) < 3) {
+            throw Error("invalid reply of CLUSTER SLOTS");
+        }
+
+        auto *master = RedisModule_CallReplyArrayElement(range, 2);
+        if (RedisModule_CallReplyType(master) != REDISMODULE_REPLY_ARRAY
+                || RedisModule_CallReplyLength(master) < 3) {
+            throw Error("node id is not available in CLUSTER SLOTS");
+        }
+
+        std::size_t len = 0;
+        const auto *id = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(master, 2), &len);
+        if (id == nullptr) {
+            throw Error("invalid node id in CLUSTER SLOTS");
+        }
+
+        std::string node(id, len);
+        auto iter = std::find(_nodes.begin(), _nodes.end(), node);
+        auto node_idx = static_cast<std::size_t>(iter - _nodes.begin());
+        if (iter == _nodes.end()) {
+            _nodes.push_back(std::move(node));
+        }
+
+        auto start = RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(range, 0));
+        auto end = RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(range, 1));
+        if (start < 0 || end < start || end >= static_cast<long long>(SLOTS)) {
+            throw Error("invalid slot range in CLUSTER SLOTS");
+        }
+
+        _ranges.push_back(Range{static_cast<uint16_t>(start), static_cast<uint16_t>(end), node_idx});
+    }
+}
+
+bool is_valid_proto(const StringView &proto) {
+    const auto *end = proto.data() + proto.size();
+    try {
+        return ::reply_with_proto(nullptr, proto.data(), end) == end;
+    } catch (const Error &) {
+        return false;
+    }
+}
+
+std::string error_proto(const std::string &msg) {
+    auto proto = "-ERR " + msg + "\r\n";
+
+    // Error messages must be in one line.
+    std::replace(proto.begin() + 1, proto.end() - 2, '\r', ' ');
+    std::replace(proto.begin() + 1, proto.end() - 2, '\n', ' ');
+
+    return proto;
+}
+
+void reply_with_proto(RedisModuleCtx *ctx, const StringView &proto) {
+    // Validate it before replying, so that a malformed reply doesn't leave
+    // a partial reply, e.g. an array with missing elements, to the client.
+    if (!is_valid_proto(proto)) {
+        throw Error("invalid reply");
+    }
+
+    ::reply_with_proto(ctx, proto.data(), proto.data() + proto.size());
+}
+
+}
+
+}
+
+}
+
+}
+
+namespace {
+
+Crc16Table make_crc16_table() {
+    Crc16Table table;
+    for (std::size_t idx = 0; idx != table.size(); ++idx) {
+        uint16_t crc = static_cast<uint16_t>(idx << 8);
+        for (auto bit = 0; bit != 8; ++bit) {
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+        }
+
+        table[idx] = crc;
+    }
+
+    return table;
+}
+
+uint16_t crc16(const char *buf, std::size_t len) {
+    static const auto table = make_crc16_table();
+
+    uint16_t crc = 0;
+    for (std::size_t idx = 0; idx != len; ++idx) {
+        auto byte = static_cast<unsigned char>(buf[idx]);
+        crc = static_cast<uint16_t>((crc << 8) ^ table[((crc >> 8) ^ byte) & 0xff]);
+    }
+
+    return crc;
+}
+
+const char* reply_with_proto(RedisModuleCtx *ctx, const char *ptr, const char *end) {
+    if (ptr == end) {
+        throw Error("incomplete reply");
+    }
+
+    auto type = *ptr++;
+    auto line = read_line(ptr, end);
+    switch (type) {
+    case '+': {
+        // Simple strings and errors must be null-terminated.
+        if (ctx != nullptr) {
+            std::string status(line.data(), line.size());
+            RedisModule_ReplyWithSimpleString(ctx, status.c_str());
+        }
+        break;
+    }
+
+    case '-': {
+        if (ctx != nullptr) {
+            std::string err(line.data(), line.size());
+            RedisModule_ReplyWithError(ctx, err.c_str());
+        }
+        break;
+    }
+
+    case ':': {
+        auto val = line_to_integer(line);
+        if (ctx != nullptr) {
+            RedisModule_ReplyWithLongLong(ctx, val);
+        }
+        break;
+    }
+
+    case '$': {
+        auto len = line_to_integer(line);
+        if (len < 0) {
+            if (ctx != nullptr) {
+                RedisModule_ReplyWithNull(ctx);
+            }
+            break;
+        }
+
+        if (static_cast<std::size_t>(end - ptr) < static_cast<std::size_t>(len) + 2) {
+            throw Error("incomplete reply");
+        }
+
+        if (ctx != nullptr) {
+            RedisModule_ReplyWithStringBuffer(ctx, ptr, len);
+        }
+
+        ptr += len + 2;
+        break;
+    }
+
+    case '*': {
+        auto num = line_to_integer(line);
+        if (num < 0) {
+            if (ctx != nullptr) {
+                RedisModule_ReplyWithNull(ctx);
+            }
+            break;
+        }
+
+        if (ctx != nullptr) {
+            RedisModule_ReplyWithArray(ctx, num);
+        }
+
+        for (long long idx = 0; idx != num; ++idx) {
+            ptr = reply_with_proto(ctx, ptr, end);
+        }
+        break;
+    }
+
+    default:
+        throw Error("unknown reply type");
+    }
+
+    return ptr;
+}
+
+StringView read_line(const char *&ptr, const char *end) {
+    const char crlf[] = "\r\n";
+    const auto *pos = std::search(ptr, end, crlf, crlf + 2);
+    if (pos == end) {
+        throw Error("incomplete reply");
+    }
+
+    StringView line(ptr, pos - ptr);
+    ptr = pos + 2;
+
+    return line;
+}
+
+long long line_to_integer(const StringView &line) {
+    try {
+        return util::sv_to_int64(line);
+    } catch (const Error &) {
+        throw Error("invalid integer in reply");
+    }
+}
+
+}
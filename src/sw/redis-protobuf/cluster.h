@@ -0,0 +1,90 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_CLUSTER_H
+#define SEWENEW_REDISPROTOBUF_CLUSTER_H
+
+#include "module_api.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+namespace cluster {
+
+constexpr std::size_t SLOTS = 16384;
+
+// Whether Redis runs in cluster mode, and the cluster APIs are available.
+bool enabled(RedisModuleCtx *ctx);
+
+// Hash slot of *key*, i.e. CRC16 of the hash tag, if any, or the whole key,
+// which is the same as CLUSTER KEYSLOT.
+uint16_t key_slot(const StringView &key);
+
+// ID of this node.
+std::string my_id();
+
+// Masters of the slots, which is fetched with CLUSTER SLOTS. It's a snapshot,
+// and should not be kept across commands.
+class SlotMap {
+public:
+    explicit SlotMap(RedisModuleCtx *ctx);
+
+    // Return the ID of the master serving *slot*, or nullptr if the slot is not served.
+    const std::string* owner(uint16_t slot) const;
+
+private:
+    struct Range {
+        uint16_t start;
+        uint16_t end;
+
+        // Index of *_nodes*.
+        std::size_t node;
+    };
+
+    void _parse(RedisModuleCallReply *reply);
+
+    // Sorted by *start*, and ranges don't overlap.
+    std::vector<Range> _ranges;
+
+    std::vector<std::string> _nodes;
+};
+
+// Whether *proto* is a complete RESP2 encoded reply.
+bool is_valid_proto(const StringView &proto);
+
+// RESP2 encoded error reply, e.g. "-ERR message\r\n".
+std::string error_proto(const std::string &msg);
+
+// Reply with the RESP2 encoded reply *proto*, e.g. a reply of RedisModule_Call,
+// which is sent by another node. Throw Error, if *proto* is malformed.
+void reply_with_proto(RedisModuleCtx *ctx, const StringView &proto);
+
+}
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_CLUSTER_H
@@ -0,0 +1,532 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "cmget_command.h"
+#include <cassert>
+#include <map>
+#include "errors.h"
+#include "cluster.h"
+#include "worker_pool.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+// Types of cluster messages.
+const uint8_t MSG_MGET_REQUEST = 1;
+const uint8_t MSG_MGET_RESPONSE = 2;
+
+// Integers are encoded in little endian, and strings are prefixed with their lengths.
+class Encoder {
+public:
+    void put_u32(uint32_t val) {
+        for (auto idx = 0; idx != 4; ++idx) {
+            _buf.push_back(static_cast<char>((val >> (idx * 8)) & 0xff));
+        }
+    }
+
+    void put_u64(uint64_t val) {
+        put_u32(static_cast<uint32_t>(val));
+        put_u32(static_cast<uint32_t>(val >> 32));
+    }
+
+    void put_str(const StringView &str) {
+        put_u32(static_cast<uint32_t>(str.size()));
+        _buf.append(str.data(), str.size());
+    }
+
+    std::string& buffer() {
+        return _buf;
+    }
+
+private:
+    std::string _buf;
+};
+
+class Decoder {
+public:
+    Decoder(const unsigned char *data, uint32_t len) : _ptr(data), _end(data + len) {}
+
+    uint32_t get_u32() {
+        _check(4);
+
+        uint32_t val = 0;
+        for (auto idx = 0; idx != 4; ++idx) {
+            val |= static_cast<uint32_t>(_ptr[idx]) << (idx * 8);
+        }
+        _ptr += 4;
+
+        return val;
+    }
+
+    uint64_t get_u64() {
+        auto low = get_u32();
+        auto high = get_u32();
+
+        return (static_cast<uint64_t>(high) << 32) | low;
+    }
+
+    StringView get_str() {
+        auto len = get_u32();
+        _check(len);
+
+        StringView str(reinterpret_cast<const char *>(_ptr), len);
+        _ptr += len;
+
+        return str;
+    }
+
+private:
+    void _check(std::size_t len) const {
+        if (static_cast<std::size_t>(_end - _ptr) < len) {
+            throw Error("truncated cluster message");
+        }
+    }
+
+    const unsigned char *_ptr;
+    const unsigned char *_end;
+};
+
+int send_message(RedisModuleCtx *ctx, const std::string &node, uint8_t type, std::string &payload) {
+    return RedisModule_SendClusterMessage(ctx,
+            const_cast<char *>(node.c_str()),
+            type,
+            reinterpret_cast<unsigned char *>(&payload[0]),
+            static_cast<uint32_t>(payload.size()));
+}
+
+uint64_t next_gather_id() {
+    // Only called in the main thread.
+    static uint64_t id = 0;
+
+    return ++id;
+}
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+class CMGetCommand::Gather : public AsyncTask {
+public:
+    Gather(uint64_t gather_id, std::size_t num) : id(gather_id), replies(num) {}
+
+    uint64_t id;
+
+    RedisModuleBlockedClient *bc = nullptr;
+
+    RedisModuleTimerID timer = 0;
+
+    // Nodes which haven't replied, and positions of their keys.
+    std::unordered_map<std::string, std::vector<std::size_t>> pending;
+
+    // RESP encoded reply of each key, which has been validated.
+    std::vector<std::string> replies;
+
+private:
+    virtual void run() override {}
+
+    virtual int reply(RedisModuleCtx *ctx) override {
+        RedisModule_ReplyWithArray(ctx, replies.size());
+
+        for (const auto &proto : replies) {
+            cluster::reply_with_proto(ctx, proto);
+        }
+
+        return REDISMODULE_OK;
+    }
+};
+
+int CMGetCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+
+        if (!cluster::enabled(ctx)) {
+            return _mget_cmd.run(ctx, args.mget_argv.data(), static_cast<int>(args.mget_argv.size()));
+        }
+
+        return _run_cluster(ctx, args);
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+}
+
+void CMGetCommand::register_receivers(RedisModuleCtx *ctx) {
+    RedisModule_RegisterClusterMessageReceiver(ctx, MSG_MGET_REQUEST, _on_request);
+    RedisModule_RegisterClusterMessageReceiver(ctx, MSG_MGET_RESPONSE, _on_response);
+}
+
+CMGetCommand::Args CMGetCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc < 3) {
+        throw WrongArityError();
+    }
+
+    Args args;
+    args.mget_argv.reserve(argc);
+    args.mget_argv.push_back(argv[0]);
+
+    auto idx = 1;
+    while (idx < argc) {
+        auto opt = StringView(argv[idx]);
+        if (util::str_case_equal(opt, "--FORMAT")) {
+            if (idx + 1 >= argc) {
+                throw Error("syntax error");
+            }
+
+            // Validate it, before sending it to other nodes.
+            _get_cmd._parse_format(argv[idx + 1]);
+
+            args.format = util::sv_to_string(argv[idx + 1]);
+            args.mget_argv.push_back(argv[idx]);
+            args.mget_argv.push_back(argv[idx + 1]);
+
+            ++idx;
+        } else if (util::str_case_equal(opt, "--TIMEOUT")) {
+            if (idx + 1 >= argc) {
+                throw Error("syntax error");
+            }
+
+            ++idx;
+
+            int64_t timeout = 0;
+            try {
+                timeout = util::sv_to_int64(argv[idx]);
+            } catch (const Error &) {
+                throw Error("timeout is not an integer or out of range");
+            }
+
+            if (timeout <= 0) {
+                throw Error("timeout must be positive");
+            }
+
+            args.timeout = std::chrono::milliseconds(timeout);
+        } else {
+            // Finish parsing options.
+            break;
+        }
+
+        ++idx;
+    }
+
+    // At least one key.
+    if (idx + 2 > argc) {
+        throw WrongArityError();
+    }
+
+    // Validate the path, before sending it to other nodes.
+    Path path(argv[idx]);
+
+    args.path = util::sv_to_string(argv[idx]);
+
+    args.keys.reserve(argc - idx - 1);
+    for (auto pos = idx; pos != argc; ++pos) {
+        args.mget_argv.push_back(argv[pos]);
+
+        if (pos != idx) {
+            args.keys.emplace_back(argv[pos]);
+        }
+    }
+
+    return args;
+}
+
+int CMGetCommand::_run_cluster(RedisModuleCtx *ctx, const Args &args) const {
+    cluster::SlotMap slots(ctx);
+    auto myself = cluster::my_id();
+
+    GatherUPtr gather(new Gather(next_gather_id(), args.keys.size()));
+
+    std::vector<std::size_t> local;
+    for (std::size_t idx = 0; idx != args.keys.size(); ++idx) {
+        const auto *owner = slots.owner(cluster::key_slot(args.keys[idx]));
+        if (owner == nullptr) {
+            gather->replies[idx] = "-CLUSTERDOWN Hash slot not served\r\n";
+        } else if (*owner == myself) {
+            local.push_back(idx);
+        } else {
+            gather->pending[*owner].push_back(idx);
+        }
+    }
+
+    if (!local.empty()) {
+        std::vector<StringView> keys;
+        keys.reserve(local.size());
+        for (auto idx : local) {
+            keys.push_back(args.keys[idx]);
+        }
+
+        auto replies = _mget(ctx, args.format, args.path, keys);
+        assert(replies.size() == local.size());
+
+        for (std::size_t idx = 0; idx != local.size(); ++idx) {
+            gather->replies[local[idx]] = std::move(replies[idx]);
+        }
+    }
+
+    // Keys of other nodes cannot be waited for, if the client cannot be blocked.
+    auto can_block = api::can_block(ctx);
+
+    auto &pending = gather->pending;
+    for (auto iter = pending.begin(); iter != pending.end(); ) {
+        const auto &node = iter->first;
+        const auto &positions = iter->second;
+
+        std::string err;
+        if (!can_block) {
+            err = "cannot get keys of other nodes in MULTI or Lua";
+        } else {
+            Encoder encoder;
+            encoder.put_u64(gather->id);
+            encoder.put_str(args.format);
+            encoder.put_str(args.path);
+            encoder.put_u32(static_cast<uint32_t>(positions.size()));
+            for (auto idx : positions) {
+                encoder.put_str(args.keys[idx]);
+            }
+
+            if (send_message(ctx, node, MSG_MGET_REQUEST, encoder.buffer()) != REDISMODULE_OK) {
+                err = "failed to send request to node " + node;
+            }
+        }
+
+        if (err.empty()) {
+            ++iter;
+        } else {
+            for (auto idx : positions) {
+                gather->replies[idx] = cluster::error_proto(err);
+            }
+
+            iter = pending.erase(iter);
+        }
+    }
+
+    if (pending.empty()) {
+        // All keys are local, or failed.
+        return gather->finish(ctx);
+    }
+
+    gather->bc = api::block(ctx);
+    gather->timer = RedisModule_CreateTimer(ctx, args.timeout.count(), _on_timeout, gather.get());
+
+    auto id = gather->id;
+    _gathers().emplace(id, std::move(gather));
+
+    return REDISMODULE_OK;
+}
+
+std::vector<std::string> CMGetCommand::_mget(RedisModuleCtx *ctx,
+        const std::string &format,
+        const std::string &path,
+        const std::vector<StringView> &keys) {
+    std::vector<std::string> replies(keys.size());
+
+    std::map<uint16_t, std::vector<std::size_t>> slots;
+    for (std::size_t idx = 0; idx != keys.size(); ++idx) {
+        slots[cluster::key_slot(keys[idx])].push_back(idx);
+    }
+
+    for (const auto &slot : slots) {
+        const auto &positions = slot.second;
+
+        std::vector<RedisModuleString *> argv;
+        argv.reserve(positions.size() + 3);
+        if (!format.empty()) {
+            argv.push_back(RedisModule_CreateString(ctx, "--FORMAT", 8));
+            argv.push_back(RedisModule_CreateString(ctx, format.data(), format.size()));
+        }
+
+        argv.push_back(RedisModule_CreateString(ctx, path.data(), path.size()));
+        for (auto idx : positions) {
+            argv.push_back(RedisModule_CreateString(ctx, keys[idx].data(), keys[idx].size()));
+        }
+
+        auto *reply = RedisModule_Call(ctx, "PB.MGET", "v", argv.data(), argv.size());
+
+        for (auto *arg : argv) {
+            RedisModule_FreeString(ctx, arg);
+        }
+
+        if (reply == nullptr) {
+            for (auto idx : positions) {
+                replies[idx] = cluster::error_proto("failed to call PB.MGET");
+            }
+
+            continue;
+        }
+
+        if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ARRAY
+                && RedisModule_CallReplyLength(reply) == positions.size()) {
+            for (std::size_t idx = 0; idx != positions.size(); ++idx) {
+                std::size_t len = 0;
+                const auto *proto = RedisModule_CallReplyProto(
+                        RedisModule_CallReplyArrayElement(reply, idx), &len);
+                replies[positions[idx]].assign(proto, len);
+            }
+        } else {
+            // Command error, e.g. invalid path, applies to all keys.
+            std::size_t len = 0;
+            const auto *proto = RedisModule_CallReplyProto(reply, &len);
+            for (auto idx : positions) {
+                replies[idx].assign(proto, len);
+            }
+        }
+
+        RedisModule_FreeCallReply(reply);
+    }
+
+    return replies;
+}
+
+std::unordered_map<uint64_t, CMGetCommand::GatherUPtr>& CMGetCommand::_gathers() {
+    static std::unordered_map<uint64_t, GatherUPtr> gathers;
+
+    return gathers;
+}
+
+void CMGetCommand::_finish(RedisModuleCtx *ctx, uint64_t id) {
+    auto &gathers = _gathers();
+    auto iter = gathers.find(id);
+    if (iter == gathers.end()) {
+        return;
+    }
+
+    auto gather = std::move(iter->second);
+    gathers.erase(iter);
+
+    if (gather->timer != 0) {
+        RedisModule_StopTimer(ctx, gather->timer, nullptr);
+    }
+
+    for (const auto &node : gather->pending) {
+        for (auto idx : node.second) {
+            gather->replies[idx] = cluster::error_proto("no reply from node " + node.first);
+        }
+    }
+
+    auto *bc = gather->bc;
+    api::unblock(bc, AsyncTaskUPtr(std::move(gather)));
+}
+
+void CMGetCommand::_on_request(RedisModuleCtx *ctx,
+        const char *sender_id,
+        uint8_t /*type*/,
+        const unsigned char *payload,
+        uint32_t len) {
+    std::string sender(sender_id, REDISMODULE_NODE_ID_LEN);
+    try {
+        Decoder decoder(payload, len);
+        auto id = decoder.get_u64();
+        auto format = util::sv_to_string(decoder.get_str());
+        auto path = util::sv_to_string(decoder.get_str());
+
+        auto num = decoder.get_u32();
+        std::vector<StringView> keys;
+        keys.reserve(num);
+        for (uint32_t idx = 0; idx != num; ++idx) {
+            keys.push_back(decoder.get_str());
+        }
+
+        auto replies = _mget(ctx, format, path, keys);
+
+        Encoder encoder;
+        encoder.put_u64(id);
+        encoder.put_u32(static_cast<uint32_t>(replies.size()));
+        for (const auto &reply : replies) {
+            encoder.put_str(reply);
+        }
+
+        if (send_message(ctx, sender, MSG_MGET_RESPONSE, encoder.buffer()) != REDISMODULE_OK) {
+            api::warning(ctx, "failed to send PB.CMGET response to node %s", sender.c_str());
+        }
+    } catch (const Error &err) {
+        // The requesting node times out.
+        api::warning(ctx, "invalid PB.CMGET request from node %s: %s", sender.c_str(), err.what());
+    }
+}
+
+void CMGetCommand::_on_response(RedisModuleCtx *ctx,
+        const char *sender_id,
+        uint8_t /*type*/,
+        const unsigned char *payload,
+        uint32_t len) {
+    std::string sender(sender_id, REDISMODULE_NODE_ID_LEN);
+    try {
+        Decoder decoder(payload, len);
+        auto id = decoder.get_u64();
+
+        auto &gathers = _gathers();
+        auto iter = gathers.find(id);
+        if (iter == gathers.end()) {
+            // It has timed out.
+            return;
+        }
+
+        auto &gather = *(iter->second);
+        auto node = gather.pending.find(sender);
+        if (node == gather.pending.end()) {
+            return;
+        }
+
+        const auto &positions = node->second;
+
+        auto num = decoder.get_u32();
+        if (num != positions.size()) {
+            throw Error("number of replies mismatch");
+        }
+
+        for (auto idx : positions) {
+            auto proto = decoder.get_str();
+            if (cluster::is_valid_proto(proto)) {
+                gather.replies[idx] = util::sv_to_string(proto);
+            } else {
+                gather.replies[idx] = cluster::error_proto("invalid reply from node " + sender);
+            }
+        }
+
+        gather.pending.erase(node);
+        if (gather.pending.empty()) {
+            _finish(ctx, id);
+        }
+    } catch (const Error &err) {
+        // Keys of the node are replied with errors on timeout.
+        api::warning(ctx, "invalid PB.CMGET response from node %s: %s", sender.c_str(), err.what());
+    }
+}
+
+void CMGetCommand::_on_timeout(RedisModuleCtx *ctx, void *data) {
+    auto *gather = static_cast<Gather *>(data);
+    assert(gather != nullptr);
+
+    // The timer has fired, and it must not be stopped.
+    gather->timer = 0;
+
+    _finish(ctx, gather->id);
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,114 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_CMGET_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_CMGET_COMMANDS_H
+
+#include "module_api.h"
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "utils.h"
+#include "get_command.h"
+#include "mget_command.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.CMGET [--FORMAT BINARY|JSON] [--TIMEOUT milliseconds] path key [key ...]
+// return:  Same as PB.MGET. In cluster mode, keys can be in any slot: keys
+//          served by this node are read with PB.MGET locally, and others are
+//          sent to their masters with cluster messages, which run PB.MGET and
+//          send the replies back. If a node doesn't reply in time (1000
+//          milliseconds by default), its keys are replied with errors.
+// error:   If the path cannot be parsed, return an error reply. Errors of
+//          a single key are returned as elements of the array reply.
+class CMGetCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+    // Register the receivers of cluster messages, that run PB.MGET for other
+    // nodes, and gather the replies.
+    static void register_receivers(RedisModuleCtx *ctx);
+
+private:
+    struct Args {
+        // Argument of --FORMAT, which is passed to PB.MGET as is.
+        std::string format;
+
+        std::chrono::milliseconds timeout{1000};
+
+        std::string path;
+
+        std::vector<StringView> keys;
+
+        // Arguments without --TIMEOUT, which are passed to PB.MGET without cluster mode.
+        std::vector<RedisModuleString *> mget_argv;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    // Run PB.MGET with *keys* in this node, and return the RESP encoded reply
+    // of each key. Keys are grouped by slot, and PB.MGET is called once for
+    // each slot, because Redis might reject cross-slot PB.MGET.
+    static std::vector<std::string> _mget(RedisModuleCtx *ctx,
+            const std::string &format,
+            const std::string &path,
+            const std::vector<StringView> &keys);
+
+    int _run_cluster(RedisModuleCtx *ctx, const Args &args) const;
+
+    class Gather;
+
+    using GatherUPtr = std::unique_ptr<Gather>;
+
+    // Gathers waiting for replies of other nodes. It's only accessed in the main thread.
+    static std::unordered_map<uint64_t, GatherUPtr>& _gathers();
+
+    // Reply with errors for nodes which haven't replied, and unblock the client.
+    static void _finish(RedisModuleCtx *ctx, uint64_t id);
+
+    static void _on_request(RedisModuleCtx *ctx,
+            const char *sender_id,
+            uint8_t type,
+            const unsigned char *payload,
+            uint32_t len);
+
+    static void _on_response(RedisModuleCtx *ctx,
+            const char *sender_id,
+            uint8_t type,
+            const unsigned char *payload,
+            uint32_t len);
+
+    static void _on_timeout(RedisModuleCtx *ctx, void *data);
+
+    MGetCommand _mget_cmd;
+
+    GetCommand _get_cmd;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_CMGET_COMMANDS_H
@@ -24,6 +24,54 @@
 #include "del_command.h"
 #include "schema_command.h"
 #include "merge_command.h"
+#include "stats_command.h"
+#include "mget_command.h"
+#include "mset_command.h"
+#include "lrange_command.h"
+#include "info_command.h"
+#include "reload_command.h"
+#include "index_command.h"
+#include "query_command.h"
+#include "scan_command.h"
+#include "agg_command.h"
+#include "incr_command.h"
+#include "patch_command.h"
+#include "getrange_command.h"
+#include "cmget_command.h"
+#include "hmget_command.h"
+#include "hexists_command.h"
+#include "hscan_command.h"
+#include "metrics.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+// Run the command, and record its latency.
+template <typename Command>
+struct InstrumentedCommand {
+    static int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+        LatencyTimer timer(latency);
+
+        Command cmd;
+        return cmd.run(ctx, argv, argc);
+    }
+
+    static LatencyHistogram *latency;
+};
+
+template <typename Command>
+LatencyHistogram *InstrumentedCommand<Command>::latency = nullptr;
+
+// Add a latency histogram for the command, and return the callback to create the command.
+template <typename Command>
+RedisModuleCmdFunc instrument(const std::string &name) {
+    InstrumentedCommand<Command>::latency = &Metrics::instance().add_command(name);
+
+    return InstrumentedCommand<Command>::run;
+}
+
+}
 
 namespace sw {
 
@@ -36,10 +84,7 @@ namespace cmd {
 void create_commands(RedisModuleCtx *ctx) {
     if (RedisModule_CreateCommand(ctx,
                 "PB.TYPE",
-                [](RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-                    TypeCommand cmd;
-                    return cmd.run(ctx, argv, argc);
-                },
+                instrument<TypeCommand>("PB.TYPE"),
                 "readonly",
                 1,
                 1,
@@ -49,10 +94,7 @@ void create_commands(RedisModuleCtx *ctx) {
 
     if (RedisModule_CreateCommand(ctx,
                 "PB.SET",
-                [](RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-                    SetCommand cmd;
-                    return cmd.run(ctx, argv, argc);
-                },
+                instrument<SetCommand>("PB.SET"),
                 "write deny-oom",
                 1,
                 1,
@@ -62,10 +104,7 @@ void create_commands(RedisModuleCtx *ctx) {
 
     if (RedisModule_CreateCommand(ctx,
                 "PB.GET",
-                [](RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-                    GetCommand cmd;
-                    return cmd.run(ctx, argv, argc);
-                },
+                instrument<GetCommand>("PB.GET"),
                 "readonly",
                 1,
                 1,
@@ -75,10 +114,7 @@ void create_commands(RedisModuleCtx *ctx) {
 
     if (RedisModule_CreateCommand(ctx,
                 "PB.CLEAR",
-                [](RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-                    ClearCommand cmd;
-                    return cmd.run(ctx, argv, argc);
-                },
+                instrument<ClearCommand>("PB.CLEAR"),
                 "write deny-oom",
                 1,
                 1,
@@ -88,10 +124,7 @@ void create_commands(RedisModuleCtx *ctx) {
 
     if (RedisModule_CreateCommand(ctx,
                 "PB.LEN",
-                [](RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-                    LenCommand cmd;
-                    return cmd.run(ctx, argv, argc);
-                },
+                instrument<LenCommand>("PB.LEN"),
                 "readonly",
                 1,
                 1,
@@ -101,10 +134,7 @@ void create_commands(RedisModuleCtx *ctx) {
 
     if (RedisModule_CreateCommand(ctx,
                 "PB.APPEND",
-                [](RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-                    AppendCommand cmd;
-                    return cmd.run(ctx, argv, argc);
-                },
+                instrument<AppendCommand>("PB.APPEND"),
                 "write deny-oom",
                 1,
                 1,
@@ -114,10 +144,7 @@ void create_commands(RedisModuleCtx *ctx) {
 
     if (RedisModule_CreateCommand(ctx,
                 "PB.DEL",
-                [](RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-                    DelCommand cmd;
-                    return cmd.run(ctx, argv, argc);
-                },
+                instrument<DelCommand>("PB.DEL"),
                 "write deny-oom",
                 1,
                 1,
@@ -127,28 +154,215 @@ void create_commands(RedisModuleCtx *ctx) {
 
     if (RedisModule_CreateCommand(ctx,
                 "PB.SCHEMA",
-                [](RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-                    SchemaCommand cmd;
-                    return cmd.run(ctx, argv, argc);
-                },
+                instrument<SchemaCommand>("PB.SCHEMA"),
+                "readonly",
+                0,
+                0,
+                0) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.SCHEMA command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.MERGE",
+                instrument<MergeCommand>("PB.MERGE"),
+                "write deny-oom",
+                1,
+                1,
+                1) == REDISMODULE_ERR) {
+        throw Error("fail to create PB.MERGE command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.STATS",
+                instrument<StatsCommand>("PB.STATS"),
+                "readonly",
+                0,
+                0,
+                0) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.STATS command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.MGET",
+                instrument<MGetCommand>("PB.MGET"),
                 "readonly getkeys-api",
+                2,
+                -1,
+                1) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.MGET command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.MSET",
+                instrument<MSetCommand>("PB.MSET"),
+                "write deny-oom",
+                2,
+                -1,
+                2) == REDISMODULE_ERR) {
+        throw Error("fail to create PB.MSET command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.LRANGE",
+                instrument<LRangeCommand>("PB.LRANGE"),
+                "readonly",
                 1,
                 1,
                 1) == REDISMODULE_ERR) {
-        throw Error("failed to create PB.SCHEMA command");
+        throw Error("failed to create PB.LRANGE command");
     }
 
     if (RedisModule_CreateCommand(ctx,
-                "PB.MERGE",
-                [](RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-                    MergeCommand cmd;
-                    return cmd.run(ctx, argv, argc);
-                },
+                "PB.INFO",
+                instrument<InfoCommand>("PB.INFO"),
+                "readonly",
+                0,
+                0,
+                0) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.INFO command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.RELOAD",
+                instrument<ReloadCommand>("PB.RELOAD"),
+                "admin",
+                0,
+                0,
+                0) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.RELOAD command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.INDEX",
+                instrument<IndexCommand>("PB.INDEX"),
+                "readonly",
+                0,
+                0,
+                0) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.INDEX command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.QUERY",
+                instrument<QueryCommand>("PB.QUERY"),
+                "readonly",
+                0,
+                0,
+                0) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.QUERY command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.SCAN",
+                instrument<ScanCommand>("PB.SCAN"),
+                "readonly",
+                0,
+                0,
+                0) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.SCAN command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.AGG",
+                instrument<AggCommand>("PB.AGG"),
+                "readonly",
+                3,
+                -1,
+                1) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.AGG command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.INCRBY",
+                instrument<IncrByCommand>("PB.INCRBY"),
                 "write deny-oom",
                 1,
                 1,
                 1) == REDISMODULE_ERR) {
-        throw Error("fail to create PB.MERGE command");
+        throw Error("failed to create PB.INCRBY command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.INCRBYFLOAT",
+                instrument<IncrByFloatCommand>("PB.INCRBYFLOAT"),
+                "write deny-oom",
+                1,
+                1,
+                1) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.INCRBYFLOAT command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.PATCH",
+                instrument<PatchCommand>("PB.PATCH"),
+                "write deny-oom",
+                1,
+                1,
+                1) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.PATCH command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.GETRANGE",
+                instrument<GetRangeCommand>("PB.GETRANGE"),
+                "readonly",
+                1,
+                1,
+                1) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.GETRANGE command");
+    }
+
+    // Keys are NOT declared, since they can be in any slot, and they're
+    // routed to their nodes by the command itself.
+    if (RedisModule_CreateCommand(ctx,
+                "PB.CMGET",
+                instrument<CMGetCommand>("PB.CMGET"),
+                "readonly",
+                0,
+                0,
+                0) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.CMGET command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.HMGET",
+                instrument<HMGetCommand>("PB.HMGET"),
+                "readonly",
+                1,
+                1,
+                1) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.HMGET command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.HEXISTS",
+                instrument<HExistsCommand>("PB.HEXISTS"),
+                "readonly",
+                1,
+                1,
+                1) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.HEXISTS command");
+    }
+
+    if (RedisModule_CreateCommand(ctx,
+                "PB.HSCAN",
+                instrument<HScanCommand>("PB.HSCAN"),
+                "readonly",
+                1,
+                1,
+                1) == REDISMODULE_ERR) {
+        throw Error("failed to create PB.HSCAN command");
+    }
+
+    // Cluster messages are only supported by Redis 5.0 or above.
+    if (RedisModule_RegisterClusterMessageReceiver != nullptr) {
+        CMGetCommand::register_receivers(ctx);
+    }
+
+    // INFO callback is only supported by Redis 6.0 or above.
+    if (RedisModule_RegisterInfoFunc != nullptr
+            && RedisModule_RegisterInfoFunc(ctx, InfoCommand::info) == REDISMODULE_ERR) {
+        throw Error("failed to register INFO callback");
     }
 }
 
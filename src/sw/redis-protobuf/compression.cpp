@@ -0,0 +1,105 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "compression.h"
+#include <zlib.h>
+#include <limits>
+#include "errors.h"
+#include "metrics.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+namespace compression {
+
+namespace {
+
+// Max compression ratio of deflate, i.e. about 1032:1.
+const std::size_t MAX_RATIO = 1032;
+
+}
+
+std::string compress(const StringView &data) {
+    if (data.size() > std::numeric_limits<uLong>::max()) {
+        return {};
+    }
+
+    LatencyTimer timer(Phase::COMPRESS);
+
+    std::string buf(compressBound(data.size()), '\0');
+
+    auto len = static_cast<uLongf>(buf.size());
+
+    // Favor speed, since it runs in the main thread on writes and RDB loading.
+    if (compress2(reinterpret_cast<Bytef *>(&buf[0]),
+                &len,
+                reinterpret_cast<const Bytef *>(data.data()),
+                data.size(),
+                Z_BEST_SPEED) != Z_OK) {
+        throw Error("failed to compress data");
+    }
+
+    if (len >= data.size()) {
+        return {};
+    }
+
+    // Release the spare capacity of the bound, since the value is kept in memory.
+    buf.resize(len);
+    buf.shrink_to_fit();
+
+    return buf;
+}
+
+std::size_t max_raw_size(std::size_t size) {
+    if (size > std::numeric_limits<std::size_t>::max() / MAX_RATIO) {
+        return std::numeric_limits<std::size_t>::max();
+    }
+
+    return size * MAX_RATIO;
+}
+
+std::string decompress(const StringView &data, std::size_t raw_size) {
+    // Check the size before allocating, since it might be loaded from a corrupted RDB file.
+    if (raw_size > max_raw_size(data.size()) || raw_size > std::numeric_limits<uLongf>::max()) {
+        throw Error("invalid size of compressed data: " + std::to_string(raw_size));
+    }
+
+    LatencyTimer timer(Phase::DECOMPRESS);
+
+    std::string raw(raw_size, '\0');
+
+    auto len = static_cast<uLongf>(raw_size);
+    auto err = uncompress(reinterpret_cast<Bytef *>(&raw[0]),
+            &len,
+            reinterpret_cast<const Bytef *>(data.data()),
+            data.size());
+    if (err != Z_OK || len != raw_size) {
+        throw Error("failed to decompress data");
+    }
+
+    return raw;
+}
+
+}
+
+}
+
+}
+
+}
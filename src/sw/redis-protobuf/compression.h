@@ -0,0 +1,52 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_COMPRESSION_H
+#define SEWENEW_REDISPROTOBUF_COMPRESSION_H
+
+#include <string>
+#include "utils.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+namespace compression {
+
+// Compress *data* with zlib, which protobuf already depends on. Return an empty
+// string, if the compressed data is not smaller than *data*, i.e. the compressed
+// form is not worth keeping. The returned string has no spare capacity.
+std::string compress(const StringView &data);
+
+// Max number of bytes, which can be decompressed from *size* bytes.
+std::size_t max_raw_size(std::size_t size);
+
+// Decompress *data*, which must be compressed from exactly *raw_size* bytes.
+// Throw Error, if *data* is corrupted, or *raw_size* is larger than
+// *max_raw_size(data.size())*.
+std::string decompress(const StringView &data, std::size_t raw_size);
+
+}
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_COMPRESSION_H
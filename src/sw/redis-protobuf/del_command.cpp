@@ -17,6 +17,7 @@
 #include "del_command.h"
 #include "errors.h"
 #include "redis_protobuf.h"
+#include "metrics.h"
 
 namespace sw {
 
@@ -33,23 +34,30 @@ int DelCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) con
         auto key = api::open_key(ctx, args.key_name, api::KeyMode::WRITEONLY);
         assert(key);
 
-        if (!api::key_exists(key.get(), RedisProtobuf::instance().type())) {
+        auto &module = RedisProtobuf::instance();
+        if (!api::key_exists(key.get(), module.type())) {
             RedisModule_ReplyWithLongLong(ctx, 0);
         } else {
-            auto *msg = api::get_msg_by_key(key.get());
-            assert(msg != nullptr);
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
 
             const auto &path = args.path;
-            if (msg->GetTypeName() != path.type()) {
+            if (value->descriptor()->full_name() != path.type()) {
                 throw Error("type mismatch");
             }
 
             if (path.empty()) {
                 // Delete key.
                 RedisModule_DeleteKey(key.get());
+
+                module.after_delete(ctx, args.key_name);
+                module.notify(ctx, "del", args.key_name, path);
             } else {
                 // Delete an item from array or map.
-                _del(*msg, path);
+                _del(value->msg(), path);
+
+                module.after_write(ctx, args.key_name, *value);
+                module.notify(ctx, "del", args.key_name, path);
             }
 
             RedisModule_ReplyWithLongLong(ctx, 1);
@@ -78,11 +86,12 @@ DelCommand::Args DelCommand::_parse_args(RedisModuleString **argv, int argc) con
 }
 
 void DelCommand::_del(gp::Message &msg, const Path &path) const {
+    LatencyTimer timer(Phase::MUTATE);
+
     MutableFieldRef field(&msg, path);
 
-    if (!field.is_array_element()) {
-        // TODO: support map element
-        throw Error("not an array or map");
+    if (!field.is_array_element() && !field.is_map_element()) {
+        throw Error("not an array or map element");
     }
 
     field.del();
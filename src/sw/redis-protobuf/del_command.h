@@ -46,6 +46,8 @@ private:
     Args _parse_args(RedisModuleString **argv, int argc) const;
 
     void _del(gp::Message &msg, const Path &path) const;
+
+    friend class PatchCommand;
 };
 
 }
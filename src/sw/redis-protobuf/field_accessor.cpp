@@ -0,0 +1,245 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "field_accessor.h"
+#include "errors.h"
+#include "field_ref.h"
+#include "redis_protobuf.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+using CppType = gp::FieldDescriptor::CppType;
+
+// Operations that are not supported by a field kind or type. Specializations
+// of *Accessor* hide them with supported ones.
+struct Unsupported {
+    static void set(MutableFieldRef &field, const StringView &sv) {
+        throw Error("cannot set the field");
+    }
+
+    static void reply(RedisModuleCtx *ctx, const ConstFieldRef &field) {
+        throw Error("cannot reply with the field");
+    }
+
+    static void reply_mapped(RedisModuleCtx *ctx, const gp::MapValueRef &value) {
+        throw Error("not a map");
+    }
+
+    static const gp::Message& get_msg(const ConstFieldRef &field) {
+        throw Error("not a message");
+    }
+};
+
+std::unique_ptr<gp::Message> create_msg(const gp::Descriptor &desc, const StringView &sv) {
+    auto msg = RedisProtobuf::instance().proto_factory()->create(desc, sv);
+    assert(msg);
+
+    return msg;
+}
+
+template <FieldKind Kind, CppType T>
+struct Accessor;
+
+template <CppType T>
+struct Accessor<FieldKind::SCALAR, T> : Unsupported {
+    static void set(MutableFieldRef &field, const StringView &sv) {
+        field.set<T>(CppTypeTraits<T>::parse(sv));
+    }
+
+    static void reply(RedisModuleCtx *ctx, const ConstFieldRef &field) {
+        CppTypeTraits<T>::reply(ctx, field.get<T>());
+    }
+};
+
+template <>
+struct Accessor<FieldKind::SCALAR, gp::FieldDescriptor::CPPTYPE_MESSAGE> : Unsupported {
+    static void set(MutableFieldRef &field, const StringView &sv) {
+        auto msg = create_msg(field.msg_descriptor(), sv);
+        field.set_msg(*msg);
+    }
+
+    static const gp::Message& get_msg(const ConstFieldRef &field) {
+        return field.get_msg();
+    }
+};
+
+template <CppType T>
+struct Accessor<FieldKind::ARRAY_ELEMENT, T> : Unsupported {
+    static void set(MutableFieldRef &field, const StringView &sv) {
+        field.set_repeated<T>(CppTypeTraits<T>::parse(sv));
+    }
+
+    static void reply(RedisModuleCtx *ctx, const ConstFieldRef &field) {
+        CppTypeTraits<T>::reply(ctx, field.get_repeated<T>());
+    }
+};
+
+template <>
+struct Accessor<FieldKind::ARRAY_ELEMENT, gp::FieldDescriptor::CPPTYPE_MESSAGE> : Unsupported {
+    static void set(MutableFieldRef &field, const StringView &sv) {
+        auto msg = create_msg(field.msg_descriptor(), sv);
+        field.set_repeated_msg(*msg);
+    }
+
+    static const gp::Message& get_msg(const ConstFieldRef &field) {
+        return field.get_repeated_msg();
+    }
+};
+
+template <CppType T>
+struct Accessor<FieldKind::MAP_ELEMENT, T> : Unsupported {
+    static void set(MutableFieldRef &field, const StringView &sv) {
+        field.set_mapped<T>(CppTypeTraits<T>::parse(sv));
+    }
+
+    static void reply(RedisModuleCtx *ctx, const ConstFieldRef &field) {
+        CppTypeTraits<T>::reply(ctx, field.get_mapped<T>());
+    }
+
+    static void reply_mapped(RedisModuleCtx *ctx, const gp::MapValueRef &value) {
+        CppTypeTraits<T>::reply(ctx, CppTypeTraits<T>::get_mapped(value));
+    }
+};
+
+template <>
+struct Accessor<FieldKind::MAP_ELEMENT, gp::FieldDescriptor::CPPTYPE_MESSAGE> : Unsupported {
+    static void set(MutableFieldRef &field, const StringView &sv) {
+        auto msg = create_msg(field.mapped_msg_descriptor(), sv);
+        field.set_mapped_msg(*msg);
+    }
+
+    static const gp::Message& get_msg(const ConstFieldRef &field) {
+        return field.get_mapped_msg();
+    }
+};
+
+template <CppType T>
+struct Accessor<FieldKind::ARRAY, T> : Unsupported {
+    static void set(MutableFieldRef &field, const StringView &sv) {
+        throw Error("cannot set the whole array field");
+    }
+};
+
+template <CppType T>
+struct Accessor<FieldKind::MAP, T> : Unsupported {
+    static void set(MutableFieldRef &field, const StringView &sv) {
+        throw Error("cannot set the whole map field");
+    }
+
+    static void reply_mapped(RedisModuleCtx *ctx, const gp::MapValueRef &value) {
+        Accessor<FieldKind::MAP_ELEMENT, T>::reply_mapped(ctx, value);
+    }
+};
+
+template <FieldKind Kind, CppType T>
+constexpr FieldAccessor accessor() {
+    return FieldAccessor{Kind,
+                            T,
+                            &Accessor<Kind, T>::set,
+                            &Accessor<Kind, T>::reply,
+                            &Accessor<Kind, T>::reply_mapped,
+                            &Accessor<Kind, T>::get_msg};
+}
+
+// Indexed by field kind and C++ type, which starts from 1.
+const FieldAccessor ACCESSORS[static_cast<int>(FieldKind::MAX)][gp::FieldDescriptor::MAX_CPPTYPE] = {
+    {
+        accessor<FieldKind::SCALAR, gp::FieldDescriptor::CPPTYPE_INT32>(),
+        accessor<FieldKind::SCALAR, gp::FieldDescriptor::CPPTYPE_INT64>(),
+        accessor<FieldKind::SCALAR, gp::FieldDescriptor::CPPTYPE_UINT32>(),
+        accessor<FieldKind::SCALAR, gp::FieldDescriptor::CPPTYPE_UINT64>(),
+        accessor<FieldKind::SCALAR, gp::FieldDescriptor::CPPTYPE_DOUBLE>(),
+        accessor<FieldKind::SCALAR, gp::FieldDescriptor::CPPTYPE_FLOAT>(),
+        accessor<FieldKind::SCALAR, gp::FieldDescriptor::CPPTYPE_BOOL>(),
+        accessor<FieldKind::SCALAR, gp::FieldDescriptor::CPPTYPE_ENUM>(),
+        accessor<FieldKind::SCALAR, gp::FieldDescriptor::CPPTYPE_STRING>(),
+        accessor<FieldKind::SCALAR, gp::FieldDescriptor::CPPTYPE_MESSAGE>()
+    },
+    {
+        accessor<FieldKind::ARRAY_ELEMENT, gp::FieldDescriptor::CPPTYPE_INT32>(),
+        accessor<FieldKind::ARRAY_ELEMENT, gp::FieldDescriptor::CPPTYPE_INT64>(),
+        accessor<FieldKind::ARRAY_ELEMENT, gp::FieldDescriptor::CPPTYPE_UINT32>(),
+        accessor<FieldKind::ARRAY_ELEMENT, gp::FieldDescriptor::CPPTYPE_UINT64>(),
+        accessor<FieldKind::ARRAY_ELEMENT, gp::FieldDescriptor::CPPTYPE_DOUBLE>(),
+        accessor<FieldKind::ARRAY_ELEMENT, gp::FieldDescriptor::CPPTYPE_FLOAT>(),
+        accessor<FieldKind::ARRAY_ELEMENT, gp::FieldDescriptor::CPPTYPE_BOOL>(),
+        accessor<FieldKind::ARRAY_ELEMENT, gp::FieldDescriptor::CPPTYPE_ENUM>(),
+        accessor<FieldKind::ARRAY_ELEMENT, gp::FieldDescriptor::CPPTYPE_STRING>(),
+        accessor<FieldKind::ARRAY_ELEMENT, gp::FieldDescriptor::CPPTYPE_MESSAGE>()
+    },
+    {
+        accessor<FieldKind::MAP_ELEMENT, gp::FieldDescriptor::CPPTYPE_INT32>(),
+        accessor<FieldKind::MAP_ELEMENT, gp::FieldDescriptor::CPPTYPE_INT64>(),
+        accessor<FieldKind::MAP_ELEMENT, gp::FieldDescriptor::CPPTYPE_UINT32>(),
+        accessor<FieldKind::MAP_ELEMENT, gp::FieldDescriptor::CPPTYPE_UINT64>(),
+        accessor<FieldKind::MAP_ELEMENT, gp::FieldDescriptor::CPPTYPE_DOUBLE>(),
+        accessor<FieldKind::MAP_ELEMENT, gp::FieldDescriptor::CPPTYPE_FLOAT>(),
+        accessor<FieldKind::MAP_ELEMENT, gp::FieldDescriptor::CPPTYPE_BOOL>(),
+        accessor<FieldKind::MAP_ELEMENT, gp::FieldDescriptor::CPPTYPE_ENUM>(),
+        accessor<FieldKind::MAP_ELEMENT, gp::FieldDescriptor::CPPTYPE_STRING>(),
+        accessor<FieldKind::MAP_ELEMENT, gp::FieldDescriptor::CPPTYPE_MESSAGE>()
+    },
+    {
+        accessor<FieldKind::ARRAY, gp::FieldDescriptor::CPPTYPE_INT32>(),
+        accessor<FieldKind::ARRAY, gp::FieldDescriptor::CPPTYPE_INT64>(),
+        accessor<FieldKind::ARRAY, gp::FieldDescriptor::CPPTYPE_UINT32>(),
+        accessor<FieldKind::ARRAY, gp::FieldDescriptor::CPPTYPE_UINT64>(),
+        accessor<FieldKind::ARRAY, gp::FieldDescriptor::CPPTYPE_DOUBLE>(),
+        accessor<FieldKind::ARRAY, gp::FieldDescriptor::CPPTYPE_FLOAT>(),
+        accessor<FieldKind::ARRAY, gp::FieldDescriptor::CPPTYPE_BOOL>(),
+        accessor<FieldKind::ARRAY, gp::FieldDescriptor::CPPTYPE_ENUM>(),
+        accessor<FieldKind::ARRAY, gp::FieldDescriptor::CPPTYPE_STRING>(),
+        accessor<FieldKind::ARRAY, gp::FieldDescriptor::CPPTYPE_MESSAGE>()
+    },
+    {
+        accessor<FieldKind::MAP, gp::FieldDescriptor::CPPTYPE_INT32>(),
+        accessor<FieldKind::MAP, gp::FieldDescriptor::CPPTYPE_INT64>(),
+        accessor<FieldKind::MAP, gp::FieldDescriptor::CPPTYPE_UINT32>(),
+        accessor<FieldKind::MAP, gp::FieldDescriptor::CPPTYPE_UINT64>(),
+        accessor<FieldKind::MAP, gp::FieldDescriptor::CPPTYPE_DOUBLE>(),
+        accessor<FieldKind::MAP, gp::FieldDescriptor::CPPTYPE_FLOAT>(),
+        accessor<FieldKind::MAP, gp::FieldDescriptor::CPPTYPE_BOOL>(),
+        accessor<FieldKind::MAP, gp::FieldDescriptor::CPPTYPE_ENUM>(),
+        accessor<FieldKind::MAP, gp::FieldDescriptor::CPPTYPE_STRING>(),
+        accessor<FieldKind::MAP, gp::FieldDescriptor::CPPTYPE_MESSAGE>()
+    }
+};
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+const FieldAccessor& select_accessor(FieldKind kind, gp::FieldDescriptor::CppType type) {
+    if (type < 1 || type > gp::FieldDescriptor::MAX_CPPTYPE) {
+        throw Error("unknown type");
+    }
+
+    assert(kind != FieldKind::MAX);
+
+    return ACCESSORS[static_cast<int>(kind)][type - 1];
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,489 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_FIELD_ACCESSOR_H
+#define SEWENEW_REDISPROTOBUF_FIELD_ACCESSOR_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <google/protobuf/message.h>
+#include <google/protobuf/map_field.h>
+#include "module_api.h"
+#include "utils.h"
+#include "errors.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+namespace gp = google::protobuf;
+
+template <typename Msg>
+class FieldRef;
+
+// Traits of a C++ type of protobuf fields, i.e. how to parse a value from
+// the command, access it with reflection, and reply with it. Messages have
+// no traits, since they need the descriptor and options of the command.
+template <gp::FieldDescriptor::CppType T>
+struct CppTypeTraits;
+
+struct IntegerReply {
+    template <typename T>
+    static void reply(RedisModuleCtx *ctx, T val) {
+        RedisModule_ReplyWithLongLong(ctx, val);
+    }
+};
+
+struct FloatingReply {
+    template <typename T>
+    static void reply(RedisModuleCtx *ctx, T val) {
+        auto str = std::to_string(val);
+        RedisModule_ReplyWithSimpleString(ctx, str.data());
+    }
+};
+
+template <>
+struct CppTypeTraits<gp::FieldDescriptor::CPPTYPE_INT32> : IntegerReply {
+    using Type = int32_t;
+
+    static Type parse(const StringView &sv) {
+        return util::sv_to_int32(sv);
+    }
+
+    static Type get(const gp::Message &msg, const gp::FieldDescriptor *desc) {
+        return msg.GetReflection()->GetInt32(msg, desc);
+    }
+
+    static Type get_repeated(const gp::Message &msg, const gp::FieldDescriptor *desc, int idx) {
+        return msg.GetReflection()->GetRepeatedInt32(msg, desc, idx);
+    }
+
+    static Type get_mapped(const gp::MapValueRef &val) {
+        return val.GetInt32Value();
+    }
+
+    static void set(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->SetInt32(msg, desc, val);
+    }
+
+    static void set_repeated(gp::Message *msg, const gp::FieldDescriptor *desc, int idx, Type val) {
+        msg->GetReflection()->SetRepeatedInt32(msg, desc, idx, val);
+    }
+
+    static void set_mapped(gp::MapValueRef &val_ref, Type val) {
+        val_ref.SetInt32Value(val);
+    }
+
+    static void add(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->AddInt32(msg, desc, val);
+    }
+};
+
+template <>
+struct CppTypeTraits<gp::FieldDescriptor::CPPTYPE_INT64> : IntegerReply {
+    using Type = int64_t;
+
+    static Type parse(const StringView &sv) {
+        return util::sv_to_int64(sv);
+    }
+
+    static Type get(const gp::Message &msg, const gp::FieldDescriptor *desc) {
+        return msg.GetReflection()->GetInt64(msg, desc);
+    }
+
+    static Type get_repeated(const gp::Message &msg, const gp::FieldDescriptor *desc, int idx) {
+        return msg.GetReflection()->GetRepeatedInt64(msg, desc, idx);
+    }
+
+    static Type get_mapped(const gp::MapValueRef &val) {
+        return val.GetInt64Value();
+    }
+
+    static void set(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->SetInt64(msg, desc, val);
+    }
+
+    static void set_repeated(gp::Message *msg, const gp::FieldDescriptor *desc, int idx, Type val) {
+        msg->GetReflection()->SetRepeatedInt64(msg, desc, idx, val);
+    }
+
+    static void set_mapped(gp::MapValueRef &val_ref, Type val) {
+        val_ref.SetInt64Value(val);
+    }
+
+    static void add(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->AddInt64(msg, desc, val);
+    }
+};
+
+template <>
+struct CppTypeTraits<gp::FieldDescriptor::CPPTYPE_UINT32> : IntegerReply {
+    using Type = uint32_t;
+
+    static Type parse(const StringView &sv) {
+        return util::sv_to_uint32(sv);
+    }
+
+    static Type get(const gp::Message &msg, const gp::FieldDescriptor *desc) {
+        return msg.GetReflection()->GetUInt32(msg, desc);
+    }
+
+    static Type get_repeated(const gp::Message &msg, const gp::FieldDescriptor *desc, int idx) {
+        return msg.GetReflection()->GetRepeatedUInt32(msg, desc, idx);
+    }
+
+    static Type get_mapped(const gp::MapValueRef &val) {
+        return val.GetUInt32Value();
+    }
+
+    static void set(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->SetUInt32(msg, desc, val);
+    }
+
+    static void set_repeated(gp::Message *msg, const gp::FieldDescriptor *desc, int idx, Type val) {
+        msg->GetReflection()->SetRepeatedUInt32(msg, desc, idx, val);
+    }
+
+    static void set_mapped(gp::MapValueRef &val_ref, Type val) {
+        val_ref.SetUInt32Value(val);
+    }
+
+    static void add(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->AddUInt32(msg, desc, val);
+    }
+};
+
+template <>
+struct CppTypeTraits<gp::FieldDescriptor::CPPTYPE_UINT64> : IntegerReply {
+    using Type = uint64_t;
+
+    static Type parse(const StringView &sv) {
+        return util::sv_to_uint64(sv);
+    }
+
+    static Type get(const gp::Message &msg, const gp::FieldDescriptor *desc) {
+        return msg.GetReflection()->GetUInt64(msg, desc);
+    }
+
+    static Type get_repeated(const gp::Message &msg, const gp::FieldDescriptor *desc, int idx) {
+        return msg.GetReflection()->GetRepeatedUInt64(msg, desc, idx);
+    }
+
+    static Type get_mapped(const gp::MapValueRef &val) {
+        return val.GetUInt64Value();
+    }
+
+    static void set(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->SetUInt64(msg, desc, val);
+    }
+
+    static void set_repeated(gp::Message *msg, const gp::FieldDescriptor *desc, int idx, Type val) {
+        msg->GetReflection()->SetRepeatedUInt64(msg, desc, idx, val);
+    }
+
+    static void set_mapped(gp::MapValueRef &val_ref, Type val) {
+        val_ref.SetUInt64Value(val);
+    }
+
+    static void add(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->AddUInt64(msg, desc, val);
+    }
+};
+
+template <>
+struct CppTypeTraits<gp::FieldDescriptor::CPPTYPE_DOUBLE> : FloatingReply {
+    using Type = double;
+
+    static Type parse(const StringView &sv) {
+        return util::sv_to_double(sv);
+    }
+
+    static Type get(const gp::Message &msg, const gp::FieldDescriptor *desc) {
+        return msg.GetReflection()->GetDouble(msg, desc);
+    }
+
+    static Type get_repeated(const gp::Message &msg, const gp::FieldDescriptor *desc, int idx) {
+        return msg.GetReflection()->GetRepeatedDouble(msg, desc, idx);
+    }
+
+    static Type get_mapped(const gp::MapValueRef &val) {
+        return val.GetDoubleValue();
+    }
+
+    static void set(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->SetDouble(msg, desc, val);
+    }
+
+    static void set_repeated(gp::Message *msg, const gp::FieldDescriptor *desc, int idx, Type val) {
+        msg->GetReflection()->SetRepeatedDouble(msg, desc, idx, val);
+    }
+
+    static void set_mapped(gp::MapValueRef &val_ref, Type val) {
+        val_ref.SetDoubleValue(val);
+    }
+
+    static void add(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->AddDouble(msg, desc, val);
+    }
+};
+
+template <>
+struct CppTypeTraits<gp::FieldDescriptor::CPPTYPE_FLOAT> : FloatingReply {
+    using Type = float;
+
+    static Type parse(const StringView &sv) {
+        return util::sv_to_float(sv);
+    }
+
+    static Type get(const gp::Message &msg, const gp::FieldDescriptor *desc) {
+        return msg.GetReflection()->GetFloat(msg, desc);
+    }
+
+    static Type get_repeated(const gp::Message &msg, const gp::FieldDescriptor *desc, int idx) {
+        return msg.GetReflection()->GetRepeatedFloat(msg, desc, idx);
+    }
+
+    static Type get_mapped(const gp::MapValueRef &val) {
+        return val.GetFloatValue();
+    }
+
+    static void set(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->SetFloat(msg, desc, val);
+    }
+
+    static void set_repeated(gp::Message *msg, const gp::FieldDescriptor *desc, int idx, Type val) {
+        msg->GetReflection()->SetRepeatedFloat(msg, desc, idx, val);
+    }
+
+    static void set_mapped(gp::MapValueRef &val_ref, Type val) {
+        val_ref.SetFloatValue(val);
+    }
+
+    static void add(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->AddFloat(msg, desc, val);
+    }
+};
+
+template <>
+struct CppTypeTraits<gp::FieldDescriptor::CPPTYPE_BOOL> : IntegerReply {
+    using Type = bool;
+
+    static Type parse(const StringView &sv) {
+        return util::sv_to_bool(sv);
+    }
+
+    static Type get(const gp::Message &msg, const gp::FieldDescriptor *desc) {
+        return msg.GetReflection()->GetBool(msg, desc);
+    }
+
+    static Type get_repeated(const gp::Message &msg, const gp::FieldDescriptor *desc, int idx) {
+        return msg.GetReflection()->GetRepeatedBool(msg, desc, idx);
+    }
+
+    static Type get_mapped(const gp::MapValueRef &val) {
+        return val.GetBoolValue();
+    }
+
+    static void set(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->SetBool(msg, desc, val);
+    }
+
+    static void set_repeated(gp::Message *msg, const gp::FieldDescriptor *desc, int idx, Type val) {
+        msg->GetReflection()->SetRepeatedBool(msg, desc, idx, val);
+    }
+
+    static void set_mapped(gp::MapValueRef &val_ref, Type val) {
+        val_ref.SetBoolValue(val);
+    }
+
+    static void add(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->AddBool(msg, desc, val);
+    }
+};
+
+// Enums are accessed with their integer values.
+template <>
+struct CppTypeTraits<gp::FieldDescriptor::CPPTYPE_ENUM> : IntegerReply {
+    using Type = int;
+
+    static Type parse(const StringView &sv) {
+        return util::sv_to_int32(sv);
+    }
+
+    static Type get(const gp::Message &msg, const gp::FieldDescriptor *desc) {
+        return msg.GetReflection()->GetEnumValue(msg, desc);
+    }
+
+    static Type get_repeated(const gp::Message &msg, const gp::FieldDescriptor *desc, int idx) {
+        return msg.GetReflection()->GetRepeatedEnumValue(msg, desc, idx);
+    }
+
+    static Type get_mapped(const gp::MapValueRef &val) {
+        return val.GetEnumValue();
+    }
+
+    static void set(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->SetEnumValue(msg, desc, val);
+    }
+
+    static void set_repeated(gp::Message *msg, const gp::FieldDescriptor *desc, int idx, Type val) {
+        msg->GetReflection()->SetRepeatedEnumValue(msg, desc, idx, val);
+    }
+
+    static void set_mapped(gp::MapValueRef &val_ref, Type val) {
+        val_ref.SetEnumValue(val);
+    }
+
+    static void add(gp::Message *msg, const gp::FieldDescriptor *desc, Type val) {
+        msg->GetReflection()->AddEnumValue(msg, desc, val);
+    }
+};
+
+template <>
+struct CppTypeTraits<gp::FieldDescriptor::CPPTYPE_STRING> {
+    using Type = std::string;
+
+    static Type parse(const StringView &sv) {
+        return util::sv_to_string(sv);
+    }
+
+    static Type get(const gp::Message &msg, const gp::FieldDescriptor *desc) {
+        return msg.GetReflection()->GetString(msg, desc);
+    }
+
+    static Type get_repeated(const gp::Message &msg, const gp::FieldDescriptor *desc, int idx) {
+        return msg.GetReflection()->GetRepeatedString(msg, desc, idx);
+    }
+
+    static Type get_mapped(const gp::MapValueRef &val) {
+        return val.GetStringValue();
+    }
+
+    static void set(gp::Message *msg, const gp::FieldDescriptor *desc, const Type &val) {
+        msg->GetReflection()->SetString(msg, desc, val);
+    }
+
+    static void set_repeated(gp::Message *msg,
+            const gp::FieldDescriptor *desc,
+            int idx,
+            const Type &val) {
+        msg->GetReflection()->SetRepeatedString(msg, desc, idx, val);
+    }
+
+    static void set_mapped(gp::MapValueRef &val_ref, const Type &val) {
+        val_ref.SetStringValue(val);
+    }
+
+    static void add(gp::Message *msg, const gp::FieldDescriptor *desc, const Type &val) {
+        msg->GetReflection()->AddString(msg, desc, val);
+    }
+
+    static void reply(RedisModuleCtx *ctx, const Type &val) {
+        RedisModule_ReplyWithStringBuffer(ctx, val.data(), val.size());
+    }
+};
+
+// Call *Fn<T>::call* with the C++ type *T*, so that the runtime type is switched
+// here, and *Fn* accesses the field with CppTypeTraits<T>. *Fn* must be defined
+// for all types, including CPPTYPE_MESSAGE, which has no traits.
+template <template <gp::FieldDescriptor::CppType> class Fn, typename ...Args>
+auto dispatch(gp::FieldDescriptor::CppType type, Args &&...args)
+    -> decltype(Fn<gp::FieldDescriptor::CPPTYPE_INT32>::call(std::forward<Args>(args)...)) {
+    switch (type) {
+    case gp::FieldDescriptor::CPPTYPE_INT32:
+        return Fn<gp::FieldDescriptor::CPPTYPE_INT32>::call(std::forward<Args>(args)...);
+
+    case gp::FieldDescriptor::CPPTYPE_INT64:
+        return Fn<gp::FieldDescriptor::CPPTYPE_INT64>::call(std::forward<Args>(args)...);
+
+    case gp::FieldDescriptor::CPPTYPE_UINT32:
+        return Fn<gp::FieldDescriptor::CPPTYPE_UINT32>::call(std::forward<Args>(args)...);
+
+    case gp::FieldDescriptor::CPPTYPE_UINT64:
+        return Fn<gp::FieldDescriptor::CPPTYPE_UINT64>::call(std::forward<Args>(args)...);
+
+    case gp::FieldDescriptor::CPPTYPE_DOUBLE:
+        return Fn<gp::FieldDescriptor::CPPTYPE_DOUBLE>::call(std::forward<Args>(args)...);
+
+    case gp::FieldDescriptor::CPPTYPE_FLOAT:
+        return Fn<gp::FieldDescriptor::CPPTYPE_FLOAT>::call(std::forward<Args>(args)...);
+
+    case gp::FieldDescriptor::CPPTYPE_BOOL:
+        return Fn<gp::FieldDescriptor::CPPTYPE_BOOL>::call(std::forward<Args>(args)...);
+
+    case gp::FieldDescriptor::CPPTYPE_ENUM:
+        return Fn<gp::FieldDescriptor::CPPTYPE_ENUM>::call(std::forward<Args>(args)...);
+
+    case gp::FieldDescriptor::CPPTYPE_STRING:
+        return Fn<gp::FieldDescriptor::CPPTYPE_STRING>::call(std::forward<Args>(args)...);
+
+    case gp::FieldDescriptor::CPPTYPE_MESSAGE:
+        return Fn<gp::FieldDescriptor::CPPTYPE_MESSAGE>::call(std::forward<Args>(args)...);
+
+    default:
+        throw Error("unknown type");
+    }
+}
+
+// How a field, at which a path ends, is contained in its message.
+enum class FieldKind {
+    SCALAR = 0,
+    ARRAY_ELEMENT,
+    MAP_ELEMENT,
+    // The whole array, or a slice of it.
+    ARRAY,
+    // The whole map.
+    MAP,
+    MAX
+};
+
+// Functions specialized for a field kind and a C++ type. It's selected once,
+// when resolving a path, so that commands access the field with a single
+// indirect call, instead of switching on its type and kind.
+struct FieldAccessor {
+    FieldKind kind;
+
+    // C++ type of the field, or of the elements, if it's an array or a map.
+    gp::FieldDescriptor::CppType type;
+
+    // Parse *sv* and set it as the value of the field.
+    void (*set)(FieldRef<gp::Message> &field, const StringView &sv);
+
+    // Reply with the value of the field. Not for messages, arrays and maps,
+    // which are replied with options of the command.
+    void (*reply)(RedisModuleCtx *ctx, const FieldRef<const gp::Message> &field);
+
+    // Reply with *value* of a map or map element, which has been looked up,
+    // e.g. with ConstFieldRef::find_map_element. Not for message values.
+    void (*reply_mapped)(RedisModuleCtx *ctx, const gp::MapValueRef &value);
+
+    // Get the message, if the field is a message, an array element or
+    // a map element of message type.
+    const gp::Message& (*get_msg)(const FieldRef<const gp::Message> &field);
+};
+
+const FieldAccessor& select_accessor(FieldKind kind, gp::FieldDescriptor::CppType type);
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_FIELD_ACCESSOR_H
@@ -0,0 +1,631 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "field_index.h"
+#include <cassert>
+#include <cstring>
+#include <initializer_list>
+#include "errors.h"
+#include "redis_protobuf.h"
+#include "wire_scanner.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+// Encodings whose byte order, i.e. std::string comparison, is the order of values.
+
+std::string encode_uint(uint64_t val);
+
+std::string encode_int(int64_t val);
+
+std::string encode_double(double val);
+
+// Encode a value of the C++ type of a field.
+std::string encode_value(int32_t val);
+std::string encode_value(int64_t val);
+std::string encode_value(uint32_t val);
+std::string encode_value(uint64_t val);
+std::string encode_value(double val);
+std::string encode_value(float val);
+std::string encode_value(bool val);
+std::string encode_value(const std::string &val);
+
+// Encode a singular field of C++ type *T*.
+template <gp::FieldDescriptor::CppType T>
+struct EncodeField {
+    static std::string call(const ConstFieldRef &field) {
+        return encode_value(field.get<T>());
+    }
+};
+
+template <>
+struct EncodeField<gp::FieldDescriptor::CPPTYPE_MESSAGE> {
+    static std::string call(const ConstFieldRef &) {
+        throw Error("not a scalar field");
+    }
+};
+
+std::string encode_field(const ConstFieldRef &field);
+
+std::string encode_wire_field(const gp::FieldDescriptor &desc, const WireField &field);
+
+bool is_pb_key(RedisModuleKey *key);
+
+void index_key(RedisModuleCtx *ctx, RedisModuleString *key_name, RedisModuleKey *key, void *privdata);
+
+// Keyspace events of non-PB commands, after which the key no longer exists.
+bool is_removed_key_event(const char *event);
+
+// Keyspace events of non-PB commands, after which the key might be created
+// or replaced with another value.
+bool is_new_key_event(const char *event);
+
+struct ScanCursorDeleter {
+    void operator()(RedisModuleScanCursor *cursor) const {
+        RedisModule_ScanCursorDestroy(cursor);
+    }
+};
+
+using ScanCursorUPtr = std::unique_ptr<RedisModuleScanCursor, ScanCursorDeleter>;
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+std::string encode_field_value(const gp::FieldDescriptor &desc, const StringView &val) {
+    switch (desc.cpp_type()) {
+    case gp::FieldDescriptor::CPPTYPE_INT32:
+        return encode_int(util::sv_to_int32(val));
+
+    case gp::FieldDescriptor::CPPTYPE_INT64:
+        return encode_int(util::sv_to_int64(val));
+
+    case gp::FieldDescriptor::CPPTYPE_UINT32:
+        return encode_uint(util::sv_to_uint32(val));
+
+    case gp::FieldDescriptor::CPPTYPE_UINT64:
+        return encode_uint(util::sv_to_uint64(val));
+
+    case gp::FieldDescriptor::CPPTYPE_DOUBLE:
+        return encode_double(util::sv_to_double(val));
+
+    case gp::FieldDescriptor::CPPTYPE_FLOAT:
+        return encode_double(util::sv_to_float(val));
+
+    case gp::FieldDescriptor::CPPTYPE_BOOL:
+        return encode_uint(util::sv_to_bool(val));
+
+    case gp::FieldDescriptor::CPPTYPE_ENUM: {
+        // Either the name or the number of the enum value.
+        const auto *enum_val = desc.enum_type()->FindValueByName(util::sv_to_string(val));
+        if (enum_val != nullptr) {
+            return encode_int(enum_val->number());
+        }
+
+        return encode_int(util::sv_to_int32(val));
+    }
+
+    case gp::FieldDescriptor::CPPTYPE_STRING:
+        return util::sv_to_string(val);
+
+    default:
+        throw Error("not a scalar field");
+    }
+}
+
+bool encode_field_value(const ProtoValue &value, const Path &path, std::string &val) {
+    try {
+        auto fields = path.resolve(*value.descriptor());
+        assert(!fields->empty());
+
+        const auto &desc = *(fields->back().desc);
+        if (desc.is_repeated() || desc.cpp_type() == gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+            return false;
+        }
+
+        if (!value.parsed() && WireScanner::scannable(*fields)) {
+            // Do not parse a lazy value, only to get a field.
+            val = encode_wire_field(desc, WireScanner(*fields).scan(value.wire()));
+        } else {
+            val = encode_field(ConstFieldRef(&(value.msg()), path));
+        }
+    } catch (const Error &) {
+        // The field doesn't exist, e.g. array index is out of range.
+        return false;
+    }
+
+    return true;
+}
+
+FieldIndex::FieldIndex(std::string name,
+                        std::string path_str,
+                        const Path &path,
+                        Kind kind,
+                        int db) :
+                            _name(std::move(name)),
+                            _path_str(std::move(path_str)),
+                            _path(path),
+                            _kind(kind),
+                            _db(db) {}
+
+void FieldIndex::update(const std::string &key, const ProtoValue &value) {
+    std::string val;
+    if (value.descriptor()->full_name() != type() || !encode_field_value(value, _path, val)) {
+        remove(key);
+        return;
+    }
+
+    auto iter = _entries.find(key);
+    if (iter != _entries.end()) {
+        if (iter->second == val) {
+            return;
+        }
+
+        _erase(key, iter->second);
+        iter->second = val;
+    } else {
+        _entries.emplace(key, val);
+    }
+
+    _insert(key, val);
+}
+
+void FieldIndex::remove(const std::string &key) {
+    auto iter = _entries.find(key);
+    if (iter == _entries.end()) {
+        return;
+    }
+
+    _erase(key, iter->second);
+    _entries.erase(iter);
+}
+
+void FieldIndex::clear() {
+    _entries.clear();
+    _hash.clear();
+    _ordered.clear();
+}
+
+const std::string* FieldIndex::get(const std::string &key) const {
+    auto iter = _entries.find(key);
+    if (iter == _entries.end()) {
+        return nullptr;
+    }
+
+    return &(iter->second);
+}
+
+std::string FieldIndex::encode(const gp::Descriptor &desc, const StringView &val) const {
+    auto fields = _path.resolve(desc);
+    assert(!fields->empty());
+
+    return encode_field_value(*(fields->back().desc), val);
+}
+
+std::vector<std::string> FieldIndex::equal(const std::string &val, std::size_t limit) const {
+    std::vector<std::string> keys;
+
+    if (_kind == Kind::HASH) {
+        auto iter = _hash.find(val);
+        if (iter == _hash.end()) {
+            return keys;
+        }
+
+        for (const auto &key : iter->second) {
+            if (keys.size() >= limit) {
+                break;
+            }
+
+            keys.push_back(key);
+        }
+    } else {
+        for (auto iter = _ordered.lower_bound(std::make_pair(val, std::string()));
+                iter != _ordered.end() && iter->first == val && keys.size() < limit;
+                ++iter) {
+            keys.push_back(iter->second);
+        }
+    }
+
+    return keys;
+}
+
+std::vector<std::string> FieldIndex::range(const std::string *min,
+        const std::string *max,
+        std::size_t limit) const {
+    if (_kind != Kind::ORDERED) {
+        throw Error("not an ordered index");
+    }
+
+    auto iter = _ordered.begin();
+    if (min != nullptr) {
+        iter = _ordered.lower_bound(std::make_pair(*min, std::string()));
+    }
+
+    std::vector<std::string> keys;
+    for (; iter != _ordered.end() && keys.size() < limit; ++iter) {
+        if (max != nullptr && iter->first > *max) {
+            break;
+        }
+
+        keys.push_back(iter->second);
+    }
+
+    return keys;
+}
+
+void FieldIndex::_insert(const std::string &key, const std::string &val) {
+    if (_kind == Kind::HASH) {
+        _hash[val].insert(key);
+    } else {
+        _ordered.emplace(val, key);
+    }
+}
+
+void FieldIndex::_erase(const std::string &key, const std::string &val) {
+    if (_kind == Kind::HASH) {
+        auto iter = _hash.find(val);
+        if (iter == _hash.end()) {
+            return;
+        }
+
+        iter->second.erase(key);
+        if (iter->second.empty()) {
+            _hash.erase(iter);
+        }
+    } else {
+        _ordered.erase(std::make_pair(val, key));
+    }
+}
+
+FieldIndex& IndexManager::create(RedisModuleCtx *ctx,
+        const std::string &name,
+        const StringView &path_str,
+        FieldIndex::Kind kind) {
+    if (_indexes.find(name) != _indexes.end()) {
+        throw Error("index already exists");
+    }
+
+    if (RedisModule_Scan == nullptr) {
+        throw Error("index requires Redis 6.0 or later");
+    }
+
+    Path path(path_str);
+    if (path.empty()) {
+        throw Error("path must specify a field");
+    }
+
+    const auto *desc = RedisProtobuf::instance().proto_factory()->descriptor(path.type());
+    if (desc == nullptr) {
+        throw Error("unknown protobuf type: " + path.type());
+    }
+
+    auto fields = path.resolve(*desc);
+    assert(!fields->empty());
+
+    const auto &field_desc = *(fields->back().desc);
+    if (field_desc.is_repeated() || field_desc.cpp_type() == gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+        throw Error("can only index a singular scalar field");
+    }
+
+    FieldIndexUPtr index(new FieldIndex(name,
+                util::sv_to_string(path_str),
+                path,
+                kind,
+                RedisModule_GetSelectedDb(ctx)));
+
+    _build(ctx, *index);
+
+    auto &ref = *index;
+    _indexes.emplace(name, std::move(index));
+
+    return ref;
+}
+
+bool IndexManager::drop(const std::string &name) {
+    return _indexes.erase(name) > 0;
+}
+
+FieldIndex* IndexManager::find(const std::string &name) {
+    auto iter = _indexes.find(name);
+    if (iter == _indexes.end()) {
+        return nullptr;
+    }
+
+    return iter->second.get();
+}
+
+void IndexManager::update(RedisModuleCtx *ctx,
+        RedisModuleString *key_name,
+        const ProtoValue &value) {
+    if (_indexes.empty()) {
+        return;
+    }
+
+    auto db = RedisModule_GetSelectedDb(ctx);
+    auto key = util::sv_to_string(StringView(key_name));
+    for (auto &ele : _indexes) {
+        auto &index = *(ele.second);
+        if (index.db() == db) {
+            // If *value* is of another type, *key* is removed from the index,
+            // since it might be overwritten by a message of another type.
+            index.update(key, value);
+        }
+    }
+}
+
+void IndexManager::remove(RedisModuleCtx *ctx, RedisModuleString *key_name) {
+    if (_indexes.empty()) {
+        return;
+    }
+
+    auto db = RedisModule_GetSelectedDb(ctx);
+    auto key = util::sv_to_string(StringView(key_name));
+    for (auto &ele : _indexes) {
+        auto &index = *(ele.second);
+        if (index.db() == db) {
+            index.remove(key);
+        }
+    }
+}
+
+void IndexManager::refresh(RedisModuleCtx *ctx, FieldIndex &index, const std::string &key) {
+    assert(RedisModule_GetSelectedDb(ctx) == index.db());
+
+    auto *key_name = RedisModule_CreateString(ctx, key.data(), key.size());
+    assert(key_name != nullptr);
+
+    // Opening the key also expires it, if it has timed out.
+    auto redis_key = api::open_key(ctx, key_name, api::KeyMode::READONLY);
+    if (is_pb_key(redis_key.get())) {
+        index.update(key, *api::get_value_by_key(redis_key.get()));
+    } else {
+        index.remove(key);
+    }
+
+    redis_key.reset();
+
+    RedisModule_FreeString(ctx, key_name);
+}
+
+void IndexManager::on_keyspace_event(RedisModuleCtx *ctx,
+        const char *event,
+        RedisModuleString *key_name) {
+    assert(event != nullptr);
+
+    if (_indexes.empty()) {
+        return;
+    }
+
+    if (is_removed_key_event(event)) {
+        // Do not open the key, since an expired key is notified before it's deleted.
+        remove(ctx, key_name);
+    } else if (is_new_key_event(event)) {
+        auto redis_key = api::open_key(ctx, key_name, api::KeyMode::READONLY);
+        if (is_pb_key(redis_key.get())) {
+            update(ctx, key_name, *api::get_value_by_key(redis_key.get()));
+        } else {
+            remove(ctx, key_name);
+        }
+    }
+    // Other events, e.g. events of PB commands, which have updated indexes,
+    // and EXPIRE, which doesn't modify the value, are ignored.
+}
+
+void IndexManager::on_flush(int db) {
+    for (auto &ele : _indexes) {
+        auto &index = *(ele.second);
+        if (db == -1 || index.db() == db) {
+            index.clear();
+        }
+    }
+}
+
+void IndexManager::on_swap_db(int first, int second) {
+    for (auto &ele : _indexes) {
+        auto &index = *(ele.second);
+        if (index.db() == first) {
+            index.set_db(second);
+        } else if (index.db() == second) {
+            index.set_db(first);
+        }
+    }
+}
+
+void IndexManager::rebuild(RedisModuleCtx *ctx) {
+    if (_indexes.empty()) {
+        return;
+    }
+
+    auto db = RedisModule_GetSelectedDb(ctx);
+
+    for (auto &ele : _indexes) {
+        auto &index = *(ele.second);
+        index.clear();
+
+        if (RedisModule_SelectDb(ctx, index.db()) != REDISMODULE_OK) {
+            continue;
+        }
+
+        _build(ctx, index);
+    }
+
+    RedisModule_SelectDb(ctx, db);
+}
+
+void IndexManager::_build(RedisModuleCtx *ctx, FieldIndex &index) {
+    assert(RedisModule_GetSelectedDb(ctx) == index.db());
+
+    ScanCursorUPtr cursor(RedisModule_ScanCursorCreate());
+    while (RedisModule_Scan(ctx, cursor.get(), index_key, &index)) {}
+}
+
+}
+
+}
+
+}
+
+namespace {
+
+std::string encode_uint(uint64_t val) {
+    // Big endian.
+    std::string str(sizeof(val), '\0');
+    for (auto idx = sizeof(val); idx > 0; --idx) {
+        str[idx - 1] = static_cast<char>(val & 0xFF);
+        val >>= 8;
+    }
+
+    return str;
+}
+
+std::string encode_int(int64_t val) {
+    // Flip the sign bit, so that negative numbers are ordered before positive ones.
+    return encode_uint(static_cast<uint64_t>(val) ^ (1ULL << 63));
+}
+
+std::string encode_double(double val) {
+    if (val == 0) {
+        // Normalize -0.0 to 0.0.
+        val = 0;
+    }
+
+    uint64_t bits = 0;
+    std::memcpy(&bits, &val, sizeof(bits));
+
+    // Flip all bits of negative numbers, and the sign bit of positive ones.
+    const auto sign = 1ULL << 63;
+    bits = (bits & sign) ? ~bits : (bits | sign);
+
+    return encode_uint(bits);
+}
+
+std::string encode_value(int32_t val) {
+    return encode_int(val);
+}
+
+std::string encode_value(int64_t val) {
+    return encode_int(val);
+}
+
+std::string encode_value(uint32_t val) {
+    return encode_uint(val);
+}
+
+std::string encode_value(uint64_t val) {
+    return encode_uint(val);
+}
+
+std::string encode_value(double val) {
+    return encode_double(val);
+}
+
+std::string encode_value(float val) {
+    return encode_double(val);
+}
+
+std::string encode_value(bool val) {
+    return encode_uint(val);
+}
+
+std::string encode_value(const std::string &val) {
+    return val;
+}
+
+std::string encode_field(const ConstFieldRef &field) {
+    return dispatch<EncodeField>(field.type(), field);
+}
+
+std::string encode_wire_field(const gp::FieldDescriptor &desc, const WireField &field) {
+    switch (desc.cpp_type()) {
+    case gp::FieldDescriptor::CPPTYPE_INT32:
+    case gp::FieldDescriptor::CPPTYPE_INT64:
+    case gp::FieldDescriptor::CPPTYPE_ENUM:
+        return encode_int(field.int_val);
+
+    case gp::FieldDescriptor::CPPTYPE_UINT32:
+    case gp::FieldDescriptor::CPPTYPE_UINT64:
+        return encode_uint(field.uint_val);
+
+    case gp::FieldDescriptor::CPPTYPE_DOUBLE:
+        return encode_double(field.double_val);
+
+    case gp::FieldDescriptor::CPPTYPE_FLOAT:
+        return encode_double(field.float_val);
+
+    case gp::FieldDescriptor::CPPTYPE_BOOL:
+        return encode_uint(field.int_val != 0);
+
+    case gp::FieldDescriptor::CPPTYPE_STRING:
+        return field.bytes;
+
+    default:
+        throw Error("not a scalar field");
+    }
+}
+
+bool is_pb_key(RedisModuleKey *key) {
+    // key can be nullptr.
+    return RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_MODULE
+        && RedisModule_ModuleTypeGetType(key) == RedisProtobuf::instance().type();
+}
+
+void index_key(RedisModuleCtx *ctx, RedisModuleString *key_name, RedisModuleKey *key, void *privdata) {
+    auto &index = *static_cast<FieldIndex *>(privdata);
+
+    try {
+        // Redis might not open the key for us.
+        api::RedisKey redis_key;
+        if (key == nullptr) {
+            redis_key = api::open_key(ctx, key_name, api::KeyMode::READONLY);
+            key = redis_key.get();
+        }
+
+        if (!is_pb_key(key)) {
+            return;
+        }
+
+        index.update(util::sv_to_string(StringView(key_name)), *api::get_value_by_key(key));
+    } catch (const Error &) {
+        // Do not throw through Redis. The key is not indexed.
+    }
+}
+
+bool is_removed_key_event(const char *event) {
+    for (const auto *name : {"del", "expired", "evicted", "rename_from", "move_from"}) {
+        if (std::strcmp(event, name) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool is_new_key_event(const char *event) {
+    for (const auto *name : {"rename_to", "restore", "move_to", "copy_to"}) {
+        if (std::strcmp(event, name) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}
@@ -0,0 +1,218 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_FIELD_INDEX_H
+#define SEWENEW_REDISPROTOBUF_FIELD_INDEX_H
+
+#include "module_api.h"
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "utils.h"
+#include "field_ref.h"
+#include "proto_value.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// Encode values of scalar fields into strings, whose byte order, i.e. std::string
+// comparison, is the order of the values. Strings are encoded as they are.
+
+// Encode *val*, which is parsed with the type of the scalar field *desc*.
+// Throw Error, if *val* is not of the field's type.
+std::string encode_field_value(const gp::FieldDescriptor &desc, const StringView &val);
+
+// Encode the field at *path* of *value*. Return false, if the field cannot be
+// got, or it's not a singular scalar field. A lazy value is not parsed, if
+// the field can be scanned from the serialized message.
+bool encode_field_value(const ProtoValue &value, const Path &path, std::string &val);
+
+// Secondary index on a singular scalar field of a message type, which maps
+// field values to key names. Field values are encoded into strings, whose
+// byte order is the order of the values, so that both kinds of index share
+// the same encoding.
+class FieldIndex {
+public:
+    enum class Kind {
+        HASH = 0,
+        ORDERED
+    };
+
+    // *path* is the indexed field, e.g. Msg.user_id, and *db* is the
+    // database of the indexed keys.
+    FieldIndex(std::string name, std::string path_str, const Path &path, Kind kind, int db);
+
+    FieldIndex(const FieldIndex &) = delete;
+    FieldIndex& operator=(const FieldIndex &) = delete;
+
+    FieldIndex(FieldIndex &&) = delete;
+    FieldIndex& operator=(FieldIndex &&) = delete;
+
+    ~FieldIndex() = default;
+
+    const std::string& name() const {
+        return _name;
+    }
+
+    // Original string of the path.
+    const std::string& path_str() const {
+        return _path_str;
+    }
+
+    const std::string& type() const {
+        return _path.type();
+    }
+
+    Kind kind() const {
+        return _kind;
+    }
+
+    int db() const {
+        return _db;
+    }
+
+    // Move the index to *db*, since databases have been swapped with SWAPDB.
+    void set_db(int db) {
+        _db = db;
+    }
+
+    // Number of indexed keys.
+    std::size_t size() const {
+        return _entries.size();
+    }
+
+    // Index *key* with its *value*. If *value* is not of the indexed type,
+    // or the field cannot be got, *key* is removed from the index.
+    void update(const std::string &key, const ProtoValue &value);
+
+    void remove(const std::string &key);
+
+    // Remove all keys from the index.
+    void clear();
+
+    // Encoded field value of *key*, or nullptr if *key* is not indexed.
+    const std::string* get(const std::string &key) const;
+
+    // Encode *val*, which is parsed with the type of the indexed field of *desc*.
+    std::string encode(const gp::Descriptor &desc, const StringView &val) const;
+
+    // Keys whose encoded field value equals to *val*.
+    std::vector<std::string> equal(const std::string &val, std::size_t limit) const;
+
+    // Keys whose encoded field value is in [min, max], ordered by the value.
+    // If *min* or *max* is null, that end is unbounded. Only ORDERED index
+    // supports it.
+    std::vector<std::string> range(const std::string *min,
+            const std::string *max,
+            std::size_t limit) const;
+
+private:
+    void _insert(const std::string &key, const std::string &val);
+
+    void _erase(const std::string &key, const std::string &val);
+
+    std::string _name;
+
+    std::string _path_str;
+
+    Path _path;
+
+    Kind _kind;
+
+    int _db;
+
+    // Key name -> encoded field value.
+    std::unordered_map<std::string, std::string> _entries;
+
+    // Encoded field value -> key names, only used by HASH index.
+    std::unordered_map<std::string, std::unordered_set<std::string>> _hash;
+
+    // (encoded field value, key name), only used by ORDERED index.
+    std::set<std::pair<std::string, std::string>> _ordered;
+};
+
+using FieldIndexUPtr = std::unique_ptr<FieldIndex>;
+
+// All indexes of the module. Indexes are kept in memory, and maintained by
+// PB commands, keyspace events and server events, i.e. they're neither saved
+// to RDB nor propagated to replicas.
+// Only modified in the main thread.
+class IndexManager {
+public:
+    // Create an index, and index existing keys of the current database
+    // with SCAN. Throw Error, if the index exists, or the path is invalid.
+    FieldIndex& create(RedisModuleCtx *ctx,
+            const std::string &name,
+            const StringView &path,
+            FieldIndex::Kind kind);
+
+    // Return false, if the index doesn't exist.
+    bool drop(const std::string &name);
+
+    // Return nullptr, if the index doesn't exist.
+    FieldIndex* find(const std::string &name);
+
+    const std::unordered_map<std::string, FieldIndexUPtr>& indexes() const {
+        return _indexes;
+    }
+
+    // Should be called after a PB command sets *key_name* to *value*.
+    void update(RedisModuleCtx *ctx, RedisModuleString *key_name, const ProtoValue &value);
+
+    // Should be called after a PB command deletes *key_name*.
+    void remove(RedisModuleCtx *ctx, RedisModuleString *key_name);
+
+    // Re-index *key* with its current value, since it might have been modified,
+    // expired or deleted by other commands, e.g. DEL, EXPIRE, RENAME.
+    void refresh(RedisModuleCtx *ctx, FieldIndex &index, const std::string &key);
+
+    // Should be called when *key_name* is deleted, created or replaced by
+    // a non-PB command, e.g. DEL, RENAME, RESTORE, or it's expired or evicted.
+    // *event* is the name of the keyspace event.
+    void on_keyspace_event(RedisModuleCtx *ctx, const char *event, RedisModuleString *key_name);
+
+    // Remove all keys of *db* from indexes, since the database has been
+    // flushed. If *db* is -1, all databases have been flushed.
+    void on_flush(int db);
+
+    void on_swap_db(int first, int second);
+
+    // Index all keys again, since the dataset has been loaded from RDB or AOF,
+    // e.g. after restart or a full sync with the master.
+    void rebuild(RedisModuleCtx *ctx);
+
+private:
+    // Index existing keys of the database of *index*. It blocks Redis until
+    // all keys are scanned.
+    void _build(RedisModuleCtx *ctx, FieldIndex &index);
+
+    std::unordered_map<std::string, FieldIndexUPtr> _indexes;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_FIELD_INDEX_H
@@ -17,6 +17,15 @@
 #include "field_ref.h"
 #include <google/protobuf/util/json_util.h>
 #include "redis_protobuf.h"
+#include "path_cache.h"
+#include "metrics.h"
+
+namespace {
+
+// Max number of descriptors, with which a path keeps its resolved fields.
+const std::size_t MAX_RESOLVED_DESCRIPTORS = 4;
+
+}
 
 namespace sw {
 
@@ -25,18 +34,102 @@ namespace redis {
 namespace pb {
 
 Path::Path(const StringView &str) {
+    auto *cache = RedisProtobuf::instance().path_cache();
+    if (cache != nullptr && cache->get(str, *this)) {
+        return;
+    }
+
+    _parse(str);
+
+    if (cache != nullptr) {
+        cache->put(str, *this);
+    }
+}
+
+PathFieldsPtr Path::resolve(const gp::Descriptor &desc) const {
+    assert(_impl);
+
+    auto &resolved = _impl->resolved_fields;
+    for (const auto &entry : resolved) {
+        if (entry.first == &desc) {
+            return entry.second;
+        }
+    }
+
+    auto fields = std::make_shared<std::vector<PathField>>();
+    fields->reserve(_impl->fields.size());
+
+    const auto *msg_desc = &desc;
+    for (const auto &field : _impl->fields) {
+        if (!fields->empty()) {
+            msg_desc = _sub_msg_desc(fields->back());
+        }
+
+        fields->push_back(_resolve_field(*msg_desc, field));
+    }
+
+    if (!fields->empty()) {
+        // Only the last field is accessed, and others are sub-messages.
+        auto &field = fields->back();
+        field.accessor = &_select_accessor(field);
+    }
+
+    // Descriptors of old generations are rarely used, so keep only a few of them.
+    if (resolved.size() >= MAX_RESOLVED_DESCRIPTORS) {
+        resolved.erase(resolved.begin());
+    }
+
+    resolved.emplace_back(&desc, fields);
+
+    return fields;
+}
+
+Path Path::prefix(std::size_t len) const {
+    assert(_impl && len <= _impl->fields.size());
+
+    auto impl = std::make_shared<Impl>();
+    impl->type = _impl->type;
+    impl->fields.assign(_impl->fields.begin(), _impl->fields.begin() + len);
+
+    Path path;
+    path._impl = std::move(impl);
+
+    return path;
+}
+
+Path Path::child(std::string field) const {
+    assert(_impl && !field.empty());
+
+    auto impl = std::make_shared<Impl>();
+    impl->type = _impl->type;
+    impl->fields = _impl->fields;
+    impl->fields.push_back(std::move(field));
+
+    Path path;
+    path._impl = std::move(impl);
+
+    return path;
+}
+
+void Path::_parse(const StringView &str) {
+    LatencyTimer timer(Phase::PARSE);
+
     const auto *ptr = str.data();
     assert(ptr != nullptr);
 
     auto len = str.size();
 
+    auto impl = std::make_shared<Impl>();
+
     std::size_t type_len = 0;
-    std::tie(_type, type_len) = _parse_type(ptr, len);
+    std::tie(impl->type, type_len) = _parse_type(ptr, len);
 
     if (type_len < len) {
         // Has fields.
-        _fields = _parse_fields(ptr + type_len, len - type_len);
+        impl->fields = _parse_fields(ptr + type_len, len - type_len);
     }
+
+    _impl = std::move(impl);
 }
 
 std::pair<std::string, std::size_t> Path::_parse_type(const char *ptr, std::size_t len) {
@@ -94,6 +187,179 @@ std::vector<std::string> Path::_parse_fields(const char *ptr, std::size_t len) {
     return fields;
 }
 
+const gp::Descriptor* Path::_sub_msg_desc(const PathField &field) const {
+    const auto *field_desc = field.desc;
+    assert(field_desc != nullptr);
+
+    if (field_desc->cpp_type() != gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+        throw Error("invalid path");
+    }
+
+    if (field_desc->is_map()) {
+        if (!field.map_key) {
+            throw Error("invalid path");
+        }
+
+        const auto *val_desc = field_desc->message_type()->FindFieldByName("value");
+        assert(val_desc != nullptr);
+
+        if (val_desc->cpp_type() != gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+            throw Error("map value is not of message type");
+        }
+
+        return val_desc->message_type();
+    } else if (field_desc->is_repeated()) {
+        if (field.arr_idx < 0) {
+            throw Error("invalid path");
+        }
+    }
+
+    return field_desc->message_type();
+}
+
+const FieldAccessor& Path::_select_accessor(const PathField &field) const {
+    const auto *field_desc = field.desc;
+    assert(field_desc != nullptr);
+
+    if (field_desc->is_map()) {
+        const auto *val_desc = field_desc->message_type()->FindFieldByName("value");
+        assert(val_desc != nullptr);
+
+        auto kind = field.map_key ? FieldKind::MAP_ELEMENT : FieldKind::MAP;
+
+        return select_accessor(kind, val_desc->cpp_type());
+    }
+
+    auto kind = FieldKind::SCALAR;
+    if (field_desc->is_repeated()) {
+        kind = field.arr_idx >= 0 ? FieldKind::ARRAY_ELEMENT : FieldKind::ARRAY;
+    }
+
+    return select_accessor(kind, field_desc->cpp_type());
+}
+
+PathField Path::_resolve_field(const gp::Descriptor &desc, const std::string &field) const {
+    assert(!field.empty());
+
+    PathField resolved_field;
+
+    if (field.back() != ']') {
+        resolved_field.desc = desc.FindFieldByName(field);
+        if (resolved_field.desc == nullptr) {
+            throw Error("field not found: " + field);
+        }
+
+        return resolved_field;
+    }
+
+    // It's an array or a map.
+    auto pos = field.find('[');
+    if (pos == std::string::npos) {
+        throw Error("invalid array or map");
+    }
+
+    auto name = field.substr(0, pos);
+    auto key = field.substr(pos + 1, field.size() - pos - 2);
+
+    resolved_field.desc = desc.FindFieldByName(name);
+    if (resolved_field.desc == nullptr) {
+        throw Error("invalid field: " + name);
+    }
+
+    if (resolved_field.desc->is_map()) {
+        resolved_field.map_key = _parse_map_key(*resolved_field.desc, key);
+    } else if (resolved_field.desc->is_repeated()) {
+        auto colon = key.find(':');
+        if (colon != std::string::npos) {
+            _parse_array_range(key, colon, resolved_field);
+        } else {
+            try {
+                resolved_field.arr_idx = util::sv_to_int32(key);
+            } catch (const Error &e) {
+                throw Error("invalid array index: " + key);
+            }
+
+            if (resolved_field.arr_idx < 0) {
+                throw Error("invalid array index: " + key);
+            }
+        }
+    } else {
+        throw Error("not an array or map");
+    }
+
+    resolved_field.key = std::move(key);
+
+    return resolved_field;
+}
+
+void Path::_parse_array_range(const std::string &key,
+        std::size_t colon,
+        PathField &field) const {
+    assert(colon < key.size() && key[colon] == ':');
+
+    field.is_range = true;
+
+    try {
+        if (colon > 0) {
+            field.range_begin = util::sv_to_int32(StringView(key.data(), colon));
+        }
+
+        if (colon + 1 < key.size()) {
+            field.range_end = util::sv_to_int32(StringView(key.data() + colon + 1,
+                        key.size() - colon - 1));
+        }
+    } catch (const Error &e) {
+        throw Error("invalid array range: " + key);
+    }
+}
+
+Optional<gp::MapKey> Path::_parse_map_key(const gp::FieldDescriptor &field_desc,
+        const std::string &key) const {
+    return Optional<gp::MapKey>(parse_map_key(field_desc, key));
+}
+
+gp::MapKey parse_map_key(const gp::FieldDescriptor &field_desc, const std::string &key) {
+    assert(field_desc.is_map());
+
+    auto *desc = field_desc.message_type();
+    assert(desc != nullptr);
+
+    auto *key_desc = desc->FindFieldByName("key");
+    assert(key_desc != nullptr);
+
+    gp::MapKey map_key;
+    switch (key_desc->cpp_type()) {
+    case gp::FieldDescriptor::CPPTYPE_INT32:
+        map_key.SetInt32Value(util::sv_to_int32(key));
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_INT64:
+        map_key.SetInt64Value(util::sv_to_int64(key));
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_UINT32:
+        map_key.SetUInt32Value(util::sv_to_uint32(key));
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_UINT64:
+        map_key.SetUInt64Value(util::sv_to_uint64(key));
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_BOOL:
+        map_key.SetBoolValue(util::sv_to_bool(key));
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_STRING:
+        map_key.SetStringValue(key);
+        break;
+
+    default:
+        throw Error("invalid map key type");
+    }
+
+    return map_key;
+}
+
 }
 
 }
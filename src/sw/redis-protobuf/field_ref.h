@@ -18,14 +18,18 @@
 #define SEWENEW_REDISPROTOBUF_FIELD_REF_H
 
 #include <cassert>
+#include <limits>
 #include <string>
 #include <type_traits>
 #include <vector>
+#include <memory>
 #include <google/protobuf/message.h>
 #include <google/protobuf/map_field.h>
 #include <google/protobuf/map.h>
 #include "module_api.h"
 #include "utils.h"
+#include "metrics.h"
+#include "field_accessor.h"
 
 namespace sw {
 
@@ -35,6 +39,42 @@ namespace pb {
 
 namespace gp = google::protobuf;
 
+// A field of a path, which has been resolved with the descriptor of the message.
+struct PathField {
+    PathField() {
+        // gp::MapKey cannot be copied without a valid type.
+        map_key->SetBoolValue(false);
+    }
+
+    const gp::FieldDescriptor *desc = nullptr;
+
+    // Index of the array element, or -1 if it's not an array element.
+    int arr_idx = -1;
+
+    // If *is_range* is true, it's a slice of the array, i.e. arr[begin:end],
+    // which consists of elements in [range_begin, range_end). Negative index
+    // counts from the end of the array, and both ends are clamped to the array.
+    bool is_range = false;
+    int range_begin = 0;
+    int range_end = std::numeric_limits<int>::max();
+
+    // Key of the map element, if it's a map element.
+    Optional<gp::MapKey> map_key;
+
+    // Original string of the array index or map key.
+    std::string key;
+
+    // Accessor selected with the kind and type of the field.
+    const FieldAccessor *accessor = nullptr;
+};
+
+// Resolved fields are shared by copies of a path, and by those who are still
+// using them, e.g. a WireScanner, even if they're dropped from the path.
+using PathFieldsPtr = std::shared_ptr<const std::vector<PathField>>;
+
+// Parse *key* as a key of the map field, e.g. an integer for map<int32, string>.
+gp::MapKey parse_map_key(const gp::FieldDescriptor &field_desc, const std::string &key);
+
 class Path {
 public:
     explicit Path(const StringView &str);
@@ -50,25 +90,67 @@ public:
     ~Path() = default;
 
     const std::string& type() const {
-        return _type;
+        assert(_impl);
+
+        return _impl->type;
     }
 
-    const std::vector<std::string> fields() const {
-        return _fields;
+    const std::vector<std::string>& fields() const {
+        assert(_impl);
+
+        return _impl->fields;
     }
 
     bool empty() const {
-        return _fields.empty();
+        assert(_impl);
+
+        return _impl->fields.empty();
     }
 
+    // Resolve fields with the descriptor of the root message. The result is kept
+    // with the path for each descriptor, so that resolving it again with the same
+    // descriptor is a lookup. Keep the returned pointer as long as fields are used.
+    PathFieldsPtr resolve(const gp::Descriptor &desc) const;
+
+    // Path of the first *len* fields, e.g. Msg.a.b of Msg.a.b.c.
+    Path prefix(std::size_t len) const;
+
+    // Path of *field* of the message at this path, e.g. Msg.a.b of Msg.a and b,
+    // or Msg.a.m[key] of Msg.a and m[key]. *field* is not split by dots.
+    Path child(std::string field) const;
+
 private:
+    struct Impl {
+        std::string type;
+
+        std::vector<std::string> fields;
+
+        // Fields resolved with each descriptor, i.e. a small map from descriptor
+        // to fields. The path might be shared between copies, e.g. those in the
+        // path cache, and used with messages of different generations of schemas.
+        std::vector<std::pair<const gp::Descriptor *, PathFieldsPtr>> resolved_fields;
+    };
+
+    void _parse(const StringView &str);
+
     std::pair<std::string, std::size_t> _parse_type(const char *ptr, std::size_t len);
 
     std::vector<std::string> _parse_fields(const char *ptr, std::size_t len);
 
-    std::string _type;
+    const gp::Descriptor* _sub_msg_desc(const PathField &field) const;
+
+    const FieldAccessor& _select_accessor(const PathField &field) const;
+
+    PathField _resolve_field(const gp::Descriptor &desc, const std::string &field) const;
 
-    std::vector<std::string> _fields;
+    // Parse array range, e.g. 1:3, 2:, :-1. *colon* is the position of ':' in *key*.
+    void _parse_array_range(const std::string &key, std::size_t colon, PathField &field) const;
+
+    Optional<gp::MapKey> _parse_map_key(const gp::FieldDescriptor &field_desc,
+            const std::string &key) const;
+
+    // Shared between copies, so that copying a cached path is cheap.
+    std::shared_ptr<Impl> _impl;
 };
 
 template <typename Msg>
@@ -93,6 +175,12 @@ public:
 
     std::string mapped_msg_type() const;
 
+    // Descriptors of the message types above. Prefer them to look up by names,
+    // since the message might be of an old generation of schemas.
+    const gp::Descriptor& msg_descriptor() const;
+
+    const gp::Descriptor& mapped_msg_descriptor() const;
+
     bool is_array() const {
         return _field_desc != nullptr && _field_desc->is_repeated();
     }
@@ -101,6 +189,17 @@ public:
         return _arr_idx >= 0;
     }
 
+    // A slice of the array, and it behaves like an array of *size()* elements.
+    bool is_array_range() const {
+        return _range_end >= 0;
+    }
+
+    // Index of the first element of the slice in the underlying array,
+    // or 0 if it's not a slice.
+    int range_begin() const {
+        return _range_begin;
+    }
+
     bool is_map() const {
         return _field_desc != nullptr && _field_desc->is_map();
     }
@@ -109,141 +208,136 @@ public:
         return bool(_map_key);
     }
 
+    // Accessor of the field, which has been selected with its kind and type,
+    // when resolving the path.
+    const FieldAccessor& accessor() const {
+        if (_accessor == nullptr) {
+            throw Error("invalid path");
+        }
+
+        return *_accessor;
+    }
+
     int size() const;
 
     FieldRef get_array_element(int idx) const;
 
+    // Get the slice [begin, end) of the array, or the slice. Negative index
+    // counts from the end, and both ends are clamped to the array.
+    FieldRef get_array_range(int begin, int end) const;
+
     auto get_map_range() const ->
         std::pair<gp::Map<gp::MapKey, gp::MapValueRef>::const_iterator,
             gp::Map<gp::MapKey, gp::MapValueRef>::const_iterator>;
 
+    // Iterator of the map element with *key*, or the end of *get_map_range()*,
+    // if the key doesn't exist. It's a hash lookup, and the map is not iterated.
+    gp::Map<gp::MapKey, gp::MapValueRef>::const_iterator find_map_element(const gp::MapKey &key) const;
+
+    // Get the element of the map with *key*, which might NOT exist, see *has_mapped_value*.
+    FieldRef get_map_element(const gp::MapKey &key) const;
+
     explicit operator bool() const {
         return _field_desc != nullptr;
     }
 
-    int32_t get_int32() const {
-        return _msg->GetReflection()->GetInt32(*_msg, _field_desc);
+    const gp::FieldDescriptor* descriptor() const {
+        return _field_desc;
     }
 
-    int64_t get_int64() const {
-        return _msg->GetReflection()->GetInt64(*_msg, _field_desc);
-    }
+    // Get the underlying container of a repeated scalar field, so that elements
+    // can be reserved and added in bulk. *T* must be the C++ type of the field,
+    // and enums are stored as *int*.
+    template <typename T>
+    const gp::RepeatedField<T>& get_repeated_field() const {
+        assert(is_array() && !is_array_element());
 
-    uint32_t get_uint32() const {
-        return _msg->GetReflection()->GetUInt32(*_msg, _field_desc);
+        const auto *reflection =
+            static_cast<const gp::internal::GeneratedMessageReflection*>(_msg->GetReflection());
+        return reflection->GetRaw<gp::RepeatedField<T>>(*_msg, _field_desc);
     }
 
-    uint64_t get_uint64() const {
-        return _msg->GetReflection()->GetUInt64(*_msg, _field_desc);
-    }
+    template <typename T>
+    gp::RepeatedField<T>* mutable_repeated_field() {
+        assert(is_array() && !is_array_element() && !is_array_range());
 
-    float get_float() const {
-        return _msg->GetReflection()->GetFloat(*_msg, _field_desc);
+        // gp::MutableRepeatedFieldRef doesn't support reservation, so hack it.
+        const auto *reflection =
+            static_cast<const gp::internal::GeneratedMessageReflection*>(_msg->GetReflection());
+        return reflection->MutableRaw<gp::RepeatedField<T>>(_msg, _field_desc);
     }
 
-    double get_double() const {
-        return _msg->GetReflection()->GetDouble(*_msg, _field_desc);
+    // Accessors with CppTypeTraits of the C++ type *T* of the field.
+    template <gp::FieldDescriptor::CppType T>
+    typename CppTypeTraits<T>::Type get() const {
+        return CppTypeTraits<T>::get(*_msg, _field_desc);
     }
 
-    bool get_bool() const {
-        return _msg->GetReflection()->GetBool(*_msg, _field_desc);
+    template <gp::FieldDescriptor::CppType T>
+    typename CppTypeTraits<T>::Type get_repeated() const {
+        return CppTypeTraits<T>::get_repeated(*_msg, _field_desc, _arr_idx);
     }
 
-    int get_enum() const {
-        return _msg->GetReflection()->GetEnumValue(*_msg, _field_desc);
+    template <gp::FieldDescriptor::CppType T>
+    typename CppTypeTraits<T>::Type get_mapped() const {
+        return CppTypeTraits<T>::get_mapped(_get_map_value_const(_msg, _field_desc, *_map_key));
     }
 
-    std::string get_string() const {
-        return _msg->GetReflection()->GetString(*_msg, _field_desc);
+    template <gp::FieldDescriptor::CppType T>
+    void set(const typename CppTypeTraits<T>::Type &val) {
+        CppTypeTraits<T>::set(_msg, _field_desc, val);
     }
 
-    const gp::Message& get_msg() const {
-        return _msg->GetReflection()->GetMessage(*_msg, _field_desc);
+    template <gp::FieldDescriptor::CppType T>
+    void set_repeated(const typename CppTypeTraits<T>::Type &val) {
+        CppTypeTraits<T>::set_repeated(_msg, _field_desc, _arr_idx, val);
     }
 
-    int32_t get_repeated_int32() const {
-        return _msg->GetReflection()->GetRepeatedInt32(*_msg, _field_desc, _arr_idx);
+    template <gp::FieldDescriptor::CppType T>
+    void set_mapped(const typename CppTypeTraits<T>::Type &val) {
+        CppTypeTraits<T>::set_mapped(_get_map_value(_msg, _field_desc, *_map_key), val);
     }
 
-    int64_t get_repeated_int64() const {
-        return _msg->GetReflection()->GetRepeatedInt64(*_msg, _field_desc, _arr_idx);
+    template <gp::FieldDescriptor::CppType T>
+    void add(const typename CppTypeTraits<T>::Type &val) {
+        CppTypeTraits<T>::add(_msg, _field_desc, val);
     }
 
-    uint32_t get_repeated_uint32() const {
-        return _msg->GetReflection()->GetRepeatedUInt32(*_msg, _field_desc, _arr_idx);
-    }
+    // Whether the singular field is set. A field without presence, e.g. a proto3
+    // scalar, is set, if it's not of the default value.
+    bool has_field() const {
+        assert(_field_desc != nullptr && !_field_desc->is_repeated());
 
-    uint64_t get_repeated_uint64() const {
-        return _msg->GetReflection()->GetRepeatedUInt64(*_msg, _field_desc, _arr_idx);
+        return _msg->GetReflection()->HasField(*_msg, _field_desc);
     }
 
-    float get_repeated_float() const {
-        return _msg->GetReflection()->GetRepeatedFloat(*_msg, _field_desc, _arr_idx);
-    }
+    // The field that is set in the oneof containing this field, or nullptr,
+    // if the field is not in a oneof, or none of the oneof is set.
+    const gp::FieldDescriptor* oneof_field() const {
+        assert(_field_desc != nullptr);
 
-    double get_repeated_double() const {
-        return _msg->GetReflection()->GetRepeatedDouble(*_msg, _field_desc, _arr_idx);
-    }
-
-    bool get_repeated_bool() const {
-        return _msg->GetReflection()->GetRepeatedBool(*_msg, _field_desc, _arr_idx);
-    }
+        const auto *oneof = _field_desc->containing_oneof();
+        if (oneof == nullptr) {
+            return nullptr;
+        }
 
-    int get_repeated_enum() const {
-        return _msg->GetReflection()->GetRepeatedEnumValue(*_msg, _field_desc, _arr_idx);
+        return _msg->GetReflection()->GetOneofFieldDescriptor(*_msg, oneof);
     }
 
-    std::string get_repeated_string() const {
-        return _msg->GetReflection()->GetRepeatedString(*_msg, _field_desc, _arr_idx);
+    // Messages have no CppTypeTraits, so they're accessed with the following.
+    const gp::Message& get_msg() const {
+        return _msg->GetReflection()->GetMessage(*_msg, _field_desc);
     }
 
     const gp::Message& get_repeated_msg() const {
         return _msg->GetReflection()->GetRepeatedMessage(*_msg, _field_desc, _arr_idx);
     }
 
-    int32_t get_mapped_int32() const {
-        const auto &val = _get_map_value_const(_msg, _field_desc, *_map_key);
-        return val.GetInt32Value();
-    }
-
-    int64_t get_mapped_int64() const {
-        const auto &val = _get_map_value_const(_msg, _field_desc, *_map_key);
-        return val.GetInt64Value();
-    }
-
-    uint32_t get_mapped_uint32() const {
-        const auto &val = _get_map_value_const(_msg, _field_desc, *_map_key);
-        return val.GetUInt32Value();
-    }
+    // Whether the key of the map element exists in the map.
+    bool has_mapped_value() const {
+        assert(is_map_element());
 
-    uint64_t get_mapped_uint64() const {
-        const auto &val = _get_map_value_const(_msg, _field_desc, *_map_key);
-        return val.GetUInt64Value();
-    }
-
-    float get_mapped_float() const {
-        const auto &val = _get_map_value_const(_msg, _field_desc, *_map_key);
-        return val.GetFloatValue();
-    }
-
-    double get_mapped_double() const {
-        const auto &val = _get_map_value_const(_msg, _field_desc, *_map_key);
-        return val.GetDoubleValue();
-    }
-
-    bool get_mapped_bool() const {
-        const auto &val = _get_map_value_const(_msg, _field_desc, *_map_key);
-        return val.GetBoolValue();
-    }
-
-    int get_mapped_enum() const {
-        const auto &val = _get_map_value_const(_msg, _field_desc, *_map_key);
-        return val.GetEnumValue();
-    }
-
-    std::string get_mapped_string() const {
-        const auto &val = _get_map_value_const(_msg, _field_desc, *_map_key);
-        return val.GetStringValue();
+        return _find_map_value(_msg, _field_desc, *_map_key) != nullptr;
     }
 
     const gp::Message& get_mapped_msg() const {
@@ -251,94 +345,29 @@ public:
         return val.GetMessageValue();
     }
 
-    void set_mapped_int32(int32_t val) {
-        auto &val_ref = _get_map_value(_msg, _field_desc, *_map_key);
-        val_ref.SetInt32Value(val);
-    }
-
-    void set_mapped_int64(int64_t val) {
-        auto &val_ref = _get_map_value(_msg, _field_desc, *_map_key);
-        val_ref.SetInt64Value(val);
-    }
-
-    void set_mapped_uint32(uint32_t val) {
-        auto &val_ref = _get_map_value(_msg, _field_desc, *_map_key);
-        val_ref.SetUInt32Value(val);
-    }
-
-    void set_mapped_uint64(uint64_t val) {
-        auto &val_ref = _get_map_value(_msg, _field_desc, *_map_key);
-        val_ref.SetUInt64Value(val);
-    }
-
-    void set_mapped_float(float val) {
-        auto &val_ref = _get_map_value(_msg, _field_desc, *_map_key);
-        val_ref.SetFloatValue(val);
-    }
-
-    void set_mapped_double(double val) {
-        auto &val_ref = _get_map_value(_msg, _field_desc, *_map_key);
-        val_ref.SetDoubleValue(val);
-    }
-
-    void set_mapped_bool(bool val) {
-        auto &val_ref = _get_map_value(_msg, _field_desc, *_map_key);
-        val_ref.SetBoolValue(val);
-    }
-
-    void set_mapped_enum(int val) {
-        auto &val_ref = _get_map_value(_msg, _field_desc, *_map_key);
-        val_ref.SetEnumValue(val);
-    }
-
-    void set_mapped_string(const std::string &val) {
-        auto &val_ref = _get_map_value(_msg, _field_desc, *_map_key);
-        val_ref.SetStringValue(val);
-    }
-
     void set_mapped_msg(const gp::Message &val) {
         auto &val_ref = _get_map_value(_msg, _field_desc, *_map_key);
         auto *msg = val_ref.MutableMessageValue();
         msg->CopyFrom(val);
     }
 
-    void set_int32(int32_t val);
-    void set_int64(int64_t val);
-    void set_uint32(uint32_t val);
-    void set_uint64(uint64_t val);
-    void set_float(float val);
-    void set_double(double val);
-    void set_bool(bool val);
-    void set_enum(int val);
-    void set_string(const std::string &val);
     void set_msg(gp::Message &msg);
 
-    void set_repeated_int32(int32_t val);
-    void set_repeated_int64(int64_t val);
-    void set_repeated_uint32(uint32_t val);
-    void set_repeated_uint64(uint64_t val);
-    void set_repeated_float(float val);
-    void set_repeated_double(double val);
-    void set_repeated_bool(bool val);
-    void set_repeated_enum(int val);
-    void set_repeated_string(const std::string &val);
     void set_repeated_msg(gp::Message &msg);
 
-    void add_int32(int32_t val);
-    void add_int64(int64_t val);
-    void add_uint32(uint32_t val);
-    void add_uint64(uint64_t val);
-    void add_float(float val);
-    void add_double(double val);
-    void add_bool(bool val);
-    void add_enum(int val);
-    void add_string(const std::string &val);
     void add_msg(gp::Message &msg);
 
     void clear();
 
     void del();
 
+    // Remove elements from the end of the array, until it has at most *size* elements.
+    void truncate(int size);
+
+    // Move the last element of the array to *idx*, and shift elements after
+    // *idx* by one, i.e. the reverse of deleting the element at *idx*.
+    void move_last_to(int idx);
+
     void merge(const gp::Message &msg);
 
 private:
@@ -383,7 +412,8 @@ private:
         NotFoundError() : Error("key not found") {}
     };
 
-    const gp::MapValueRef& _get_map_value_const(Msg *msg,
+    // Return nullptr, if the key doesn't exist.
+    const gp::MapValueRef* _find_map_value(Msg *msg,
             const gp::FieldDescriptor *field_desc,
             const gp::MapKey &key) const {
         // The following is hacking, hacking, and hacking!!!
@@ -394,10 +424,21 @@ private:
         const auto &m = dynamic_map.GetMap();
         auto iter = m.find(key);
         if (iter == m.end()) {
+            return nullptr;
+        }
+
+        return &(iter->second);
+    }
+
+    const gp::MapValueRef& _get_map_value_const(Msg *msg,
+            const gp::FieldDescriptor *field_desc,
+            const gp::MapKey &key) const {
+        const auto *val = _find_map_value(msg, field_desc, key);
+        if (val == nullptr) {
             throw NotFoundError();
         }
 
-        return iter->second;
+        return *val;
     }
 
     gp::MapValueRef& _get_map_value(Msg *msg,
@@ -466,29 +507,40 @@ private:
 
     void _validate_parameters(Msg *root_msg, const Path &path) const;
 
-    void _parse_aggregate_field(const std::string &field);
+    void _validate_element(const PathField &field) const;
 
-    Optional<gp::MapKey> _parse_map_key(const std::string &key) {
-        return _parse_map_key_impl(key, typename std::is_const<Msg>::type());
-    }
+    void _validate_map_key(const PathField &field, std::true_type) const;
 
-    Optional<gp::MapKey> _parse_map_key_impl(const std::string &key);
+    void _validate_map_key(const PathField &field, std::false_type) const {}
 
-    Optional<gp::MapKey> _parse_map_key_impl(const std::string &key, std::true_type);
+    void _set_range(int begin, int end);
 
-    Optional<gp::MapKey> _parse_map_key_impl(const std::string &key, std::false_type) {
-        return _parse_map_key_impl(key);
+    void _validate_range(std::true_type) const {}
+
+    void _validate_range(std::false_type) const {
+        throw Error("cannot modify an array range");
     }
 
     void _del_array_element();
 
+    void _del_map_element();
+
+    const gp::Map<gp::MapKey, gp::MapValueRef>& _get_map() const;
+
     Msg *_msg = nullptr;
 
     const gp::FieldDescriptor *_field_desc = nullptr;
 
     int _arr_idx = -1;
 
+    // Slice [_range_begin, _range_end) of the array, or _range_end is -1 if it's not a slice.
+    int _range_begin = 0;
+
+    int _range_end = -1;
+
     Optional<gp::MapKey> _map_key;
+
+    const FieldAccessor *_accessor = nullptr;
 };
 
 using ConstFieldRef = FieldRef<const gp::Message>;
@@ -496,6 +548,8 @@ using MutableFieldRef = FieldRef<gp::Message>;
 
 template <typename Msg>
 FieldRef<Msg>::FieldRef(Msg *root_msg, const Path &path) {
+    LatencyTimer timer(Phase::RESOLVE);
+
     _validate_parameters(root_msg, path);
 
     // Here we have to give _map_key a valid value.
@@ -503,40 +557,32 @@ FieldRef<Msg>::FieldRef(Msg *root_msg, const Path &path) {
 
     _msg = root_msg;
 
-    for (const auto &field : path.fields()) {
-        assert(!field.empty() && _msg != nullptr);
+    // Fields have been looked up by name, and the path has been checked, when resolving.
+    auto fields = path.resolve(*root_msg->GetDescriptor());
+    for (const auto &field : *fields) {
+        assert(field.desc != nullptr && _msg != nullptr);
 
         if (_field_desc != nullptr) {
-            if (type() != gp::FieldDescriptor::CPPTYPE_MESSAGE) {
-                throw Error("invalid path");
-            }
-
             if (_field_desc->is_map()) {
-                if (!_map_key) {
-                    throw Error("invalid path");
-                }
                 _msg = _get_map_msg(_msg, _field_desc, *_map_key);
-                _map_key.reset();
-                _map_key->SetBoolValue(false);
             } else if (_field_desc->is_repeated()) {
-                if (_arr_idx < 0) {
-                    throw Error("invalid path");
-                }
                 _msg = _get_sub_repeated_msg(_msg, _field_desc, _arr_idx);
-                _arr_idx = -1;
             } else {
                 _msg = _get_sub_msg(_msg, _field_desc);
             }
         }
 
-        if (field.back() == ']') {
-            // It's an array or a map.
-            _parse_aggregate_field(field);
-        } else {
-            _field_desc = _msg->GetDescriptor()->FindFieldByName(field);
-            if (_field_desc == nullptr) {
-                throw Error("field not found: " + field);
-            }
+        _field_desc = field.desc;
+        _arr_idx = field.arr_idx;
+        _map_key = field.map_key;
+        _accessor = field.accessor;
+
+        _validate_element(field);
+
+        if (field.is_range) {
+            _validate_range(typename std::is_const<Msg>::type());
+
+            _set_range(field.range_begin, field.range_end);
         }
     }
 }
@@ -546,40 +592,93 @@ FieldRef<Msg> FieldRef<Msg>::get_array_element(int idx) const {
     assert(is_array() && idx < size());
 
     FieldRef<Msg> element(*this);
-    element._arr_idx = idx;
+    element._arr_idx = _range_begin + idx;
+    element._range_begin = 0;
+    element._range_end = -1;
+    element._accessor = &select_accessor(FieldKind::ARRAY_ELEMENT, _accessor->type);
 
     return element;
 }
 
+template <typename Msg>
+FieldRef<Msg> FieldRef<Msg>::get_array_range(int begin, int end) const {
+    if (!is_array() || is_array_element()) {
+        throw Error("not an array");
+    }
+
+    // If it's already a slice, *begin* and *end* are relative to the slice.
+    FieldRef<Msg> range(*this);
+    range._set_range(begin, end);
+    range._range_begin += _range_begin;
+    range._range_end += _range_begin;
+
+    return range;
+}
+
 template <typename Msg>
 auto FieldRef<Msg>::get_map_range() const ->
     std::pair<gp::Map<gp::MapKey, gp::MapValueRef>::const_iterator,
         gp::Map<gp::MapKey, gp::MapValueRef>::const_iterator> {
     assert(is_map());
 
+    const auto &m = _get_map();
+
+    return {m.begin(), m.end()};
+}
+
+template <typename Msg>
+auto FieldRef<Msg>::find_map_element(const gp::MapKey &key) const ->
+    gp::Map<gp::MapKey, gp::MapValueRef>::const_iterator {
+    assert(is_map());
+
+    return _get_map().find(key);
+}
+
+template <typename Msg>
+FieldRef<Msg> FieldRef<Msg>::get_map_element(const gp::MapKey &key) const {
+    assert(is_map() && !is_map_element());
+
+    FieldRef<Msg> element(*this);
+    element._map_key = Optional<gp::MapKey>(key);
+    element._accessor = &select_accessor(FieldKind::MAP_ELEMENT, _accessor->type);
+
+    return element;
+}
+
+template <typename Msg>
+const gp::Map<gp::MapKey, gp::MapValueRef>& FieldRef<Msg>::_get_map() const {
     // The following is hacking, hacking, and hacking!!!
     const auto *reflection =
         static_cast<const gp::internal::GeneratedMessageReflection*>(_msg->GetReflection());
     const auto &map_base = reflection->GetRaw<gp::internal::MapFieldBase>(*_msg, _field_desc);
     const auto &dynamic_map = static_cast<const gp::internal::DynamicMapField&>(map_base);
-    const auto &m = dynamic_map.GetMap();
 
-    return {m.begin(), m.end()};
+    return dynamic_map.GetMap();
 }
 
 template <typename Msg>
 std::string FieldRef<Msg>::msg_type() const {
+    return msg_descriptor().full_name();
+}
+
+template <typename Msg>
+std::string FieldRef<Msg>::mapped_msg_type() const {
+    return mapped_msg_descriptor().full_name();
+}
+
+template <typename Msg>
+const gp::Descriptor& FieldRef<Msg>::msg_descriptor() const {
     assert(_field_desc != nullptr);
 
     if (type() != gp::FieldDescriptor::CPPTYPE_MESSAGE) {
         throw Error("not a message");
     }
 
-    return _field_desc->message_type()->full_name();
+    return *(_field_desc->message_type());
 }
 
 template <typename Msg>
-std::string FieldRef<Msg>::mapped_msg_type() const {
+const gp::Descriptor& FieldRef<Msg>::mapped_msg_descriptor() const {
     assert(_field_desc != nullptr);
 
     if (type() != gp::FieldDescriptor::CPPTYPE_MESSAGE) {
@@ -589,7 +688,7 @@ std::string FieldRef<Msg>::mapped_msg_type() const {
     auto *value_desc = _field_desc->message_type()->FindFieldByName("value");
     assert(value_desc != nullptr);
 
-    return value_desc->message_type()->full_name();
+    return *(value_desc->message_type());
 }
 
 template <typename Msg>
@@ -598,9 +697,34 @@ int FieldRef<Msg>::size() const {
         throw Error("not an array or map");
     }
 
+    if (is_array_range()) {
+        return _range_end - _range_begin;
+    }
+
     return _msg->GetReflection()->FieldSize(*_msg, _field_desc);
 }
 
+template <typename Msg>
+void FieldRef<Msg>::_set_range(int begin, int end) {
+    assert(is_array() && !is_array_element());
+
+    auto size = this->size();
+
+    auto clamp = [size](int idx) {
+        if (idx < 0) {
+            idx = idx < -size ? 0 : idx + size;
+        }
+
+        return idx < size ? idx : size;
+    };
+
+    _range_begin = clamp(begin);
+    _range_end = clamp(end);
+    if (_range_end < _range_begin) {
+        _range_end = _range_begin;
+    }
+}
+
 template <typename Msg>
 void FieldRef<Msg>::_validate_parameters(Msg *root_msg, const Path &path) const {
     assert(root_msg != nullptr);
@@ -611,141 +735,24 @@ void FieldRef<Msg>::_validate_parameters(Msg *root_msg, const Path &path) const
 }
 
 template <typename Msg>
-void FieldRef<Msg>::_parse_aggregate_field(const std::string &field) {
-    assert(!field.empty() && field.back() == ']');
-
-    auto pos = field.find('[');
-    if (pos == std::string::npos) {
-        throw Error("invalid array or map");
-    }
-
-    auto name = field.substr(0, pos);
-    auto key = field.substr(pos + 1, field.size() - pos - 2);
-
-    _field_desc = _msg->GetDescriptor()->FindFieldByName(name);
-    if (_field_desc == nullptr) {
-        throw Error("invalid field: " + name);
-    }
-
-    if (is_map()) {
-        _map_key = _parse_map_key(key);
-    } else if (is_array()) {
-        try {
-            _arr_idx = std::stoi(key);
-        } catch (const std::exception &e) {
-            throw Error("invalid array index: " + key);
-        }
-
+void FieldRef<Msg>::_validate_element(const PathField &field) const {
+    if (is_array_element()) {
         auto size = _msg->GetReflection()->FieldSize(*_msg, _field_desc);
         if (_arr_idx >= size) {
-            throw Error("array index is out-of-range: " + key + " : " + std::to_string(size));
+            throw Error("array index is out-of-range: " + field.key + " : " + std::to_string(size));
         }
-    } else {
-        throw Error("not an array or map");
+    } else if (is_map_element()) {
+        _validate_map_key(field, typename std::is_const<Msg>::type());
     }
 }
 
 template <typename Msg>
-Optional<gp::MapKey> FieldRef<Msg>::_parse_map_key_impl(const std::string &key, std::true_type) {
-    auto map_key = _parse_map_key_impl(key);
-
+void FieldRef<Msg>::_validate_map_key(const PathField &field, std::true_type) const {
     try {
-        _get_map_value_const(_msg, _field_desc, *map_key);
+        _get_map_value_const(_msg, _field_desc, *_map_key);
     } catch (const NotFoundError &e) {
-        throw MapKeyNotFoundError(key);
-    }
-
-    return map_key;
-}
-
-template <typename Msg>
-Optional<gp::MapKey> FieldRef<Msg>::_parse_map_key_impl(const std::string &key) {
-    assert(is_map() && !_map_key);
-
-    auto *desc = _field_desc->message_type();
-    assert(desc != nullptr);
-
-    auto *key_desc = desc->FindFieldByName("key");
-    assert(key_desc != nullptr);
-
-    // TODO: it seems we don't need a new map_key, just use _map_key
-    gp::MapKey map_key;
-    switch (key_desc->cpp_type()) {
-    case gp::FieldDescriptor::CPPTYPE_INT32:
-        map_key.SetInt32Value(util::sv_to_int32(key));
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_INT64:
-        map_key.SetInt64Value(util::sv_to_int64(key));
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_UINT32:
-        map_key.SetUInt32Value(util::sv_to_uint32(key));
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_UINT64:
-        map_key.SetUInt64Value(util::sv_to_uint64(key));
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_BOOL:
-        map_key.SetBoolValue(util::sv_to_bool(key));
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_STRING:
-        map_key.SetStringValue(key);
-        break;
-
-    default:
-        // TODO: or assert?
-        throw Error("invalid map key type");
+        throw MapKeyNotFoundError(field.key);
     }
-
-    return Optional<gp::MapKey>(map_key);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_int32(int32_t val) {
-    _msg->GetReflection()->SetInt32(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_int64(int64_t val) {
-    _msg->GetReflection()->SetInt64(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_uint32(uint32_t val) {
-    _msg->GetReflection()->SetUInt32(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_uint64(uint64_t val) {
-    _msg->GetReflection()->SetUInt64(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_float(float val) {
-    _msg->GetReflection()->SetFloat(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_double(double val) {
-    _msg->GetReflection()->SetDouble(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_bool(bool val) {
-    _msg->GetReflection()->SetBool(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_enum(int val) {
-    _msg->GetReflection()->SetEnumValue(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_string(const std::string &val) {
-    _msg->GetReflection()->SetString(_msg, _field_desc, val);
 }
 
 template <typename Msg>
@@ -757,102 +764,12 @@ void FieldRef<Msg>::set_msg(gp::Message &msg) {
     sub_msg->GetReflection()->Swap(sub_msg, &msg);
 }
 
-template <typename Msg>
-void FieldRef<Msg>::set_repeated_int32(int32_t val) {
-    _msg->GetReflection()->SetRepeatedInt32(_msg, _field_desc, _arr_idx, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_repeated_int64(int64_t val) {
-    _msg->GetReflection()->SetRepeatedInt64(_msg, _field_desc, _arr_idx, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_repeated_uint32(uint32_t val) {
-    _msg->GetReflection()->SetRepeatedUInt32(_msg, _field_desc, _arr_idx, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_repeated_uint64(uint64_t val) {
-    _msg->GetReflection()->SetRepeatedUInt64(_msg, _field_desc, _arr_idx, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_repeated_float(float val) {
-    _msg->GetReflection()->SetRepeatedFloat(_msg, _field_desc, _arr_idx, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_repeated_double(double val) {
-    _msg->GetReflection()->SetRepeatedDouble(_msg, _field_desc, _arr_idx, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_repeated_bool(bool val) {
-    _msg->GetReflection()->SetRepeatedBool(_msg, _field_desc, _arr_idx, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_repeated_enum(int val) {
-    _msg->GetReflection()->SetRepeatedEnumValue(_msg, _field_desc, _arr_idx, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::set_repeated_string(const std::string &val) {
-    _msg->GetReflection()->SetRepeatedString(_msg, _field_desc, _arr_idx, val);
-}
-
 template <typename Msg>
 void FieldRef<Msg>::set_repeated_msg(gp::Message &msg) {
     auto *sub_msg = _msg->GetReflection()->MutableRepeatedMessage(_msg, _field_desc, _arr_idx);
     sub_msg->GetReflection()->Swap(sub_msg, &msg);
 }
 
-template <typename Msg>
-void FieldRef<Msg>::add_int32(int32_t val) {
-    _msg->GetReflection()->AddInt32(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::add_int64(int64_t val) {
-    _msg->GetReflection()->AddInt64(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::add_uint32(uint32_t val) {
-    _msg->GetReflection()->AddUInt32(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::add_uint64(uint64_t val) {
-    _msg->GetReflection()->AddUInt64(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::add_float(float val) {
-    _msg->GetReflection()->AddFloat(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::add_double(double val) {
-    _msg->GetReflection()->AddDouble(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::add_bool(bool val) {
-    _msg->GetReflection()->AddBool(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::add_enum(int val) {
-    _msg->GetReflection()->AddEnumValue(_msg, _field_desc, val);
-}
-
-template <typename Msg>
-void FieldRef<Msg>::add_string(const std::string &val) {
-    _msg->GetReflection()->AddString(_msg, _field_desc, val);
-}
-
 template <typename Msg>
 void FieldRef<Msg>::add_msg(gp::Message &msg) {
     auto sub_msg = _msg->GetReflection()->AddMessage(_msg, _field_desc);
@@ -881,9 +798,30 @@ template <typename Msg>
 void FieldRef<Msg>::del() {
     if (is_array_element()) {
         _del_array_element();
+    } else if (is_map_element()) {
+        _del_map_element();
     } else {
-        // TODO: support map
-        throw Error("can only delete array element");
+        throw Error("can only delete array or map element");
+    }
+}
+
+template <typename Msg>
+void FieldRef<Msg>::truncate(int size) {
+    assert(is_array() && !is_array_element() && !is_array_range());
+
+    const auto *reflection = _msg->GetReflection();
+    for (auto len = reflection->FieldSize(*_msg, _field_desc); len > size; --len) {
+        reflection->RemoveLast(_msg, _field_desc);
+    }
+}
+
+template <typename Msg>
+void FieldRef<Msg>::move_last_to(int idx) {
+    assert(is_array() && !is_array_element() && !is_array_range());
+
+    const auto *reflection = _msg->GetReflection();
+    for (auto pos = reflection->FieldSize(*_msg, _field_desc) - 1; pos > idx; --pos) {
+        reflection->SwapElements(_msg, _field_desc, pos, pos - 1);
     }
 }
 
@@ -902,6 +840,18 @@ void FieldRef<Msg>::merge(const gp::Message &msg) {
     sub_msg->MergeFrom(msg);
 }
 
+template <typename Msg>
+void FieldRef<Msg>::_del_map_element() {
+    assert(is_map_element());
+
+    // The following is hacking, hacking, and hacking!!!
+    // Delete the entry with a hash lookup, and it's a no-op, if the key doesn't exist.
+    const auto *reflection =
+        static_cast<const gp::internal::GeneratedMessageReflection*>(_msg->GetReflection());
+    auto *map_base = reflection->MutableRaw<gp::internal::MapFieldBase>(_msg, _field_desc);
+    static_cast<gp::internal::DynamicMapField*>(map_base)->DeleteMapValue(*_map_key);
+}
+
 template <typename Msg>
 void FieldRef<Msg>::_del_array_element() {
     assert(is_array_element());
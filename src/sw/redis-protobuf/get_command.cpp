@@ -15,10 +15,249 @@
  *************************************************************************/
 
 #include "get_command.h"
+#include <cstdio>
+#include <limits>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>
 #include "errors.h"
 #include "redis_protobuf.h"
 #include "utils.h"
 #include "field_ref.h"
+#include "worker_pool.h"
+#include "metrics.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+class JsonGetTask : public AsyncTask {
+public:
+    JsonGetTask(MsgUPtr msg, const util::JsonPrintOptions &opts) : _msg(std::move(msg)), _opts(opts) {}
+
+    // Convert a copy of the serialized message of a lazy value, which is
+    // cheaper than copying the parsed message.
+    JsonGetTask(const gp::Descriptor &desc, std::string binary, const util::JsonPrintOptions &opts) :
+        _desc(&desc), _binary(std::move(binary)), _opts(opts) {}
+
+private:
+    virtual void run() override {
+        if (_msg) {
+            _json = util::msg_to_json(*_msg, _opts);
+
+            // Free the copy in worker thread too.
+            _msg.reset();
+        } else {
+            assert(_desc != nullptr);
+
+            _json = util::binary_to_json(*_desc, _binary, _opts);
+
+            std::string().swap(_binary);
+        }
+    }
+
+    virtual int reply(RedisModuleCtx *ctx) override {
+        return RedisModule_ReplyWithStringBuffer(ctx, _json.data(), _json.size());
+    }
+
+    MsgUPtr _msg;
+
+    const gp::Descriptor *_desc = nullptr;
+
+    std::string _binary;
+
+    util::JsonPrintOptions _opts;
+
+    std::string _json;
+};
+
+template <typename T>
+void reply_with_integers(RedisModuleCtx *ctx, const gp::RepeatedField<T> &arr, int begin, int size) {
+    assert(begin >= 0 && begin + size <= arr.size());
+
+    RedisModule_ReplyWithArray(ctx, size);
+
+    const auto *data = arr.data() + begin;
+    for (auto idx = 0; idx != size; ++idx) {
+        RedisModule_ReplyWithLongLong(ctx, static_cast<long long>(data[idx]));
+    }
+}
+
+template <typename T>
+void reply_with_floatings(RedisModuleCtx *ctx, const gp::RepeatedField<T> &arr, int begin, int size) {
+    assert(begin >= 0 && begin + size <= arr.size());
+
+    RedisModule_ReplyWithArray(ctx, size);
+
+    const auto *data = arr.data() + begin;
+    for (auto idx = 0; idx != size; ++idx) {
+        // Same format as replying with a single element.
+        auto str = std::to_string(data[idx]);
+        RedisModule_ReplyWithSimpleString(ctx, str.data());
+    }
+}
+
+// Compute and cache the serialized size of *msg*, so that it can be serialized
+// with SerializeWithCachedSizes.
+uint32_t byte_size(const gp::Message &msg) {
+    auto size = msg.ByteSizeLong();
+    if (size > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+        throw Error("message is too large");
+    }
+
+    return static_cast<uint32_t>(size);
+}
+
+// Write *msg* prefixed with its size.
+void write_delimited(const gp::Message &msg, gp::io::CodedOutputStream &coded) {
+    coded.WriteVarint32(byte_size(msg));
+    msg.SerializeWithCachedSizes(&coded);
+}
+
+// Append the JSON string of *msg* to *json*. *binary* is a buffer for the
+// serialized message, which can be reused.
+void append_json(const gp::Message &msg,
+        const util::JsonPrintOptions &opts,
+        std::string &binary,
+        std::string &json) {
+    binary.clear();
+    {
+        LatencyTimer timer(Phase::SERIALIZE);
+
+        if (!msg.AppendToString(&binary)) {
+            throw Error("failed to serialize message to binary string");
+        }
+    }
+
+    util::binary_to_json(*msg.GetDescriptor(), binary, opts, json);
+}
+
+// Encode *key* as field 1 of a map entry, and append it to *buf*.
+void encode_map_key(const gp::FieldDescriptor &key_desc, const gp::MapKey &key, std::string &buf) {
+    using gp::internal::WireFormatLite;
+
+    gp::io::StringOutputStream output(&buf);
+    gp::io::CodedOutputStream coded(&output);
+
+    switch (key_desc.type()) {
+    case gp::FieldDescriptor::TYPE_INT32:
+        WireFormatLite::WriteInt32(1, key.GetInt32Value(), &coded);
+        break;
+
+    case gp::FieldDescriptor::TYPE_SINT32:
+        WireFormatLite::WriteSInt32(1, key.GetInt32Value(), &coded);
+        break;
+
+    case gp::FieldDescriptor::TYPE_SFIXED32:
+        WireFormatLite::WriteSFixed32(1, key.GetInt32Value(), &coded);
+        break;
+
+    case gp::FieldDescriptor::TYPE_INT64:
+        WireFormatLite::WriteInt64(1, key.GetInt64Value(), &coded);
+        break;
+
+    case gp::FieldDescriptor::TYPE_SINT64:
+        WireFormatLite::WriteSInt64(1, key.GetInt64Value(), &coded);
+        break;
+
+    case gp::FieldDescriptor::TYPE_SFIXED64:
+        WireFormatLite::WriteSFixed64(1, key.GetInt64Value(), &coded);
+        break;
+
+    case gp::FieldDescriptor::TYPE_UINT32:
+        WireFormatLite::WriteUInt32(1, key.GetUInt32Value(), &coded);
+        break;
+
+    case gp::FieldDescriptor::TYPE_FIXED32:
+        WireFormatLite::WriteFixed32(1, key.GetUInt32Value(), &coded);
+        break;
+
+    case gp::FieldDescriptor::TYPE_UINT64:
+        WireFormatLite::WriteUInt64(1, key.GetUInt64Value(), &coded);
+        break;
+
+    case gp::FieldDescriptor::TYPE_FIXED64:
+        WireFormatLite::WriteFixed64(1, key.GetUInt64Value(), &coded);
+        break;
+
+    case gp::FieldDescriptor::TYPE_BOOL:
+        WireFormatLite::WriteBool(1, key.GetBoolValue(), &coded);
+        break;
+
+    case gp::FieldDescriptor::TYPE_STRING:
+        WireFormatLite::WriteString(1, key.GetStringValue(), &coded);
+        break;
+
+    default:
+        throw Error("invalid type of map key");
+    }
+}
+
+std::string map_key_to_string(const gp::MapKey &key) {
+    switch (key.type()) {
+    case gp::FieldDescriptor::CPPTYPE_INT32:
+        return std::to_string(key.GetInt32Value());
+
+    case gp::FieldDescriptor::CPPTYPE_INT64:
+        return std::to_string(key.GetInt64Value());
+
+    case gp::FieldDescriptor::CPPTYPE_UINT32:
+        return std::to_string(key.GetUInt32Value());
+
+    case gp::FieldDescriptor::CPPTYPE_UINT64:
+        return std::to_string(key.GetUInt64Value());
+
+    case gp::FieldDescriptor::CPPTYPE_BOOL:
+        return key.GetBoolValue() ? "true" : "false";
+
+    case gp::FieldDescriptor::CPPTYPE_STRING:
+        return key.GetStringValue();
+
+    default:
+        throw Error("invalid type of map key");
+    }
+}
+
+// Append *str* as a quoted and escaped JSON string to *json*.
+void append_json_string(const std::string &str, std::string &json) {
+    json.push_back('"');
+    for (auto ch : str) {
+        switch (ch) {
+        case '"':
+            json += "\\\"";
+            break;
+
+        case '\\':
+            json += "\\\\";
+            break;
+
+        case '\n':
+            json += "\\n";
+            break;
+
+        case '\r':
+            json += "\\r";
+            break;
+
+        case '\t':
+            json += "\\t";
+            break;
+
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20) {
+                char hex[8];
+                snprintf(hex, sizeof(hex), "\\u%04x", static_cast<unsigned char>(ch));
+                json += hex;
+            } else {
+                json.push_back(ch);
+            }
+            break;
+        }
+    }
+    json.push_back('"');
+}
+
+}
 
 namespace sw {
 
@@ -36,10 +275,15 @@ int GetCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) con
         if (!api::key_exists(key.get(), RedisProtobuf::instance().type())) {
             _reply_with_nil(ctx);
         } else {
-            auto *msg = api::get_msg_by_key(key.get());
-            assert(msg != nullptr);
-
-            _reply_with_msg(ctx, *msg, args);
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
+
+            if (!_async_reply_with_wire(ctx, *value, args) && !_reply_with_wire(ctx, *value, args)) {
+                auto &msg = value->msg();
+                if (!_async_reply_with_msg(ctx, msg, args)) {
+                    _reply_with_msg(ctx, msg, args);
+                }
+            }
         }
 
         return REDISMODULE_OK;
@@ -61,11 +305,14 @@ GetCommand::Args GetCommand::_parse_args(RedisModuleString **argv, int argc) con
     args.key_name = argv[1];
 
     auto pos = _parse_opts(argv, argc, args);
-    if (pos + 1 != argc) {
+    if (pos >= argc) {
         throw WrongArityError();
     }
 
-    args.path = Path(argv[pos]);
+    args.paths.reserve(argc - pos);
+    for (auto idx = pos; idx != argc; ++idx) {
+        args.paths.emplace_back(argv[idx]);
+    }
 
     return args;
 }
@@ -82,6 +329,10 @@ int GetCommand::_parse_opts(RedisModuleString **argv, int argc, Args &args) cons
             ++idx;
 
             args.format = _parse_format(argv[idx]);
+        } else if (util::str_case_equal(opt, "--FLAT")) {
+            args.flat = true;
+        } else if (_parse_json_opt(opt, args.json_opts)) {
+            // JSON option has been parsed.
         } else {
             // Finish parsing options.
             break;
@@ -103,19 +354,38 @@ GetCommand::Args::Format GetCommand::_parse_format(const StringView &format) con
     }
 }
 
+bool GetCommand::_parse_json_opt(const StringView &opt, util::JsonPrintOptions &json_opts) const {
+    if (util::str_case_equal(opt, "--PRESERVE-FIELD-NAMES")) {
+        json_opts.preserve_proto_field_names = true;
+    } else if (util::str_case_equal(opt, "--PRINT-PRIMITIVES")) {
+        json_opts.always_print_primitive_fields = true;
+    } else if (util::str_case_equal(opt, "--ENUMS-AS-INTS")) {
+        json_opts.always_print_enums_as_ints = true;
+    } else if (util::str_case_equal(opt, "--PRETTY")) {
+        json_opts.add_whitespace = true;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
 void GetCommand::_get_msg(RedisModuleCtx *ctx,
         const gp::Message &msg,
-        Args::Format format) const {
+        const Args &args) const {
     std::string result;
-    switch (format) {
-    case Args::Format::BINARY:
+    switch (args.format) {
+    case Args::Format::BINARY: {
+        LatencyTimer timer(Phase::SERIALIZE);
+
         if (!msg.SerializeToString(&result)) {
             throw Error("failed to serialize message to binary string");
         }
         break;
+    }
 
     case Args::Format::JSON:
-        result = util::msg_to_json(msg);
+        result = util::msg_to_json(msg, args.json_opts);
         break;
 
     case Args::Format::NONE:
@@ -131,240 +401,256 @@ void GetCommand::_get_msg(RedisModuleCtx *ctx,
 
 void GetCommand::_get_field(RedisModuleCtx *ctx,
         const ConstFieldRef &field,
-        Args::Format format) const {
-    if (field.is_map_element()) {
-        _get_map_element(ctx, field, format);
-    } else if (field.is_map()) {
-        _get_map(ctx, field, format);
-    } else if (field.is_array_element()) {
-        _get_array_element(ctx, field, format);
-    } else if (field.is_array()) {
-        _get_array(ctx, field, format);
-    } else {
-        // Non-aggregate type.
-        _get_scalar_field(ctx, field, format);
-    }
-}
-
-void GetCommand::_get_scalar_field(RedisModuleCtx *ctx,
-        const ConstFieldRef &field,
-        Args::Format format) const {
-    switch (field.type()) {
-    case gp::FieldDescriptor::CPPTYPE_INT32: {
-        auto val = field.get_int32();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_INT64: {
-        auto val = field.get_int64();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_UINT32: {
-        auto val = field.get_uint32();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_UINT64: {
-        auto val = field.get_uint64();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_DOUBLE: {
-        auto val = field.get_double();
-        auto str = std::to_string(val);
-        RedisModule_ReplyWithSimpleString(ctx, str.data());
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_FLOAT: {
-        auto val = field.get_float();
-        auto str = std::to_string(val);
-        RedisModule_ReplyWithSimpleString(ctx, str.data());
+        const Args &args) const {
+    // The accessor has been selected with the kind and type of the field,
+    // when resolving the path.
+    const auto &accessor = field.accessor();
+    switch (accessor.kind) {
+    case FieldKind::MAP:
+        _get_map(ctx, field, args);
         break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_BOOL: {
-        auto val = field.get_bool();
-        RedisModule_ReplyWithLongLong(ctx, val);
+
+    case FieldKind::ARRAY:
+        _get_array(ctx, field, args);
         break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_ENUM: {
-        auto val = field.get_enum();
-        RedisModule_ReplyWithLongLong(ctx, val);
+
+    default:
+        if (accessor.type == gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+            _get_msg(ctx, accessor.get_msg(field), args);
+        } else {
+            accessor.reply(ctx, field);
+        }
         break;
     }
-    case gp::FieldDescriptor::CPPTYPE_STRING: {
-        auto val = field.get_string();
-        RedisModule_ReplyWithStringBuffer(ctx, val.data(), val.size());
-        break;
+}
+
+void GetCommand::_get_array(RedisModuleCtx *ctx,
+        const ConstFieldRef &field,
+        const Args &args) const {
+    if (_get_scalar_array(ctx, field)) {
+        return;
     }
-    case gp::FieldDescriptor::CPPTYPE_MESSAGE: {
-        _get_msg(ctx, field.get_msg(), format);
-        break;
+
+    if (args.flat && field.type() == gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+        _get_flat_array(ctx, field, args);
+        return;
     }
-    default:
-        assert(false);
+
+    auto arr_size = field.size();
+
+    RedisModule_ReplyWithArray(ctx, arr_size);
+
+    for (auto idx = 0; idx != arr_size; ++idx) {
+        try {
+            _get_field(ctx, field.get_array_element(idx), args);
+        } catch (const Error &e) {
+            api::reply_with_error(ctx, e);
+        }
     }
 }
 
-void GetCommand::_get_array_element(RedisModuleCtx *ctx,
-        const ConstFieldRef &field,
-        Args::Format format) const {
+bool GetCommand::_get_scalar_array(RedisModuleCtx *ctx, const ConstFieldRef &field) const {
+    assert(field.is_array() && !field.is_array_element());
+
+    auto begin = field.range_begin();
+    auto size = field.size();
+
     switch (field.type()) {
-    case gp::FieldDescriptor::CPPTYPE_INT32: {
-        auto val = field.get_repeated_int32();
-        RedisModule_ReplyWithLongLong(ctx, val);
+    case gp::FieldDescriptor::CPPTYPE_INT32:
+        reply_with_integers(ctx, field.get_repeated_field<int32_t>(), begin, size);
         break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_INT64: {
-        auto val = field.get_repeated_int64();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_UINT32: {
-        auto val = field.get_repeated_uint32();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_UINT64: {
-        auto val = field.get_repeated_uint64();
-        RedisModule_ReplyWithLongLong(ctx, val);
+
+    case gp::FieldDescriptor::CPPTYPE_INT64:
+        reply_with_integers(ctx, field.get_repeated_field<int64_t>(), begin, size);
         break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_DOUBLE: {
-        auto val = field.get_repeated_double();
-        auto str = std::to_string(val);
-        RedisModule_ReplyWithSimpleString(ctx, str.data());
+
+    case gp::FieldDescriptor::CPPTYPE_UINT32:
+        reply_with_integers(ctx, field.get_repeated_field<uint32_t>(), begin, size);
         break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_FLOAT: {
-        auto val = field.get_repeated_float();
-        auto str = std::to_string(val);
-        RedisModule_ReplyWithSimpleString(ctx, str.data());
+
+    case gp::FieldDescriptor::CPPTYPE_UINT64:
+        reply_with_integers(ctx, field.get_repeated_field<uint64_t>(), begin, size);
         break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_BOOL: {
-        auto val = field.get_repeated_bool();
-        RedisModule_ReplyWithLongLong(ctx, val);
+
+    case gp::FieldDescriptor::CPPTYPE_BOOL:
+        reply_with_integers(ctx, field.get_repeated_field<bool>(), begin, size);
         break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_ENUM: {
-        auto val = field.get_repeated_enum();
-        RedisModule_ReplyWithLongLong(ctx, val);
+
+    case gp::FieldDescriptor::CPPTYPE_ENUM:
+        reply_with_integers(ctx, field.get_repeated_field<int>(), begin, size);
         break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_STRING: {
-        const auto &val = field.get_repeated_string();
-        RedisModule_ReplyWithStringBuffer(ctx, val.data(), val.size());
+
+    case gp::FieldDescriptor::CPPTYPE_DOUBLE:
+        reply_with_floatings(ctx, field.get_repeated_field<double>(), begin, size);
         break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_MESSAGE: {
-        _get_msg(ctx, field.get_repeated_msg(), format);
+
+    case gp::FieldDescriptor::CPPTYPE_FLOAT:
+        reply_with_floatings(ctx, field.get_repeated_field<float>(), begin, size);
         break;
-    }
+
     default:
-        assert(false);
+        // String and message arrays are replied element by element.
+        return false;
     }
+
+    return true;
 }
 
-void GetCommand::_get_array(RedisModuleCtx *ctx,
+void GetCommand::_get_map(RedisModuleCtx *ctx,
         const ConstFieldRef &field,
-        Args::Format format) const {
+        const Args &args) const {
+    if (args.flat && field.map_value_type() == gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+        _get_flat_map(ctx, field, args);
+        return;
+    }
+
     auto arr_size = field.size();
 
     RedisModule_ReplyWithArray(ctx, arr_size);
 
-    for (auto idx = 0; idx != arr_size; ++idx) {
+    auto range = field.get_map_range();
+    for (auto iter = range.first; iter != range.second; ++iter) {
+        const auto &key = iter->first;
+        const auto &val = iter->second;
+
         try {
-            _get_field(ctx, field.get_array_element(idx), format);
+            _get_map_kv(ctx, field, args, key, val);
         } catch (const Error &e) {
             api::reply_with_error(ctx, e);
         }
     }
 }
 
-void GetCommand::_get_map_element(RedisModuleCtx *ctx,
+void GetCommand::_get_flat_array(RedisModuleCtx *ctx,
         const ConstFieldRef &field,
-        Args::Format format) const {
-    switch (field.map_value_type()) {
-    case gp::FieldDescriptor::CPPTYPE_INT32: {
-        auto val = field.get_mapped_int32();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_INT64: {
-        auto val = field.get_mapped_int64();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_UINT32: {
-        auto val = field.get_mapped_uint32();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_UINT64: {
-        auto val = field.get_mapped_uint64();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_DOUBLE: {
-        auto val = field.get_mapped_double();
-        auto str = std::to_string(val);
-        RedisModule_ReplyWithSimpleString(ctx, str.data());
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_FLOAT: {
-        auto val = field.get_mapped_float();
-        auto str = std::to_string(val);
-        RedisModule_ReplyWithSimpleString(ctx, str.data());
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_BOOL: {
-        auto val = field.get_mapped_bool();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
-    }
-    case gp::FieldDescriptor::CPPTYPE_ENUM: {
-        auto val = field.get_mapped_enum();
-        RedisModule_ReplyWithLongLong(ctx, val);
+        const Args &args) const {
+    auto size = field.size();
+
+    std::string buf;
+    switch (args.format) {
+    case Args::Format::BINARY: {
+        LatencyTimer timer(Phase::SERIALIZE);
+
+        // The streams must be destroyed before replying, so that *buf* is trimmed to size.
+        gp::io::StringOutputStream output(&buf);
+        gp::io::CodedOutputStream coded(&output);
+        for (auto idx = 0; idx != size; ++idx) {
+            write_delimited(field.get_array_element(idx).get_repeated_msg(), coded);
+        }
+
+        if (coded.HadError()) {
+            throw Error("failed to serialize message to binary string");
+        }
         break;
     }
-    case gp::FieldDescriptor::CPPTYPE_STRING: {
-        const auto &val = field.get_mapped_string();
-        RedisModule_ReplyWithStringBuffer(ctx, val.data(), val.size());
+
+    case Args::Format::JSON: {
+        // Serialized form of each message, whose buffer is reused.
+        std::string binary;
+
+        buf.push_back('[');
+        for (auto idx = 0; idx != size; ++idx) {
+            if (idx > 0) {
+                buf.push_back(',');
+            }
+
+            const auto &msg = field.get_array_element(idx).get_repeated_msg();
+            append_json(msg, args.json_opts, binary, buf);
+        }
+        buf.push_back(']');
         break;
     }
-    case gp::FieldDescriptor::CPPTYPE_MESSAGE: {
-        _get_msg(ctx, field.get_mapped_msg(), format);
+
+    case Args::Format::NONE:
+        throw Error("option --FORMAT not specified");
         break;
-    }
+
     default:
         assert(false);
     }
+
+    RedisModule_ReplyWithStringBuffer(ctx, buf.data(), buf.size());
 }
 
-void GetCommand::_get_map(RedisModuleCtx *ctx,
+void GetCommand::_get_flat_map(RedisModuleCtx *ctx,
         const ConstFieldRef &field,
-        Args::Format format) const {
-    auto arr_size = field.size();
-
-    RedisModule_ReplyWithArray(ctx, arr_size);
+        const Args &args) const {
+    const auto *key_desc = field.descriptor()->message_type()->FindFieldByName("key");
+    assert(key_desc != nullptr);
 
     auto range = field.get_map_range();
-    for (auto iter = range.first; iter != range.second; ++iter) {
-        const auto &key = iter->first;
-        const auto &val = iter->second;
 
-        try {
-            _get_map_kv(ctx, field, format, key, val);
-        } catch (const Error &e) {
-            api::reply_with_error(ctx, e);
+    std::string buf;
+    switch (args.format) {
+    case Args::Format::BINARY: {
+        LatencyTimer timer(Phase::SERIALIZE);
+
+        // Encoded key of each entry, whose buffer is reused.
+        std::string key;
+
+        gp::io::StringOutputStream output(&buf);
+        gp::io::CodedOutputStream coded(&output);
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            key.clear();
+            encode_map_key(*key_desc, iter->first, key);
+
+            const auto &msg = iter->second.GetMessageValue();
+            auto msg_size = byte_size(msg);
+
+            // Key, tag of the value, size of the value, and the value.
+            auto entry_size = key.size() + 1 + gp::io::CodedOutputStream::VarintSize32(msg_size)
+                + msg_size;
+            if (entry_size > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+                throw Error("map entry is too large");
+            }
+
+            coded.WriteVarint32(entry_size);
+            coded.WriteRaw(key.data(), key.size());
+            coded.WriteTag(gp::internal::WireFormatLite::MakeTag(2,
+                        gp::internal::WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+            coded.WriteVarint32(msg_size);
+            msg.SerializeWithCachedSizes(&coded);
+        }
+
+        if (coded.HadError()) {
+            throw Error("failed to serialize message to binary string");
         }
+        break;
+    }
+
+    case Args::Format::JSON: {
+        std::string binary;
+
+        buf.push_back('{');
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            if (iter != range.first) {
+                buf.push_back(',');
+            }
+
+            // Keys of JSON maps are always strings.
+            append_json_string(map_key_to_string(iter->first), buf);
+            buf.push_back(':');
+
+            append_json(iter->second.GetMessageValue(), args.json_opts, binary, buf);
+        }
+        buf.push_back('}');
+        break;
+    }
+
+    case Args::Format::NONE:
+        throw Error("option --FORMAT not specified");
+        break;
+
+    default:
+        assert(false);
     }
+
+    RedisModule_ReplyWithStringBuffer(ctx, buf.data(), buf.size());
 }
 
 void GetCommand::_get_map_kv(RedisModuleCtx *ctx,
         const ConstFieldRef &field,
-        Args::Format format,
+        const Args &args,
         const gp::MapKey &key,
         const gp::MapValueRef &value) const {
     RedisModule_ReplyWithArray(ctx, 2);
@@ -405,84 +691,260 @@ void GetCommand::_get_map_kv(RedisModuleCtx *ctx,
         assert(false);
     }
 
-    // Reply with value.
-    switch (field.map_value_type()) {
-    case gp::FieldDescriptor::CPPTYPE_INT32: {
-        auto val = value.GetInt32Value();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
+    _get_mapped_value(ctx, field, args, value);
+}
+
+void GetCommand::_get_mapped_value(RedisModuleCtx *ctx,
+        const ConstFieldRef &field,
+        const Args &args,
+        const gp::MapValueRef &value) const {
+    const auto &accessor = field.accessor();
+    if (accessor.type == gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+        _get_msg(ctx, value.GetMessageValue(), args);
+    } else {
+        accessor.reply_mapped(ctx, value);
     }
-    case gp::FieldDescriptor::CPPTYPE_INT64: {
-        auto val = value.GetInt64Value();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
+}
+
+void GetCommand::_reply_with_nil(RedisModuleCtx *ctx) const {
+    RedisModule_ReplyWithNull(ctx);
+}
+
+void GetCommand::_reply_with_msg(RedisModuleCtx *ctx,
+        gp::Message &msg,
+        const Args &args) const {
+    const auto &paths = args.paths;
+    if (paths.size() == 1) {
+        return _reply_with_path(ctx, msg, paths.front(), args);
     }
-    case gp::FieldDescriptor::CPPTYPE_UINT32: {
-        auto val = value.GetUInt32Value();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
+
+    // The key is looked up once for all paths, and each path is resolved
+    // with its cached descriptors.
+    RedisModule_ReplyWithArray(ctx, paths.size());
+
+    for (const auto &path : paths) {
+        try {
+            _reply_with_path(ctx, msg, path, args);
+        } catch (const Error &e) {
+            api::reply_with_error(ctx, e);
+        }
     }
-    case gp::FieldDescriptor::CPPTYPE_UINT64: {
-        auto val = value.GetUInt64Value();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
+}
+
+bool GetCommand::_reply_with_wire(RedisModuleCtx *ctx,
+        const ProtoValue &value,
+        const Args &args) const {
+    if (args.paths.size() != 1) {
+        return false;
+    }
+
+    const auto &path = args.paths.front();
+    if (value.descriptor()->full_name() != path.type()) {
+        return false;
+    }
+
+    if (args.format == Args::Format::JSON) {
+        return _reply_with_wire_json(ctx, value, args);
+    }
+
+    if (value.parsed()) {
+        if (args.format != Args::Format::BINARY
+                || !path.empty()
+                || !RedisProtobuf::instance().options().cache_serialized) {
+            return false;
+        }
+
+        // Serialize it only if it has been modified since the last read.
+        const auto &serialized = value.cache_serialized();
+        RedisModule_ReplyWithStringBuffer(ctx, serialized.data(), serialized.size());
+
+        return true;
+    }
+
+    // Scalar fields are replied in the same way with or without --FORMAT,
+    // while a message can only be replied with its wire bytes in BINARY format.
+    PathFieldsPtr fields;
+    if (!path.empty()) {
+        fields = path.resolve(*value.descriptor());
+    }
+
+    if ((fields == nullptr || fields->back().desc->cpp_type() == gp::FieldDescriptor::CPPTYPE_MESSAGE)
+            && args.format != Args::Format::BINARY) {
+        return false;
+    }
+
+    const auto &wire = value.wire();
+
+    if (fields == nullptr) {
+        RedisModule_ReplyWithStringBuffer(ctx, wire.data(), wire.size());
+
+        return true;
+    }
+
+    if (!WireScanner::scannable(*fields)) {
+        return false;
+    }
+
+    _reply_with_wire_field(ctx, *(fields->back().desc), WireScanner(*fields).scan(wire));
+
+    return true;
+}
+
+bool GetCommand::_reply_with_wire_json(RedisModuleCtx *ctx,
+        const ProtoValue &value,
+        const Args &args) const {
+    if (!args.paths.front().empty()) {
+        return false;
+    }
+
+    // Decompress a compressed value, instead of parsing it.
+    const auto *binary = value.parsed() ? value.serialized() : &value.wire();
+    if (binary == nullptr) {
+        return false;
     }
+
+    auto json = util::binary_to_json(*value.descriptor(), *binary, args.json_opts);
+    RedisModule_ReplyWithStringBuffer(ctx, json.data(), json.size());
+
+    return true;
+}
+
+void GetCommand::_reply_with_wire_field(RedisModuleCtx *ctx,
+        const gp::FieldDescriptor &desc,
+        const WireField &field) const {
+    // Reply in the same way as CppTypeTraits, see field_accessor.h.
+    switch (desc.cpp_type()) {
+    case gp::FieldDescriptor::CPPTYPE_INT32:
+    case gp::FieldDescriptor::CPPTYPE_INT64:
+    case gp::FieldDescriptor::CPPTYPE_BOOL:
+    case gp::FieldDescriptor::CPPTYPE_ENUM:
+        RedisModule_ReplyWithLongLong(ctx, field.int_val);
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_UINT32:
+    case gp::FieldDescriptor::CPPTYPE_UINT64:
+        RedisModule_ReplyWithLongLong(ctx, field.uint_val);
+        break;
+
     case gp::FieldDescriptor::CPPTYPE_DOUBLE: {
-        auto val = value.GetDoubleValue();
-        auto str = std::to_string(val);
+        auto str = std::to_string(field.double_val);
         RedisModule_ReplyWithSimpleString(ctx, str.data());
         break;
     }
     case gp::FieldDescriptor::CPPTYPE_FLOAT: {
-        auto val = value.GetFloatValue();
-        auto str = std::to_string(val);
+        auto str = std::to_string(field.float_val);
         RedisModule_ReplyWithSimpleString(ctx, str.data());
         break;
     }
-    case gp::FieldDescriptor::CPPTYPE_BOOL: {
-        auto val = value.GetBoolValue();
-        RedisModule_ReplyWithLongLong(ctx, val);
+    case gp::FieldDescriptor::CPPTYPE_STRING:
+    case gp::FieldDescriptor::CPPTYPE_MESSAGE:
+        RedisModule_ReplyWithStringBuffer(ctx, field.bytes.data(), field.bytes.size());
         break;
+
+    default:
+        assert(false);
     }
-    case gp::FieldDescriptor::CPPTYPE_ENUM: {
-        auto val = value.GetEnumValue();
-        RedisModule_ReplyWithLongLong(ctx, val);
-        break;
+}
+
+bool GetCommand::_async_reply_with_msg(RedisModuleCtx *ctx,
+        gp::Message &msg,
+        const Args &args) const {
+    auto &module = RedisProtobuf::instance();
+    auto *pool = module.worker_pool();
+    if (pool == nullptr
+            || args.format != Args::Format::JSON
+            || args.paths.size() != 1
+            || !api::can_block(ctx)) {
+        return false;
     }
-    case gp::FieldDescriptor::CPPTYPE_STRING: {
-        auto val = value.GetStringValue();
-        RedisModule_ReplyWithStringBuffer(ctx, val.data(), val.size());
-        break;
+
+    const auto *target = _msg_at_path(msg, args.paths.front());
+    if (target == nullptr || target->ByteSizeLong() < module.options().async_json_threshold) {
+        return false;
     }
-    case gp::FieldDescriptor::CPPTYPE_MESSAGE: {
-        const auto &msg = value.GetMessageValue();
-        _get_msg(ctx, msg, format);
-        break;
+
+    // Snapshot the message, so that it can be modified or deleted by
+    // other clients, while the worker thread is converting the copy.
+    MsgUPtr snapshot(target->New());
+    snapshot->CopyFrom(*target);
+
+    api::block_and_run(ctx, *pool, AsyncTaskUPtr(new JsonGetTask(std::move(snapshot), args.json_opts)));
+
+    return true;
+}
+
+bool GetCommand::_async_reply_with_wire(RedisModuleCtx *ctx,
+        const ProtoValue &value,
+        const Args &args) const {
+    auto &module = RedisProtobuf::instance();
+    auto *pool = module.worker_pool();
+    if (pool == nullptr
+            || args.format != Args::Format::JSON
+            || args.paths.size() != 1
+            || !args.paths.front().empty()
+            || value.descriptor()->full_name() != args.paths.front().type()
+            || !api::can_block(ctx)) {
+        return false;
     }
-    default:
-        assert(false);
+
+    const auto *binary = value.parsed() ? value.serialized() : &value.wire();
+    if (binary == nullptr || binary->size() < module.options().async_json_threshold) {
+        return false;
     }
+
+    api::block_and_run(ctx, *pool,
+            AsyncTaskUPtr(new JsonGetTask(*value.descriptor(), *binary, args.json_opts)));
+
+    return true;
 }
 
-void GetCommand::_reply_with_nil(RedisModuleCtx *ctx) const {
-    RedisModule_ReplyWithNull(ctx);
+const gp::Message* GetCommand::_msg_at_path(gp::Message &msg, const Path &path) const {
+    if (msg.GetDescriptor()->full_name() != path.type()) {
+        // Let _reply_with_msg reply with the error.
+        return nullptr;
+    }
+
+    if (path.empty()) {
+        return &msg;
+    }
+
+    ConstFieldRef field(&msg, path);
+    if (field.is_map_element()) {
+        if (field.map_value_type() != gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+            return nullptr;
+        }
+
+        return &field.get_mapped_msg();
+    }
+
+    // Array elements are also of repeated fields, i.e. *is_array()* is true.
+    if (field.is_map() || (field.is_array() && !field.is_array_element())
+            || field.type() != gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+        return nullptr;
+    }
+
+    if (field.is_array_element()) {
+        return &field.get_repeated_msg();
+    }
+
+    return &field.get_msg();
 }
 
-void GetCommand::_reply_with_msg(RedisModuleCtx *ctx,
+void GetCommand::_reply_with_path(RedisModuleCtx *ctx,
         gp::Message &msg,
+        const Path &path,
         const Args &args) const {
-    const auto &path = args.path;
-    if (msg.GetTypeName() != path.type()) {
+    if (msg.GetDescriptor()->full_name() != path.type()) {
         throw Error("type mismatch");
     }
 
     if (path.empty()) {
         // Get the whole message.
-        return _get_msg(ctx, msg, args.format);
+        return _get_msg(ctx, msg, args);
     }
 
     // Get field.
-    _get_field(ctx, ConstFieldRef(&msg, path), args.format);
+    _get_field(ctx, ConstFieldRef(&msg, path), args);
 }
 
 }
@@ -18,8 +18,11 @@
 #define SEWENEW_REDISPROTOBUF_GET_COMMANDS_H
 
 #include "module_api.h"
+#include <vector>
 #include "utils.h"
 #include "field_ref.h"
+#include "proto_value.h"
+#include "wire_scanner.h"
 
 namespace sw {
 
@@ -27,18 +30,34 @@ namespace redis {
 
 namespace pb {
 
-// command: PB.GET key [--FORMAT BINARY|JSON] path
+// command: PB.GET key [--FORMAT BINARY|JSON] [--PRESERVE-FIELD-NAMES] [--PRINT-PRIMITIVES]
+//              [--ENUMS-AS-INTS] [--PRETTY] [--FLAT] path [path ...]
 // return:  If no path is specified, return the protobuf message of the key
 //          as a bulk string reply. If path is specified, return the value
 //          of the field specified with the path, and the reply type depends
-//          on the definition of the protobuf. If the key doesn't exist,
-//          return a nil reply.
+//          on the definition of the protobuf. If multiple paths are specified,
+//          return an array reply, and each element is the value of a path.
+//          If the key doesn't exist, return a nil reply.
 // error:   If the path doesn't exist, or type mismatch return an error reply.
+//          With multiple paths, errors of a path are returned as elements
+//          of the array reply.
 class GetCommand {
 public:
     int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
 
 private:
+    friend class MGetCommand;
+
+    friend class CMGetCommand;
+
+    friend class HMGetCommand;
+
+    friend class HScanCommand;
+
+    friend class LRangeCommand;
+
+    friend class ScanCommand;
+
     struct Args {
         RedisModuleString *key_name;
         
@@ -50,7 +69,14 @@ private:
 
         Format format = Format::NONE;
 
-        Path path;
+        // Options of converting messages to JSON, which are only used with Format::JSON.
+        util::JsonPrintOptions json_opts;
+
+        // Whether to reply with an array or a map of messages as a single
+        // string, instead of an array reply, see _get_flat_array.
+        bool flat = false;
+
+        std::vector<Path> paths;
     };
 
     Args _parse_args(RedisModuleString **argv, int argc) const;
@@ -59,45 +85,103 @@ private:
 
     Args::Format _parse_format(const StringView &format) const;
 
+    // Parse *opt* as an option of JSON format. Return false, if it's not a JSON option.
+    bool _parse_json_opt(const StringView &opt, util::JsonPrintOptions &json_opts) const;
+
     void _reply_with_nil(RedisModuleCtx *ctx) const;
 
     void _reply_with_msg(RedisModuleCtx *ctx,
             gp::Message &msg,
             const Args &args) const;
 
-    void _get_scalar_field(RedisModuleCtx *ctx,
-            const ConstFieldRef &field,
-            Args::Format format) const;
+    void _reply_with_path(RedisModuleCtx *ctx,
+            gp::Message &msg,
+            const Path &path,
+            const Args &args) const;
 
-    void _get_array_element(RedisModuleCtx *ctx,
-            const ConstFieldRef &field,
-            Args::Format format) const;
+    // If the value is lazy, try to reply with the serialized message, or
+    // a field scanned from it, without parsing the message. If the value is
+    // parsed, and --CACHE-SERIALIZED is enabled, reply with the cached
+    // serialized message. A whole message in JSON format is converted from
+    // the serialized message directly. Return true, if it has replied.
+    bool _reply_with_wire(RedisModuleCtx *ctx,
+            const ProtoValue &value,
+            const Args &args) const;
+
+    // Convert the serialized form of the whole message to JSON, without
+    // parsing it. Return false, if the value has no serialized form.
+    bool _reply_with_wire_json(RedisModuleCtx *ctx,
+            const ProtoValue &value,
+            const Args &args) const;
+
+    void _reply_with_wire_field(RedisModuleCtx *ctx,
+            const gp::FieldDescriptor &desc,
+            const WireField &field) const;
+
+    // If the JSON string of a large message is required, copy the message,
+    // and convert it to JSON in a worker thread. Return true, if the reply
+    // is deferred to the worker thread.
+    bool _async_reply_with_msg(RedisModuleCtx *ctx,
+            gp::Message &msg,
+            const Args &args) const;
+
+    // Same as *_async_reply_with_msg*, except that it converts a copy of the
+    // serialized message, if the value has one. See *_reply_with_wire_json*.
+    bool _async_reply_with_wire(RedisModuleCtx *ctx,
+            const ProtoValue &value,
+            const Args &args) const;
+
+    // Return the message at *path*, or nullptr if *path* is not a message.
+    const gp::Message* _msg_at_path(gp::Message &msg, const Path &path) const;
 
     void _get_array(RedisModuleCtx *ctx,
             const ConstFieldRef &field,
-            Args::Format format) const;
+            const Args &args) const;
 
-    void _get_map_element(RedisModuleCtx *ctx,
-            const ConstFieldRef &field,
-            Args::Format format) const;
+    // Reply with all elements of an array of numeric, boolean or enum type in
+    // a tight loop, instead of dispatching on the type of each element.
+    // Return false, if it's an array of other types.
+    bool _get_scalar_array(RedisModuleCtx *ctx, const ConstFieldRef &field) const;
 
     void _get_map(RedisModuleCtx *ctx,
             const ConstFieldRef &field,
-            Args::Format format) const;
+            const Args &args) const;
+
+    // Reply with an array of messages as a single bulk string, which is
+    // serialized into one buffer. With binary format, each message is
+    // prefixed with its size in varint, i.e. length-delimited. With JSON
+    // format, it's a JSON array of these messages.
+    void _get_flat_array(RedisModuleCtx *ctx,
+            const ConstFieldRef &field,
+            const Args &args) const;
+
+    // Same as *_get_flat_array*, except that with binary format, each element
+    // is a length-delimited map entry, i.e. a message with the key as field 1,
+    // and the value as field 2, and with JSON format, it's a JSON object.
+    void _get_flat_map(RedisModuleCtx *ctx,
+            const ConstFieldRef &field,
+            const Args &args) const;
 
     void _get_map_kv(RedisModuleCtx *ctx,
             const ConstFieldRef &field,
-            Args::Format format,
+            const Args &args,
             const gp::MapKey &key,
             const gp::MapValueRef &value) const;
 
+    // Reply with *value* of the map, which has been looked up, e.g. with
+    // ConstFieldRef::find_map_element.
+    void _get_mapped_value(RedisModuleCtx *ctx,
+            const ConstFieldRef &field,
+            const Args &args,
+            const gp::MapValueRef &value) const;
+
     void _get_msg(RedisModuleCtx *ctx,
             const gp::Message &msg,
-            Args::Format format) const;
+            const Args &args) const;
 
     void _get_field(RedisModuleCtx *ctx,
             const ConstFieldRef &field,
-            Args::Format format) const;
+            const Args &args) const;
 };
 
 }
@@ -0,0 +1,276 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "getrange_command.h"
+#include <cassert>
+#include <algorithm>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream.h>
+#include "errors.h"
+#include "redis_protobuf.h"
+#include "metrics.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+// Output stream that only keeps bytes whose offsets are in [begin, end), and
+// stops accepting bytes once all of them have been written. Bytes are written
+// into a small buffer, so that the whole serialized string is never kept.
+class RangeOutputStream : public gp::io::ZeroCopyOutputStream {
+public:
+    RangeOutputStream(std::size_t begin, std::size_t end, std::string &out) :
+        _begin(begin),
+        _end(end),
+        _out(out) {
+        assert(begin <= end);
+
+        _out.reserve(end - begin);
+    }
+
+    virtual bool Next(void **data, int *size) override {
+        _commit();
+
+        if (_pos >= _end) {
+            // No more bytes are needed, and the serialization fails fast.
+            return false;
+        }
+
+        *data = _buf;
+        *size = sizeof(_buf);
+        _len = sizeof(_buf);
+
+        return true;
+    }
+
+    virtual void BackUp(int count) override {
+        assert(count >= 0 && static_cast<std::size_t>(count) <= _len);
+
+        _len -= count;
+    }
+
+    virtual int64_t ByteCount() const override {
+        return static_cast<int64_t>(_pos + _len);
+    }
+
+    // Commit the last buffer. It must be called after the CodedOutputStream
+    // is destroyed, which backs up the unused bytes.
+    void flush() {
+        _commit();
+    }
+
+private:
+    void _commit() {
+        // Keep the overlap of [_pos, _pos + _len) and [_begin, _end).
+        auto lo = std::max(_pos, _begin);
+        auto hi = std::min(_pos + _len, _end);
+        if (lo < hi) {
+            _out.append(_buf + (lo - _pos), hi - lo);
+        }
+
+        _pos += _len;
+        _len = 0;
+    }
+
+    char _buf[8192];
+
+    std::size_t _begin;
+
+    std::size_t _end;
+
+    std::string &_out;
+
+    // Offset of *_buf*.
+    std::size_t _pos = 0;
+
+    // Number of bytes written to *_buf*.
+    std::size_t _len = 0;
+};
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int GetRangeCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+
+        auto key = api::open_key(ctx, args.key_name, api::KeyMode::READONLY);
+        if (!api::key_exists(key.get(), RedisProtobuf::instance().type())) {
+            RedisModule_ReplyWithStringBuffer(ctx, "", 0);
+        } else {
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
+
+            _reply_with_range(ctx, *value, args);
+        }
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+GetRangeCommand::Args GetRangeCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc != 5) {
+        throw WrongArityError();
+    }
+
+    Args args;
+    args.key_name = argv[1];
+    args.path = Path(argv[2]);
+
+    try {
+        args.start = util::sv_to_int64(argv[3]);
+        args.end = util::sv_to_int64(argv[4]);
+    } catch (const Error &e) {
+        throw Error("value is not an integer or out of range");
+    }
+
+    return args;
+}
+
+void GetRangeCommand::_reply_with_range(RedisModuleCtx *ctx,
+        const ProtoValue &value,
+        const Args &args) const {
+    const auto &path = args.path;
+    if (value.descriptor()->full_name() != path.type()) {
+        throw Error("type mismatch");
+    }
+
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    if (path.empty()
+            && (!value.parsed() || RedisProtobuf::instance().options().cache_serialized)) {
+        // Reply with bytes of the lazy value, or the cached serialized message directly.
+        const auto &wire = value.cache_serialized();
+        if (!_normalize(args, wire.size(), begin, end)) {
+            RedisModule_ReplyWithStringBuffer(ctx, "", 0);
+        } else {
+            RedisModule_ReplyWithStringBuffer(ctx, wire.data() + begin, end - begin);
+        }
+
+        return;
+    }
+
+    const auto &msg = _sub_msg(value.msg(), path);
+
+    // It also caches sizes of sub-messages, which are used by serialization.
+    auto size = msg.ByteSizeLong();
+    if (!_normalize(args, size, begin, end)) {
+        RedisModule_ReplyWithStringBuffer(ctx, "", 0);
+        return;
+    }
+
+    auto range = _serialize_range(msg, begin, end);
+
+    RedisModule_ReplyWithStringBuffer(ctx, range.data(), range.size());
+}
+
+const gp::Message& GetRangeCommand::_sub_msg(const gp::Message &msg, const Path &path) const {
+    if (path.empty()) {
+        return msg;
+    }
+
+    ConstFieldRef field(&msg, path);
+    if (field.is_map_element()) {
+        if (field.map_value_type() == gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+            return field.get_mapped_msg();
+        }
+    } else if (field.type() == gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+        if (field.is_array_element()) {
+            return field.get_repeated_msg();
+        } else if (!field.is_array()) {
+            return field.get_msg();
+        }
+    }
+
+    throw Error("not a message");
+}
+
+std::string GetRangeCommand::_serialize_range(const gp::Message &msg,
+        std::size_t begin,
+        std::size_t end) const {
+    LatencyTimer timer(Phase::SERIALIZE);
+
+    std::string range;
+    RangeOutputStream stream(begin, end, range);
+    {
+        gp::io::CodedOutputStream output(&stream);
+        msg.SerializeWithCachedSizes(&output);
+
+        // The stream stops accepting bytes after *end*, and the output
+        // reports an error, which is expected.
+    }
+
+    stream.flush();
+
+    if (range.size() != end - begin) {
+        throw Error("failed to serialize protobuf message of type " + msg.GetTypeName());
+    }
+
+    return range;
+}
+
+bool GetRangeCommand::_normalize(const Args &args,
+        std::size_t size,
+        std::size_t &begin,
+        std::size_t &end) const {
+    auto len = static_cast<int64_t>(size);
+    auto start = args.start;
+    auto stop = args.end;
+
+    // Same as Redis GETRANGE.
+    if (start < 0 && stop < 0 && start > stop) {
+        return false;
+    }
+
+    if (start < 0) {
+        start = std::max<int64_t>(start + len, 0);
+    }
+
+    if (stop < 0) {
+        stop = std::max<int64_t>(stop + len, 0);
+    }
+
+    stop = std::min(stop, len - 1);
+    if (len == 0 || start > stop) {
+        return false;
+    }
+
+    begin = static_cast<std::size_t>(start);
+    end = static_cast<std::size_t>(stop) + 1;
+
+    return true;
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,77 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_GETRANGE_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_GETRANGE_COMMANDS_H
+
+#include "module_api.h"
+#include <string>
+#include "utils.h"
+#include "field_ref.h"
+#include "proto_value.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.GETRANGE key path start end
+// return:  Bulk string reply: bytes of the serialized binary string of the
+//          message at path, whose offsets are in [start, end]. Same as Redis
+//          GETRANGE, negative offset counts from the end of the string, and
+//          out-of-range offsets are clamped. If the key doesn't exist, return
+//          an empty string.
+// error:   If the path doesn't exist, or it's not a message, or type mismatch,
+//          return an error reply.
+class GetRangeCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    struct Args {
+        RedisModuleString *key_name;
+        Path path;
+        int64_t start = 0;
+        int64_t end = -1;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    void _reply_with_range(RedisModuleCtx *ctx, const ProtoValue &value, const Args &args) const;
+
+    const gp::Message& _sub_msg(const gp::Message &msg, const Path &path) const;
+
+    // Serialize *msg*, and only keep bytes in [begin, end), so that memory
+    // usage is bounded by the size of the range, instead of the message.
+    std::string _serialize_range(const gp::Message &msg,
+            std::size_t begin,
+            std::size_t end) const;
+
+    // Convert [start, end] to [begin, end) with *size* bytes. Return false, if the range is empty.
+    bool _normalize(const Args &args,
+            std::size_t size,
+            std::size_t &begin,
+            std::size_t &end) const;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_GETRANGE_COMMANDS_H
@@ -0,0 +1,87 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "hexists_command.h"
+#include "errors.h"
+#include "redis_protobuf.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int HExistsCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+
+        auto key = api::open_key(ctx, args.key_name, api::KeyMode::READONLY);
+        if (!api::key_exists(key.get(), RedisProtobuf::instance().type())) {
+            RedisModule_ReplyWithLongLong(ctx, 0);
+        } else {
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
+
+            RedisModule_ReplyWithLongLong(ctx, _exists(value->msg(), args) ? 1 : 0);
+        }
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+HExistsCommand::Args HExistsCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc != 4) {
+        throw WrongArityError();
+    }
+
+    return {argv[1], Path(argv[2]), StringView(argv[3])};
+}
+
+bool HExistsCommand::_exists(gp::Message &msg, const Args &args) const {
+    const auto &path = args.path;
+    if (msg.GetDescriptor()->full_name() != path.type()) {
+        throw Error("type mismatch");
+    }
+
+    if (path.empty()) {
+        throw Error("not a map");
+    }
+
+    ConstFieldRef field(&msg, path);
+    if (!field.is_map() || field.is_map_element()) {
+        throw Error("not a map");
+    }
+
+    auto map_key = parse_map_key(*field.descriptor(), util::sv_to_string(args.map_key));
+
+    return field.find_map_element(map_key) != field.get_map_range().second;
+}
+
+}
+
+}
+
+}
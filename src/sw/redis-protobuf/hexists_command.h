@@ -0,0 +1,58 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_HEXISTS_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_HEXISTS_COMMANDS_H
+
+#include "module_api.h"
+#include "utils.h"
+#include "field_ref.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.HEXISTS key path map-key
+// return:  Integer reply: 1 if the map at path has the map key, 0 if it
+//          doesn't, or the key doesn't exist. It's a hash lookup, and the
+//          map is NOT iterated.
+// error:   If the path doesn't exist, or it's not a map, or the map key is
+//          invalid, or type mismatch, return an error reply.
+class HExistsCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    struct Args {
+        RedisModuleString *key_name;
+        Path path;
+        StringView map_key;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    bool _exists(gp::Message &msg, const Args &args) const;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_HEXISTS_COMMANDS_H
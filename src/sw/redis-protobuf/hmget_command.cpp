@@ -0,0 +1,119 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "hmget_command.h"
+#include "errors.h"
+#include "redis_protobuf.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int HMGetCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+
+        auto key = api::open_key(ctx, args.get_args.key_name, api::KeyMode::READONLY);
+        if (!api::key_exists(key.get(), RedisProtobuf::instance().type())) {
+            _get_cmd._reply_with_nil(ctx);
+        } else {
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
+
+            _reply_with_values(ctx, value->msg(), args);
+        }
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+HMGetCommand::Args HMGetCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc < 4) {
+        throw WrongArityError();
+    }
+
+    Args args;
+    args.get_args.key_name = argv[1];
+
+    auto pos = _get_cmd._parse_opts(argv, argc, args.get_args);
+
+    // At least one map key.
+    if (pos + 2 > argc) {
+        throw WrongArityError();
+    }
+
+    args.get_args.paths.emplace_back(argv[pos]);
+
+    args.map_keys.reserve(argc - pos - 1);
+    for (auto idx = pos + 1; idx != argc; ++idx) {
+        args.map_keys.emplace_back(argv[idx]);
+    }
+
+    return args;
+}
+
+void HMGetCommand::_reply_with_values(RedisModuleCtx *ctx,
+        gp::Message &msg,
+        const Args &args) const {
+    const auto &path = args.get_args.paths.front();
+    if (msg.GetDescriptor()->full_name() != path.type()) {
+        throw Error("type mismatch");
+    }
+
+    if (path.empty()) {
+        throw Error("not a map");
+    }
+
+    ConstFieldRef field(&msg, path);
+    if (!field.is_map() || field.is_map_element()) {
+        throw Error("not a map");
+    }
+
+    RedisModule_ReplyWithArray(ctx, args.map_keys.size());
+
+    auto end = field.get_map_range().second;
+    for (const auto &map_key : args.map_keys) {
+        try {
+            auto iter = field.find_map_element(parse_map_key(*field.descriptor(),
+                        util::sv_to_string(map_key)));
+            if (iter == end) {
+                _get_cmd._reply_with_nil(ctx);
+            } else {
+                _get_cmd._get_mapped_value(ctx, field, args.get_args, iter->second);
+            }
+        } catch (const Error &e) {
+            api::reply_with_error(ctx, e);
+        }
+    }
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,64 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_HMGET_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_HMGET_COMMANDS_H
+
+#include "module_api.h"
+#include <vector>
+#include "utils.h"
+#include "field_ref.h"
+#include "get_command.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.HMGET key [--FORMAT BINARY|JSON] path map-key [map-key ...]
+// return:  Array reply: for each map key, the value of the map at path, which
+//          is the same reply as PB.GET key path[map-key], or a nil reply if
+//          the map key doesn't exist. Each map key is a hash lookup, and the
+//          map is NOT iterated. If the key doesn't exist, return a nil reply.
+// error:   If the path doesn't exist, or it's not a map, or type mismatch,
+//          return an error reply. If a map key is invalid, e.g. not an integer
+//          for map<int32, string>, its element is an error reply.
+class HMGetCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    struct Args {
+        GetCommand::Args get_args;
+
+        std::vector<StringView> map_keys;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    void _reply_with_values(RedisModuleCtx *ctx, gp::Message &msg, const Args &args) const;
+
+    GetCommand _get_cmd;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_HMGET_COMMANDS_H
@@ -0,0 +1,359 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "hscan_command.h"
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "errors.h"
+#include "redis_protobuf.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+// A cursor is prefixed with 'K', so that it never equals to the start cursor,
+// i.e. "0". It's followed by the id of the snapshot, ':', and the last map key.
+const char CURSOR_PREFIX = 'K';
+
+// Max number of scans in progress, whose snapshots are kept.
+const std::size_t MAX_SCAN_SNAPSHOTS = 64;
+
+// Sorted map keys, taken when a scan starts.
+struct ScanSnapshot {
+    uint64_t id = 0;
+
+    // Db, key name and path of the map.
+    std::string target;
+
+    std::vector<gp::MapKey> keys;
+};
+
+// Snapshots of scans in progress, so that each call of PB.HSCAN only looks up
+// the keys it returns, instead of iterating the whole hash map. If there're too
+// many scans, the least recently used snapshot is evicted.
+class ScanSnapshots {
+public:
+    ScanSnapshot& create(std::string target, const ConstFieldRef &field);
+
+    // Return nullptr, if the snapshot has been evicted, or it's not of *target*.
+    ScanSnapshot* find(uint64_t id, const std::string &target);
+
+    void remove(uint64_t id);
+
+private:
+    using SnapshotList = std::list<ScanSnapshot>;
+
+    // The most recently used snapshot is at the front.
+    SnapshotList _snapshots;
+
+    std::unordered_map<uint64_t, SnapshotList::iterator> _index;
+
+    uint64_t _next_id = 1;
+};
+
+ScanSnapshots& scan_snapshots();
+
+std::string scan_target(RedisModuleCtx *ctx, const StringView &key_name, const StringView &path);
+
+void parse_cursor(const StringView &cursor,
+        const gp::FieldDescriptor &desc,
+        uint64_t &id,
+        gp::MapKey &key);
+
+std::string map_key_to_cursor(uint64_t id, const gp::MapKey &key);
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int HScanCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+
+        auto key = api::open_key(ctx, args.get_args.key_name, api::KeyMode::READONLY);
+        if (!api::key_exists(key.get(), RedisProtobuf::instance().type())) {
+            _reply_with_empty(ctx);
+        } else {
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
+
+            _scan(ctx, value->msg(), args);
+        }
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+HScanCommand::Args HScanCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc < 4) {
+        throw WrongArityError();
+    }
+
+    Args args;
+    args.get_args.key_name = argv[1];
+
+    auto pos = _get_cmd._parse_opts(argv, argc, args.get_args);
+    if (pos + 2 != argc && pos + 4 != argc) {
+        throw WrongArityError();
+    }
+
+    args.get_args.paths.emplace_back(argv[pos]);
+    args.path_str = StringView(argv[pos]);
+    args.cursor = StringView(argv[pos + 1]);
+
+    if (pos + 4 == argc) {
+        if (!util::str_case_equal(argv[pos + 2], "--COUNT")) {
+            throw Error("syntax error");
+        }
+
+        try {
+            args.count = util::sv_to_int64(argv[pos + 3]);
+        } catch (const Error &) {
+            throw Error("count is not an integer or out of range");
+        }
+
+        if (args.count <= 0) {
+            throw Error("count must be positive");
+        }
+    }
+
+    return args;
+}
+
+void HScanCommand::_scan(RedisModuleCtx *ctx, gp::Message &msg, const Args &args) const {
+    const auto &path = args.get_args.paths.front();
+    if (msg.GetDescriptor()->full_name() != path.type()) {
+        throw Error("type mismatch");
+    }
+
+    if (path.empty()) {
+        throw Error("not a map");
+    }
+
+    ConstFieldRef field(&msg, path);
+    if (!field.is_map() || field.is_map_element()) {
+        throw Error("not a map");
+    }
+
+    // Keys are scanned in sorted order from a snapshot, and each call resumes
+    // from the smallest key greater than the cursor. Unlike iterating the hash
+    // map, it's not affected by rehashing, or by deleting the key of the cursor.
+    auto &snapshots = scan_snapshots();
+    auto target = scan_target(ctx, StringView(args.get_args.key_name), args.path_str);
+
+    const auto &cursor = args.cursor;
+    ScanSnapshot *snapshot = nullptr;
+    std::size_t pos = 0;
+    if (cursor.size() == 1 && cursor.data()[0] == '0') {
+        snapshot = &snapshots.create(std::move(target), field);
+    } else {
+        uint64_t id = 0;
+        gp::MapKey last_key;
+        parse_cursor(cursor, *field.descriptor(), id, last_key);
+
+        snapshot = snapshots.find(id, target);
+        if (snapshot == nullptr) {
+            // The snapshot has been evicted, so take a new one.
+            snapshot = &snapshots.create(std::move(target), field);
+        }
+
+        const auto &keys = snapshot->keys;
+        pos = std::upper_bound(keys.begin(), keys.end(), last_key) - keys.begin();
+    }
+
+    const auto &keys = snapshot->keys;
+    auto end = keys.size();
+    if (static_cast<unsigned long long>(args.count) < end - pos) {
+        end = pos + static_cast<std::size_t>(args.count);
+    }
+
+    auto map_end = field.get_map_range().second;
+    std::vector<decltype(map_end)> elements;
+    for (auto idx = pos; idx != end; ++idx) {
+        auto iter = field.find_map_element(keys[idx]);
+        if (iter != map_end) {
+            // Otherwise, it has been deleted since the scan started.
+            elements.push_back(iter);
+        }
+    }
+
+    std::string next_cursor = "0";
+    if (end < keys.size()) {
+        next_cursor = map_key_to_cursor(snapshot->id, keys[end - 1]);
+    } else {
+        snapshots.remove(snapshot->id);
+    }
+
+    RedisModule_ReplyWithArray(ctx, 2);
+
+    RedisModule_ReplyWithStringBuffer(ctx, next_cursor.data(), next_cursor.size());
+
+    RedisModule_ReplyWithArray(ctx, elements.size());
+    for (const auto &element : elements) {
+        try {
+            _get_cmd._get_map_kv(ctx, field, args.get_args, element->first, element->second);
+        } catch (const Error &e) {
+            api::reply_with_error(ctx, e);
+        }
+    }
+}
+
+void HScanCommand::_reply_with_empty(RedisModuleCtx *ctx) const {
+    RedisModule_ReplyWithArray(ctx, 2);
+    RedisModule_ReplyWithStringBuffer(ctx, "0", 1);
+    RedisModule_ReplyWithArray(ctx, 0);
+}
+
+}
+
+}
+
+}
+
+namespace {
+
+ScanSnapshot& ScanSnapshots::create(std::string target, const ConstFieldRef &field) {
+    ScanSnapshot snapshot;
+    snapshot.id = _next_id++;
+    snapshot.target = std::move(target);
+
+    auto range = field.get_map_range();
+    for (auto iter = range.first; iter != range.second; ++iter) {
+        snapshot.keys.push_back(iter->first);
+    }
+
+    std::sort(snapshot.keys.begin(), snapshot.keys.end());
+
+    _snapshots.push_front(std::move(snapshot));
+    _index.emplace(_snapshots.front().id, _snapshots.begin());
+
+    if (_snapshots.size() > MAX_SCAN_SNAPSHOTS) {
+        _index.erase(_snapshots.back().id);
+        _snapshots.pop_back();
+    }
+
+    return _snapshots.front();
+}
+
+ScanSnapshot* ScanSnapshots::find(uint64_t id, const std::string &target) {
+    auto iter = _index.find(id);
+    if (iter == _index.end() || iter->second->target != target) {
+        return nullptr;
+    }
+
+    _snapshots.splice(_snapshots.begin(), _snapshots, iter->second);
+
+    return &_snapshots.front();
+}
+
+void ScanSnapshots::remove(uint64_t id) {
+    auto iter = _index.find(id);
+    if (iter == _index.end()) {
+        return;
+    }
+
+    _snapshots.erase(iter->second);
+    _index.erase(iter);
+}
+
+ScanSnapshots& scan_snapshots() {
+    // Commands run in the main thread.
+    static ScanSnapshots snapshots;
+
+    return snapshots;
+}
+
+std::string scan_target(RedisModuleCtx *ctx, const StringView &key_name, const StringView &path) {
+    // Prefix the key name with its length, so that different keys and paths
+    // never make the same target.
+    auto target = std::to_string(RedisModule_GetSelectedDb(ctx)) + ":"
+        + std::to_string(key_name.size()) + ":";
+    target.append(key_name.data(), key_name.size());
+    target.append(path.data(), path.size());
+
+    return target;
+}
+
+void parse_cursor(const StringView &cursor,
+        const gp::FieldDescriptor &desc,
+        uint64_t &id,
+        gp::MapKey &key) {
+    std::string str(cursor.data(), cursor.size());
+    auto colon = str.find(':');
+    if (str.empty() || str[0] != CURSOR_PREFIX || colon == std::string::npos) {
+        throw Error("invalid cursor");
+    }
+
+    try {
+        id = util::sv_to_uint64(StringView(str.data() + 1, colon - 1));
+        key = parse_map_key(desc, str.substr(colon + 1));
+    } catch (const Error &) {
+        throw Error("invalid cursor");
+    }
+}
+
+std::string map_key_to_cursor(uint64_t id, const gp::MapKey &key) {
+    auto cursor = CURSOR_PREFIX + std::to_string(id) + ":";
+
+    switch (key.type()) {
+    case gp::FieldDescriptor::CPPTYPE_INT32:
+        cursor += std::to_string(key.GetInt32Value());
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_INT64:
+        cursor += std::to_string(key.GetInt64Value());
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_UINT32:
+        cursor += std::to_string(key.GetUInt32Value());
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_UINT64:
+        cursor += std::to_string(key.GetUInt64Value());
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_BOOL:
+        cursor += key.GetBoolValue() ? "1" : "0";
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_STRING:
+        cursor += key.GetStringValue();
+        break;
+
+    default:
+        assert(false);
+    }
+
+    return cursor;
+}
+
+}
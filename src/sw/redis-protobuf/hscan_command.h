@@ -0,0 +1,79 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_HSCAN_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_HSCAN_COMMANDS_H
+
+#include "module_api.h"
+#include <string>
+#include "utils.h"
+#include "field_ref.h"
+#include "get_command.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.HSCAN key [--FORMAT BINARY|JSON] path cursor [--COUNT count]
+// return:  Array reply: the next cursor, and an array of at most *count*
+//          (10 by default) key-value pairs of the map at path, in the same
+//          format as PB.GET key path. Scan starts with cursor 0, and ends
+//          when the returned cursor is 0. Pairs are returned in the order of
+//          map keys, from a snapshot of the keys taken when the scan starts.
+//          The cursor has the id of the snapshot and the last scanned map key,
+//          and each call resumes from the smallest key greater than it, even
+//          if that key has been deleted. Pairs that exist during the whole scan
+//          are returned exactly once, and those added or deleted during the
+//          scan might or might not be returned. A call might return fewer than
+//          *count* pairs, if some have been deleted. Taking the snapshot costs
+//          O(N log(N)) for a map of N pairs, and each call costs O(count).
+//          If the key doesn't exist, return cursor 0 and an empty array.
+// error:   If the path doesn't exist, or it's not a map, or type mismatch,
+//          or the cursor is invalid, return an error reply.
+class HScanCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    struct Args {
+        GetCommand::Args get_args;
+
+        // Path of the map as it's in argv, which identifies the scan.
+        StringView path_str;
+
+        StringView cursor;
+
+        long long count = 10;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    void _scan(RedisModuleCtx *ctx, gp::Message &msg, const Args &args) const;
+
+    void _reply_with_empty(RedisModuleCtx *ctx) const;
+
+    GetCommand _get_cmd;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_HSCAN_COMMANDS_H
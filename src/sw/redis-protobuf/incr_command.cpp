@@ -0,0 +1,308 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "incr_command.h"
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <type_traits>
+#include "errors.h"
+#include "redis_protobuf.h"
+#include "metrics.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+using CppType = gp::FieldDescriptor::CppType;
+
+template <CppType T>
+using IsInteger = std::integral_constant<bool,
+        T == gp::FieldDescriptor::CPPTYPE_INT32
+        || T == gp::FieldDescriptor::CPPTYPE_INT64
+        || T == gp::FieldDescriptor::CPPTYPE_UINT32
+        || T == gp::FieldDescriptor::CPPTYPE_UINT64>;
+
+template <CppType T>
+using IsFloating = std::integral_constant<bool,
+        T == gp::FieldDescriptor::CPPTYPE_DOUBLE
+        || T == gp::FieldDescriptor::CPPTYPE_FLOAT>;
+
+class OverflowError : public Error {
+public:
+    OverflowError() : Error("increment or decrement would overflow") {}
+};
+
+template <typename T>
+T add(T cur, int64_t increment, std::true_type) {
+    // Signed integer.
+    auto min = static_cast<int64_t>(std::numeric_limits<T>::min());
+    auto max = static_cast<int64_t>(std::numeric_limits<T>::max());
+    auto val = static_cast<int64_t>(cur);
+    if ((increment > 0 && val > max - increment)
+            || (increment < 0 && val < min - increment)) {
+        throw OverflowError();
+    }
+
+    return static_cast<T>(val + increment);
+}
+
+template <typename T>
+T add(T cur, int64_t increment, std::false_type) {
+    // Unsigned integer.
+    auto max = static_cast<uint64_t>(std::numeric_limits<T>::max());
+    auto val = static_cast<uint64_t>(cur);
+    if (increment >= 0) {
+        auto delta = static_cast<uint64_t>(increment);
+        if (val > max - delta) {
+            throw OverflowError();
+        }
+
+        return static_cast<T>(val + delta);
+    } else {
+        // Absolute value of *increment* might be larger than the max value of int64_t.
+        auto delta = static_cast<uint64_t>(-(increment + 1)) + 1;
+        if (val < delta) {
+            throw OverflowError();
+        }
+
+        return static_cast<T>(val - delta);
+    }
+}
+
+template <CppType T>
+long long incr_int(MutableFieldRef &field, int64_t increment, std::true_type) {
+    using Type = typename CppTypeTraits<T>::Type;
+    auto is_signed = typename std::is_signed<Type>::type();
+
+    Type val = 0;
+    if (field.is_array_element()) {
+        val = add(field.get_repeated<T>(), increment, is_signed);
+        field.set_repeated<T>(val);
+    } else if (field.is_map_element()) {
+        // Like HINCRBY, a map element that doesn't exist is treated as 0.
+        auto cur = field.has_mapped_value() ? field.get_mapped<T>() : Type(0);
+        val = add(cur, increment, is_signed);
+        field.set_mapped<T>(val);
+    } else {
+        val = add(field.get<T>(), increment, is_signed);
+        field.set<T>(val);
+    }
+
+    return static_cast<long long>(val);
+}
+
+template <CppType T>
+long long incr_int(MutableFieldRef &, int64_t, std::false_type) {
+    throw Error("not an integer field");
+}
+
+template <CppType T>
+struct IncrInt {
+    static long long call(MutableFieldRef &field, int64_t increment) {
+        return incr_int<T>(field, increment, IsInteger<T>());
+    }
+};
+
+template <CppType T>
+std::string incr_float(MutableFieldRef &field, double increment, std::true_type) {
+    using Type = typename CppTypeTraits<T>::Type;
+
+    Type cur = 0;
+    if (field.is_array_element()) {
+        cur = field.get_repeated<T>();
+    } else if (field.is_map_element()) {
+        // Like HINCRBYFLOAT, a map element that doesn't exist is treated as 0.
+        if (field.has_mapped_value()) {
+            cur = field.get_mapped<T>();
+        }
+    } else {
+        cur = field.get<T>();
+    }
+
+    auto val = static_cast<Type>(cur + increment);
+    if (std::isnan(val) || std::isinf(val)) {
+        throw Error("increment would produce NaN or Infinity");
+    }
+
+    if (field.is_array_element()) {
+        field.set_repeated<T>(val);
+    } else if (field.is_map_element()) {
+        field.set_mapped<T>(val);
+    } else {
+        field.set<T>(val);
+    }
+
+    // So many digits are required to parse the string back to the same value.
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%.*g", std::numeric_limits<Type>::max_digits10, val);
+
+    return buf;
+}
+
+template <CppType T>
+std::string incr_float(MutableFieldRef &, double, std::false_type) {
+    throw Error("not a floating point field");
+}
+
+template <CppType T>
+struct IncrFloat {
+    static std::string call(MutableFieldRef &field, double increment) {
+        return incr_float<T>(field, increment, IsFloating<T>());
+    }
+};
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int IncrCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+        const auto &path = args.path;
+
+        auto key = api::open_key(ctx, args.key_name, api::KeyMode::WRITEONLY);
+        assert(key);
+
+        auto &module = RedisProtobuf::instance();
+
+        ProtoValueUPtr new_value;
+        ProtoValue *value = nullptr;
+        if (!api::key_exists(key.get(), module.type())) {
+            new_value = module.proto_factory()->create_value(path.type());
+            value = new_value.get();
+        } else {
+            value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
+
+            if (value->descriptor()->full_name() != path.type()) {
+                throw Error("type mismatch");
+            }
+        }
+
+        MutableFieldRef field(&(value->msg()), path);
+
+        long long int_val = 0;
+        std::string float_val;
+        {
+            LatencyTimer timer(Phase::MUTATE);
+
+            if (_floating) {
+                float_val = _incr_float(field, args.increment);
+            } else {
+                int_val = _incr_int(field, args.increment);
+            }
+        }
+
+        module.after_write(ctx, args.key_name, *value);
+
+        if (new_value) {
+            if (RedisModule_ModuleTypeSetValue(key.get(),
+                        module.type(),
+                        new_value.get()) != REDISMODULE_OK) {
+                throw Error("failed to set message");
+            }
+
+            new_value.release();
+        }
+
+        module.notify(ctx, _floating ? "incrbyfloat" : "incrby", args.key_name, path);
+
+        if (_floating) {
+            RedisModule_ReplyWithSimpleString(ctx, float_val.data());
+
+            // Like INCRBYFLOAT, replicate the result instead of the increment,
+            // so that replicas won't diverge due to different floating point precision.
+            RedisModule_Replicate(ctx, "PB.SET", "ssc",
+                    args.key_name, args.path_name, float_val.data());
+        } else {
+            RedisModule_ReplyWithLongLong(ctx, int_val);
+
+            RedisModule_ReplicateVerbatim(ctx);
+        }
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+IncrCommand::Args IncrCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc != 4) {
+        throw WrongArityError();
+    }
+
+    Args args;
+    args.key_name = argv[1];
+    args.path_name = argv[2];
+    args.path = Path(argv[2]);
+    if (args.path.empty()) {
+        throw Error("can only increment a numeric field");
+    }
+
+    args.increment = StringView(argv[3]);
+
+    return args;
+}
+
+long long IncrCommand::_incr_int(MutableFieldRef &field, const StringView &increment) const {
+    // Parse the increment before modifying the field.
+    auto type = _field_type(field);
+    auto delta = util::sv_to_int64(increment);
+
+    return dispatch<IncrInt>(type, field, delta);
+}
+
+std::string IncrCommand::_incr_float(MutableFieldRef &field, const StringView &increment) const {
+    auto type = _field_type(field);
+    auto delta = util::sv_to_double(increment);
+    if (std::isnan(delta) || std::isinf(delta)) {
+        throw Error("increment would produce NaN or Infinity");
+    }
+
+    return dispatch<IncrFloat>(type, field, delta);
+}
+
+gp::FieldDescriptor::CppType IncrCommand::_field_type(const MutableFieldRef &field) const {
+    if (field.is_map_element()) {
+        return field.map_value_type();
+    }
+
+    if (field.is_map() || (field.is_array() && !field.is_array_element())) {
+        throw Error("cannot increment the whole array or map");
+    }
+
+    return field.type();
+}
+
+}
+
+}
+
+}
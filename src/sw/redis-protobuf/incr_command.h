@@ -0,0 +1,86 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_INCR_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_INCR_COMMANDS_H
+
+#include "module_api.h"
+#include <string>
+#include "utils.h"
+#include "field_ref.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.INCRBY key path increment
+//          PB.INCRBYFLOAT key path increment
+// return:  PB.INCRBY: Integer reply: the value of the field after the increment.
+//          PB.INCRBYFLOAT: Simple string reply: the value of the field after the increment.
+// error:   If the path doesn't exist, or type mismatch, or the field is not an
+//          integer (PB.INCRBY) or floating point (PB.INCRBYFLOAT) field, or the
+//          result overflows, return an error reply, and the field is left unchanged.
+class IncrCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+protected:
+    explicit IncrCommand(bool floating) : _floating(floating) {}
+
+private:
+    struct Args {
+        RedisModuleString *key_name;
+        RedisModuleString *path_name;
+        Path path;
+        StringView increment;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    // Return the new value. Unsigned values are returned as is, i.e. cast to long long.
+    long long _incr_int(MutableFieldRef &field, const StringView &increment) const;
+
+    // Return the new value formatted as a string, which is precise enough
+    // to be parsed back to the same value.
+    std::string _incr_float(MutableFieldRef &field, const StringView &increment) const;
+
+    // Type of the field, or the type of the map value, if it's a map element.
+    gp::FieldDescriptor::CppType _field_type(const MutableFieldRef &field) const;
+
+    bool _floating;
+
+    friend class PatchCommand;
+};
+
+class IncrByCommand : public IncrCommand {
+public:
+    IncrByCommand() : IncrCommand(false) {}
+};
+
+class IncrByFloatCommand : public IncrCommand {
+public:
+    IncrByFloatCommand() : IncrCommand(true) {}
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_INCR_COMMANDS_H
@@ -0,0 +1,118 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "index_command.h"
+#include <cassert>
+#include "errors.h"
+#include "redis_protobuf.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int IndexCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+        assert(argv != nullptr);
+
+        if (argc < 2) {
+            throw WrongArityError();
+        }
+
+        auto sub_cmd = StringView(argv[1]);
+        if (util::str_case_equal(sub_cmd, "CREATE")) {
+            _create(ctx, argv, argc);
+        } else if (util::str_case_equal(sub_cmd, "DROP")) {
+            _drop(ctx, argv, argc);
+        } else if (util::str_case_equal(sub_cmd, "LIST")) {
+            _list(ctx, argc);
+        } else {
+            throw Error("unknown sub-command: " + util::sv_to_string(sub_cmd));
+        }
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+void IndexCommand::_create(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    if (argc != 4 && argc != 5) {
+        throw WrongArityError();
+    }
+
+    auto kind = FieldIndex::Kind::HASH;
+    auto pos = 3;
+    if (argc == 5) {
+        if (!util::str_case_equal(StringView(argv[3]), "--ORDERED")) {
+            throw Error("syntax error");
+        }
+
+        kind = FieldIndex::Kind::ORDERED;
+        ++pos;
+    }
+
+    auto &index = RedisProtobuf::instance().index_manager().create(ctx,
+            util::sv_to_string(StringView(argv[2])),
+            StringView(argv[pos]),
+            kind);
+
+    RedisModule_ReplyWithLongLong(ctx, index.size());
+}
+
+void IndexCommand::_drop(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    if (argc != 3) {
+        throw WrongArityError();
+    }
+
+    auto dropped = RedisProtobuf::instance().index_manager().drop(
+            util::sv_to_string(StringView(argv[2])));
+
+    RedisModule_ReplyWithLongLong(ctx, dropped ? 1 : 0);
+}
+
+void IndexCommand::_list(RedisModuleCtx *ctx, int argc) const {
+    if (argc != 2) {
+        throw WrongArityError();
+    }
+
+    const auto &indexes = RedisProtobuf::instance().index_manager().indexes();
+
+    RedisModule_ReplyWithArray(ctx, indexes.size());
+    for (const auto &ele : indexes) {
+        const auto &index = *(ele.second);
+
+        RedisModule_ReplyWithArray(ctx, 4);
+
+        RedisModule_ReplyWithStringBuffer(ctx, index.name().data(), index.name().size());
+        RedisModule_ReplyWithStringBuffer(ctx, index.path_str().data(), index.path_str().size());
+        RedisModule_ReplyWithSimpleString(ctx,
+                index.kind() == FieldIndex::Kind::HASH ? "HASH" : "ORDERED");
+        RedisModule_ReplyWithLongLong(ctx, index.size());
+    }
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,57 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_INDEX_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_INDEX_COMMANDS_H
+
+#include "module_api.h"
+#include <string>
+#include "utils.h"
+#include "field_index.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.INDEX CREATE name [--ORDERED] path
+//          PB.INDEX DROP name
+//          PB.INDEX LIST
+// return:  CREATE: Integer reply: number of existing keys that have been indexed.
+//          DROP: Integer reply: 1 if the index has been dropped, 0 if it doesn't exist.
+//          LIST: Array reply: name, path, kind and number of keys of each index.
+// error:   If the index already exists, or the path is not a singular scalar
+//          field, return an error reply.
+class IndexCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    void _create(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+    void _drop(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+    void _list(RedisModuleCtx *ctx, int argc) const;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_INDEX_COMMANDS_H
@@ -0,0 +1,149 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "info_command.h"
+#include "errors.h"
+#include "stats_command.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int InfoCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        _parse_args(argv, argc);
+
+        RedisModule_ReplyWithArray(ctx, 4);
+
+        _reply_with_section(ctx, "commands", _command_latencies());
+
+        _reply_with_section(ctx, "phases", _phase_latencies());
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+void InfoCommand::info(RedisModuleInfoCtx *ctx, int /*for_crash_report*/) {
+    // INFO APIs are available, since the callback has been registered.
+    assert(ctx != nullptr);
+
+    _info_latencies(ctx, "commands", _command_latencies());
+
+    _info_latencies(ctx, "phases", _phase_latencies());
+
+    for (const auto &section : StatsCommand().sections()) {
+        RedisModule_InfoAddSection(ctx, section.first.data());
+
+        for (const auto &metric : section.second) {
+            RedisModule_InfoAddFieldLongLong(ctx, metric.first.data(), metric.second);
+        }
+    }
+}
+
+void InfoCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc != 1) {
+        throw WrongArityError();
+    }
+}
+
+InfoCommand::Latency InfoCommand::_latency(const LatencyHistogram &histogram) {
+    auto snapshot = histogram.snapshot();
+
+    return {
+        {"calls", snapshot.count},
+        {"total_ns", snapshot.total_ns},
+        {"p50_ns", snapshot.percentile(0.5)},
+        {"p90_ns", snapshot.percentile(0.9)},
+        {"p99_ns", snapshot.percentile(0.99)},
+        {"p999_ns", snapshot.percentile(0.999)},
+        {"max_ns", snapshot.max_ns}
+    };
+}
+
+InfoCommand::Section InfoCommand::_command_latencies() {
+    Section section;
+    for (const auto &command : Metrics::instance().commands()) {
+        section.emplace_back(command.first, _latency(*command.second));
+    }
+
+    return section;
+}
+
+InfoCommand::Section InfoCommand::_phase_latencies() {
+    auto &metrics = Metrics::instance();
+
+    Section section;
+    for (auto idx = 0; idx != static_cast<int>(Phase::NUM_PHASES); ++idx) {
+        auto phase = static_cast<Phase>(idx);
+        section.emplace_back(phase_name(phase), _latency(metrics.phase(phase)));
+    }
+
+    return section;
+}
+
+void InfoCommand::_info_latencies(RedisModuleInfoCtx *ctx,
+        const std::string &name,
+        const Section &section) {
+    RedisModule_InfoAddSection(ctx, name.data());
+
+    // Each latency is shown as a dict field, e.g. PB.GET:calls=10,total_ns=...
+    for (const auto &latency : section) {
+        RedisModule_InfoBeginDictField(ctx, latency.first.data());
+
+        for (const auto &metric : latency.second) {
+            RedisModule_InfoAddFieldLongLong(ctx, metric.first.data(), metric.second);
+        }
+
+        RedisModule_InfoEndDictField(ctx);
+    }
+}
+
+void InfoCommand::_reply_with_section(RedisModuleCtx *ctx,
+        const std::string &name,
+        const Section &section) const {
+    RedisModule_ReplyWithSimpleString(ctx, name.data());
+
+    RedisModule_ReplyWithArray(ctx, section.size() * 2);
+
+    for (const auto &latency : section) {
+        RedisModule_ReplyWithSimpleString(ctx, latency.first.data());
+
+        RedisModule_ReplyWithArray(ctx, latency.second.size() * 2);
+
+        for (const auto &metric : latency.second) {
+            RedisModule_ReplyWithSimpleString(ctx, metric.first.data());
+            RedisModule_ReplyWithLongLong(ctx, metric.second);
+        }
+    }
+}
+
+}
+
+}
+
+}
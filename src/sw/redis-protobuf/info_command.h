@@ -0,0 +1,74 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_INFO_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_INFO_COMMANDS_H
+
+#include "module_api.h"
+#include <string>
+#include <utility>
+#include <vector>
+#include "metrics.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.INFO
+// return:  Array reply: return latencies of the module as pairs of section
+//          name and section. There're two sections, i.e. *commands* and
+//          *phases*. Each section is an array of pairs of command or phase
+//          name and its latency, which is an array of metric name and integer
+//          value pairs.
+class InfoCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+    // Callback of INFO. It shows latencies and statistics of PB.STATS as
+    // sections of INFO, e.g. PB_commands, PB_phases and PB_path_cache.
+    static void info(RedisModuleInfoCtx *ctx, int for_crash_report);
+
+private:
+    using Latency = std::vector<std::pair<std::string, long long>>;
+
+    using Section = std::vector<std::pair<std::string, Latency>>;
+
+    void _parse_args(RedisModuleString **argv, int argc) const;
+
+    static Latency _latency(const LatencyHistogram &histogram);
+
+    static Section _command_latencies();
+
+    static Section _phase_latencies();
+
+    static void _info_latencies(RedisModuleInfoCtx *ctx,
+            const std::string &name,
+            const Section &section);
+
+    void _reply_with_section(RedisModuleCtx *ctx,
+            const std::string &name,
+            const Section &section) const;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_INFO_COMMANDS_H
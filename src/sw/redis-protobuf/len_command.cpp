@@ -20,6 +20,35 @@
 #include "utils.h"
 #include "field_ref.h"
 
+namespace {
+
+using namespace sw::redis::pb;
+
+// Length of a singular field of C++ type *T*.
+template <gp::FieldDescriptor::CppType T>
+struct FieldLen {
+    static long long call(const ConstFieldRef &) {
+        throw Error("cannot get length of this field");
+    }
+};
+
+template <>
+struct FieldLen<gp::FieldDescriptor::CPPTYPE_STRING> {
+    static long long call(const ConstFieldRef &field) {
+        // TODO: use GetStringReference instead.
+        return field.get<gp::FieldDescriptor::CPPTYPE_STRING>().size();
+    }
+};
+
+template <>
+struct FieldLen<gp::FieldDescriptor::CPPTYPE_MESSAGE> {
+    static long long call(const ConstFieldRef &field) {
+        return field.get_msg().ByteSizeLong();
+    }
+};
+
+}
+
 namespace sw {
 
 namespace redis {
@@ -36,10 +65,10 @@ int LenCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) con
         if (!api::key_exists(key.get(), RedisProtobuf::instance().type())) {
             RedisModule_ReplyWithLongLong(ctx, 0);
         } else {
-            auto *msg = api::get_msg_by_key(key.get());
-            assert(msg != nullptr);
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
 
-            auto len = _len(*msg, args.path);
+            auto len = _len(*value, args.path);
             RedisModule_ReplyWithLongLong(ctx, len);
         }
 
@@ -61,17 +90,26 @@ LenCommand::Args LenCommand::_parse_args(RedisModuleString **argv, int argc) con
     return {argv[1], Path(argv[2])};
 }
 
-long long LenCommand::_len(gp::Message &msg, const Path &path) const {
-    if (msg.GetTypeName() != path.type()) {
+long long LenCommand::_len(ProtoValue &value, const Path &path) const {
+    if (value.descriptor()->full_name() != path.type()) {
         throw Error("type mismatch");
     }
 
     if (path.empty()) {
         // Return the length of the message.
-        return msg.ByteSizeLong();
+        if (value.compressed() != nullptr) {
+            return value.raw_size();
+        }
+
+        const auto *serialized = value.serialized();
+        if (serialized != nullptr) {
+            return serialized->size();
+        }
+
+        return value.msg().ByteSizeLong();
     }
 
-    return _len(ConstFieldRef(&msg, path));
+    return _len(ConstFieldRef(&(value.msg()), path));
 }
 
 long long LenCommand::_len(const ConstFieldRef &field) const {
@@ -80,17 +118,7 @@ long long LenCommand::_len(const ConstFieldRef &field) const {
     }
 
     // Scalar type.
-    switch (field.type()) {
-    case gp::FieldDescriptor::CPPTYPE_MESSAGE:
-        return field.get_msg().ByteSizeLong();
-
-    case gp::FieldDescriptor::CPPTYPE_STRING:
-        // TODO: use GetStringReference instead.
-        return field.get_string().size();
-
-    default:
-        throw Error("cannot get length of this field");
-    }
+    return dispatch<FieldLen>(field.type(), field);
 }
 
 }
@@ -20,6 +20,7 @@
 #include "module_api.h"
 #include "utils.h"
 #include "field_ref.h"
+#include "proto_value.h"
 
 namespace sw {
 
@@ -47,7 +48,7 @@ private:
 
     Args _parse_args(RedisModuleString **argv, int argc) const;
 
-    long long _len(gp::Message &msg, const Path &path) const;
+    long long _len(ProtoValue &value, const Path &path) const;
 
     long long _len(const ConstFieldRef &field) const;
 };
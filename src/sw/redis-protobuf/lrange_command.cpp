@@ -0,0 +1,112 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "lrange_command.h"
+#include <limits>
+#include "errors.h"
+#include "redis_protobuf.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int LRangeCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+
+        auto key = api::open_key(ctx, args.get_args.key_name, api::KeyMode::READONLY);
+        if (!api::key_exists(key.get(), RedisProtobuf::instance().type())) {
+            RedisModule_ReplyWithArray(ctx, 0);
+        } else {
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
+
+            _reply_with_range(ctx, value->msg(), args);
+        }
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+LRangeCommand::Args LRangeCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc < 5) {
+        throw WrongArityError();
+    }
+
+    Args args;
+    args.get_args.key_name = argv[1];
+
+    auto pos = _get_cmd._parse_opts(argv, argc, args.get_args);
+    if (pos + 3 != argc) {
+        throw WrongArityError();
+    }
+
+    args.get_args.paths.emplace_back(argv[pos]);
+
+    try {
+        args.start = util::sv_to_int32(argv[pos + 1]);
+        args.stop = util::sv_to_int32(argv[pos + 2]);
+    } catch (const Error &e) {
+        throw Error("value is not an integer or out of range");
+    }
+
+    return args;
+}
+
+void LRangeCommand::_reply_with_range(RedisModuleCtx *ctx,
+        gp::Message &msg,
+        const Args &args) const {
+    const auto &path = args.get_args.paths.front();
+    if (path.empty()) {
+        throw Error("not an array");
+    }
+
+    ConstFieldRef field(&msg, path);
+    if (!field.is_array() || field.is_array_element()) {
+        throw Error("not an array");
+    }
+
+    // Convert the inclusive *stop* to the end of a half-open range.
+    auto stop = args.stop;
+    if (stop < 0) {
+        stop += field.size();
+    }
+
+    auto end = 0;
+    if (stop >= 0) {
+        end = stop < std::numeric_limits<int>::max() ? stop + 1 : stop;
+    }
+
+    _get_cmd._get_array(ctx, field.get_array_range(args.start, end), args.get_args);
+}
+
+}
+
+}
+
+}
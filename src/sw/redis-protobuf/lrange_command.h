@@ -0,0 +1,63 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_LRANGE_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_LRANGE_COMMANDS_H
+
+#include "module_api.h"
+#include "utils.h"
+#include "field_ref.h"
+#include "get_command.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.LRANGE key [--FORMAT BINARY|JSON] path start stop
+// return:  Array reply: elements of the array at path, whose indexes are
+//          in [start, stop]. Same as Redis LRANGE, negative index counts
+//          from the end of the array, and out-of-range indexes are clamped.
+//          If the key doesn't exist, return an empty array.
+// error:   If the path doesn't exist, or it's not an array, or type mismatch,
+//          return an error reply.
+class LRangeCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    struct Args {
+        GetCommand::Args get_args;
+
+        int start = 0;
+        int stop = -1;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    void _reply_with_range(RedisModuleCtx *ctx, gp::Message &msg, const Args &args) const;
+
+    GetCommand _get_cmd;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_LRANGE_COMMANDS_H
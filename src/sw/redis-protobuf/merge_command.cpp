@@ -17,6 +17,7 @@
 #include "merge_command.h"
 #include "errors.h"
 #include "redis_protobuf.h"
+#include "metrics.h"
 #include "utils.h"
 #include "field_ref.h"
 #include "set_command.h"
@@ -34,21 +35,39 @@ int MergeCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) c
         auto args = _parse_args(argv, argc);
 
         auto key = api::open_key(ctx, args.key_name, api::KeyMode::WRITEONLY);
-        if (!api::key_exists(key.get(), RedisProtobuf::instance().type())) {
+        auto &module = RedisProtobuf::instance();
+        if (!api::key_exists(key.get(), module.type())) {
             SetCommand set_cmd;
-            set_cmd._run(ctx, argv, argc);
+            auto set_args = set_cmd._parse_args(argv, argc);
+            Optional<std::string> binary;
+            auto res = set_cmd._run(ctx, set_args, binary);
 
-            return RedisModule_ReplyWithLongLong(ctx, 0);
+            RedisModule_ReplyWithLongLong(ctx, 0);
+
+            set_cmd._replicate(ctx, set_args, res, binary);
+
+            return REDISMODULE_OK;
         }
 
-        auto *msg = api::get_msg_by_key(key.get());
-        assert(msg != nullptr);
+        auto *value = api::get_value_by_key(key.get());
+        assert(value != nullptr);
 
-        _merge(args, *msg);
+        auto other = _merge(args, value->msg());
+        assert(other);
+
+        module.after_write(ctx, args.key_name, *value);
+        module.notify(ctx, "merge", args.key_name, args.path);
 
         RedisModule_ReplyWithLongLong(ctx, 1);
 
-        RedisModule_ReplicateVerbatim(ctx);
+        if (module.replicate_binary(args.val)) {
+            // Replicate the merged message in binary form, so that replicas don't parse JSON.
+            auto binary = util::msg_to_binary(*other);
+            RedisModule_Replicate(ctx, "PB.MERGE", "ssb",
+                    args.key_name, argv[2], binary.data(), binary.size());
+        } else {
+            RedisModule_ReplicateVerbatim(ctx);
+        }
 
         return REDISMODULE_OK;
     } catch (const WrongArityError &err) {
@@ -70,36 +89,42 @@ MergeCommand::Args MergeCommand::_parse_args(RedisModuleString **argv, int argc)
     return {argv[1], Path(argv[2]), StringView(argv[3])};
 }
 
-void MergeCommand::_merge(const Args &args, gp::Message &msg) const {
+MsgUPtr MergeCommand::_merge(const Args &args, gp::Message &msg) const {
+    LatencyTimer timer(Phase::MUTATE);
+
     const auto &path = args.path;
     if (path.empty()) {
-        _merge_msg(path.type(), args.val, msg);
+        return _merge_msg(path.type(), args.val, msg);
     } else {
-        _merge_sub_msg(path, args.val, msg);
+        return _merge_sub_msg(path, args.val, msg);
     }
 }
 
-void MergeCommand::_merge_msg(const std::string &type,
+MsgUPtr MergeCommand::_merge_msg(const std::string &type,
         const StringView &val,
         gp::Message &msg) const {
     if (type != msg.GetTypeName()) {
         throw Error("type mismatch");
     }
 
-    auto other = RedisProtobuf::instance().proto_factory()->create(type, val);
+    auto other = RedisProtobuf::instance().proto_factory()->create(*msg.GetDescriptor(), val);
     assert(other);
 
     msg.MergeFrom(*other);
+
+    return other;
 }
 
-void MergeCommand::_merge_sub_msg(const Path &path,
+MsgUPtr MergeCommand::_merge_sub_msg(const Path &path,
         const StringView &val,
         gp::Message &msg) const {
     MutableFieldRef field(&msg, path);
-    auto sub_msg = RedisProtobuf::instance().proto_factory()->create(field.msg_type(), val);
+    auto sub_msg = RedisProtobuf::instance().proto_factory()->create(field.msg_descriptor(), val);
     assert(sub_msg);
 
     field.merge(*sub_msg);
+
+    return sub_msg;
 }
 
 }
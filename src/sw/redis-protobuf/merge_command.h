@@ -46,11 +46,14 @@ private:
 
     Args _parse_args(RedisModuleString **argv, int argc) const;
 
-    void _merge(const Args &args, gp::Message &msg) const;
+    // Return the message that has been merged into *msg*.
+    MsgUPtr _merge(const Args &args, gp::Message &msg) const;
 
-    void _merge_msg(const std::string &type, const StringView &val, gp::Message &msg) const;
+    MsgUPtr _merge_msg(const std::string &type, const StringView &val, gp::Message &msg) const;
 
-    void _merge_sub_msg(const Path &path, const StringView &val, gp::Message &msg) const;
+    MsgUPtr _merge_sub_msg(const Path &path, const StringView &val, gp::Message &msg) const;
+
+    friend class PatchCommand;
 };
 
 }
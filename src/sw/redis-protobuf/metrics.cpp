@@ -0,0 +1,165 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "metrics.h"
+#include <cassert>
+#include <cmath>
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+LatencyHistogram::LatencyHistogram() {
+    for (auto &bucket : _buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+
+    _count.store(0, std::memory_order_relaxed);
+    _total_ns.store(0, std::memory_order_relaxed);
+    _max_ns.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    _buckets[_bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+    auto max = _max_ns.load(std::memory_order_relaxed);
+    while (ns > max && !_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot snapshot;
+    snapshot.count = _count.load(std::memory_order_relaxed);
+    snapshot.total_ns = _total_ns.load(std::memory_order_relaxed);
+    snapshot.max_ns = _max_ns.load(std::memory_order_relaxed);
+
+    snapshot.buckets.reserve(_BUCKETS);
+    for (const auto &bucket : _buckets) {
+        snapshot.buckets.push_back(bucket.load(std::memory_order_relaxed));
+    }
+
+    return snapshot;
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double p) const {
+    uint64_t total = 0;
+    for (auto cnt : buckets) {
+        total += cnt;
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    auto target = static_cast<uint64_t>(std::ceil(p * total));
+    if (target == 0) {
+        target = 1;
+    }
+
+    uint64_t cnt = 0;
+    for (std::size_t idx = 0; idx != buckets.size(); ++idx) {
+        cnt += buckets[idx];
+        if (cnt >= target) {
+            if (idx + 1 == buckets.size()) {
+                // The last bucket has no upper bound.
+                return max_ns;
+            }
+
+            auto bound = _bucket_upper_bound(idx);
+            return bound < max_ns ? bound : max_ns;
+        }
+    }
+
+    return max_ns;
+}
+
+std::size_t LatencyHistogram::_bucket(uint64_t ns) {
+    if (ns < _SUB_BUCKETS) {
+        return ns;
+    }
+
+    // Index of the most significant bit.
+    std::size_t magnitude = 63 - __builtin_clzll(ns);
+    if (magnitude >= _MAX_MAGNITUDE) {
+        return _BUCKETS - 1;
+    }
+
+    auto shift = magnitude - _SUB_BUCKET_BITS;
+    auto sub_bucket = (ns >> shift) - _SUB_BUCKETS;
+
+    return _SUB_BUCKETS + shift * _SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t LatencyHistogram::_bucket_upper_bound(std::size_t idx) {
+    assert(idx < _BUCKETS);
+
+    if (idx < _SUB_BUCKETS) {
+        return idx;
+    }
+
+    auto shift = (idx - _SUB_BUCKETS) / _SUB_BUCKETS;
+    auto sub_bucket = (idx - _SUB_BUCKETS) % _SUB_BUCKETS;
+    auto lower_bound = static_cast<uint64_t>(_SUB_BUCKETS + sub_bucket) << shift;
+
+    return lower_bound + (static_cast<uint64_t>(1) << shift) - 1;
+}
+
+const char* phase_name(Phase phase) {
+    switch (phase) {
+    case Phase::PARSE:
+        return "parse";
+
+    case Phase::RESOLVE:
+        return "resolve";
+
+    case Phase::MUTATE:
+        return "mutate";
+
+    case Phase::SERIALIZE:
+        return "serialize";
+
+    case Phase::COMPRESS:
+        return "compress";
+
+    case Phase::DECOMPRESS:
+        return "decompress";
+
+    default:
+        assert(false);
+        return "unknown";
+    }
+}
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+
+    return metrics;
+}
+
+LatencyHistogram& Metrics::add_command(const std::string &name) {
+    _commands.emplace_back(name, std::unique_ptr<LatencyHistogram>(new LatencyHistogram));
+
+    return *(_commands.back().second);
+}
+
+}
+
+}
+
+}
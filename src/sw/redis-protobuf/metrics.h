@@ -0,0 +1,195 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_METRICS_H
+#define SEWENEW_REDISPROTOBUF_METRICS_H
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// A lock-free latency histogram in the style of HdrHistogram. Each power-of-two
+// range of nanoseconds is split into 8 linear buckets, so that the relative
+// error of a percentile is at most 12.5%. It can be recorded from any thread.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram &) = delete;
+
+    LatencyHistogram(LatencyHistogram &&) = delete;
+    LatencyHistogram& operator=(LatencyHistogram &&) = delete;
+
+    ~LatencyHistogram() = default;
+
+    void record(uint64_t ns);
+
+    struct Snapshot {
+        uint64_t count = 0;
+
+        uint64_t total_ns = 0;
+
+        uint64_t max_ns = 0;
+
+        std::vector<uint64_t> buckets;
+
+        // Upper bound of the latency, below which *p* of the samples fall,
+        // e.g. percentile(0.99) is the 99th percentile.
+        uint64_t percentile(double p) const;
+    };
+
+    // Counters are read one by one, so a snapshot taken while recording
+    // might be slightly inconsistent.
+    Snapshot snapshot() const;
+
+private:
+    static const std::size_t _SUB_BUCKET_BITS = 3;
+
+    static const std::size_t _SUB_BUCKETS = 1 << _SUB_BUCKET_BITS;
+
+    // Latencies no less than 2^40 nanoseconds, i.e. about 18 minutes, fall
+    // into the last bucket.
+    static const std::size_t _MAX_MAGNITUDE = 40;
+
+    static const std::size_t _BUCKETS = _SUB_BUCKETS
+                                        + (_MAX_MAGNITUDE - _SUB_BUCKET_BITS) * _SUB_BUCKETS;
+
+    static std::size_t _bucket(uint64_t ns);
+
+    static uint64_t _bucket_upper_bound(std::size_t idx);
+
+    std::array<std::atomic<uint64_t>, _BUCKETS> _buckets;
+
+    std::atomic<uint64_t> _count;
+
+    std::atomic<uint64_t> _total_ns;
+
+    std::atomic<uint64_t> _max_ns;
+};
+
+// Phases of a command. Phases might nest, e.g. parsing a sub-message while
+// appending it to an array, so they don't add up to the command latency.
+enum class Phase {
+    // Parse paths, binary or JSON strings.
+    PARSE = 0,
+
+    // Resolve a path to a field of the message.
+    RESOLVE,
+
+    // Modify the message.
+    MUTATE,
+
+    // Serialize the message to binary or JSON string.
+    SERIALIZE,
+
+    // Compress or decompress serialized messages, see --COMPRESS-THRESHOLD.
+    COMPRESS,
+
+    DECOMPRESS,
+
+    NUM_PHASES
+};
+
+const char* phase_name(Phase phase);
+
+class Metrics {
+public:
+    static Metrics& instance();
+
+    // Should only be called when loading the module.
+    void enable(bool enabled) {
+        _enabled = enabled;
+    }
+
+    bool enabled() const {
+        return _enabled;
+    }
+
+    // Add a histogram for the command. It should only be called when creating
+    // commands, and the histogram is valid until the module is unloaded.
+    LatencyHistogram& add_command(const std::string &name);
+
+    using CommandHistograms = std::vector<std::pair<std::string, std::unique_ptr<LatencyHistogram>>>;
+
+    const CommandHistograms& commands() const {
+        return _commands;
+    }
+
+    LatencyHistogram& phase(Phase phase) {
+        return _phases[static_cast<std::size_t>(phase)];
+    }
+
+private:
+    Metrics() = default;
+
+    bool _enabled = true;
+
+    CommandHistograms _commands;
+
+    std::array<LatencyHistogram, static_cast<std::size_t>(Phase::NUM_PHASES)> _phases;
+};
+
+// Record the lifetime of the timer into a histogram. If metrics are disabled,
+// it doesn't even read the clock.
+class LatencyTimer {
+public:
+    explicit LatencyTimer(LatencyHistogram *histogram) {
+        if (histogram != nullptr && Metrics::instance().enabled()) {
+            _histogram = histogram;
+            _start = std::chrono::steady_clock::now();
+        }
+    }
+
+    explicit LatencyTimer(Phase phase) : LatencyTimer(&Metrics::instance().phase(phase)) {}
+
+    LatencyTimer(const LatencyTimer &) = delete;
+    LatencyTimer& operator=(const LatencyTimer &) = delete;
+
+    LatencyTimer(LatencyTimer &&) = delete;
+    LatencyTimer& operator=(LatencyTimer &&) = delete;
+
+    ~LatencyTimer() {
+        if (_histogram != nullptr) {
+            auto elapsed = std::chrono::steady_clock::now() - _start;
+            _histogram->record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    }
+
+private:
+    LatencyHistogram *_histogram = nullptr;
+
+    std::chrono::steady_clock::time_point _start;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_METRICS_H
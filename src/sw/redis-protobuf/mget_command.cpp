@@ -0,0 +1,129 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "mget_command.h"
+#include "errors.h"
+#include "redis_protobuf.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int MGetCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+
+        if (RedisModule_IsKeysPositionRequest(ctx)) {
+            _reply_with_keys_position(ctx, argc, args);
+
+            return REDISMODULE_OK;
+        }
+
+        // The path is parsed and resolved once, and shared by all keys.
+        GetCommand::Args get_args;
+        get_args.format = args.format;
+        get_args.paths.push_back(args.path);
+
+        RedisModule_ReplyWithArray(ctx, argc - args.key_pos);
+
+        for (auto idx = args.key_pos; idx != argc; ++idx) {
+            try {
+                get_args.key_name = argv[idx];
+                _reply_with_value(ctx, get_args);
+            } catch (const Error &e) {
+                api::reply_with_error(ctx, e);
+            }
+        }
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+}
+
+MGetCommand::Args MGetCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc < 3) {
+        throw WrongArityError();
+    }
+
+    Args args;
+
+    auto idx = 1;
+    while (idx < argc) {
+        auto opt = StringView(argv[idx]);
+        if (util::str_case_equal(opt, "--FORMAT")) {
+            if (idx + 1 >= argc) {
+                throw Error("syntax error");
+            }
+
+            ++idx;
+
+            args.format = _get_cmd._parse_format(argv[idx]);
+        } else {
+            // Finish parsing options.
+            break;
+        }
+
+        ++idx;
+    }
+
+    // At least one key.
+    if (idx + 2 > argc) {
+        throw WrongArityError();
+    }
+
+    args.path = Path(argv[idx]);
+    args.key_pos = idx + 1;
+
+    return args;
+}
+
+void MGetCommand::_reply_with_keys_position(RedisModuleCtx *ctx,
+        int argc,
+        const Args &args) const {
+    for (auto idx = args.key_pos; idx != argc; ++idx) {
+        RedisModule_KeyAtPos(ctx, idx);
+    }
+}
+
+void MGetCommand::_reply_with_value(RedisModuleCtx *ctx,
+        const GetCommand::Args &args) const {
+    auto key = api::open_key(ctx, args.key_name, api::KeyMode::READONLY);
+    if (!api::key_exists(key.get(), RedisProtobuf::instance().type())) {
+        _get_cmd._reply_with_nil(ctx);
+    } else {
+        auto *value = api::get_value_by_key(key.get());
+        assert(value != nullptr);
+
+        if (!_get_cmd._reply_with_wire(ctx, *value, args)) {
+            _get_cmd._reply_with_msg(ctx, value->msg(), args);
+        }
+    }
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,68 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_MGET_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_MGET_COMMANDS_H
+
+#include "module_api.h"
+#include <vector>
+#include "utils.h"
+#include "field_ref.h"
+#include "get_command.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.MGET [--FORMAT BINARY|JSON] path key [key ...]
+// return:  Array reply: for each key, reply with the same value as PB.GET
+//          key [--FORMAT BINARY|JSON] path. If a key doesn't exist, its
+//          element is a nil reply.
+// error:   If the path cannot be parsed, return an error reply. Errors of
+//          a single key, e.g. type mismatch, are returned as elements of
+//          the array reply.
+class MGetCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    struct Args {
+        GetCommand::Args::Format format = GetCommand::Args::Format::NONE;
+
+        Path path;
+
+        // Position of the first key.
+        int key_pos = 0;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    void _reply_with_keys_position(RedisModuleCtx *ctx, int argc, const Args &args) const;
+
+    void _reply_with_value(RedisModuleCtx *ctx, const GetCommand::Args &args) const;
+
+    GetCommand _get_cmd;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_MGET_COMMANDS_H
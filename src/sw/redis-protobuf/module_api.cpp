@@ -16,6 +16,8 @@
 
 #include "module_api.h"
 #include <cassert>
+#include "proto_value.h"
+#include "redis_protobuf.h"
 
 namespace sw {
 
@@ -71,13 +73,29 @@ int reply_with_error(RedisModuleCtx *ctx, const Error &err) {
     return RedisModule_ReplyWithError(ctx, msg.data());
 }
 
-google::protobuf::Message* get_msg_by_key(RedisModuleKey *key) {
-    auto *msg = static_cast<google::protobuf::Message *>(RedisModule_ModuleTypeGetValue(key));
-    if (msg == nullptr) {
+ProtoValue* get_value_by_key(RedisModuleKey *key) {
+    auto *value = static_cast<ProtoValue *>(RedisModule_ModuleTypeGetValue(key));
+    if (value == nullptr) {
         throw Error("failed to get message by key");
     }
 
-    return msg;
+    // Values of old generations of schemas are migrated on access, so that
+    // a command never mixes descriptors of different generations.
+    RedisProtobuf::instance().proto_factory()->migrate(*value);
+
+    return value;
+}
+
+google::protobuf::Message* get_msg_by_key(RedisModuleKey *key) {
+    return &(get_value_by_key(key)->msg());
+}
+
+bool has_active_child(RedisModuleCtx *ctx) {
+    if (RedisModule_GetContextFlags == nullptr) {
+        return false;
+    }
+
+    return (RedisModule_GetContextFlags(ctx) & REDISMODULE_CTX_FLAGS_ACTIVE_CHILD) != 0;
 }
 
 }
@@ -41,6 +41,8 @@ namespace redis {
 
 namespace pb {
 
+class ProtoValue;
+
 namespace api {
 
 template <typename ...Args>
@@ -86,8 +88,14 @@ bool key_exists(RedisModuleKey *key, RedisModuleType *key_type);
 
 int reply_with_error(RedisModuleCtx *ctx, const Error &err);
 
+ProtoValue* get_value_by_key(RedisModuleKey *key);
+
 google::protobuf::Message* get_msg_by_key(RedisModuleKey *key);
 
+// Whether there's a child process, e.g. BGSAVE or BGREWRITEAOF, sharing pages
+// with Redis. Always return false, if Redis doesn't support this flag.
+bool has_active_child(RedisModuleCtx *ctx);
+
 }
 
 }
@@ -0,0 +1,93 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "mset_command.h"
+#include "errors.h"
+#include "redis_protobuf.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int MSetCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+
+        RedisModule_ReplyWithArray(ctx, (argc - args.key_pos) / 2);
+
+        for (auto idx = args.key_pos; idx != argc; idx += 2) {
+            try {
+                _set(ctx, argv[idx], args.path, StringView(argv[idx + 1]));
+
+                RedisModule_ReplyWithLongLong(ctx, 1);
+            } catch (const Error &e) {
+                api::reply_with_error(ctx, e);
+            }
+        }
+
+        RedisModule_ReplicateVerbatim(ctx);
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+MSetCommand::Args MSetCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc < 4 || argc % 2 != 0) {
+        throw WrongArityError();
+    }
+
+    Args args;
+    args.path = Path(argv[1]);
+    args.key_pos = 2;
+
+    return args;
+}
+
+void MSetCommand::_set(RedisModuleCtx *ctx,
+        RedisModuleString *key_name,
+        const Path &path,
+        const StringView &val) const {
+    auto key = api::open_key(ctx, key_name, api::KeyMode::WRITEONLY);
+    assert(key);
+
+    auto &module = RedisProtobuf::instance();
+    if (!api::key_exists(key.get(), module.type())) {
+        _set_cmd._create_msg(*key, path, val);
+    } else {
+        _set_cmd._set_msg(*key, path, val);
+    }
+
+    module.after_write(ctx, key_name, *api::get_value_by_key(key.get()));
+    module.notify(ctx, "mset", key_name, path);
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,64 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_MSET_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_MSET_COMMANDS_H
+
+#include "module_api.h"
+#include "utils.h"
+#include "field_ref.h"
+#include "set_command.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.MSET path key value [key value ...]
+// return:  Array reply: for each key, an integer reply of 1 if it's set
+//          successfully, or an error reply, e.g. type mismatch, if it fails.
+//          Each key is set in the same way as PB.SET key path value.
+// error:   If the path cannot be parsed, return an error reply.
+class MSetCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    struct Args {
+        Path path;
+
+        // Position of the first key.
+        int key_pos = 0;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    void _set(RedisModuleCtx *ctx,
+            RedisModuleString *key_name,
+            const Path &path,
+            const StringView &val) const;
+
+    SetCommand _set_cmd;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_MSET_COMMANDS_H
@@ -41,6 +41,144 @@ void Options::load(RedisModuleString **argv, int argc) {
             ++idx;
 
             opts.proto_dir = util::sv_to_string(StringView(argv[idx]));
+        } else if (util::str_case_equal(opt, "--DESCRIPTOR-SET")) {
+            if (idx + 1 >= argc) {
+                throw Error("option '--DESCRIPTOR-SET file' requires a value");
+            }
+
+            if (!opts.descriptor_set.empty()) {
+                throw Error("duplicate --DESCRIPTOR-SET option");
+            }
+
+            ++idx;
+
+            opts.descriptor_set = util::sv_to_string(StringView(argv[idx]));
+        } else if (util::str_case_equal(opt, "--PLUGIN")) {
+            if (idx + 1 >= argc) {
+                throw Error("option '--PLUGIN file' requires a value");
+            }
+
+            ++idx;
+
+            opts.plugins.push_back(util::sv_to_string(StringView(argv[idx])));
+        } else if (util::str_case_equal(opt, "--PATH-CACHE-SIZE")) {
+            if (idx + 1 >= argc) {
+                throw Error("option '--PATH-CACHE-SIZE size' requires a value");
+            }
+
+            ++idx;
+
+            auto size = util::sv_to_int64(StringView(argv[idx]));
+            if (size < 0) {
+                throw Error("path cache size must be non-negative");
+            }
+
+            opts.path_cache_size = size;
+        } else if (util::str_case_equal(opt, "--ARENA")) {
+            opts.use_arena = true;
+        } else if (util::str_case_equal(opt, "--LAZY")) {
+            opts.lazy_parse = true;
+        } else if (util::str_case_equal(opt, "--COMPACT")) {
+            // Values at rest are always serialized, so it implies --LAZY.
+            opts.compact = true;
+            opts.lazy_parse = true;
+        } else if (util::str_case_equal(opt, "--AOF-CHUNK-SIZE")) {
+            if (idx + 1 >= argc) {
+                throw Error("option '--AOF-CHUNK-SIZE bytes' requires a value");
+            }
+
+            ++idx;
+
+            auto size = util::sv_to_int64(StringView(argv[idx]));
+            if (size < 0) {
+                throw Error("aof chunk size must be non-negative");
+            }
+
+            opts.aof_chunk_size = size;
+        } else if (util::str_case_equal(opt, "--COMPRESS-THRESHOLD")) {
+            if (idx + 1 >= argc) {
+                throw Error("option '--COMPRESS-THRESHOLD bytes' requires a value");
+            }
+
+            ++idx;
+
+            auto threshold = util::sv_to_int64(StringView(argv[idx]));
+            if (threshold < 0) {
+                throw Error("compress threshold must be non-negative");
+            }
+
+            opts.compress_threshold = threshold;
+        } else if (util::str_case_equal(opt, "--DECOMPRESSED-CACHE-SIZE")) {
+            if (idx + 1 >= argc) {
+                throw Error("option '--DECOMPRESSED-CACHE-SIZE bytes' requires a value");
+            }
+
+            ++idx;
+
+            auto size = util::sv_to_int64(StringView(argv[idx]));
+            if (size < 0) {
+                throw Error("decompressed cache size must be non-negative");
+            }
+
+            opts.decompressed_cache_size = size;
+        } else if (util::str_case_equal(opt, "--CACHE-SERIALIZED")) {
+            opts.cache_serialized = true;
+        } else if (util::str_case_equal(opt, "--REPLICATE-EFFECTS")) {
+            opts.replicate_effects = true;
+        } else if (util::str_case_equal(opt, "--DISABLE-METRICS")) {
+            opts.metrics = false;
+        } else if (util::str_case_equal(opt, "--ASYNC-JSON-THRESHOLD")) {
+            if (idx + 1 >= argc) {
+                throw Error("option '--ASYNC-JSON-THRESHOLD bytes' requires a value");
+            }
+
+            ++idx;
+
+            auto threshold = util::sv_to_int64(StringView(argv[idx]));
+            if (threshold < 0) {
+                throw Error("async json threshold must be non-negative");
+            }
+
+            opts.async_json_threshold = threshold;
+        } else if (util::str_case_equal(opt, "--WORKER-THREADS")) {
+            if (idx + 1 >= argc) {
+                throw Error("option '--WORKER-THREADS num' requires a value");
+            }
+
+            ++idx;
+
+            auto num = util::sv_to_int64(StringView(argv[idx]));
+            if (num <= 0) {
+                throw Error("number of worker threads must be larger than 0");
+            }
+
+            opts.worker_threads = num;
+        } else if (util::str_case_equal(opt, "--LOAD-THREADS")) {
+            if (idx + 1 >= argc) {
+                throw Error("option '--LOAD-THREADS num' requires a value");
+            }
+
+            ++idx;
+
+            auto num = util::sv_to_int64(StringView(argv[idx]));
+            if (num < 0) {
+                throw Error("number of load threads must be non-negative");
+            }
+
+            opts.load_threads = num;
+        } else if (util::str_case_equal(opt, "--SCAN-TIME-BUDGET")) {
+            if (idx + 1 >= argc) {
+                throw Error("option '--SCAN-TIME-BUDGET micros' requires a value");
+            }
+
+            ++idx;
+
+            auto budget = util::sv_to_int64(StringView(argv[idx]));
+            if (budget <= 0) {
+                throw Error("scan time budget must be larger than 0");
+            }
+
+            opts.scan_time_budget = budget;
         } else {
             throw Error("unknown option: " + util::sv_to_string(opt));
         }
@@ -48,8 +186,13 @@ void Options::load(RedisModuleString **argv, int argc) {
         ++idx;
     }
 
-    if (opts.proto_dir.empty()) {
-        throw Error("option '--DIR dir' is required");
+    if (opts.compress_threshold > 0) {
+        // Only serialized messages are compressed, so it implies --LAZY.
+        opts.lazy_parse = true;
+    }
+
+    if (opts.proto_dir.empty() && opts.descriptor_set.empty()) {
+        throw Error("option '--DIR dir' or '--DESCRIPTOR-SET file' is required");
     }
 
     *this = std::move(opts);
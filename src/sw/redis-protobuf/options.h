@@ -19,6 +19,7 @@
 
 #include "module_api.h"
 #include <string>
+#include <vector>
 
 namespace sw {
 
@@ -30,6 +31,63 @@ struct Options {
     void load(RedisModuleString **argv, int argc);
 
     std::string proto_dir;
+
+    // Path of a FileDescriptorSet, e.g. generated by 'protoc --descriptor_set_out'.
+    std::string descriptor_set;
+
+    // Shared objects with classes generated by protoc, see plugin.h.
+    std::vector<std::string> plugins;
+
+    // Max number of parsed paths to be cached. 0 means no cache.
+    std::size_t path_cache_size = 1024;
+
+    // Whether to allocate each key's message on its own arena.
+    bool use_arena = false;
+
+    // Whether to keep messages as binary strings, until some field is accessed.
+    bool lazy_parse = false;
+
+    // Whether to serialize a message back to a binary string, after it's
+    // modified. If it's true, *lazy_parse* is also true.
+    bool compact = false;
+
+    // JSON conversion of messages whose serialized size is no less than
+    // this threshold, is done in worker threads. 0 means always in the
+    // main thread.
+    std::size_t async_json_threshold = 0;
+
+    // Number of worker threads, only used when async_json_threshold > 0.
+    std::size_t worker_threads = 4;
+
+    // Whether to record latency histograms reported by PB.INFO.
+    bool metrics = true;
+
+    // Number of threads to parse .proto files at load and PB.RELOAD.
+    // 0 means one thread per core.
+    std::size_t load_threads = 0;
+
+    // Max time in microseconds that PB.SCAN runs before it returns a cursor.
+    std::size_t scan_time_budget = 1000;
+
+    // Whether to replicate messages written with JSON values in binary form,
+    // so that replicas and AOF don't parse JSON again.
+    bool replicate_effects = false;
+
+    // Messages whose serialized size is larger than this threshold, are
+    // rewritten to AOF in chunks of about this size. 0 means no chunking.
+    std::size_t aof_chunk_size = 0;
+
+    // Whether to cache the serialized message of a parsed value, once it's
+    // read in binary form, until the value is modified.
+    bool cache_serialized = false;
+
+    // Serialized messages of lazy values, and messages saved to RDB, whose
+    // size is no less than this threshold, are compressed. 0 means no
+    // compression. If it's larger than 0, *lazy_parse* is also true.
+    std::size_t compress_threshold = 0;
+
+    // Max total size of decompressed messages cached for compressed values.
+    std::size_t decompressed_cache_size = 16 * 1024 * 1024;
 };
 
 }
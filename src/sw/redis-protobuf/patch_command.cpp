@@ -0,0 +1,878 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "patch_command.h"
+#include <cassert>
+#include <cmath>
+#include "errors.h"
+#include "redis_protobuf.h"
+#include "metrics.h"
+#include "field_accessor.h"
+#include "set_command.h"
+#include "append_command.h"
+#include "del_command.h"
+#include "incr_command.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+namespace {
+
+using CppType = gp::FieldDescriptor::CppType;
+
+// Old value of a singular field, an array element or a map element.
+class SavedValue {
+public:
+    virtual ~SavedValue() = default;
+
+    // Set the field back to the saved value.
+    virtual void restore(MutableFieldRef &field) = 0;
+
+    // Append the saved value to the array.
+    virtual void add(MutableFieldRef &field) = 0;
+};
+
+using SavedValueUPtr = std::unique_ptr<SavedValue>;
+
+template <CppType T>
+class SavedScalar : public SavedValue {
+public:
+    explicit SavedScalar(const ConstFieldRef &field) {
+        if (field.is_map_element()) {
+            _val = field.get_mapped<T>();
+        } else if (field.is_array_element()) {
+            _val = field.get_repeated<T>();
+        } else {
+            _val = field.get<T>();
+        }
+    }
+
+    void restore(MutableFieldRef &field) override {
+        if (field.is_map_element()) {
+            field.set_mapped<T>(_val);
+        } else if (field.is_array_element()) {
+            field.set_repeated<T>(_val);
+        } else {
+            field.set<T>(_val);
+        }
+    }
+
+    void add(MutableFieldRef &field) override {
+        field.add<T>(_val);
+    }
+
+private:
+    typename CppTypeTraits<T>::Type _val;
+};
+
+class SavedMsg : public SavedValue {
+public:
+    explicit SavedMsg(MsgUPtr msg) : _msg(std::move(msg)) {
+        assert(_msg);
+    }
+
+    void restore(MutableFieldRef &field) override {
+        // Except for map elements, the saved message is swapped in.
+        if (field.is_map_element()) {
+            field.set_mapped_msg(*_msg);
+        } else if (field.is_array_element()) {
+            field.set_repeated_msg(*_msg);
+        } else {
+            field.set_msg(*_msg);
+        }
+    }
+
+    void add(MutableFieldRef &field) override {
+        field.add_msg(*_msg);
+    }
+
+private:
+    MsgUPtr _msg;
+};
+
+// Save the value of a field of C++ type *T*.
+template <CppType T>
+struct SaveValue {
+    static SavedValueUPtr call(const ConstFieldRef &field) {
+        return SavedValueUPtr(new SavedScalar<T>(field));
+    }
+};
+
+template <>
+struct SaveValue<gp::FieldDescriptor::CPPTYPE_MESSAGE> {
+    static SavedValueUPtr call(const ConstFieldRef &field) {
+        const auto &old_msg = field.accessor().get_msg(field);
+        MsgUPtr msg(old_msg.New());
+        msg->CopyFrom(old_msg);
+
+        return SavedValueUPtr(new SavedMsg(std::move(msg)));
+    }
+};
+
+// Parse *val* as a scalar of C++ type *T*, and throw if it's invalid.
+template <CppType T>
+struct ValidateScalar {
+    static void call(const StringView &val) {
+        CppTypeTraits<T>::parse(val);
+    }
+};
+
+template <>
+struct ValidateScalar<gp::FieldDescriptor::CPPTYPE_STRING> {
+    static void call(const StringView &) {
+        // Any string is valid, and there's no need to copy it.
+    }
+};
+
+template <>
+struct ValidateScalar<gp::FieldDescriptor::CPPTYPE_MESSAGE> {
+    static void call(const StringView &) {
+        throw Error("not a scalar field");
+    }
+};
+
+SavedValueUPtr save_value(const ConstFieldRef &field);
+
+// Parse *val* as the value of the field, and return the message, if it's of message type.
+MsgUPtr parse_value(const PathField &field, const StringView &val);
+
+// Whether the map element, i.e. the *idx*-th field of the path, exists.
+bool has_map_element(const gp::Message &msg, const Path &path, std::size_t idx);
+
+// Key of the map entry, formatted as it's in a path.
+std::string map_entry_key(const gp::Message &entry);
+
+}
+
+struct PatchCommand::Undo {
+    enum class Type {
+        // Clear the field, or delete the map element, which the operation creates.
+        CLEAR = 0,
+        // Set the field, the array element or the map element to its old value.
+        RESTORE,
+        // Remove elements appended to the array.
+        TRUNCATE,
+        // Insert the deleted element back to the array.
+        INSERT,
+        // Swap the old message back.
+        SWAP
+    };
+
+    Undo(Type undo_type, Path undo_path) : type(undo_type), path(std::move(undo_path)) {}
+
+    Type type;
+
+    Path path;
+
+    // Old size of the array for TRUNCATE, or index of the deleted element for INSERT.
+    int idx = 0;
+
+    // Old value for RESTORE and INSERT.
+    SavedValueUPtr val;
+
+    // Old message for SWAP.
+    MsgUPtr msg;
+};
+
+int PatchCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+        const auto &type = args.ops.front().path.type();
+
+        auto key = api::open_key(ctx, args.key_name, api::KeyMode::WRITEONLY);
+        assert(key);
+
+        auto &module = RedisProtobuf::instance();
+
+        std::vector<Result> results;
+        if (!api::key_exists(key.get(), module.type())) {
+            auto value = module.proto_factory()->create_value(type);
+            results = _apply(value->msg(), args);
+
+            module.after_write(ctx, args.key_name, *value);
+
+            if (RedisModule_ModuleTypeSetValue(key.get(),
+                        module.type(),
+                        value.get()) != REDISMODULE_OK) {
+                throw Error("failed to set message");
+            }
+
+            value.release();
+        } else {
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
+
+            if (value->descriptor()->full_name() != type) {
+                throw Error("type mismatch");
+            }
+
+            results = _apply(value->msg(), args);
+
+            module.after_write(ctx, args.key_name, *value);
+        }
+
+        for (const auto &op : args.ops) {
+            module.notify(ctx, "patch", args.key_name, op.path);
+        }
+
+        _reply(ctx, results);
+
+        _replicate(ctx, argv, argc, args, results);
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+PatchCommand::Args PatchCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc < 4) {
+        throw WrongArityError();
+    }
+
+    Args args;
+    args.key_name = argv[1];
+
+    auto pos = 2;
+    while (pos < argc) {
+        Op op;
+        op.type = _parse_op(StringView(argv[pos]));
+        ++pos;
+
+        if (pos >= argc) {
+            throw WrongArityError();
+        }
+
+        op.path = Path(argv[pos]);
+        ++pos;
+
+        if (!args.ops.empty() && op.path.type() != args.ops.front().path.type()) {
+            throw Error("all paths must be of the same type");
+        }
+
+        if (op.type == Op::Type::DEL) {
+            op.val_pos = -1;
+        } else {
+            if (pos >= argc) {
+                throw WrongArityError();
+            }
+
+            op.val = StringView(argv[pos]);
+            op.val_pos = pos;
+            ++pos;
+        }
+
+        args.ops.push_back(std::move(op));
+    }
+
+    return args;
+}
+
+PatchCommand::Op::Type PatchCommand::_parse_op(const StringView &op) const {
+    if (util::str_case_equal(op, "SET")) {
+        return Op::Type::SET;
+    } else if (util::str_case_equal(op, "APPEND")) {
+        return Op::Type::APPEND;
+    } else if (util::str_case_equal(op, "DEL")) {
+        return Op::Type::DEL;
+    } else if (util::str_case_equal(op, "MERGE")) {
+        return Op::Type::MERGE;
+    } else if (util::str_case_equal(op, "INCR")) {
+        return Op::Type::INCR;
+    } else {
+        throw Error("unknown operation: " + util::sv_to_string(op));
+    }
+}
+
+auto PatchCommand::_apply(gp::Message &msg, Args &args) const -> std::vector<Result> {
+    // Invalid paths and values are rejected before the message is touched.
+    for (auto &op : args.ops) {
+        _validate(*msg.GetDescriptor(), op);
+    }
+
+    std::vector<Result> results;
+    results.reserve(args.ops.size());
+
+    std::vector<Undo> undos;
+    try {
+        for (auto &op : args.ops) {
+            auto saved = undos.size();
+            _save(msg, op, undos);
+
+            results.push_back(_apply(msg, op));
+
+            if (op.msg && undos.size() > saved) {
+                // The new message has been swapped in, and *op.msg* holds the old one.
+                auto &undo = undos.back();
+                if (undo.type == Undo::Type::SWAP) {
+                    undo.msg = std::move(op.msg);
+                } else if (undo.type == Undo::Type::RESTORE && !undo.val) {
+                    undo.val.reset(new SavedMsg(std::move(op.msg)));
+                }
+            }
+        }
+    } catch (const Error &) {
+        _undo(msg, undos);
+        throw;
+    }
+
+    return results;
+}
+
+auto PatchCommand::_apply(gp::Message &msg, Op &op) const -> Result {
+    const auto &path = op.path;
+
+    Result res;
+    res.integer = 1;
+
+    switch (op.type) {
+    case Op::Type::SET:
+        if (path.empty()) {
+            LatencyTimer timer(Phase::MUTATE);
+
+            msg.GetReflection()->Swap(&msg, op.msg.get());
+        } else if (op.msg) {
+            LatencyTimer timer(Phase::MUTATE);
+
+            MutableFieldRef field(&msg, path);
+            if (field.is_map_element()) {
+                field.set_mapped_msg(*op.msg);
+            } else if (field.is_array_element()) {
+                field.set_repeated_msg(*op.msg);
+            } else {
+                field.set_msg(*op.msg);
+            }
+        } else {
+            MutableFieldRef field(&msg, path);
+            SetCommand()._set_field(field, op.val);
+        }
+        break;
+
+    case Op::Type::APPEND: {
+        LatencyTimer timer(Phase::MUTATE);
+
+        MutableFieldRef field(&msg, path);
+        if (op.msg) {
+            field.add_msg(*op.msg);
+            res.integer = field.size();
+        } else {
+            res.integer = AppendCommand()._append(field, std::vector<StringView>{op.val});
+        }
+        break;
+    }
+
+    case Op::Type::DEL:
+        DelCommand()._del(msg, path);
+        break;
+
+    case Op::Type::MERGE: {
+        LatencyTimer timer(Phase::MUTATE);
+
+        if (path.empty()) {
+            msg.MergeFrom(*op.msg);
+        } else {
+            MutableFieldRef field(&msg, path);
+            field.merge(*op.msg);
+        }
+        break;
+    }
+
+    case Op::Type::INCR: {
+        LatencyTimer timer(Phase::MUTATE);
+
+        MutableFieldRef field(&msg, path);
+        IncrCommand incr_cmd(false);
+        auto type = incr_cmd._field_type(field);
+        if (type == gp::FieldDescriptor::CPPTYPE_DOUBLE
+                || type == gp::FieldDescriptor::CPPTYPE_FLOAT) {
+            res.str = incr_cmd._incr_float(field, op.val);
+        } else {
+            res.integer = incr_cmd._incr_int(field, op.val);
+        }
+        break;
+    }
+
+    default:
+        assert(false);
+    }
+
+    return res;
+}
+
+void PatchCommand::_validate(const gp::Descriptor &desc, Op &op) const {
+    const auto &path = op.path;
+    auto &factory = *(RedisProtobuf::instance().proto_factory());
+
+    if (path.empty()) {
+        switch (op.type) {
+        case Op::Type::SET:
+        case Op::Type::MERGE:
+            op.msg = factory.create(desc, op.val);
+            return;
+
+        case Op::Type::APPEND:
+            throw Error("can only call append on array");
+
+        case Op::Type::DEL:
+            throw Error("cannot delete the whole message");
+
+        case Op::Type::INCR:
+            throw Error("can only increment a numeric field");
+
+        default:
+            assert(false);
+        }
+    }
+
+    auto fields = path.resolve(desc);
+    const auto &field = fields->back();
+    if (field.is_range) {
+        throw Error("cannot patch a slice of array");
+    }
+
+    assert(field.accessor != nullptr);
+    const auto kind = field.accessor->kind;
+    const auto type = field.accessor->type;
+
+    switch (op.type) {
+    case Op::Type::SET:
+        if (kind == FieldKind::ARRAY) {
+            throw Error("cannot set the whole array field");
+        } else if (kind == FieldKind::MAP) {
+            throw Error("cannot set the whole map field");
+        }
+
+        op.msg = parse_value(field, op.val);
+        break;
+
+    case Op::Type::APPEND:
+        if (kind == FieldKind::ARRAY) {
+            op.msg = parse_value(field, op.val);
+        } else if ((kind != FieldKind::SCALAR && kind != FieldKind::ARRAY_ELEMENT)
+                || type != gp::FieldDescriptor::CPPTYPE_STRING) {
+            throw Error("not an array or string");
+        }
+        break;
+
+    case Op::Type::DEL:
+        if (kind != FieldKind::ARRAY_ELEMENT && kind != FieldKind::MAP_ELEMENT) {
+            throw Error("not an array or map element");
+        }
+        break;
+
+    case Op::Type::MERGE:
+        if (kind != FieldKind::SCALAR || type != gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+            throw Error("not a message");
+        }
+
+        op.msg = factory.create(*(field.desc->message_type()), op.val);
+        break;
+
+    case Op::Type::INCR:
+        if (kind == FieldKind::ARRAY || kind == FieldKind::MAP) {
+            throw Error("cannot increment the whole array or map");
+        }
+
+        switch (type) {
+        case gp::FieldDescriptor::CPPTYPE_INT32:
+        case gp::FieldDescriptor::CPPTYPE_INT64:
+        case gp::FieldDescriptor::CPPTYPE_UINT32:
+        case gp::FieldDescriptor::CPPTYPE_UINT64:
+            util::sv_to_int64(op.val);
+            break;
+
+        case gp::FieldDescriptor::CPPTYPE_DOUBLE:
+        case gp::FieldDescriptor::CPPTYPE_FLOAT: {
+            auto delta = util::sv_to_double(op.val);
+            if (std::isnan(delta) || std::isinf(delta)) {
+                throw Error("increment would produce NaN or Infinity");
+            }
+            break;
+        }
+
+        default:
+            throw Error("not an integer field");
+        }
+        break;
+
+    default:
+        assert(false);
+    }
+}
+
+void PatchCommand::_save(const gp::Message &msg, const Op &op, std::vector<Undo> &undos) const {
+    const auto &path = op.path;
+
+    if (path.empty()) {
+        if (op.type == Op::Type::SET) {
+            // The old message is taken after it's swapped out.
+            undos.emplace_back(Undo::Type::SWAP, path);
+        } else {
+            assert(op.type == Op::Type::MERGE && op.msg);
+
+            _save_merge(msg, path, *op.msg, undos);
+        }
+
+        return;
+    }
+
+    if (_save_parents(msg, path, undos)) {
+        // Everything the operation modifies is under the created parent.
+        return;
+    }
+
+    auto fields = path.resolve(*msg.GetDescriptor());
+    const auto &leaf = fields->back();
+
+    switch (op.type) {
+    case Op::Type::SET:
+        // A message is swapped in, except for map elements, which copy it.
+        _save_field(msg, path, !op.msg || bool(leaf.map_key), undos);
+        break;
+
+    case Op::Type::APPEND:
+        if (leaf.accessor->kind == FieldKind::ARRAY) {
+            Undo undo(Undo::Type::TRUNCATE, path);
+            undo.idx = ConstFieldRef(&msg, path).size();
+            undos.push_back(std::move(undo));
+        } else {
+            _save_field(msg, path, true, undos);
+        }
+        break;
+
+    case Op::Type::DEL:
+        if (leaf.map_key) {
+            // Deleting a key that doesn't exist is a no-op.
+            if (has_map_element(msg, path, fields->size() - 1)) {
+                Undo undo(Undo::Type::RESTORE, path);
+                undo.val = save_value(ConstFieldRef(&msg, path));
+                undos.push_back(std::move(undo));
+            }
+        } else {
+            auto arr_path = path.prefix(fields->size() - 1).child(leaf.desc->name());
+            Undo undo(Undo::Type::INSERT, std::move(arr_path));
+            undo.idx = leaf.arr_idx;
+            undo.val = save_value(ConstFieldRef(&msg, path));
+            undos.push_back(std::move(undo));
+        }
+        break;
+
+    case Op::Type::MERGE:
+        assert(op.msg);
+
+        if (ConstFieldRef(&msg, path).has_field()) {
+            _save_merge(msg, path, *op.msg, undos);
+        } else {
+            _save_field(msg, path, true, undos);
+        }
+        break;
+
+    case Op::Type::INCR:
+        _save_field(msg, path, true, undos);
+        break;
+
+    default:
+        assert(false);
+    }
+}
+
+bool PatchCommand::_save_parents(const gp::Message &msg,
+        const Path &path,
+        std::vector<Undo> &undos) const {
+    auto fields = path.resolve(*msg.GetDescriptor());
+    for (std::size_t idx = 0; idx + 1 < fields->size(); ++idx) {
+        const auto &field = (*fields)[idx];
+        if (field.arr_idx >= 0) {
+            // Array elements are never created, and out-of-range index fails the operation.
+            continue;
+        }
+
+        auto parent = path.prefix(idx + 1);
+        if (field.map_key) {
+            if (!has_map_element(msg, path, idx)) {
+                undos.emplace_back(Undo::Type::CLEAR, std::move(parent));
+                return true;
+            }
+        } else if (!ConstFieldRef(&msg, parent).has_field()) {
+            _save_field(msg, parent, true, undos);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void PatchCommand::_save_field(const gp::Message &msg,
+        const Path &path,
+        bool copy,
+        std::vector<Undo> &undos) const {
+    auto fields = path.resolve(*msg.GetDescriptor());
+    const auto &leaf = fields->back();
+
+    if (leaf.map_key) {
+        if (!has_map_element(msg, path, fields->size() - 1)) {
+            undos.emplace_back(Undo::Type::CLEAR, path);
+            return;
+        }
+    } else if (leaf.arr_idx < 0) {
+        ConstFieldRef field(&msg, path);
+        if (!field.has_field()) {
+            // Setting a member of oneof clears the other member, which has been set.
+            const auto *other = field.oneof_field();
+            if (other != nullptr) {
+                _save_field(msg, path.prefix(fields->size() - 1).child(other->name()), true, undos);
+            }
+
+            undos.emplace_back(Undo::Type::CLEAR, path);
+            return;
+        }
+    }
+
+    Undo undo(Undo::Type::RESTORE, path);
+    if (copy) {
+        undo.val = save_value(ConstFieldRef(&msg, path));
+    }
+
+    undos.push_back(std::move(undo));
+}
+
+void PatchCommand::_save_merge(const gp::Message &msg,
+        const Path &path,
+        const gp::Message &other,
+        std::vector<Undo> &undos) const {
+    const auto *reflection = other.GetReflection();
+
+    std::vector<const gp::FieldDescriptor *> field_descs;
+    reflection->ListFields(other, &field_descs);
+
+    for (const auto *field_desc : field_descs) {
+        auto child = path.child(field_desc->name());
+
+        if (field_desc->is_map()) {
+            // Only keys in *other* are set.
+            for (int idx = 0; idx != reflection->FieldSize(other, field_desc); ++idx) {
+                const auto &entry = reflection->GetRepeatedMessage(other, field_desc, idx);
+                auto element = path.child(field_desc->name() + "[" + map_entry_key(entry) + "]");
+                _save_field(msg, element, true, undos);
+            }
+        } else if (field_desc->is_repeated()) {
+            // Elements of *other* are appended.
+            Undo undo(Undo::Type::TRUNCATE, child);
+            undo.idx = ConstFieldRef(&msg, child).size();
+            undos.push_back(std::move(undo));
+        } else if (field_desc->cpp_type() == gp::FieldDescriptor::CPPTYPE_MESSAGE
+                && ConstFieldRef(&msg, child).has_field()) {
+            // Sub-messages are merged recursively.
+            _save_merge(msg, child, reflection->GetMessage(other, field_desc), undos);
+        } else {
+            _save_field(msg, child, true, undos);
+        }
+    }
+}
+
+void PatchCommand::_undo(gp::Message &msg, std::vector<Undo> &undos) const {
+    for (auto iter = undos.rbegin(); iter != undos.rend(); ++iter) {
+        auto &undo = *iter;
+
+        try {
+            if (undo.type == Undo::Type::SWAP) {
+                if (undo.msg) {
+                    msg.GetReflection()->Swap(&msg, undo.msg.get());
+                }
+
+                continue;
+            }
+
+            MutableFieldRef field(&msg, undo.path);
+            switch (undo.type) {
+            case Undo::Type::CLEAR:
+                if (field.is_map_element()) {
+                    field.del();
+                } else {
+                    field.clear();
+                }
+                break;
+
+            case Undo::Type::RESTORE:
+                if (undo.val) {
+                    undo.val->restore(field);
+                }
+                break;
+
+            case Undo::Type::TRUNCATE:
+                field.truncate(undo.idx);
+                break;
+
+            case Undo::Type::INSERT:
+                undo.val->add(field);
+                field.move_last_to(undo.idx);
+                break;
+
+            default:
+                assert(false);
+            }
+        } catch (const Error &) {
+            // The message has been rolled back to the state, in which the undo
+            // was saved, so it should not fail. Go on with the others anyway.
+        }
+    }
+}
+
+void PatchCommand::_reply(RedisModuleCtx *ctx, const std::vector<Result> &results) const {
+    RedisModule_ReplyWithArray(ctx, results.size());
+
+    for (const auto &res : results) {
+        if (!res.str.empty()) {
+            RedisModule_ReplyWithSimpleString(ctx, res.str.data());
+        } else {
+            RedisModule_ReplyWithLongLong(ctx, res.integer);
+        }
+    }
+}
+
+void PatchCommand::_replicate(RedisModuleCtx *ctx,
+        RedisModuleString **argv,
+        int argc,
+        const Args &args,
+        const std::vector<Result> &results) const {
+    assert(args.ops.size() == results.size());
+
+    auto rewrite = false;
+    for (std::size_t idx = 0; idx != args.ops.size(); ++idx) {
+        if (args.ops[idx].type == Op::Type::INCR && !results[idx].str.empty()) {
+            rewrite = true;
+            break;
+        }
+    }
+
+    if (!rewrite) {
+        RedisModule_ReplicateVerbatim(ctx);
+        return;
+    }
+
+    // Like PB.INCRBYFLOAT, replace floating point INCR with SET of the new value,
+    // so that replicas won't diverge due to different floating point precision.
+    std::vector<RedisModuleString *> new_argv(argv + 1, argv + argc);
+    std::vector<RedisModuleString *> new_strs;
+    for (std::size_t idx = 0; idx != args.ops.size(); ++idx) {
+        const auto &op = args.ops[idx];
+        const auto &res = results[idx];
+        if (op.type != Op::Type::INCR || res.str.empty()) {
+            continue;
+        }
+
+        // *new_argv* doesn't have the command name, and the op name is 2 ahead of its value.
+        auto *op_name = RedisModule_CreateString(ctx, "SET", 3);
+        auto *val = RedisModule_CreateString(ctx, res.str.data(), res.str.size());
+        new_strs.push_back(op_name);
+        new_strs.push_back(val);
+
+        new_argv[op.val_pos - 3] = op_name;
+        new_argv[op.val_pos - 1] = val;
+    }
+
+    RedisModule_Replicate(ctx, "PB.PATCH", "v", new_argv.data(), new_argv.size());
+
+    for (auto *str : new_strs) {
+        RedisModule_FreeString(ctx, str);
+    }
+}
+
+namespace {
+
+SavedValueUPtr save_value(const ConstFieldRef &field) {
+    // The accessor has been selected with the type of the map value, if it's a map element.
+    return dispatch<SaveValue>(field.accessor().type, field);
+}
+
+MsgUPtr parse_value(const PathField &field, const StringView &val) {
+    assert(field.desc != nullptr && field.accessor != nullptr);
+
+    if (field.accessor->type != gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+        dispatch<ValidateScalar>(field.accessor->type, val);
+
+        return nullptr;
+    }
+
+    const auto *desc = field.desc->message_type();
+    if (field.map_key) {
+        // Value of the map entry.
+        desc = desc->map_value()->message_type();
+    }
+
+    assert(desc != nullptr);
+
+    return RedisProtobuf::instance().proto_factory()->create(*desc, val);
+}
+
+bool has_map_element(const gp::Message &msg, const Path &path, std::size_t idx) {
+    auto fields = path.resolve(*msg.GetDescriptor());
+    const auto &field = (*fields)[idx];
+    assert(field.map_key);
+
+    // Looking up a map element, which doesn't exist, with a ConstFieldRef throws.
+    ConstFieldRef map(&msg, path.prefix(idx).child(field.desc->name()));
+
+    return map.find_map_element(*field.map_key) != map.get_map_range().second;
+}
+
+std::string map_entry_key(const gp::Message &entry) {
+    const auto *reflection = entry.GetReflection();
+    const auto *key_desc = entry.GetDescriptor()->map_key();
+    assert(key_desc != nullptr);
+
+    switch (key_desc->cpp_type()) {
+    case gp::FieldDescriptor::CPPTYPE_INT32:
+        return std::to_string(reflection->GetInt32(entry, key_desc));
+
+    case gp::FieldDescriptor::CPPTYPE_INT64:
+        return std::to_string(reflection->GetInt64(entry, key_desc));
+
+    case gp::FieldDescriptor::CPPTYPE_UINT32:
+        return std::to_string(reflection->GetUInt32(entry, key_desc));
+
+    case gp::FieldDescriptor::CPPTYPE_UINT64:
+        return std::to_string(reflection->GetUInt64(entry, key_desc));
+
+    case gp::FieldDescriptor::CPPTYPE_BOOL:
+        return reflection->GetBool(entry, key_desc) ? "true" : "false";
+
+    case gp::FieldDescriptor::CPPTYPE_STRING:
+        return reflection->GetString(entry, key_desc);
+
+    default:
+        throw Error("invalid type of map key");
+    }
+}
+
+}
+
+}
+
+}
+
+}
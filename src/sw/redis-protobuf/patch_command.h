@@ -0,0 +1,137 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_PATCH_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_PATCH_COMMANDS_H
+
+#include "module_api.h"
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "field_ref.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.PATCH key op path [value] [op path [value] ...]
+//          op:  SET path value | APPEND path element | DEL path |
+//               MERGE path value | INCR path increment
+// return:  Array reply: result of each operation. SET, DEL and MERGE return 1,
+//          APPEND returns the length of the array or string, and INCR returns
+//          the new value, i.e. an integer reply or a simple string reply.
+// error:   If any operation fails, return an error reply, and the key is left
+//          unchanged. If paths are of different types, or type mismatch,
+//          return an error reply.
+class PatchCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    struct Op {
+        enum class Type {
+            SET = 0,
+            APPEND,
+            DEL,
+            MERGE,
+            INCR
+        };
+
+        Type type;
+
+        Path path;
+
+        // Empty for DEL.
+        StringView val;
+
+        // Position of *val* in argv.
+        int val_pos;
+
+        // Message parsed from *val*, if it sets, appends or merges a message.
+        MsgUPtr msg;
+    };
+
+    struct Args {
+        RedisModuleString *key_name;
+        std::vector<Op> ops;
+    };
+
+    struct Result {
+        long long integer = 0;
+
+        // If it's not empty, reply with it instead of *integer*.
+        std::string str;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    // How to undo an operation, defined in patch_command.cpp.
+    struct Undo;
+
+    Op::Type _parse_op(const StringView &op) const;
+
+    // Validate all operations, and then apply them to *msg* in place. If any
+    // operation fails, those that have been applied are undone in reverse order,
+    // and *msg* is left unchanged.
+    std::vector<Result> _apply(gp::Message &msg, Args &args) const;
+
+    Result _apply(gp::Message &msg, Op &op) const;
+
+    // Resolve the path, check the operation against the field, and parse
+    // the value, without touching the message.
+    void _validate(const gp::Descriptor &desc, Op &op) const;
+
+    // Save the old values, which *op* is going to modify.
+    void _save(const gp::Message &msg, const Op &op, std::vector<Undo> &undos) const;
+
+    // Save sub-messages and map elements on the path, which don't exist,
+    // and will be created by the operation. Return true if any is saved.
+    bool _save_parents(const gp::Message &msg, const Path &path, std::vector<Undo> &undos) const;
+
+    // Save a singular field, an array element or a map element. If *copy* is false,
+    // the old message is taken after it's swapped out by the operation.
+    void _save_field(const gp::Message &msg,
+            const Path &path,
+            bool copy,
+            std::vector<Undo> &undos) const;
+
+    // Save fields of the message at *path*, which will be modified by merging *other*.
+    void _save_merge(const gp::Message &msg,
+            const Path &path,
+            const gp::Message &other,
+            std::vector<Undo> &undos) const;
+
+    void _undo(gp::Message &msg, std::vector<Undo> &undos) const;
+
+    void _reply(RedisModuleCtx *ctx, const std::vector<Result> &results) const;
+
+    // Floating point increments are replicated as SET with the new value.
+    void _replicate(RedisModuleCtx *ctx,
+            RedisModuleString **argv,
+            int argc,
+            const Args &args,
+            const std::vector<Result> &results) const;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_PATCH_COMMANDS_H
@@ -0,0 +1,89 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "path_cache.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+bool PathCache::get(const StringView &str, Path &path) {
+    auto iter = _index.find(str);
+    if (iter == _index.end()) {
+        ++_misses;
+        return false;
+    }
+
+    ++_hits;
+
+    auto entry = iter->second;
+    if (entry != _entries.begin()) {
+        _entries.splice(_entries.begin(), _entries, entry);
+    }
+
+    path = entry->path;
+
+    return true;
+}
+
+void PathCache::put(const StringView &str, const Path &path) {
+    if (_capacity == 0 || _index.find(str) != _index.end()) {
+        return;
+    }
+
+    if (_entries.size() >= _capacity) {
+        auto &last = _entries.back();
+        _index.erase(StringView(last.key));
+        _entries.pop_back();
+        ++_evictions;
+    }
+
+    _entries.emplace_front(str, path);
+
+    auto entry = _entries.begin();
+    _index.emplace(StringView(entry->key), entry);
+}
+
+PathCache::Stats PathCache::stats() const {
+    Stats stats;
+    stats.capacity = _capacity;
+    stats.size = _entries.size();
+    stats.hits = _hits;
+    stats.misses = _misses;
+    stats.evictions = _evictions;
+
+    return stats;
+}
+
+std::size_t PathCache::KeyHash::operator()(const StringView &key) const {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    const auto *ptr = key.data();
+    for (std::size_t idx = 0; idx != key.size(); ++idx) {
+        hash ^= static_cast<unsigned char>(ptr[idx]);
+        hash *= 1099511628211ULL;
+    }
+
+    return static_cast<std::size_t>(hash);
+}
+
+}
+
+}
+
+}
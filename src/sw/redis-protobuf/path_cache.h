@@ -0,0 +1,103 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_PATH_CACHE_H
+#define SEWENEW_REDISPROTOBUF_PATH_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "utils.h"
+#include "field_ref.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// LRU cache of parsed paths, keyed by the original path string. Since a Path
+// keeps its resolved fields, a cached path also skips the field lookups.
+class PathCache {
+public:
+    explicit PathCache(std::size_t capacity) : _capacity(capacity) {}
+
+    PathCache(const PathCache &) = delete;
+    PathCache& operator=(const PathCache &) = delete;
+
+    PathCache(PathCache &&) = delete;
+    PathCache& operator=(PathCache &&) = delete;
+
+    ~PathCache() = default;
+
+    // If the path has been cached, assign it to *path* and return true.
+    // Otherwise, return false.
+    bool get(const StringView &str, Path &path);
+
+    void put(const StringView &str, const Path &path);
+
+    struct Stats {
+        std::size_t capacity = 0;
+        std::size_t size = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        Entry(const StringView &str, const Path &p) : key(str.data(), str.size()), path(p) {}
+
+        std::string key;
+        Path path;
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const StringView &key) const;
+    };
+
+    struct KeyEqual {
+        bool operator()(const StringView &lhs, const StringView &rhs) const {
+            return lhs.size() == rhs.size()
+                && std::memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+        }
+    };
+
+    using EntryList = std::list<Entry>;
+
+    std::size_t _capacity;
+
+    // The most recently used entry is at the front.
+    EntryList _entries;
+
+    // Keys refer to the strings owned by *_entries*.
+    std::unordered_map<StringView, EntryList::iterator, KeyHash, KeyEqual> _index;
+
+    uint64_t _hits = 0;
+    uint64_t _misses = 0;
+    uint64_t _evictions = 0;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_PATH_CACHE_H
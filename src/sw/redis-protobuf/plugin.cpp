@@ -0,0 +1,96 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "plugin.h"
+#include <dlfcn.h>
+#include "errors.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+std::string dl_error() {
+    const auto *err = dlerror();
+    return err == nullptr ? "unknown error" : err;
+}
+
+// Redis loads modules with RTLD_LOCAL, while plugins link to the protobuf
+// library inside this module. Reopen the module with RTLD_GLOBAL, so that
+// plugins are resolved with the same protobuf runtime and generated pool.
+void export_module_symbols() {
+    static bool exported = false;
+    if (exported) {
+        return;
+    }
+
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void *>(&export_module_symbols), &info) == 0
+            || info.dli_fname == nullptr) {
+        throw Error("failed to locate the module: " + dl_error());
+    }
+
+    if (dlopen(info.dli_fname, RTLD_NOW | RTLD_NOLOAD | RTLD_GLOBAL) == nullptr) {
+        throw Error("failed to export module symbols: " + dl_error());
+    }
+
+    exported = true;
+}
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+namespace plugin {
+
+std::vector<const gp::FileDescriptor*> load(const std::string &path) {
+    export_module_symbols();
+
+    // Static initializers of the generated code register its files to the
+    // generated pool, when the plugin is opened.
+    auto *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        throw Error("failed to load plugin " + path + ": " + dl_error());
+    }
+
+    auto files_func = reinterpret_cast<FilesFunc>(dlsym(handle, FILES_SYMBOL));
+    if (files_func == nullptr) {
+        throw Error("invalid plugin " + path + ": " + FILES_SYMBOL + " not found");
+    }
+
+    std::vector<const gp::FileDescriptor*> files;
+    for (const auto *iter = files_func(); iter != nullptr && *iter != nullptr; ++iter) {
+        if ((*iter)->pool() != gp::DescriptorPool::generated_pool()) {
+            throw Error("invalid plugin " + path + ": "
+                    + (*iter)->name() + " is not a generated file");
+        }
+
+        files.push_back(*iter);
+    }
+
+    return files;
+}
+
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,55 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_PLUGIN_H
+#define SEWENEW_REDISPROTOBUF_PLUGIN_H
+
+#include <string>
+#include <vector>
+#include <google/protobuf/descriptor.h>
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+namespace plugin {
+
+namespace gp = google::protobuf;
+
+// A plugin is a shared object with C++ classes generated by protoc, and
+// a registration stub, which exports a function of this name and type.
+// It returns the files compiled into the plugin, ended with a nullptr.
+constexpr const char *FILES_SYMBOL = "redis_protobuf_plugin_files";
+
+using FilesFunc = const gp::FileDescriptor* const* (*)();
+
+// Load the plugin at *path*, and return its files, whose descriptors are
+// in the generated pool. The plugin is never unloaded, since its classes
+// and descriptors are used until the process exits. It's NOT thread-safe.
+// Throw Error, if it fails to load.
+std::vector<const gp::FileDescriptor*> load(const std::string &path);
+
+}
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_PLUGIN_H
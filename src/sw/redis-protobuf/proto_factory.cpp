@@ -15,9 +15,34 @@
  *************************************************************************/
 
 #include "proto_factory.h"
-#include <google/protobuf/util/json_util.h>
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+#include <google/protobuf/compiler/parser.h>
+#include <google/protobuf/io/tokenizer.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include "utils.h"
 #include "errors.h"
+#include "metrics.h"
+#include "compression.h"
+#include "plugin.h"
+
+namespace {
+
+using namespace sw::redis::pb;
+
+// Parse the .proto file at *path* into *proto*, and name it with *name*.
+// Return the errors, or an empty string on success. It's thread-safe.
+std::string parse_proto(const std::string &path,
+        const std::string &name,
+        gp::FileDescriptorProto &proto);
+
+}
 
 namespace sw {
 
@@ -26,16 +51,9 @@ namespace redis {
 namespace pb {
 
 void FactoryErrorCollector::_add_error(const std::string &type,
-                                        const std::string &filename,
-                                        int line,
-                                        int column,
+                                        const std::string &location,
                                         const std::string &message) {
-    auto err = type + ":" + filename + ":"
-                + std::to_string(line) + ":"
-                + std::to_string(column) + ":"
-                + message;
-
-    _errors.push_back(std::move(err));
+    _errors.push_back(type + ":" + location + ":" + message);
 }
 
 std::string FactoryErrorCollector::last_errors() const {
@@ -51,78 +69,557 @@ std::string FactoryErrorCollector::last_errors() const {
     return err_str;
 }
 
-ProtoFactory::ProtoFactory(const std::string &proto_dir) :
-                            _proto_dir(proto_dir),
-                            _importer(&_source_tree, &_error_collector) {
-    _source_tree.MapPath("", _proto_dir);
+ProtoSchema::ProtoSchema(const std::string &proto_dir,
+                            const std::string &descriptor_set,
+                            std::size_t threads) {
+    gp::FileDescriptorSet file_set;
+    if (!descriptor_set.empty()) {
+        file_set = _load_descriptor_set(descriptor_set);
+    }
+
+    std::vector<std::string> names;
+    if (!proto_dir.empty()) {
+        names = _list_protos(proto_dir);
+    }
+
+    auto protos = _parse_protos(proto_dir, names, threads);
+
+    // Files in the descriptor set are inserted first, so that they take
+    // precedence over those with the same name in the directory.
+    ProtoMap proto_map;
+    for (const auto &proto : file_set.file()) {
+        proto_map.emplace(proto.name(), &proto);
+    }
+
+    for (const auto &proto : protos) {
+        proto_map.emplace(proto.name(), &proto);
+    }
+
+    std::unordered_set<std::string> building;
+    for (const auto &proto : file_set.file()) {
+        _build(proto.name(), proto_map, building);
+    }
 
-    _load_protos(_proto_dir);
+    for (const auto &name : names) {
+        _build(name, proto_map, building);
+    }
+
+    // The pool is immutable from now on, so that its type resolver can be
+    // shared by all JSON conversions.
+    util::register_type_resolver(_pool);
 }
 
-MsgUPtr ProtoFactory::create(const std::string &type) {
-    const auto *desc = descriptor(type);
-    if (desc == nullptr) {
-        throw Error("unknown protobuf type: " + type);
+ProtoSchema::~ProtoSchema() {
+    util::unregister_type_resolver(_pool);
+}
+
+gp::FileDescriptorSet ProtoSchema::_load_descriptor_set(const std::string &path) const {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw Error("failed to open descriptor set: " + path);
     }
 
-    const auto *prototype = _factory.GetPrototype(desc);
+    gp::FileDescriptorSet file_set;
+    if (!file_set.ParseFromIstream(&file)) {
+        throw Error("failed to parse descriptor set: " + path);
+    }
 
-    assert(prototype != nullptr);
+    return file_set;
+}
 
-    return MsgUPtr(prototype->New());
+std::vector<std::string> ProtoSchema::_list_protos(const std::string &proto_dir) const {
+    std::vector<std::string> names;
+    auto prefix_size = proto_dir.size() + 1;
+
+    // list_dir walks sub-directories, and a file's name is its path relative
+    // to *proto_dir*, e.g. 'google/protobuf/any.proto', which matches imports.
+    for (const auto &file : io::list_dir(proto_dir)) {
+        if (!io::is_regular(file) || io::extension(file) != "proto"
+                || file.size() < prefix_size) {
+            continue;
+        }
+
+        names.push_back(file.substr(prefix_size));
+    }
+
+    // Keep the load order stable, no matter how the directory is listed.
+    std::sort(names.begin(), names.end());
+
+    return names;
 }
 
-MsgUPtr ProtoFactory::create(const std::string &type, const StringView &sv) {
-    auto msg = create(type);
+std::vector<gp::FileDescriptorProto> ProtoSchema::_parse_protos(const std::string &proto_dir,
+        const std::vector<std::string> &names,
+        std::size_t threads) const {
+    std::vector<gp::FileDescriptorProto> protos(names.size());
+    std::vector<std::string> errors(names.size());
 
-    const auto *ptr = sv.data();
-    auto len = sv.size();
-    if (len >= 2 && ptr[0] == '{' && ptr[len - 1] == '}') {
-        auto status = gp::util::JsonStringToMessage(gp::StringPiece(ptr, len), msg.get());
-        if (!status.ok()) {
-            throw Error("failed to parse json to " + type + ": " + status.ToString());
+    // Parsing is independent for each file, so that files are distributed
+    // among threads. Building them into the pool is done later in this thread.
+    std::atomic<std::size_t> next{0};
+    auto worker = [&]() {
+        for (auto idx = next++; idx < names.size(); idx = next++) {
+            errors[idx] = parse_proto(proto_dir + "/" + names[idx], names[idx], protos[idx]);
         }
-    } else {
-        if (!msg->ParseFromArray(ptr, len)) {
-            throw Error("failed to parse binary to " + type);
+    };
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+    threads = std::min(threads, names.size());
+
+    std::vector<std::thread> workers;
+    try {
+        for (std::size_t idx = 1; idx < threads; ++idx) {
+            workers.emplace_back(worker);
         }
+    } catch (const std::system_error &) {
+        // Failed to create more threads, go on with those already created.
     }
 
+    worker();
+
+    for (auto &thread : workers) {
+        thread.join();
+    }
+
+    for (std::size_t idx = 0; idx != names.size(); ++idx) {
+        if (!errors[idx].empty()) {
+            throw Error("failed to load " + names[idx] + "\n" + errors[idx]);
+        }
+    }
+
+    return protos;
+}
+
+const gp::FileDescriptor* ProtoSchema::_build(const std::string &name,
+        const ProtoMap &protos,
+        std::unordered_set<std::string> &building) {
+    const auto *file = _pool.FindFileByName(name);
+    if (file != nullptr) {
+        return file;
+    }
+
+    auto iter = protos.find(name);
+    if (iter == protos.end()) {
+        throw Error("failed to load " + name + ": file not found");
+    }
+
+    if (!building.insert(name).second) {
+        throw Error("failed to load " + name + ": import cycle");
+    }
+
+    const auto &proto = *(iter->second);
+    for (auto idx = 0; idx != proto.dependency_size(); ++idx) {
+        _build(proto.dependency(idx), protos, building);
+    }
+
+    building.erase(name);
+
+    // Clear last errors.
+    _error_collector.clear();
+
+    file = _pool.BuildFileCollectingErrors(proto, &_error_collector);
+    if (file == nullptr || _error_collector.has_error()) {
+        throw Error("failed to load " + name + "\n" + _error_collector.last_errors());
+    }
+
+    _files.push_back(file);
+
+    return file;
+}
+
+ProtoFactory::ProtoFactory(const std::string &proto_dir,
+                            bool use_arena,
+                            bool lazy_parse,
+                            std::size_t load_threads,
+                            const std::string &descriptor_set,
+                            std::size_t compress_threshold,
+                            const std::vector<std::string> &plugins) :
+                            _proto_dir(proto_dir),
+                            _descriptor_set(descriptor_set),
+                            _use_arena(use_arena),
+                            _lazy_parse(lazy_parse),
+                            _load_threads(load_threads),
+                            _compress_threshold(compress_threshold) {
+    _schemas.push_back(load_schema());
+
+    for (const auto &path : plugins) {
+        _load_plugin(path);
+    }
+
+    if (!_plugin_types.empty()) {
+        util::register_type_resolver(*gp::DescriptorPool::generated_pool());
+    }
+}
+
+ProtoFactory::~ProtoFactory() {
+    if (!_plugin_types.empty()) {
+        util::unregister_type_resolver(*gp::DescriptorPool::generated_pool());
+    }
+}
+
+MsgUPtr ProtoFactory::create(const std::string &type) {
+    return MsgUPtr(_prototype(type)->New());
+}
+
+MsgUPtr ProtoFactory::create(const std::string &type, const StringView &sv) {
+    auto msg = create(type);
+
+    _parse(type, sv, *msg);
+
+    return msg;
+}
+
+MsgUPtr ProtoFactory::create(const gp::Descriptor &desc, const StringView &sv) {
+    MsgUPtr msg(_prototype(desc)->New());
+
+    _parse(desc.full_name(), sv, *msg);
+
     return msg;
 }
 
+ProtoValueUPtr ProtoFactory::create_value(const std::string &type) {
+    return _create_value(*_prototype(type));
+}
+
+ProtoValueUPtr ProtoFactory::create_value(const std::string &type, const StringView &sv) {
+    if (_lazy_parse && !util::is_json(sv)) {
+        const auto *prototype = _prototype(type);
+
+        // Validate the binary string with a temporary message, so that we
+        // can reply with an error at once. Only the binary string is kept.
+        MsgUPtr msg(prototype->New());
+        _parse(type, sv, *msg);
+
+        ProtoValueUPtr value(new ProtoValue(*prototype,
+                    std::string(sv.data(), sv.size()),
+                    _use_arena));
+
+        value->compact(*prototype, _compress_threshold);
+
+        return value;
+    }
+
+    auto value = create_value(type);
+
+    _parse(type, sv, value->msg());
+
+    return value;
+}
+
+ProtoValueUPtr ProtoFactory::create_value(const gp::Descriptor &desc) {
+    return _create_value(*_prototype(desc));
+}
+
+ProtoValueUPtr ProtoFactory::create_lazy_value(const gp::Descriptor &desc,
+        std::string wire,
+        std::size_t raw_size) {
+    if (raw_size > 0 && _compress_threshold == 0) {
+        // Compression has been disabled since the message was compressed.
+        wire = compression::decompress(wire, raw_size);
+        raw_size = 0;
+    }
+
+    const auto &prototype = *_prototype(desc);
+
+    ProtoValueUPtr value(new ProtoValue(prototype, std::move(wire), _use_arena, raw_size));
+
+    value->compact(prototype, _compress_threshold);
+
+    return value;
+}
+
+void ProtoFactory::compact(ProtoValue &value) {
+    value.compact(*_prototype(*value.descriptor()), _compress_threshold);
+}
+
 const gp::Descriptor* ProtoFactory::descriptor(const std::string &type) {
-    return _importer.pool()->FindMessageTypeByName(type);
+    if (!_plugin_types.empty()) {
+        auto iter = _plugin_types.find(type);
+        if (iter != _plugin_types.end()) {
+            return iter->second;
+        }
+    }
+
+    return _schema().pool()->FindMessageTypeByName(type);
 }
 
-void ProtoFactory::_load_protos(const std::string &proto_dir) {
-    auto files = io::list_dir(proto_dir);
-    for (const auto &file : files) {
-        if (!io::is_regular(file) || io::extension(file) != "proto") {
+std::vector<const gp::Descriptor*> ProtoFactory::message_types() const {
+    const auto &schema_files = _schema().files();
+
+    std::vector<const gp::Descriptor*> types;
+    std::unordered_set<const gp::FileDescriptor*> visited;
+    std::vector<const gp::FileDescriptor*> files(schema_files.begin(), schema_files.end());
+    while (!files.empty()) {
+        const auto *file = files.back();
+        files.pop_back();
+
+        if (!visited.insert(file).second) {
             continue;
         }
 
-        auto prefix_size = proto_dir.size() + 1;
-        if (file.size() < prefix_size) {
-            continue;
+        for (auto idx = 0; idx != file->dependency_count(); ++idx) {
+            files.push_back(file->dependency(idx));
+        }
+
+        std::vector<const gp::Descriptor*> descs;
+        for (auto idx = 0; idx != file->message_type_count(); ++idx) {
+            descs.push_back(file->message_type(idx));
         }
 
-        _load(file.substr(prefix_size));
+        while (!descs.empty()) {
+            const auto *desc = descs.back();
+            descs.pop_back();
+
+            types.push_back(desc);
+
+            for (auto idx = 0; idx != desc->nested_type_count(); ++idx) {
+                descs.push_back(desc->nested_type(idx));
+            }
+        }
     }
+
+    if (!_plugin_types.empty()) {
+        std::unordered_set<std::string> replaced;
+        for (auto &desc : types) {
+            auto iter = _plugin_types.find(desc->full_name());
+            if (iter != _plugin_types.end()) {
+                desc = iter->second;
+                replaced.insert(iter->first);
+            }
+        }
+
+        for (const auto &type : _plugin_types) {
+            if (replaced.find(type.first) == replaced.end()) {
+                types.push_back(type.second);
+            }
+        }
+    }
+
+    return types;
 }
 
-void ProtoFactory::_load(const std::string &file) {
-    // Clear last errors.
-    _error_collector.clear();
+ProtoSchemaUPtr ProtoFactory::load_schema() const {
+    return ProtoSchemaUPtr(new ProtoSchema(_proto_dir, _descriptor_set, _load_threads));
+}
+
+uint64_t ProtoFactory::install(ProtoSchemaUPtr schema) {
+    assert(schema);
+
+    _schemas.push_back(std::move(schema));
+
+    // Prototypes looked up by descriptor are still valid for values of old
+    // generations, while names should be looked up in the new generation.
+    _prototypes_by_name.clear();
+
+    return generation();
+}
+
+ProtoFactory::SchemaStats ProtoFactory::schema_stats() const {
+    SchemaStats stats;
+    stats.generation = generation();
+    stats.files = _schema().files().size();
+    stats.migrations = _migrations;
+    stats.plugin_types = _plugin_types.size();
+
+    return stats;
+}
+
+void ProtoFactory::_migrate(ProtoValue &value) {
+    const auto *desc = descriptor(value.descriptor()->full_name());
+    if (desc == nullptr) {
+        // The type has been removed, and the value keeps its old descriptor.
+        return;
+    }
+
+    value.migrate(*_prototype(*desc));
+
+    ++_migrations;
+}
+
+void ProtoFactory::_load_plugin(const std::string &path) {
+    auto *factory = gp::MessageFactory::generated_factory();
+    for (const auto *file : plugin::load(path)) {
+        std::vector<const gp::Descriptor*> descs;
+        for (auto idx = 0; idx != file->message_type_count(); ++idx) {
+            descs.push_back(file->message_type(idx));
+        }
+
+        while (!descs.empty()) {
+            const auto *desc = descs.back();
+            descs.pop_back();
+
+            for (auto idx = 0; idx != desc->nested_type_count(); ++idx) {
+                descs.push_back(desc->nested_type(idx));
+            }
+
+            if (desc->options().map_entry()) {
+                continue;
+            }
+
+            std::unordered_set<const gp::Descriptor*> visited;
+            if (_has_map(*desc, visited) || factory->GetPrototype(desc) == nullptr) {
+                continue;
+            }
+
+            _plugin_types.emplace(desc->full_name(), desc);
+        }
+    }
+}
+
+bool ProtoFactory::_has_map(const gp::Descriptor &desc,
+        std::unordered_set<const gp::Descriptor*> &visited) const {
+    if (!visited.insert(&desc).second) {
+        return false;
+    }
+
+    for (auto idx = 0; idx != desc.field_count(); ++idx) {
+        const auto *field = desc.field(idx);
+        if (field->is_map()) {
+            return true;
+        }
+
+        if (field->cpp_type() == gp::FieldDescriptor::CPPTYPE_MESSAGE
+                && _has_map(*field->message_type(), visited)) {
+            return true;
+        }
+    }
 
-    auto *desc = _importer.Import(file);
-    if (desc == nullptr || _error_collector.has_error()) {
-        throw Error("failed to load " + file + "\n" + _error_collector.last_errors());
+    return false;
+}
+
+ProtoFactory::PrototypeCacheStats ProtoFactory::prototype_cache_stats() const {
+    PrototypeCacheStats stats;
+    stats.size = _prototypes_by_desc.size();
+    stats.hits = _prototype_hits;
+    stats.misses = _prototype_misses;
+
+    return stats;
+}
+
+const gp::Message* ProtoFactory::_prototype(const std::string &type) {
+    auto iter = _prototypes_by_name.find(type);
+    if (iter != _prototypes_by_name.end()) {
+        ++_prototype_hits;
+        return iter->second;
+    }
+
+    const auto *desc = descriptor(type);
+    if (desc == nullptr) {
+        throw Error("unknown protobuf type: " + type);
+    }
+
+    const auto *prototype = _prototype(*desc);
+
+    _prototypes_by_name.emplace(type, prototype);
+
+    return prototype;
+}
+
+const gp::Message* ProtoFactory::_prototype(const gp::Descriptor &desc) {
+    auto iter = _prototypes_by_desc.find(&desc);
+    if (iter != _prototypes_by_desc.end()) {
+        ++_prototype_hits;
+        return iter->second;
+    }
+
+    ++_prototype_misses;
+
+    // Only types of plugins and their sub-messages are looked up in the
+    // generated pool, and messages of the same type must be of the same
+    // class, so that they can be swapped and merged.
+    const gp::Message *prototype = nullptr;
+    if (desc.file()->pool() == gp::DescriptorPool::generated_pool()) {
+        prototype = gp::MessageFactory::generated_factory()->GetPrototype(&desc);
+    } else {
+        prototype = _factory.GetPrototype(&desc);
+    }
+
+    assert(prototype != nullptr);
+
+    _prototypes_by_desc.emplace(&desc, prototype);
+
+    return prototype;
+}
+
+ProtoValueUPtr ProtoFactory::_create_value(const gp::Message &prototype) {
+    if (_use_arena) {
+        return ProtoValueUPtr(new ProtoValue(prototype));
     }
+
+    return ProtoValueUPtr(new ProtoValue(MsgUPtr(prototype.New())));
+}
+
+void ProtoFactory::_parse(const std::string &type, const StringView &sv, gp::Message &msg) const {
+    if (util::is_json(sv)) {
+        util::json_to_msg(sv, msg);
+    } else {
+        LatencyTimer timer(Phase::PARSE);
+
+        if (!msg.ParseFromArray(sv.data(), sv.size())) {
+            throw Error("failed to parse binary to " + type);
+        }
+    }
+}
+
 }
 
 }
 
 }
 
+namespace {
+
+class ParseErrorCollector : public gp::io::ErrorCollector {
+public:
+    ParseErrorCollector(const std::string &file_name, FactoryErrorCollector &errors) :
+                            _file_name(file_name), _errors(errors) {}
+
+    virtual void AddError(int line,
+                            gp::io::ColumnNumber column,
+                            const std::string &message) override {
+        // Both line and column are zero-based.
+        _errors.add_parse_error("error", _file_name, line + 1, column + 1, message);
+    }
+
+    virtual void AddWarning(int line,
+                            gp::io::ColumnNumber column,
+                            const std::string &message) override {
+        _errors.add_parse_error("warning", _file_name, line + 1, column + 1, message);
+    }
+
+private:
+    const std::string &_file_name;
+
+    FactoryErrorCollector &_errors;
+};
+
+std::string parse_proto(const std::string &path,
+        const std::string &name,
+        gp::FileDescriptorProto &proto) {
+    std::ifstream file(path);
+    if (!file) {
+        return "failed to open " + path;
+    }
+
+    std::string str((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    FactoryErrorCollector errors;
+    ParseErrorCollector collector(name, errors);
+    gp::io::ArrayInputStream input(str.data(), static_cast<int>(str.size()));
+    gp::io::Tokenizer tokenizer(&input, &collector);
+
+    gp::compiler::Parser parser;
+    parser.RecordErrorsTo(&collector);
+    if (!parser.Parse(&tokenizer, &proto) || errors.has_error()) {
+        auto err = errors.last_errors();
+        return err.empty() ? "failed to parse " + name : err;
+    }
+
+    proto.set_name(name);
+
+    return {};
+}
+
 }
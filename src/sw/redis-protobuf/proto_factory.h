@@ -17,11 +17,18 @@
 #ifndef SEWENEW_REDISPROTOBUF_PROTO_FACTORY_H
 #define SEWENEW_REDISPROTOBUF_PROTO_FACTORY_H
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
+#include <unordered_set>
 #include <google/protobuf/message.h>
-#include <google/protobuf/compiler/importer.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/descriptor.pb.h>
 #include <google/protobuf/dynamic_message.h>
 #include "utils.h"
+#include "proto_value.h"
 
 namespace sw {
 
@@ -29,20 +36,35 @@ namespace redis {
 
 namespace pb {
 
-class FactoryErrorCollector : public gp::compiler::MultiFileErrorCollector {
+// Collects errors of building files into a descriptor pool, and errors
+// of parsing .proto files.
+class FactoryErrorCollector : public gp::DescriptorPool::ErrorCollector {
 public:
     virtual void AddError(const std::string &file_name,
-                            int line,
-                            int column,
+                            const std::string &element_name,
+                            const gp::Message * /*descriptor*/,
+                            ErrorLocation /*location*/,
                             const std::string &message) override {
-        _add_error("error", file_name, line, column, message);
+        _add_error("error", file_name + ":" + element_name, message);
     }
 
     virtual void AddWarning(const std::string &file_name,
+                            const std::string &element_name,
+                            const gp::Message * /*descriptor*/,
+                            ErrorLocation /*location*/,
+                            const std::string &message) override {
+        _add_error("warning", file_name + ":" + element_name, message);
+    }
+
+    // *type* is either "error" or "warning".
+    void add_parse_error(const std::string &type,
+                            const std::string &file_name,
                             int line,
                             int column,
-                            const std::string &message) override {
-        _add_error("warning", file_name, line, column, message);
+                            const std::string &message) {
+        _add_error(type,
+                file_name + ":" + std::to_string(line) + ":" + std::to_string(column),
+                message);
     }
 
     std::string last_errors() const;
@@ -57,17 +79,94 @@ public:
 
 private:
     void _add_error(const std::string &type,
-                    const std::string &filename,
-                    int line,
-                    int column,
+                    const std::string &location,
                     const std::string &message);
 
     std::vector<std::string> _errors;
 };
 
+// Message types imported from all .proto files in a directory (searched
+// recursively), and from a serialized FileDescriptorSet, i.e. a generation
+// of schemas. Either *proto_dir* or *descriptor_set* can be empty.
+// Once created, it's immutable, and its descriptors stay valid until it's
+// destroyed. It can be created in a worker thread.
+//
+// Files are parsed in parallel with *threads* threads, and then built into
+// the pool in dependency order. If *threads* is 0, use one thread per core.
+// If a file exists in both the descriptor set and the directory, the one in
+// the descriptor set is used.
+class ProtoSchema {
+public:
+    ProtoSchema(const std::string &proto_dir,
+                const std::string &descriptor_set,
+                std::size_t threads);
+
+    ProtoSchema(const ProtoSchema &) = delete;
+    ProtoSchema& operator=(const ProtoSchema &) = delete;
+
+    ProtoSchema(ProtoSchema &&) = delete;
+    ProtoSchema& operator=(ProtoSchema &&) = delete;
+
+    // Unregister the type resolver of the pool, see util::register_type_resolver.
+    ~ProtoSchema();
+
+    const gp::DescriptorPool* pool() const {
+        return &_pool;
+    }
+
+    // Files imported from the directory and the descriptor set.
+    const std::vector<const gp::FileDescriptor*>& files() const {
+        return _files;
+    }
+
+private:
+    using ProtoMap = std::unordered_map<std::string, const gp::FileDescriptorProto*>;
+
+    // Load files from the serialized FileDescriptorSet at *path*.
+    gp::FileDescriptorSet _load_descriptor_set(const std::string &path) const;
+
+    // List .proto files under *proto_dir*, and return their relative names.
+    std::vector<std::string> _list_protos(const std::string &proto_dir) const;
+
+    // Parse .proto files, whose names are relative to *proto_dir*. Throw Error
+    // if any file fails to parse.
+    std::vector<gp::FileDescriptorProto> _parse_protos(const std::string &proto_dir,
+            const std::vector<std::string> &names,
+            std::size_t threads) const;
+
+    // Build the file after its dependencies, and return the built file.
+    // *building* is the files being built, which is used to detect cycles.
+    const gp::FileDescriptor* _build(const std::string &name,
+            const ProtoMap &protos,
+            std::unordered_set<std::string> &building);
+
+    FactoryErrorCollector _error_collector;
+
+    gp::DescriptorPool _pool;
+
+    std::vector<const gp::FileDescriptor*> _files;
+};
+
+using ProtoSchemaUPtr = std::unique_ptr<ProtoSchema>;
+
 class ProtoFactory {
 public:
-    explicit ProtoFactory(const std::string &proto_dir);
+    // If *use_arena* is true, values created by this factory are allocated on arenas.
+    // If *lazy_parse* is true, values created from binary strings are lazy,
+    // i.e. only the binary string is kept, until some field is accessed.
+    // .proto files are parsed with *load_threads* threads, and files in
+    // *descriptor_set* are loaded along with them, see ProtoSchema.
+    // If *compress_threshold* is larger than 0, lazy values whose serialized
+    // messages are no smaller than it are compressed, see ProtoValue::compact.
+    // Message types compiled into *plugins*, see plugin.h, are created as
+    // generated messages, and they take precedence over those in .proto files.
+    explicit ProtoFactory(const std::string &proto_dir,
+                            bool use_arena = false,
+                            bool lazy_parse = false,
+                            std::size_t load_threads = 0,
+                            const std::string &descriptor_set = {},
+                            std::size_t compress_threshold = 0,
+                            const std::vector<std::string> &plugins = {});
 
     ProtoFactory(const ProtoFactory &) = delete;
     ProtoFactory& operator=(const ProtoFactory &) = delete;
@@ -75,29 +174,160 @@ public:
     ProtoFactory(ProtoFactory &&) = delete;
     ProtoFactory& operator=(ProtoFactory &&) = delete;
 
-    ~ProtoFactory() = default;
+    ~ProtoFactory();
 
     MsgUPtr create(const std::string &type);
 
     MsgUPtr create(const std::string &type, const StringView &sv);
 
+    // Create a message of the given type, which might be of an old generation.
+    MsgUPtr create(const gp::Descriptor &desc, const StringView &sv);
+
+    // Create a message as the value of a key.
+    ProtoValueUPtr create_value(const std::string &type);
+
+    ProtoValueUPtr create_value(const std::string &type, const StringView &sv);
+
+    // Create a value of the given message type, without looking up the type name.
+    ProtoValueUPtr create_value(const gp::Descriptor &desc);
+
+    // Create a lazy value with the serialized message, which is NOT validated.
+    // If *raw_size* is larger than 0, *wire* is compressed from a serialized
+    // message of *raw_size* bytes, and it's kept compressed only if compression
+    // is enabled.
+    ProtoValueUPtr create_lazy_value(const gp::Descriptor &desc,
+            std::string wire,
+            std::size_t raw_size = 0);
+
+    // Serialize a parsed value back to a lazy one, and compress it if it's
+    // large enough. See ProtoValue::compact.
+    void compact(ProtoValue &value);
+
+    std::size_t compress_threshold() const {
+        return _compress_threshold;
+    }
+
+    // Look up the type in plugins, and then in the current generation of schemas.
     const gp::Descriptor* descriptor(const std::string &type);
 
+    // All message types, including nested ones, defined in the loaded .proto
+    // files, of the current generation, and their dependencies, and types
+    // of plugins. A type of plugins replaces the one with the same name.
+    std::vector<const gp::Descriptor*> message_types() const;
+
+    // Load all .proto files in the proto directory as a new generation.
+    // It doesn't modify the factory, and can be called in a worker thread.
+    // Throw Error, if any file fails to load.
+    ProtoSchemaUPtr load_schema() const;
+
+    // Switch to *schema*, and return its generation. Values of old generations
+    // are still valid, since old generations are never freed, and they're
+    // migrated to the new generation lazily, when they're accessed.
+    uint64_t install(ProtoSchemaUPtr schema);
+
+    // Current generation, which starts from 1.
+    uint64_t generation() const {
+        return _schemas.size();
+    }
+
+    // If *value* is of an old generation, and its type exists in the current
+    // generation, convert it to the current one. Otherwise, leave it pinned
+    // to its own generation. Types of plugins never change.
+    void migrate(ProtoValue &value) {
+        const auto *pool = value.descriptor()->file()->pool();
+        if (pool != _schema().pool() && pool != gp::DescriptorPool::generated_pool()) {
+            _migrate(value);
+        }
+    }
+
+    struct PrototypeCacheStats {
+        // Number of cached prototypes.
+        std::size_t size = 0;
+
+        uint64_t hits = 0;
+
+        uint64_t misses = 0;
+    };
+
+    PrototypeCacheStats prototype_cache_stats() const;
+
+    struct SchemaStats {
+        uint64_t generation = 0;
+
+        // Number of .proto files of the current generation.
+        std::size_t files = 0;
+
+        // Number of values migrated from old generations.
+        uint64_t migrations = 0;
+
+        // Number of message types created as generated messages.
+        std::size_t plugin_types = 0;
+    };
+
+    SchemaStats schema_stats() const;
+
 private:
-    void _load_protos(const std::string &proto_dir);
+    const ProtoSchema& _schema() const {
+        return *_schemas.back();
+    }
+
+    void _migrate(ProtoValue &value);
 
-    void _load(const std::string &file);
+    void _load_plugin(const std::string &path);
+
+    // Whether messages of *desc*, or any of its sub-messages, have map fields.
+    // Map fields are accessed as dynamic maps, see FieldRef, so that these
+    // types fall back to dynamic messages.
+    bool _has_map(const gp::Descriptor &desc,
+            std::unordered_set<const gp::Descriptor*> &visited) const;
+
+    const gp::Message* _prototype(const std::string &type);
+
+    const gp::Message* _prototype(const gp::Descriptor &desc);
+
+    ProtoValueUPtr _create_value(const gp::Message &prototype);
+
+    // Parse binary or json string into *msg*.
+    void _parse(const std::string &type, const StringView &sv, gp::Message &msg) const;
 
     // Dir where .proto file are saved.
     std::string _proto_dir;
 
-    gp::compiler::DiskSourceTree _source_tree;
+    // Path of a serialized FileDescriptorSet.
+    std::string _descriptor_set;
 
-    FactoryErrorCollector _error_collector;
-
-    gp::compiler::Importer _importer;
+    // All generations, and the last one is the current generation.
+    std::vector<ProtoSchemaUPtr> _schemas;
 
+    // It creates prototypes of any generation, and must be destroyed before
+    // *_schemas*, since prototypes refer to descriptors.
     gp::DynamicMessageFactory _factory;
+
+    // Types of plugins, whose descriptors are in the generated pool, and
+    // whose prototypes are created by the generated factory.
+    std::unordered_map<std::string, const gp::Descriptor*> _plugin_types;
+
+    // Prototypes looked up by type name and by descriptor, so that creating
+    // a message only costs one hash probe, instead of a pool lookup and
+    // a locked lookup in *_factory*. Unknown types are not cached. Names are
+    // looked up in the current generation, and they're cleared on switching.
+    std::unordered_map<std::string, const gp::Message*> _prototypes_by_name;
+
+    std::unordered_map<const gp::Descriptor*, const gp::Message*> _prototypes_by_desc;
+
+    uint64_t _prototype_hits = 0;
+
+    uint64_t _prototype_misses = 0;
+
+    uint64_t _migrations = 0;
+
+    bool _use_arena;
+
+    bool _lazy_parse;
+
+    std::size_t _load_threads;
+
+    std::size_t _compress_threshold;
 };
 
 }
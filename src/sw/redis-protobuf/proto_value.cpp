@@ -0,0 +1,587 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "proto_value.h"
+#include <cassert>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include "errors.h"
+#include "metrics.h"
+#include "compression.h"
+
+namespace {
+
+struct ArenaCounters {
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> blocks{0};
+    std::atomic<uint64_t> allocated_bytes{0};
+};
+
+ArenaCounters& arena_counters();
+
+// Values might be freed in the lazyfree thread, so counters are atomic.
+struct StorageCounters {
+    std::atomic<uint64_t> values{0};
+    std::atomic<uint64_t> serialized_values{0};
+    std::atomic<uint64_t> serialized_bytes{0};
+    std::atomic<uint64_t> compactions{0};
+    std::atomic<uint64_t> cached_values{0};
+    std::atomic<uint64_t> cached_bytes{0};
+};
+
+StorageCounters& storage_counters();
+
+void add_serialized(const std::string &wire);
+
+void remove_serialized(const std::string &wire);
+
+struct CompressionCounters {
+    std::atomic<uint64_t> compressed_values{0};
+    std::atomic<uint64_t> compressed_bytes{0};
+    std::atomic<uint64_t> uncompressed_bytes{0};
+    std::atomic<uint64_t> decompressed_values{0};
+    std::atomic<uint64_t> decompressed_bytes{0};
+    std::atomic<uint64_t> decompressions{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> evictions{0};
+};
+
+CompressionCounters& compression_counters();
+
+void add_compressed(const std::string &wire, std::size_t raw_size);
+
+void remove_compressed(const std::string &wire, std::size_t raw_size);
+
+// LRU list of compressed values, whose decompressed messages are cached. Values
+// are only read, and the cache is only filled, in the main thread. However, a
+// value might be freed in the lazyfree thread, so the list is guarded by the mutex.
+struct DecompressedCache {
+    using ValueList = std::list<const sw::redis::pb::ProtoValue *>;
+
+    std::mutex mtx;
+
+    // The most recently used one is at the front.
+    ValueList lru;
+
+    std::unordered_map<const sw::redis::pb::ProtoValue *, ValueList::iterator> index;
+
+    std::size_t bytes = 0;
+
+    std::size_t capacity = 16 * 1024 * 1024;
+};
+
+DecompressedCache& decompressed_cache();
+
+void* arena_block_alloc(std::size_t size);
+
+void arena_block_dealloc(void *ptr, std::size_t size);
+
+google::protobuf::ArenaOptions arena_options();
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+ProtoValue::ProtoValue(MsgUPtr msg) : _msg(msg.release()) {
+    if (_msg == nullptr) {
+        throw Error("null message");
+    }
+
+    _prototype = _msg;
+
+    storage_counters().values.fetch_add(1, std::memory_order_relaxed);
+}
+
+ProtoValue::ProtoValue(const gp::Message &prototype) :
+                        _prototype(&prototype),
+                        _use_arena(true),
+                        _arena(new gp::Arena(arena_options())),
+                        _msg(prototype.New(_arena.get())) {
+    assert(_msg != nullptr);
+
+    arena_counters().messages.fetch_add(1, std::memory_order_relaxed);
+    storage_counters().values.fetch_add(1, std::memory_order_relaxed);
+}
+
+ProtoValue::ProtoValue(const gp::Message &prototype,
+        std::string wire,
+        bool use_arena,
+        std::size_t raw_size) :
+                        _prototype(&prototype),
+                        _use_arena(use_arena),
+                        _wire(std::move(wire)),
+                        _raw_size(raw_size) {
+    storage_counters().values.fetch_add(1, std::memory_order_relaxed);
+    add_serialized(_wire);
+
+    if (_raw_size > 0) {
+        add_compressed(_wire, _raw_size);
+    }
+}
+
+ProtoValue::~ProtoValue() {
+    if (_msg != nullptr) {
+        invalidate();
+
+        _free_msg();
+    } else {
+        if (_raw_size > 0) {
+            // It might be freed in the lazyfree thread, so remove it from the
+            // decompressed cache first, with the cache locked.
+            _untrack();
+
+            remove_compressed(_wire, _raw_size);
+        }
+
+        remove_serialized(_wire);
+    }
+
+    storage_counters().values.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ProtoValue::compact(const gp::Message &prototype, std::size_t compress_threshold) {
+    assert(prototype.GetDescriptor() == descriptor());
+
+    if (_msg != nullptr) {
+        _serialize();
+
+        // The heap allocated message might be the prototype itself.
+        _prototype = &prototype;
+
+        storage_counters().compactions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (compress_threshold > 0 && _raw_size == 0 && _wire.size() >= compress_threshold) {
+        _compress();
+    }
+}
+
+void ProtoValue::decompress(std::string &buf) const {
+    assert(_raw_size > 0);
+
+    buf = compression::decompress(_wire, _raw_size);
+}
+
+void ProtoValue::migrate(const gp::Message &prototype) {
+    assert(prototype.GetDescriptor()->full_name() == descriptor()->full_name());
+
+    if (_msg != nullptr) {
+        _serialize();
+    }
+
+    // Fields that don't exist in the new type are kept as unknown fields.
+    _prototype = &prototype;
+}
+
+const std::string& ProtoValue::cache_serialized() const {
+    if (_msg == nullptr) {
+        return wire();
+    }
+
+    if (!_cached) {
+        LatencyTimer timer(Phase::SERIALIZE);
+
+        if (!_msg->SerializeToString(&_cache)) {
+            _cache.clear();
+            throw Error("failed to serialize protobuf of type: " + descriptor()->full_name());
+        }
+
+        _cached = true;
+
+        auto &counters = storage_counters();
+        counters.cached_values.fetch_add(1, std::memory_order_relaxed);
+        counters.cached_bytes.fetch_add(_cache.capacity(), std::memory_order_relaxed);
+    }
+
+    return _cache;
+}
+
+std::string ProtoValue::_drop_cache() const {
+    assert(_cached);
+
+    auto &counters = storage_counters();
+    counters.cached_values.fetch_sub(1, std::memory_order_relaxed);
+    counters.cached_bytes.fetch_sub(_cache.capacity(), std::memory_order_relaxed);
+
+    std::string cache;
+    cache.swap(_cache);
+    _cached = false;
+
+    return cache;
+}
+
+void ProtoValue::_compress() {
+    assert(_msg == nullptr && _raw_size == 0 && !_cached);
+
+    auto compressed = compression::compress(_wire);
+    if (compressed.empty()) {
+        // Incompressible, e.g. the message mostly consists of compressed bytes.
+        return;
+    }
+
+    remove_serialized(_wire);
+
+    _raw_size = _wire.size();
+    _wire = std::move(compressed);
+
+    add_serialized(_wire);
+    add_compressed(_wire, _raw_size);
+}
+
+const std::string& ProtoValue::_decompressed() const {
+    assert(_msg == nullptr && _raw_size > 0);
+
+    auto &cache = decompressed_cache();
+    auto &counters = compression_counters();
+
+    // Only the main thread fills the cache, or evicts messages from it, so
+    // it's safe to check our own message without the lock.
+    if (_cached) {
+        std::lock_guard<std::mutex> lock(cache.mtx);
+
+        auto iter = cache.index.find(this);
+        assert(iter != cache.index.end());
+
+        cache.lru.splice(cache.lru.begin(), cache.lru, iter->second);
+
+        counters.hits.fetch_add(1, std::memory_order_relaxed);
+
+        return _cache;
+    }
+
+    // Decompress it without the lock, so that the lazyfree thread is not blocked.
+    auto raw = compression::decompress(_wire, _raw_size);
+
+    counters.decompressions.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(cache.mtx);
+
+    _cache.swap(raw);
+    _cached = true;
+
+    cache.lru.push_front(this);
+    cache.index.emplace(this, cache.lru.begin());
+    cache.bytes += _cache.capacity();
+
+    counters.decompressed_values.fetch_add(1, std::memory_order_relaxed);
+    counters.decompressed_bytes.fetch_add(_cache.capacity(), std::memory_order_relaxed);
+
+    // Never evict the message that has just been decompressed.
+    while (cache.bytes > cache.capacity && cache.lru.size() > 1) {
+        const auto *victim = cache.lru.back();
+        cache.lru.pop_back();
+        cache.index.erase(victim);
+
+        assert(victim->_cached);
+
+        auto size = victim->_cache.capacity();
+        cache.bytes -= size;
+
+        std::string().swap(victim->_cache);
+        victim->_cached = false;
+
+        counters.decompressed_values.fetch_sub(1, std::memory_order_relaxed);
+        counters.decompressed_bytes.fetch_sub(size, std::memory_order_relaxed);
+        counters.evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return _cache;
+}
+
+void ProtoValue::_untrack() const {
+    assert(_raw_size > 0);
+
+    auto &cache = decompressed_cache();
+
+    std::lock_guard<std::mutex> lock(cache.mtx);
+
+    if (!_cached) {
+        return;
+    }
+
+    auto iter = cache.index.find(this);
+    assert(iter != cache.index.end());
+
+    cache.lru.erase(iter->second);
+    cache.index.erase(iter);
+
+    auto size = _cache.capacity();
+    cache.bytes -= size;
+
+    std::string().swap(_cache);
+    _cached = false;
+
+    auto &counters = compression_counters();
+    counters.decompressed_values.fetch_sub(1, std::memory_order_relaxed);
+    counters.decompressed_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void ProtoValue::_serialize() {
+    assert(_msg != nullptr);
+
+    std::string wire;
+    if (_cached) {
+        // The message has not been modified since it was serialized.
+        wire = _drop_cache();
+    } else {
+        LatencyTimer timer(Phase::SERIALIZE);
+
+        if (!_msg->SerializeToString(&wire)) {
+            throw Error("failed to serialize protobuf of type: " + descriptor()->full_name());
+        }
+    }
+
+    _free_msg();
+
+    _wire = std::move(wire);
+
+    add_serialized(_wire);
+}
+
+void ProtoValue::_free_msg() const {
+    assert(_msg != nullptr);
+
+    if (_arena) {
+        // Messages allocated on arena are destroyed by the arena.
+        _msg = nullptr;
+        _arena.reset();
+
+        arena_counters().messages.fetch_sub(1, std::memory_order_relaxed);
+    } else {
+        delete _msg;
+        _msg = nullptr;
+    }
+}
+
+void ProtoValue::_parse() const {
+    assert(_msg == nullptr);
+
+    LatencyTimer timer(Phase::PARSE);
+
+    std::unique_ptr<gp::Arena> arena;
+    MsgUPtr msg;
+    if (_use_arena) {
+        arena.reset(new gp::Arena(arena_options()));
+        // The message is owned by the arena, and the unique_ptr won't delete it.
+        _msg = _prototype->New(arena.get());
+    } else {
+        msg.reset(_prototype->New());
+        _msg = msg.get();
+    }
+
+    // Parse a compressed value with its cached decompressed message, if any.
+    std::string raw;
+    const auto *wire = &_wire;
+    if (_raw_size > 0) {
+        if (_cached) {
+            wire = &_cache;
+        } else {
+            raw = compression::decompress(_wire, _raw_size);
+            wire = &raw;
+        }
+    }
+
+    if (!_msg->ParseFromString(*wire)) {
+        _msg = nullptr;
+        throw Error("failed to parse protobuf of type: " + descriptor()->full_name());
+    }
+
+    msg.release();
+
+    if (arena) {
+        _arena = std::move(arena);
+        arena_counters().messages.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (_raw_size > 0) {
+        _untrack();
+
+        remove_compressed(_wire, _raw_size);
+        _raw_size = 0;
+    }
+
+    // Free the serialized message.
+    remove_serialized(_wire);
+    std::string().swap(_wire);
+}
+
+std::size_t ProtoValue::memory_usage() const {
+    if (_msg == nullptr) {
+        // Including the cached decompressed message of a compressed value.
+        return sizeof(*this) + _wire.capacity() + (_cached ? _cache.capacity() : 0);
+    }
+
+    auto cache_size = _cached ? _cache.capacity() : 0;
+
+    if (_arena) {
+        return sizeof(*this) + sizeof(gp::Arena) + _arena->SpaceAllocated() + cache_size;
+    }
+
+    return sizeof(*this) + _msg->SpaceUsedLong() + cache_size;
+}
+
+std::size_t ProtoValue::free_effort() const {
+    // Freeing a heap allocated message costs roughly one deallocation per
+    // sub-object, while an arena frees its memory in blocks.
+    const std::size_t HEAP_BYTES_PER_FREE = 64;
+    const std::size_t ARENA_BYTES_PER_FREE = 1024;
+
+    auto bytes_per_free = _arena ? ARENA_BYTES_PER_FREE : HEAP_BYTES_PER_FREE;
+
+    return memory_usage() / bytes_per_free + 1;
+}
+
+ProtoValue::ArenaStats ProtoValue::arena_stats() {
+    const auto &counters = arena_counters();
+
+    ArenaStats stats;
+    stats.messages = counters.messages.load(std::memory_order_relaxed);
+    stats.blocks = counters.blocks.load(std::memory_order_relaxed);
+    stats.allocated_bytes = counters.allocated_bytes.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+ProtoValue::StorageStats ProtoValue::storage_stats() {
+    const auto &counters = storage_counters();
+
+    StorageStats stats;
+    stats.values = counters.values.load(std::memory_order_relaxed);
+    stats.serialized_values = counters.serialized_values.load(std::memory_order_relaxed);
+    stats.serialized_bytes = counters.serialized_bytes.load(std::memory_order_relaxed);
+    stats.compactions = counters.compactions.load(std::memory_order_relaxed);
+    stats.cached_values = counters.cached_values.load(std::memory_order_relaxed);
+    stats.cached_bytes = counters.cached_bytes.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+ProtoValue::CompressionStats ProtoValue::compression_stats() {
+    const auto &counters = compression_counters();
+
+    CompressionStats stats;
+    stats.compressed_values = counters.compressed_values.load(std::memory_order_relaxed);
+    stats.compressed_bytes = counters.compressed_bytes.load(std::memory_order_relaxed);
+    stats.uncompressed_bytes = counters.uncompressed_bytes.load(std::memory_order_relaxed);
+    stats.decompressed_values = counters.decompressed_values.load(std::memory_order_relaxed);
+    stats.decompressed_bytes = counters.decompressed_bytes.load(std::memory_order_relaxed);
+    stats.decompressions = counters.decompressions.load(std::memory_order_relaxed);
+    stats.hits = counters.hits.load(std::memory_order_relaxed);
+    stats.evictions = counters.evictions.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+void ProtoValue::set_decompressed_cache_size(std::size_t bytes) {
+    auto &cache = decompressed_cache();
+
+    std::lock_guard<std::mutex> lock(cache.mtx);
+
+    cache.capacity = bytes;
+}
+
+}
+
+}
+
+}
+
+namespace {
+
+ArenaCounters& arena_counters() {
+    static ArenaCounters counters;
+
+    return counters;
+}
+
+StorageCounters& storage_counters() {
+    static StorageCounters counters;
+
+    return counters;
+}
+
+void add_serialized(const std::string &wire) {
+    auto &counters = storage_counters();
+    counters.serialized_values.fetch_add(1, std::memory_order_relaxed);
+    counters.serialized_bytes.fetch_add(wire.capacity(), std::memory_order_relaxed);
+}
+
+void remove_serialized(const std::string &wire) {
+    auto &counters = storage_counters();
+    counters.serialized_values.fetch_sub(1, std::memory_order_relaxed);
+    counters.serialized_bytes.fetch_sub(wire.capacity(), std::memory_order_relaxed);
+}
+
+CompressionCounters& compression_counters() {
+    static CompressionCounters counters;
+
+    return counters;
+}
+
+void add_compressed(const std::string &wire, std::size_t raw_size) {
+    auto &counters = compression_counters();
+    counters.compressed_values.fetch_add(1, std::memory_order_relaxed);
+    counters.compressed_bytes.fetch_add(wire.capacity(), std::memory_order_relaxed);
+    counters.uncompressed_bytes.fetch_add(raw_size, std::memory_order_relaxed);
+}
+
+void remove_compressed(const std::string &wire, std::size_t raw_size) {
+    auto &counters = compression_counters();
+    counters.compressed_values.fetch_sub(1, std::memory_order_relaxed);
+    counters.compressed_bytes.fetch_sub(wire.capacity(), std::memory_order_relaxed);
+    counters.uncompressed_bytes.fetch_sub(raw_size, std::memory_order_relaxed);
+}
+
+DecompressedCache& decompressed_cache() {
+    static DecompressedCache cache;
+
+    return cache;
+}
+
+void* arena_block_alloc(std::size_t size) {
+    auto *ptr = ::operator new(size);
+
+    auto &counters = arena_counters();
+    counters.blocks.fetch_add(1, std::memory_order_relaxed);
+    counters.allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    return ptr;
+}
+
+void arena_block_dealloc(void *ptr, std::size_t size) {
+    ::operator delete(ptr);
+
+    auto &counters = arena_counters();
+    counters.blocks.fetch_sub(1, std::memory_order_relaxed);
+    counters.allocated_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+google::protobuf::ArenaOptions arena_options() {
+    google::protobuf::ArenaOptions options;
+    options.block_alloc = arena_block_alloc;
+    options.block_dealloc = arena_block_dealloc;
+
+    return options;
+}
+
+}
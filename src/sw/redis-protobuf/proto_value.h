@@ -0,0 +1,314 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_PROTO_VALUE_H
+#define SEWENEW_REDISPROTOBUF_PROTO_VALUE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <google/protobuf/message.h>
+#include <google/protobuf/arena.h>
+#include "utils.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// Value of a key of PB type. The message is either allocated on heap, or
+// allocated on an arena owned by the value, along with all its sub-objects.
+// In the latter case, the whole message is freed with a single release.
+//
+// A value can also be lazy, i.e. it only keeps the serialized message, and
+// parses it on the first call to *msg()*. After that, the serialized message
+// is dropped, and the value works as a normal one. A parsed value can be
+// compacted, i.e. serialized back to a lazy one.
+//
+// A parsed value can also cache its serialized message, which is kept until
+// the message is modified, so that reading an unchanged value in binary form
+// doesn't serialize it again.
+//
+// A lazy value can be compressed, i.e. it keeps the compressed serialized
+// message. When it's read in binary form, the decompressed message is cached
+// in a process-wide LRU cache of limited size, so that hot keys are not
+// decompressed on each read.
+class ProtoValue {
+public:
+    // Take the ownership of a heap allocated message.
+    explicit ProtoValue(MsgUPtr msg);
+
+    // Create a new arena, and create a message of the same type as *prototype* on it.
+    explicit ProtoValue(const gp::Message &prototype);
+
+    // Create a lazy value with the serialized message, i.e. *wire*. If
+    // *use_arena* is true, the message will be parsed onto a new arena.
+    // If *raw_size* is larger than 0, *wire* is compressed from a serialized
+    // message of *raw_size* bytes, see *compression::compress*.
+    // NOTE: *prototype* must outlive this value.
+    ProtoValue(const gp::Message &prototype,
+            std::string wire,
+            bool use_arena,
+            std::size_t raw_size = 0);
+
+    ProtoValue(const ProtoValue &) = delete;
+    ProtoValue& operator=(const ProtoValue &) = delete;
+
+    ProtoValue(ProtoValue &&) = delete;
+    ProtoValue& operator=(ProtoValue &&) = delete;
+
+    ~ProtoValue();
+
+    // Parse the message, if the value is lazy.
+    gp::Message& msg() {
+        if (_msg == nullptr) {
+            _parse();
+        }
+
+        return *_msg;
+    }
+
+    const gp::Message& msg() const {
+        if (_msg == nullptr) {
+            _parse();
+        }
+
+        return *_msg;
+    }
+
+    // Whether the message has been parsed, i.e. either the value is not lazy,
+    // or *msg()* has been called.
+    bool parsed() const {
+        return _msg != nullptr;
+    }
+
+    // Serialized message of a lazy value. Only valid if *parsed()* is false.
+    // If the value is compressed, the message is decompressed and cached. The
+    // returned reference is only valid until *wire()* of another compressed
+    // value is called, which might evict it. So it must be called in the main
+    // thread, and never in a forked child, see *decompress*.
+    const std::string& wire() const {
+        if (_raw_size > 0) {
+            return _decompressed();
+        }
+
+        return _wire;
+    }
+
+    // Serialized message of a lazy value, or the cached one of a parsed value,
+    // or the cached decompressed message of a compressed value. Return nullptr,
+    // if there's no such message. It never serializes or decompresses the message.
+    const std::string* serialized() const {
+        if (_msg == nullptr && _raw_size == 0) {
+            return &_wire;
+        }
+
+        return _cached ? &_cache : nullptr;
+    }
+
+    // Compressed serialized message, or nullptr if the value is not compressed.
+    const std::string* compressed() const {
+        return _raw_size > 0 ? &_wire : nullptr;
+    }
+
+    // Size of the serialized message of a compressed value, or 0 if it's not compressed.
+    std::size_t raw_size() const {
+        return _raw_size;
+    }
+
+    // Decompress the message of a compressed value into *buf*, without caching
+    // it. It's safe to call in a forked child, e.g. saving RDB.
+    void decompress(std::string &buf) const;
+
+    // Same as *serialized()*, except that if the cache is invalid, serialize
+    // the parsed message, and cache it.
+    const std::string& cache_serialized() const;
+
+    // Drop the cached serialized message. It must be called after the message
+    // is modified. A lazy value cannot be modified without being parsed, so the
+    // decompressed message of a compressed value is always kept.
+    void invalidate() {
+        if (_cached && _raw_size == 0) {
+            _drop_cache();
+        }
+    }
+
+    // Descriptor of the message, and it doesn't parse a lazy value.
+    const gp::Descriptor* descriptor() const {
+        return _prototype->GetDescriptor();
+    }
+
+    const gp::Message& prototype() const {
+        return *_prototype;
+    }
+
+    // Return nullptr, if the message is allocated on heap.
+    gp::Arena* arena() {
+        return _arena.get();
+    }
+
+    const gp::Arena* arena() const {
+        return _arena.get();
+    }
+
+    // Memory used by the value, including the message and its sub-objects.
+    std::size_t memory_usage() const;
+
+    // Estimated work of freeing the value. Redis frees the value in a
+    // background thread, if the effort is larger than its lazyfree threshold.
+    std::size_t free_effort() const;
+
+    // Serialize the message into a single buffer, and free the message along
+    // with its sub-objects, i.e. the value becomes lazy again. A parsed message
+    // spreads over many heap pages, while a serialized one occupies as few pages
+    // as possible, which is friendly to copy-on-write of a forked child.
+    // *prototype* is the default instance of the same message type, and it must
+    // outlive this value. If *compress_threshold* is larger than 0, and the
+    // serialized message is no smaller than it, the message is also compressed,
+    // even if the value has not been parsed.
+    void compact(const gp::Message &prototype, std::size_t compress_threshold = 0);
+
+    // Switch the value to *prototype*, which is of the same type name, but
+    // from another generation of schemas. The message is serialized, and will
+    // be parsed with the new type on next access. It must outlive this value.
+    void migrate(const gp::Message &prototype);
+
+    struct ArenaStats {
+        // Number of messages allocated on arenas.
+        uint64_t messages = 0;
+
+        // Number of memory blocks allocated by arenas.
+        uint64_t blocks = 0;
+
+        // Total size of memory blocks allocated by arenas.
+        uint64_t allocated_bytes = 0;
+    };
+
+    static ArenaStats arena_stats();
+
+    struct StorageStats {
+        // Number of values.
+        uint64_t values = 0;
+
+        // Number of values kept as serialized messages, i.e. lazy values.
+        uint64_t serialized_values = 0;
+
+        // Total capacity of buffers of serialized messages.
+        uint64_t serialized_bytes = 0;
+
+        // Number of times that a parsed value is compacted.
+        uint64_t compactions = 0;
+
+        // Number of parsed values with cached serialized messages.
+        uint64_t cached_values = 0;
+
+        // Total capacity of buffers of cached serialized messages.
+        uint64_t cached_bytes = 0;
+    };
+
+    static StorageStats storage_stats();
+
+    struct CompressionStats {
+        // Number of compressed values.
+        uint64_t compressed_values = 0;
+
+        // Total size of buffers of compressed messages.
+        uint64_t compressed_bytes = 0;
+
+        // Total size of these messages before compression.
+        uint64_t uncompressed_bytes = 0;
+
+        // Number of compressed values with cached decompressed messages.
+        uint64_t decompressed_values = 0;
+
+        // Total capacity of buffers of cached decompressed messages.
+        uint64_t decompressed_bytes = 0;
+
+        // Number of times that a message is decompressed for caching.
+        uint64_t decompressions = 0;
+
+        // Number of reads served by the cached decompressed messages.
+        uint64_t hits = 0;
+
+        // Number of decompressed messages evicted from the cache.
+        uint64_t evictions = 0;
+    };
+
+    static CompressionStats compression_stats();
+
+    // Max total size of cached decompressed messages. The most recently read
+    // one is always kept, even if it's larger than *bytes*.
+    static void set_decompressed_cache_size(std::size_t bytes);
+
+private:
+    void _parse() const;
+
+    // Serialize the parsed message, and free it, i.e. make the value lazy.
+    void _serialize();
+
+    // Free the parsed message.
+    void _free_msg() const;
+
+    // Return the dropped cache.
+    std::string _drop_cache() const;
+
+    // Compress the serialized message of a lazy value, if it saves memory.
+    void _compress();
+
+    // Return the cached decompressed message, and decompress it on cache miss.
+    // Least recently used messages of other values are evicted, if the cache is full.
+    const std::string& _decompressed() const;
+
+    // Drop the decompressed message of a compressed value from the cache.
+    void _untrack() const;
+
+    // The default instance of the message type, or the message itself,
+    // if the value is created with a heap allocated message.
+    const gp::Message *_prototype = nullptr;
+
+    bool _use_arena = false;
+
+    // Serialized message of a lazy value, which is cleared once parsed.
+    mutable std::string _wire;
+
+    mutable std::unique_ptr<gp::Arena> _arena;
+
+    // If _arena is not null, the message is owned by _arena.
+    // If it's null, the value is lazy and not parsed yet.
+    mutable gp::Message *_msg = nullptr;
+
+    // If it's larger than 0, the value is lazy, and *_wire* is compressed
+    // from a serialized message of *_raw_size* bytes.
+    mutable std::size_t _raw_size = 0;
+
+    // Cached serialized message of a parsed value, or cached decompressed message
+    // of a compressed value. Only valid if *_cached* is true. The latter is shared
+    // with the decompressed cache, and it's modified with the cache locked.
+    mutable std::string _cache;
+
+    mutable bool _cached = false;
+};
+
+using ProtoValueUPtr = std::unique_ptr<ProtoValue>;
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_PROTO_VALUE_H
@@ -0,0 +1,167 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "query_command.h"
+#include <cassert>
+#include "errors.h"
+#include "redis_protobuf.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int QueryCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+
+        auto *index = RedisProtobuf::instance().index_manager().find(args.index);
+        if (index == nullptr) {
+            throw Error("unknown index: " + args.index);
+        }
+
+        if (RedisModule_GetSelectedDb(ctx) != index->db()) {
+            throw Error("index is created in another database");
+        }
+
+        auto keys = _query(ctx, *index, args);
+
+        RedisModule_ReplyWithArray(ctx, keys.size());
+        for (const auto &key : keys) {
+            RedisModule_ReplyWithStringBuffer(ctx, key.data(), key.size());
+        }
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+QueryCommand::Args QueryCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc < 2) {
+        throw WrongArityError();
+    }
+
+    Args args;
+    args.index = util::sv_to_string(StringView(argv[1]));
+
+    auto idx = 2;
+    while (idx + 1 < argc) {
+        auto opt = StringView(argv[idx]);
+
+        if (util::str_case_equal(opt, "--LIMIT")) {
+            auto limit = util::sv_to_int64(StringView(argv[idx + 1]));
+            if (limit < 0) {
+                throw Error("limit must be non-negative");
+            }
+
+            args.limit = limit;
+        } else if (util::str_case_equal(opt, "--MIN")) {
+            args.min = Optional<StringView>(StringView(argv[idx + 1]));
+        } else if (util::str_case_equal(opt, "--MAX")) {
+            args.max = Optional<StringView>(StringView(argv[idx + 1]));
+        } else {
+            // Finish parsing options.
+            break;
+        }
+
+        idx += 2;
+    }
+
+    if (idx + 1 == argc) {
+        if (args.min || args.max) {
+            throw Error("syntax error");
+        }
+
+        args.val = Optional<StringView>(StringView(argv[idx]));
+    } else if (idx != argc) {
+        throw Error("syntax error");
+    }
+
+    return args;
+}
+
+std::vector<std::string> QueryCommand::_query(RedisModuleCtx *ctx,
+        FieldIndex &index,
+        const Args &args) const {
+    auto &module = RedisProtobuf::instance();
+
+    const auto *desc = module.proto_factory()->descriptor(index.type());
+    if (desc == nullptr) {
+        throw Error("unknown protobuf type: " + index.type());
+    }
+
+    std::string val;
+    std::string min;
+    std::string max;
+    std::vector<std::string> candidates;
+    if (args.val) {
+        val = index.encode(*desc, *args.val);
+        candidates = index.equal(val, args.limit);
+    } else {
+        if (args.min) {
+            min = index.encode(*desc, *args.min);
+        }
+
+        if (args.max) {
+            max = index.encode(*desc, *args.max);
+        }
+
+        candidates = index.range(args.min ? &min : nullptr,
+                args.max ? &max : nullptr,
+                args.limit);
+    }
+
+    // Keys might have been modified or deleted by non-PB commands, e.g. DEL,
+    // EXPIRE, RENAME, so check each key, and skip those no longer matched.
+    std::vector<std::string> keys;
+    for (auto &key : candidates) {
+        module.index_manager().refresh(ctx, index, key);
+
+        const auto *cur = index.get(key);
+        if (cur == nullptr) {
+            continue;
+        }
+
+        bool matched = false;
+        if (args.val) {
+            matched = (*cur == val);
+        } else {
+            matched = (!args.min || *cur >= min) && (!args.max || *cur <= max);
+        }
+
+        if (matched) {
+            keys.push_back(std::move(key));
+        }
+    }
+
+    return keys;
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,68 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_QUERY_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_QUERY_COMMANDS_H
+
+#include "module_api.h"
+#include <cstddef>
+#include <limits>
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "field_index.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.QUERY index [--LIMIT count] [--MIN min] [--MAX max] [value]
+// return:  Array reply: keys whose indexed field equals to *value*, or, if
+//          *value* is not specified, keys whose indexed field is in [min, max].
+//          Keys of a range query are ordered by the field.
+// error:   If the index doesn't exist, or the values are not of the field's
+//          type, or a range query is done with a HASH index, return an error reply.
+class QueryCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    struct Args {
+        std::string index;
+
+        std::size_t limit = std::numeric_limits<std::size_t>::max();
+
+        Optional<StringView> min;
+
+        Optional<StringView> max;
+
+        Optional<StringView> val;
+    };
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    std::vector<std::string> _query(RedisModuleCtx *ctx, FieldIndex &index, const Args &args) const;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_QUERY_COMMANDS_H
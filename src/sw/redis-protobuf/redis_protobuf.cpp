@@ -16,10 +16,17 @@
 
 #include "redis_protobuf.h"
 #include <cassert>
+#include <limits>
 #include <string>
 #include <google/protobuf/message.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format.h>
+#include <google/protobuf/wire_format_lite.h>
 #include "errors.h"
 #include "commands.h"
+#include "metrics.h"
+#include "compression.h"
 
 namespace {
 
@@ -40,9 +47,31 @@ struct RDBString {
 
 RDBString rdb_load_string(RedisModuleIO *rdb);
 
-std::pair<RDBString, RDBString> rdb_load_value(RedisModuleIO *rdb);
-
-std::pair<std::string, std::string> serialize_message(void *value);
+// Buffer reused by serialize_message, so that saving millions of keys
+// does not allocate a new string for each key.
+std::string& serialize_buffer();
+
+// Serialize the message, and return the serialized bytes. The size is
+// computed once with ByteSizeLong, and the message is written directly into
+// *buf*, which keeps its capacity between calls. If the value is lazy,
+// return its serialized bytes without touching *buf*.
+// If *deterministic* is true, map entries are serialized in order of keys,
+// so that equal messages always have the same output.
+sw::redis::pb::StringView serialize_message(void *value,
+        std::string &buf,
+        bool deterministic = false);
+
+const std::string& message_type(void *value);
+
+// If the parsed message is larger than *chunk_size*, emit it as a PB.SET of
+// fields other than top-level arrays, followed by PB.MERGE commands, each of
+// which appends at most about *chunk_size* bytes of elements to an array.
+// So that neither the rewrite child nor AOF loading holds the whole serialized
+// message. Return false, if the message is not chunked.
+bool aof_rewrite_chunked(RedisModuleIO *aof,
+        RedisModuleString *key,
+        const sw::redis::pb::ProtoValue &value,
+        std::size_t chunk_size);
 
 }
 
@@ -75,9 +104,16 @@ void RedisProtobuf::load(RedisModuleCtx *ctx, RedisModuleString **argv, int argc
         _rdb_load,
         _rdb_save,
         _aof_rewrite,
+        _mem_usage,
+        _digest,
+        _free_msg,
+        _aux_load,
+        _aux_save,
+        REDISMODULE_AUX_BEFORE_RDB | REDISMODULE_AUX_AFTER_RDB,
+        _free_effort,
         nullptr,
         nullptr,
-        _free_msg
+        nullptr
     };
 
     _module_type = RedisModule_CreateDataType(ctx,
@@ -88,9 +124,148 @@ void RedisProtobuf::load(RedisModuleCtx *ctx, RedisModuleString **argv, int argc
         throw Error(std::string("failed to create ") + type_name() + " type");
     }
 
-    _proto_factory = std::unique_ptr<ProtoFactory>(new ProtoFactory(options().proto_dir));
+    _proto_factory = std::unique_ptr<ProtoFactory>(new ProtoFactory(options().proto_dir,
+                options().use_arena,
+                options().lazy_parse,
+                options().load_threads,
+                options().descriptor_set,
+                options().compress_threshold,
+                options().plugins));
+
+    ProtoValue::set_decompressed_cache_size(options().decompressed_cache_size);
+
+    if (options().path_cache_size > 0) {
+        _path_cache = std::unique_ptr<PathCache>(new PathCache(options().path_cache_size));
+    }
+
+    if (options().async_json_threshold > 0) {
+        _worker_pool = std::unique_ptr<WorkerPool>(new WorkerPool(options().worker_threads));
+    }
+
+    Metrics::instance().enable(options().metrics);
 
     cmd::create_commands(ctx);
+
+    _subscribe_events(ctx);
+}
+
+void RedisProtobuf::after_write(RedisModuleCtx *ctx, RedisModuleString *key_name, ProtoValue &value) {
+    ++_write_stats.writes;
+
+    value.invalidate();
+
+    if (api::has_active_child(ctx)) {
+        ++_write_stats.writes_with_child;
+    }
+
+    // Index before compacting, so that fields are got from the parsed message.
+    _index_manager.update(ctx, key_name, value);
+
+    if (options().compact) {
+        _proto_factory->compact(value);
+    }
+}
+
+void RedisProtobuf::after_delete(RedisModuleCtx *ctx, RedisModuleString *key_name) {
+    _index_manager.remove(ctx, key_name);
+}
+
+void RedisProtobuf::notify(RedisModuleCtx *ctx,
+        const char *cmd,
+        RedisModuleString *key_name,
+        const Path &path) const {
+    assert(ctx != nullptr && cmd != nullptr && key_name != nullptr);
+
+    // If generic events are disabled, don't bother building the event name.
+    // GetNotifyKeyspaceEvents is only available since Redis 6.0.
+    if (RedisModule_GetNotifyKeyspaceEvents != nullptr
+            && (RedisModule_GetNotifyKeyspaceEvents() & REDISMODULE_NOTIFY_GENERIC) == 0) {
+        return;
+    }
+
+    auto event = std::string("pb.") + cmd + ":" + path.type();
+    if (!path.empty()) {
+        // Strip array index or map key, e.g. arr[0] -> arr.
+        const auto &field = path.fields().front();
+        event += ".";
+        event += field.substr(0, field.find('['));
+    }
+
+    RedisModule_NotifyKeyspaceEvent(ctx, REDISMODULE_NOTIFY_GENERIC, event.c_str(), key_name);
+}
+
+int RedisProtobuf::_on_keyspace_event(RedisModuleCtx *ctx,
+        int type,
+        const char *event,
+        RedisModuleString *key) {
+    try {
+        assert(ctx != nullptr && event != nullptr && key != nullptr);
+
+        instance()._index_manager.on_keyspace_event(ctx, event, key);
+    } catch (const Error &) {
+        // Do not throw through Redis. The key will be checked when it's queried.
+    }
+
+    return REDISMODULE_OK;
+}
+
+void RedisProtobuf::_on_server_event(RedisModuleCtx *ctx,
+        RedisModuleEvent eid,
+        uint64_t subevent,
+        void *data) {
+    assert(ctx != nullptr);
+
+    auto &index_manager = instance()._index_manager;
+
+    switch (eid.id) {
+    case REDISMODULE_EVENT_FLUSHDB:
+        if (subevent == REDISMODULE_SUBEVENT_FLUSHDB_END) {
+            const auto *info = static_cast<const RedisModuleFlushInfo *>(data);
+            index_manager.on_flush(info->dbnum);
+        }
+        break;
+
+    case REDISMODULE_EVENT_SWAPDB: {
+        const auto *info = static_cast<const RedisModuleSwapDbInfo *>(data);
+        index_manager.on_swap_db(info->dbnum_first, info->dbnum_second);
+        break;
+    }
+
+    case REDISMODULE_EVENT_LOADING:
+        // Keys loaded from RDB are not written by PB commands. If loading
+        // failed, index whatever has been loaded.
+        if (subevent == REDISMODULE_SUBEVENT_LOADING_ENDED
+                || subevent == REDISMODULE_SUBEVENT_LOADING_FAILED) {
+            index_manager.rebuild(ctx);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+void RedisProtobuf::_subscribe_events(RedisModuleCtx *ctx) {
+    // Both APIs are null with Redis older than 6.0, which cannot create
+    // indexes anyway, since it has no SCAN API.
+    if (RedisModule_SubscribeToKeyspaceEvents != nullptr
+            && RedisModule_SubscribeToKeyspaceEvents(ctx,
+                REDISMODULE_NOTIFY_GENERIC | REDISMODULE_NOTIFY_EXPIRED | REDISMODULE_NOTIFY_EVICTED,
+                _on_keyspace_event) != REDISMODULE_OK) {
+        throw Error("failed to subscribe to keyspace events");
+    }
+
+    if (RedisModule_SubscribeToServerEvent == nullptr) {
+        return;
+    }
+
+    for (const auto &event : {RedisModuleEvent_FlushDB,
+                                RedisModuleEvent_SwapDB,
+                                RedisModuleEvent_Loading}) {
+        if (RedisModule_SubscribeToServerEvent(ctx, event, _on_server_event) != REDISMODULE_OK) {
+            throw Error("failed to subscribe to server events");
+        }
+    }
 }
 
 void* RedisProtobuf::_rdb_load(RedisModuleIO *rdb, int encver) {
@@ -99,30 +274,56 @@ void* RedisProtobuf::_rdb_load(RedisModuleIO *rdb, int encver) {
 
         auto &module = RedisProtobuf::instance();
 
-        if (encver != module.encoding_version()) {
+        if (encver < 0 || encver > module.encoding_version()) {
             throw Error("cannot load data of version: " + std::to_string(encver));
         }
 
-        RDBString type_str;
-        RDBString data_str;
-        std::tie(type_str, data_str) = rdb_load_value(rdb);
+        const auto &desc = module._rdb_load_type(rdb, encver);
 
-        auto type = std::string(type_str.str.get(), type_str.len);
+        uint64_t raw_size = 0;
+        if (encver > 1) {
+            raw_size = RedisModule_LoadUnsigned(rdb);
+        }
+
+        auto data_str = rdb_load_string(rdb);
+
+        if (raw_size > compression::max_raw_size(data_str.len)) {
+            // Check it even if the data is loaded lazily, so that a corrupted
+            // RDB file fails loading, instead of reading the key.
+            throw Error("invalid size of compressed data: " + std::to_string(raw_size));
+        }
 
         auto *factory = module.proto_factory();
 
         assert(factory != nullptr);
 
-        auto msg = factory->create(type);
-        if (!msg) {
-            throw Error("unknown protobuf type: " + type);
+        if (module.options().lazy_parse) {
+            // Data saved by ourselves, and we don't validate it. Compressed
+            // data is kept as is, without decompressing it.
+            auto value = factory->create_lazy_value(desc,
+                    std::string(data_str.str.get(), data_str.len),
+                    raw_size);
+
+            return value.release();
+        }
+
+        auto value = factory->create_value(desc);
+        assert(value);
+
+        bool parsed = false;
+        if (raw_size > 0) {
+            auto raw = compression::decompress(StringView(data_str.str.get(), data_str.len),
+                    raw_size);
+            parsed = value->msg().ParseFromString(raw);
+        } else {
+            parsed = value->msg().ParseFromArray(data_str.str.get(), data_str.len);
         }
 
-        if (!msg->ParseFromArray(data_str.str.get(), data_str.len)) {
-            throw Error("failed to parse protobuf of type: " + type);
+        if (!parsed) {
+            throw Error("failed to parse protobuf of type: " + desc.full_name());
         }
 
-        return msg.release();
+        return value.release();
     } catch (const Error &e) {
         RedisModule_LogIOError(rdb, "warning", e.what());
         return nullptr;
@@ -133,14 +334,119 @@ void RedisProtobuf::_rdb_save(RedisModuleIO *rdb, void *value) {
     try {
         assert(rdb != nullptr);
 
-        std::string type;
-        std::string buf;
-        std::tie(type, buf) = serialize_message(value);
+        assert(value != nullptr);
 
-        RedisModule_SaveStringBuffer(rdb, type.data(), type.size());
+        const auto &proto_value = *static_cast<ProtoValue *>(value);
+
+        auto &module = RedisProtobuf::instance();
+        module._rdb_save_type(rdb, proto_value.descriptor());
+
+        const auto *compressed = proto_value.compressed();
+        if (compressed != nullptr) {
+            // Save the compressed message as is.
+            RedisModule_SaveUnsigned(rdb, proto_value.raw_size());
+            RedisModule_SaveStringBuffer(rdb, compressed->data(), compressed->size());
+
+            return;
+        }
+
+        auto &buf = serialize_buffer();
+        auto data = serialize_message(value, buf);
+
+        // Compress large messages, which have not been compressed, e.g. parsed values.
+        auto threshold = module.options().compress_threshold;
+        if (threshold > 0 && data.size() >= threshold) {
+            auto compressed_data = compression::compress(data);
+            if (!compressed_data.empty()) {
+                RedisModule_SaveUnsigned(rdb, data.size());
+                RedisModule_SaveStringBuffer(rdb, compressed_data.data(), compressed_data.size());
+
+                return;
+            }
+        }
+
+        RedisModule_SaveUnsigned(rdb, 0);
+        RedisModule_SaveStringBuffer(rdb, data.data(), data.size());
+    } catch (const Error &e) {
+        RedisModule_LogIOError(rdb, "warning", e.what());
+    }
+}
+
+int RedisProtobuf::_aux_load(RedisModuleIO *rdb, int encver, int when) {
+    try {
+        assert(rdb != nullptr);
+
+        auto &module = RedisProtobuf::instance();
+
+        if (when != REDISMODULE_AUX_BEFORE_RDB) {
+            // Keys have been loaded. Drop the dictionary, so that RESTORE
+            // never resolves type IDs against it.
+            module._rdb_load_types.clear();
+
+            return REDISMODULE_OK;
+        }
+
+        if (encver < 1 || encver > module.encoding_version()) {
+            throw Error("cannot load aux data of version: " + std::to_string(encver));
+        }
+
+        auto *factory = module.proto_factory();
+
+        assert(factory != nullptr);
+
+        auto &types = module._rdb_load_types;
+        types.clear();
+
+        auto cnt = RedisModule_LoadUnsigned(rdb);
+        types.reserve(cnt);
+        for (uint64_t idx = 0; idx != cnt; ++idx) {
+            auto type_str = rdb_load_string(rdb);
+
+            // A type removed from the .proto files is only an error,
+            // if some key is still of that type.
+            types.push_back(factory->descriptor(std::string(type_str.str.get(), type_str.len)));
+        }
+
+        return REDISMODULE_OK;
+    } catch (const Error &e) {
+        RedisModule_LogIOError(rdb, "warning", e.what());
+        return REDISMODULE_ERR;
+    }
+}
+
+void RedisProtobuf::_aux_save(RedisModuleIO *rdb, int when) {
+    try {
+        assert(rdb != nullptr);
+
+        auto &module = RedisProtobuf::instance();
+
+        if (when != REDISMODULE_AUX_BEFORE_RDB) {
+            // Keys have been saved. Drop the dictionary, so that DUMP, which
+            // has no aux data, saves type names inline.
+            module._rdb_save_types.clear();
+
+            return;
+        }
+
+        auto *factory = module.proto_factory();
+
+        assert(factory != nullptr);
+
+        auto types = factory->message_types();
+
+        auto &type_ids = module._rdb_save_types;
+        type_ids.clear();
 
-        RedisModule_SaveStringBuffer(rdb, buf.data(), buf.size());
+        RedisModule_SaveUnsigned(rdb, types.size());
+        for (const auto *desc : types) {
+            const auto &type = desc->full_name();
+            RedisModule_SaveStringBuffer(rdb, type.data(), type.size());
+
+            type_ids.emplace(desc, type_ids.size() + 1);
+        }
     } catch (const Error &e) {
+        RedisProtobuf::instance()._rdb_save_types.clear();
+
         RedisModule_LogIOError(rdb, "warning", e.what());
     }
 }
@@ -153,9 +459,16 @@ void RedisProtobuf::_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key, voi
             throw Error("null key to rewrite aof");
         }
 
-        std::string type;
-        std::string buf;
-        std::tie(type, buf) = serialize_message(value);
+        auto chunk_size = instance().options().aof_chunk_size;
+        if (chunk_size > 0
+                && aof_rewrite_chunked(aof, key, *static_cast<ProtoValue *>(value), chunk_size)) {
+            return;
+        }
+
+        auto &buf = serialize_buffer();
+        auto data = serialize_message(value, buf);
+
+        const auto &type = message_type(value);
 
         RedisModule_EmitAOF(aof,
                 "PB.SET",
@@ -163,17 +476,105 @@ void RedisProtobuf::_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key, voi
                 key,
                 type.data(),
                 type.size(),
-                buf.data(),
-                buf.size());
+                data.data(),
+                data.size());
     } catch (const Error &e) {
         RedisModule_LogIOError(aof, "warning", e.what());
     }
 }
 
+std::size_t RedisProtobuf::_mem_usage(const void *value) {
+    if (value == nullptr) {
+        return 0;
+    }
+
+    return static_cast<const ProtoValue *>(value)->memory_usage();
+}
+
+void RedisProtobuf::_digest(RedisModuleDigest *md, void *value) {
+    try {
+        assert(md != nullptr);
+
+        auto &buf = serialize_buffer();
+        auto data = serialize_message(value, buf, true);
+
+        auto type = message_type(value);
+
+        RedisModule_DigestAddStringBuffer(md,
+                reinterpret_cast<unsigned char *>(&type[0]),
+                type.size());
+
+        RedisModule_DigestAddStringBuffer(md,
+                reinterpret_cast<unsigned char *>(const_cast<char *>(data.data())),
+                data.size());
+
+        RedisModule_DigestEndSequence(md);
+    } catch (const Error &e) {
+        // Digest cannot report errors, and the digest of this key is left empty.
+    }
+}
+
 void RedisProtobuf::_free_msg(void *value) {
     if (value != nullptr) {
-        auto *msg = static_cast<google::protobuf::Message *>(value);
-        delete msg;
+        delete static_cast<ProtoValue *>(value);
+    }
+}
+
+std::size_t RedisProtobuf::_free_effort(RedisModuleString * /*key*/, const void *value) {
+    if (value == nullptr) {
+        return 0;
+    }
+
+    return static_cast<const ProtoValue *>(value)->free_effort();
+}
+
+const gp::Descriptor& RedisProtobuf::_rdb_load_type(RedisModuleIO *rdb, int encver) {
+    auto *factory = proto_factory();
+
+    assert(factory != nullptr);
+
+    uint64_t type_id = 0;
+    if (encver > 0) {
+        type_id = RedisModule_LoadUnsigned(rdb);
+    }
+
+    if (type_id == 0) {
+        auto type_str = rdb_load_string(rdb);
+        auto type = std::string(type_str.str.get(), type_str.len);
+
+        const auto *desc = factory->descriptor(type);
+        if (desc == nullptr) {
+            throw Error("unknown protobuf type: " + type);
+        }
+
+        return *desc;
+    }
+
+    if (type_id > _rdb_load_types.size()) {
+        throw Error("unknown protobuf type id: " + std::to_string(type_id));
+    }
+
+    const auto *desc = _rdb_load_types[type_id - 1];
+    if (desc == nullptr) {
+        throw Error("protobuf type of id " + std::to_string(type_id) + " no longer exists");
+    }
+
+    return *desc;
+}
+
+void RedisProtobuf::_rdb_save_type(RedisModuleIO *rdb, const gp::Descriptor *desc) {
+    assert(desc != nullptr);
+
+    // If Redis does not support auxiliary data, or the key is not saved as
+    // part of an RDB, e.g. DUMP, the dictionary is empty, and we save type name inline.
+    auto iter = _rdb_save_types.find(desc);
+    if (iter != _rdb_save_types.end()) {
+        RedisModule_SaveUnsigned(rdb, iter->second);
+    } else {
+        RedisModule_SaveUnsigned(rdb, 0);
+
+        const auto &type = desc->full_name();
+        RedisModule_SaveStringBuffer(rdb, type.data(), type.size());
     }
 }
 
@@ -197,29 +598,258 @@ RDBString rdb_load_string(RedisModuleIO *rdb) {
     return {StringUPtr(buf), len};
 }
 
-std::pair<RDBString, RDBString> rdb_load_value(RedisModuleIO *rdb) {
-    auto type = rdb_load_string(rdb);
-
-    auto data = rdb_load_string(rdb);
+std::string& serialize_buffer() {
+    thread_local std::string buf;
 
-    return {std::move(type), std::move(data)};
+    return buf;
 }
 
-std::pair<std::string, std::string> serialize_message(void *value) {
+sw::redis::pb::StringView serialize_message(void *value,
+        std::string &buf,
+        bool deterministic) {
     if (value == nullptr) {
         throw Error("Null value to serialize");
     }
 
-    auto *msg = static_cast<google::protobuf::Message*>(value);
+    const auto &proto_value = *static_cast<sw::redis::pb::ProtoValue*>(value);
+
+    if (!deterministic) {
+        // The serialized message of a lazy value, or the one cached by a read.
+        // It never caches the message here, since it might run in a forked child.
+        const auto *serialized = proto_value.serialized();
+        if (serialized != nullptr) {
+            return *serialized;
+        }
+
+        // For the same reason, decompress it into the buffer, instead of the cache.
+        if (proto_value.compressed() != nullptr) {
+            proto_value.decompress(buf);
+
+            return buf;
+        }
+    }
+
+    sw::redis::pb::MsgUPtr tmp;
+    if (!proto_value.parsed()) {
+
+        // Parse a temporary copy, so that the value is still kept lazy.
+        tmp.reset(proto_value.prototype().New());
+
+        bool parsed = false;
+        if (proto_value.compressed() != nullptr) {
+            std::string wire;
+            proto_value.decompress(wire);
+            parsed = tmp->ParseFromString(wire);
+        } else {
+            parsed = tmp->ParseFromString(proto_value.wire());
+        }
+
+        if (!parsed) {
+            throw Error("failed to parse protobuf of type " + message_type(value));
+        }
+    }
+
+    const auto &msg = tmp ? *tmp : proto_value.msg();
+
+    const auto &type = msg.GetDescriptor()->full_name();
+
+    auto size = msg.ByteSizeLong();
+    if (size > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+        throw Error("protobuf message of type " + type + " is too large to serialize");
+    }
+
+    // resize() keeps the capacity, so the buffer is only reallocated
+    // when a larger message comes.
+    buf.resize(size);
+
+    auto *target = reinterpret_cast<google::protobuf::uint8 *>(&buf[0]);
+    if (deterministic) {
+        google::protobuf::io::ArrayOutputStream output(target, static_cast<int>(size));
+        google::protobuf::io::CodedOutputStream coded_output(&output);
+        coded_output.SetSerializationDeterministic(true);
+        msg.SerializeWithCachedSizes(&coded_output);
+        if (coded_output.HadError()) {
+            throw Error("failed to serialize protobuf message of type " + type);
+        }
+    } else {
+        msg.SerializeWithCachedSizesToArray(target);
+    }
+
+    return buf;
+}
+
+const std::string& message_type(void *value) {
+    if (value == nullptr) {
+        throw Error("Null value to get type");
+    }
+
+    return static_cast<sw::redis::pb::ProtoValue*>(value)->descriptor()->full_name();
+}
+
+// Serialize the *idx*-th element of the array, with its tag. Sizes of sub-messages
+// must have been cached with ByteSizeLong.
+void serialize_element(const google::protobuf::Message &msg,
+        const google::protobuf::FieldDescriptor &field,
+        int idx,
+        google::protobuf::io::CodedOutputStream &output) {
+    using google::protobuf::FieldDescriptor;
+    using google::protobuf::internal::WireFormatLite;
+
+    const auto *reflection = msg.GetReflection();
+    auto num = field.number();
+    switch (field.type()) {
+    case FieldDescriptor::TYPE_INT32:
+        WireFormatLite::WriteInt32(num, reflection->GetRepeatedInt32(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_SINT32:
+        WireFormatLite::WriteSInt32(num, reflection->GetRepeatedInt32(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_SFIXED32:
+        WireFormatLite::WriteSFixed32(num, reflection->GetRepeatedInt32(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_INT64:
+        WireFormatLite::WriteInt64(num, reflection->GetRepeatedInt64(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_SINT64:
+        WireFormatLite::WriteSInt64(num, reflection->GetRepeatedInt64(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_SFIXED64:
+        WireFormatLite::WriteSFixed64(num, reflection->GetRepeatedInt64(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_UINT32:
+        WireFormatLite::WriteUInt32(num, reflection->GetRepeatedUInt32(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_FIXED32:
+        WireFormatLite::WriteFixed32(num, reflection->GetRepeatedUInt32(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_UINT64:
+        WireFormatLite::WriteUInt64(num, reflection->GetRepeatedUInt64(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_FIXED64:
+        WireFormatLite::WriteFixed64(num, reflection->GetRepeatedUInt64(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_FLOAT:
+        WireFormatLite::WriteFloat(num, reflection->GetRepeatedFloat(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_DOUBLE:
+        WireFormatLite::WriteDouble(num, reflection->GetRepeatedDouble(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_BOOL:
+        WireFormatLite::WriteBool(num, reflection->GetRepeatedBool(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_ENUM:
+        WireFormatLite::WriteEnum(num, reflection->GetRepeatedEnumValue(msg, &field, idx), &output);
+        break;
+
+    case FieldDescriptor::TYPE_STRING:
+    case FieldDescriptor::TYPE_BYTES: {
+        std::string scratch;
+        const auto &str = reflection->GetRepeatedStringReference(msg, &field, idx, &scratch);
+        WireFormatLite::WriteBytes(num, str, &output);
+        break;
+    }
+
+    case FieldDescriptor::TYPE_MESSAGE:
+        WireFormatLite::WriteMessage(num, reflection->GetRepeatedMessage(msg, &field, idx), &output);
+        break;
+
+    default:
+        throw Error("cannot rewrite array of type: " + std::string(field.type_name()));
+    }
+}
+
+bool aof_rewrite_chunked(RedisModuleIO *aof,
+        RedisModuleString *key,
+        const sw::redis::pb::ProtoValue &value,
+        std::size_t chunk_size) {
+    if (!value.parsed() || value.serialized() != nullptr) {
+        // The serialized message, or the compressed one, is already in memory.
+        return false;
+    }
+
+    const auto &msg = value.msg();
+
+    // ByteSizeLong also caches sizes of sub-messages, which are used by serialization.
+    if (msg.ByteSizeLong() <= chunk_size) {
+        return false;
+    }
 
-    auto type = msg->GetTypeName();
+    const auto *reflection = msg.GetReflection();
+    std::vector<const google::protobuf::FieldDescriptor *> fields;
+    reflection->ListFields(msg, &fields);
 
-    std::string buf;
-    if (!msg->SerializeToString(&buf)) {
-        throw Error("failed to serialize protobuf message of type " + type);
+    // Map entries are kept in the base message, since iterating a map
+    // with reflection copies the whole map.
+    std::vector<const google::protobuf::FieldDescriptor *> arrays;
+    for (const auto *field : fields) {
+        if (field->is_repeated() && !field->is_map()) {
+            arrays.push_back(field);
+        }
+    }
+
+    if (arrays.empty()) {
+        return false;
+    }
+
+    using google::protobuf::internal::WireFormat;
+
+    const auto &type = msg.GetDescriptor()->full_name();
+    auto &buf = serialize_buffer();
+    buf.clear();
+    {
+        google::protobuf::io::StringOutputStream stream(&buf);
+        google::protobuf::io::CodedOutputStream output(&stream);
+        for (const auto *field : fields) {
+            if (!field->is_repeated() || field->is_map()) {
+                WireFormat::SerializeFieldWithCachedSizes(field, msg, &output);
+            }
+        }
+
+        WireFormat::SerializeUnknownFields(reflection->GetUnknownFields(msg), &output);
+    }
+
+    RedisModule_EmitAOF(aof, "PB.SET", "sbb", key, type.data(), type.size(), buf.data(), buf.size());
+
+    // Merging a message with some elements of an array appends them to the array.
+    for (const auto *field : arrays) {
+        auto cnt = reflection->FieldSize(msg, field);
+        auto idx = 0;
+        while (idx < cnt) {
+            buf.clear();
+            {
+                google::protobuf::io::StringOutputStream stream(&buf);
+                google::protobuf::io::CodedOutputStream output(&stream);
+                while (idx < cnt && static_cast<std::size_t>(output.ByteCount()) < chunk_size) {
+                    serialize_element(msg, *field, idx, output);
+                    ++idx;
+                }
+            }
+
+            RedisModule_EmitAOF(aof,
+                    "PB.MERGE",
+                    "sbb",
+                    key,
+                    type.data(),
+                    type.size(),
+                    buf.data(),
+                    buf.size());
+        }
     }
 
-    return {std::move(type), std::move(buf)};
+    return true;
 }
 
 }
@@ -17,9 +17,14 @@
 #ifndef SEWENEW_REDISPROTOBUF_REDIS_PROTOBUF_H
 #define SEWENEW_REDISPROTOBUF_REDIS_PROTOBUF_H
 
+#include <unordered_map>
+#include <vector>
 #include "module_api.h"
 #include "proto_factory.h"
+#include "path_cache.h"
+#include "worker_pool.h"
 #include "options.h"
+#include "field_index.h"
 
 namespace sw {
 
@@ -61,6 +66,57 @@ public:
         return _proto_factory.get();
     }
 
+    // Return nullptr, if path cache is disabled or the module is not loaded.
+    PathCache* path_cache() {
+        return _path_cache.get();
+    }
+
+    // Return nullptr, if async JSON conversion is disabled.
+    WorkerPool* worker_pool() {
+        return _worker_pool.get();
+    }
+
+    IndexManager& index_manager() {
+        return _index_manager;
+    }
+
+    // Whether a write with *val* should be replicated with the binary form of
+    // the resulting message, instead of verbatim, i.e. *val* is a JSON string,
+    // and --REPLICATE-EFFECTS is enabled.
+    bool replicate_binary(const StringView &val) const {
+        return _options.replicate_effects && util::is_json(val);
+    }
+
+    // Should be called after a command modifies *value*, i.e. the value of
+    // *key_name*. Indexes are updated, and if --COMPACT is enabled, the value
+    // is serialized back to a single buffer.
+    void after_write(RedisModuleCtx *ctx, RedisModuleString *key_name, ProtoValue &value);
+
+    // Should be called after a command deletes *key_name*.
+    void after_delete(RedisModuleCtx *ctx, RedisModuleString *key_name);
+
+    // Fire a keyspace event for a write to *key_name* by *cmd*, e.g. "set".
+    // The event is "pb.<cmd>:<type>[.<field>]", where *field* is the top-level
+    // field of *path*, so that clients can invalidate only the changed field.
+    // Events are of the generic class, i.e. enabled with 'g' of notify-keyspace-events.
+    void notify(RedisModuleCtx *ctx,
+            const char *cmd,
+            RedisModuleString *key_name,
+            const Path &path) const;
+
+    struct WriteStats {
+        // Number of modified values.
+        uint64_t writes = 0;
+
+        // Number of values modified while a forked child is active, i.e.
+        // writes that might trigger copy-on-write.
+        uint64_t writes_with_child = 0;
+    };
+
+    const WriteStats& write_stats() const {
+        return _write_stats;
+    }
+
 private:
     RedisProtobuf() = default;
 
@@ -68,13 +124,48 @@ private:
 
     static void _rdb_save(RedisModuleIO *rdb, void *value);
 
+    static int _aux_load(RedisModuleIO *rdb, int encver, int when);
+
+    static void _aux_save(RedisModuleIO *rdb, int when);
+
     static void _aof_rewrite(RedisModuleIO *aof, RedisModuleString *key, void *value);
 
+    static std::size_t _mem_usage(const void *value);
+
+    static void _digest(RedisModuleDigest *md, void *value);
+
     static void _free_msg(void *value);
 
+    static std::size_t _free_effort(RedisModuleString *key, const void *value);
+
+    // Keep indexes in sync with keys modified by non-PB commands.
+    static int _on_keyspace_event(RedisModuleCtx *ctx,
+            int type,
+            const char *event,
+            RedisModuleString *key);
+
+    // Keep indexes in sync with FLUSHDB, SWAPDB and loading.
+    static void _on_server_event(RedisModuleCtx *ctx,
+            RedisModuleEvent eid,
+            uint64_t subevent,
+            void *data);
+
+    void _subscribe_events(RedisModuleCtx *ctx);
+
+    // Load the type of a key.
+    const gp::Descriptor& _rdb_load_type(RedisModuleIO *rdb, int encver);
+
+    void _rdb_save_type(RedisModuleIO *rdb, const gp::Descriptor *desc);
+
     const int _MODULE_VERSION = 0;
 
-    const int _ENCODING_VERSION = 0;
+    // Version 0: each key saves its type name.
+    // Version 1: a type dictionary is saved as auxiliary data before keys,
+    // and each key saves its type ID. ID 0 means the type is not in the
+    // dictionary, and its name is saved inline.
+    // Version 2: each key saves the size of the serialized message before
+    // its data, if the data is compressed, or 0 otherwise.
+    const int _ENCODING_VERSION = 2;
 
     const std::string _MODULE_NAME = "PB";
 
@@ -84,6 +175,24 @@ private:
 
     std::unique_ptr<ProtoFactory> _proto_factory;
 
+    std::unique_ptr<PathCache> _path_cache;
+
+    std::unique_ptr<WorkerPool> _worker_pool;
+
+    // Type IDs of the RDB being saved. It's only filled between the aux data
+    // saved before and after keys.
+    std::unordered_map<const gp::Descriptor*, uint64_t> _rdb_save_types;
+
+    // Type dictionary of the RDB being loaded, indexed by type ID - 1.
+    // A type that no longer exists is set to nullptr. It's cleared once keys
+    // have been loaded.
+    std::vector<const gp::Descriptor*> _rdb_load_types;
+
+    // Only modified in the main thread.
+    WriteStats _write_stats;
+
+    IndexManager _index_manager;
+
     Options _options;
 };
 
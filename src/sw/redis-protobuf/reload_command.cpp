@@ -0,0 +1,122 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "reload_command.h"
+#include <cassert>
+#include "errors.h"
+#include "redis_protobuf.h"
+#include "worker_pool.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+class ReloadCommand::ReloadTask : public AsyncTask {
+public:
+    explicit ReloadTask(const ProtoFactory &factory) : _factory(factory) {}
+
+private:
+    virtual void run() override {
+        // Only reads the proto directory, and doesn't touch the current schemas.
+        _schema = _factory.load_schema();
+    }
+
+    virtual int reply(RedisModuleCtx *ctx) override {
+        ReloadCommand reload_cmd;
+        auto generation = reload_cmd._install(ctx, std::move(_schema));
+
+        RedisModule_ReplyWithLongLong(ctx, generation);
+
+        return REDISMODULE_OK;
+    }
+
+    const ProtoFactory &_factory;
+
+    ProtoSchemaUPtr _schema;
+};
+
+int ReloadCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        _parse_args(argv, argc);
+
+        if (_async_reload(ctx)) {
+            return REDISMODULE_OK;
+        }
+
+        auto *factory = RedisProtobuf::instance().proto_factory();
+        assert(factory != nullptr);
+
+        auto generation = _install(ctx, factory->load_schema());
+
+        RedisModule_ReplyWithLongLong(ctx, generation);
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+void ReloadCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc != 1) {
+        throw WrongArityError();
+    }
+}
+
+bool ReloadCommand::_async_reload(RedisModuleCtx *ctx) const {
+    auto &module = RedisProtobuf::instance();
+
+    auto *pool = module.worker_pool();
+    if (pool == nullptr || !api::can_block(ctx)) {
+        return false;
+    }
+
+    auto *factory = module.proto_factory();
+    assert(factory != nullptr);
+
+    api::block_and_run(ctx, *pool, AsyncTaskUPtr(new ReloadTask(*factory)));
+
+    return true;
+}
+
+uint64_t ReloadCommand::_install(RedisModuleCtx *ctx, ProtoSchemaUPtr schema) const {
+    auto *factory = RedisProtobuf::instance().proto_factory();
+    assert(factory != nullptr);
+
+    // Commands run in the main thread, so that they see either the old
+    // schemas or the new ones, but never both.
+    auto generation = factory->install(std::move(schema));
+
+    api::notice(ctx, "reloaded .proto files, generation: %llu",
+            static_cast<unsigned long long>(generation));
+
+    return generation;
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,58 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_RELOAD_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_RELOAD_COMMANDS_H
+
+#include "module_api.h"
+#include <cstdint>
+#include "utils.h"
+#include "proto_factory.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.RELOAD
+// return:  Integer reply: the generation of the reloaded schemas.
+// error:   If any .proto file fails to load, return an error reply, and
+//          the current schemas are not changed.
+class ReloadCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    class ReloadTask;
+
+    void _parse_args(RedisModuleString **argv, int argc) const;
+
+    // Load .proto files in a worker thread. Return true, if the reply is
+    // deferred to the worker thread.
+    bool _async_reload(RedisModuleCtx *ctx) const;
+
+    // Switch to *schema*, and return its generation.
+    uint64_t _install(RedisModuleCtx *ctx, ProtoSchemaUPtr schema) const;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_RELOAD_COMMANDS_H
@@ -0,0 +1,401 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "scan_command.h"
+#include <cassert>
+#include <chrono>
+#include "errors.h"
+#include "redis_protobuf.h"
+#include "field_index.h"
+
+namespace {
+
+struct CallReplyDeleter {
+    void operator()(RedisModuleCallReply *reply) const {
+        RedisModule_FreeCallReply(reply);
+    }
+};
+
+using CallReplyUPtr = std::unique_ptr<RedisModuleCallReply, CallReplyDeleter>;
+
+std::string reply_to_string(RedisModuleCallReply *reply);
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+class ScanCommand::KeyNames {
+public:
+    explicit KeyNames(RedisModuleCtx *ctx) : _ctx(ctx) {}
+
+    KeyNames(const KeyNames &) = delete;
+    KeyNames& operator=(const KeyNames &) = delete;
+
+    ~KeyNames() {
+        for (auto *name : _names) {
+            RedisModule_FreeString(_ctx, name);
+        }
+    }
+
+    void add(RedisModuleString *name) {
+        _names.push_back(name);
+    }
+
+    const std::vector<RedisModuleString *>& names() const {
+        return _names;
+    }
+
+private:
+    RedisModuleCtx *_ctx;
+
+    std::vector<RedisModuleString *> _names;
+};
+
+int ScanCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+
+        auto budget = std::chrono::microseconds(RedisProtobuf::instance().options().scan_time_budget);
+        auto start = std::chrono::steady_clock::now();
+
+        // Scan at least one batch, so that the scan always makes progress.
+        KeyNames keys(ctx);
+        auto cursor = args.cursor;
+        do {
+            cursor = _scan(ctx, cursor, args, keys);
+        } while (cursor != "0" && std::chrono::steady_clock::now() - start < budget);
+
+        _reply(ctx, cursor, keys, args);
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+ScanCommand::Args ScanCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc < 2) {
+        throw WrongArityError();
+    }
+
+    Args args;
+
+    auto cursor = StringView(argv[1]);
+    try {
+        util::sv_to_uint64(cursor);
+    } catch (const Error &) {
+        throw Error("invalid cursor");
+    }
+    args.cursor = util::sv_to_string(cursor);
+
+    auto idx = 2;
+    while (idx < argc) {
+        auto opt = StringView(argv[idx]);
+
+        if (util::str_case_equal(opt, "--MATCH")) {
+            if (idx + 1 >= argc) {
+                throw Error("syntax error");
+            }
+
+            ++idx;
+
+            args.pattern = util::sv_to_string(StringView(argv[idx]));
+        } else if (util::str_case_equal(opt, "--COUNT")) {
+            if (idx + 1 >= argc) {
+                throw Error("syntax error");
+            }
+
+            ++idx;
+
+            auto count = util::sv_to_int64(StringView(argv[idx]));
+            if (count <= 0) {
+                throw Error("count must be larger than 0");
+            }
+
+            args.count = std::to_string(count);
+        } else if (util::str_case_equal(opt, "--TYPE")) {
+            if (idx + 1 >= argc) {
+                throw Error("syntax error");
+            }
+
+            ++idx;
+
+            _set_type(args, Path(argv[idx]).type());
+        } else if (util::str_case_equal(opt, "--WHERE")) {
+            if (idx + 3 >= argc) {
+                throw Error("syntax error");
+            }
+
+            Predicate where;
+            where.path = Path(argv[idx + 1]);
+            where.op = _parse_op(StringView(argv[idx + 2]));
+            where.val = StringView(argv[idx + 3]);
+
+            _set_type(args, where.path.type());
+            _encode_predicate(where);
+
+            args.where = Optional<Predicate>(std::move(where));
+
+            idx += 3;
+        } else if (util::str_case_equal(opt, "--FIELD")) {
+            if (idx + 1 >= argc) {
+                throw Error("syntax error");
+            }
+
+            ++idx;
+
+            Path path(argv[idx]);
+            _set_type(args, path.type());
+
+            args.field = Optional<Path>(std::move(path));
+        } else if (util::str_case_equal(opt, "--FORMAT")) {
+            if (idx + 1 >= argc) {
+                throw Error("syntax error");
+            }
+
+            ++idx;
+
+            args.format = _get_cmd._parse_format(argv[idx]);
+        } else {
+            throw Error("syntax error");
+        }
+
+        ++idx;
+    }
+
+    return args;
+}
+
+ScanCommand::Predicate::Op ScanCommand::_parse_op(const StringView &op) const {
+    using Op = Predicate::Op;
+
+    auto str = util::sv_to_string(op);
+    if (str == "=" || str == "==") {
+        return Op::EQ;
+    } else if (str == "!=") {
+        return Op::NE;
+    } else if (str == "<") {
+        return Op::LT;
+    } else if (str == "<=") {
+        return Op::LE;
+    } else if (str == ">") {
+        return Op::GT;
+    } else if (str == ">=") {
+        return Op::GE;
+    } else {
+        throw Error("unknown operator: " + str);
+    }
+}
+
+void ScanCommand::_set_type(Args &args, const std::string &type) const {
+    if (args.type.empty()) {
+        args.type = type;
+    } else if (args.type != type) {
+        throw Error("type mismatch");
+    }
+}
+
+void ScanCommand::_encode_predicate(Predicate &where) const {
+    const auto &path = where.path;
+    if (path.empty()) {
+        throw Error("path must specify a field");
+    }
+
+    const auto *desc = RedisProtobuf::instance().proto_factory()->descriptor(path.type());
+    if (desc == nullptr) {
+        throw Error("unknown protobuf type: " + path.type());
+    }
+
+    auto fields = path.resolve(*desc);
+    assert(!fields->empty());
+
+    const auto &field_desc = *(fields->back().desc);
+    if (field_desc.is_repeated() || field_desc.cpp_type() == gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+        throw Error("can only filter by a singular scalar field");
+    }
+
+    where.encoded_val = encode_field_value(field_desc, where.val);
+}
+
+std::string ScanCommand::_scan(RedisModuleCtx *ctx,
+        const std::string &cursor,
+        const Args &args,
+        KeyNames &keys) const {
+    CallReplyUPtr reply;
+    if (args.pattern.empty()) {
+        reply = CallReplyUPtr(RedisModule_Call(ctx, "SCAN", "ccc",
+                    cursor.c_str(), "COUNT", args.count.c_str()));
+    } else {
+        reply = CallReplyUPtr(RedisModule_Call(ctx, "SCAN", "ccccc",
+                    cursor.c_str(), "COUNT", args.count.c_str(), "MATCH", args.pattern.c_str()));
+    }
+
+    if (!reply
+            || RedisModule_CallReplyType(reply.get()) != REDISMODULE_REPLY_ARRAY
+            || RedisModule_CallReplyLength(reply.get()) != 2) {
+        throw Error("failed to scan keys");
+    }
+
+    auto next_cursor = reply_to_string(RedisModule_CallReplyArrayElement(reply.get(), 0));
+
+    auto *batch = RedisModule_CallReplyArrayElement(reply.get(), 1);
+    assert(batch != nullptr);
+
+    auto len = RedisModule_CallReplyLength(batch);
+    for (std::size_t idx = 0; idx != len; ++idx) {
+        auto *key_name = RedisModule_CreateStringFromCallReply(
+                RedisModule_CallReplyArrayElement(batch, idx));
+        if (key_name == nullptr) {
+            throw Error("failed to scan keys");
+        }
+
+        if (_match(ctx, key_name, args)) {
+            keys.add(key_name);
+        } else {
+            RedisModule_FreeString(ctx, key_name);
+        }
+    }
+
+    return next_cursor;
+}
+
+bool ScanCommand::_match(RedisModuleCtx *ctx, RedisModuleString *key_name, const Args &args) const {
+    auto key = api::open_key(ctx, key_name, api::KeyMode::READONLY);
+
+    // The key might have expired, or it's not a PB key.
+    if (RedisModule_KeyType(key.get()) != REDISMODULE_KEYTYPE_MODULE
+            || RedisModule_ModuleTypeGetType(key.get()) != RedisProtobuf::instance().type()) {
+        return false;
+    }
+
+    const auto *value = api::get_value_by_key(key.get());
+    assert(value != nullptr);
+
+    if (!args.type.empty() && value->descriptor()->full_name() != args.type) {
+        return false;
+    }
+
+    if (!args.where) {
+        return true;
+    }
+
+    std::string val;
+    if (!encode_field_value(*value, args.where->path, val)) {
+        return false;
+    }
+
+    return _compare(val, *(args.where));
+}
+
+bool ScanCommand::_compare(const std::string &lhs, const Predicate &where) const {
+    using Op = Predicate::Op;
+
+    const auto &rhs = where.encoded_val;
+    switch (where.op) {
+    case Op::EQ:
+        return lhs == rhs;
+
+    case Op::NE:
+        return lhs != rhs;
+
+    case Op::LT:
+        return lhs < rhs;
+
+    case Op::LE:
+        return lhs <= rhs;
+
+    case Op::GT:
+        return lhs > rhs;
+
+    case Op::GE:
+        return lhs >= rhs;
+
+    default:
+        assert(false);
+        return false;
+    }
+}
+
+void ScanCommand::_reply(RedisModuleCtx *ctx,
+        const std::string &cursor,
+        const KeyNames &keys,
+        const Args &args) const {
+    RedisModule_ReplyWithArray(ctx, 2);
+
+    RedisModule_ReplyWithStringBuffer(ctx, cursor.data(), cursor.size());
+
+    GetCommand::Args get_args;
+    get_args.format = args.format;
+
+    const auto &names = keys.names();
+    RedisModule_ReplyWithArray(ctx, names.size());
+    for (auto *name : names) {
+        if (!args.field) {
+            RedisModule_ReplyWithString(ctx, name);
+            continue;
+        }
+
+        RedisModule_ReplyWithArray(ctx, 2);
+        RedisModule_ReplyWithString(ctx, name);
+
+        // Same as PB.GET with multiple paths, reply with the error of the field.
+        try {
+            auto key = api::open_key(ctx, name, api::KeyMode::READONLY);
+            auto *value = api::get_value_by_key(key.get());
+            assert(value != nullptr);
+
+            _get_cmd._reply_with_path(ctx, value->msg(), *(args.field), get_args);
+        } catch (const Error &err) {
+            api::reply_with_error(ctx, err);
+        }
+    }
+}
+
+}
+
+}
+
+}
+
+namespace {
+
+std::string reply_to_string(RedisModuleCallReply *reply) {
+    if (reply == nullptr) {
+        throw sw::redis::pb::Error("failed to scan keys");
+    }
+
+    std::size_t len = 0;
+    const auto *ptr = RedisModule_CallReplyStringPtr(reply, &len);
+    if (ptr == nullptr) {
+        throw sw::redis::pb::Error("failed to scan keys");
+    }
+
+    return std::string(ptr, len);
+}
+
+}
@@ -0,0 +1,122 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_SCAN_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_SCAN_COMMANDS_H
+
+#include "module_api.h"
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "field_ref.h"
+#include "get_command.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.SCAN cursor [--MATCH pattern] [--COUNT count] [--TYPE type]
+//          [--WHERE path op value] [--FIELD path] [--FORMAT BINARY|JSON]
+// return:  Array reply of 2 elements: the cursor for the next call, and an
+//          array of matched keys. If --FIELD is specified, each element is
+//          an array of the key and the value of the field. Keys are scanned
+//          with SCAN, until the cursor is 0, or the time budget runs out.
+// error:   If the cursor is invalid, or the types of options don't match,
+//          or *value* is not of the field's type, return an error reply.
+class ScanCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+private:
+    struct Predicate {
+        enum class Op {
+            EQ = 0,
+            NE,
+            LT,
+            LE,
+            GT,
+            GE
+        };
+
+        Path path;
+
+        // No default member initializer, so that Optional<Predicate> can be
+        // default constructed inside ScanCommand. It's always set by parsing.
+        Op op;
+
+        StringView val;
+
+        // *val* encoded with encode_field_value.
+        std::string encoded_val;
+    };
+
+    struct Args {
+        std::string cursor;
+
+        std::string pattern;
+
+        std::string count = "10";
+
+        // Only keys of this type are matched. If it's empty, match all types.
+        std::string type;
+
+        Optional<Predicate> where;
+
+        Optional<Path> field;
+
+        GetCommand::Args::Format format = GetCommand::Args::Format::NONE;
+    };
+
+    // Key names created by this command, which are freed on destruction.
+    class KeyNames;
+
+    Args _parse_args(RedisModuleString **argv, int argc) const;
+
+    Predicate::Op _parse_op(const StringView &op) const;
+
+    // Set the type of keys to be scanned, which must match types of other options.
+    void _set_type(Args &args, const std::string &type) const;
+
+    // Encode the value of the predicate with the current schemas.
+    void _encode_predicate(Predicate &where) const;
+
+    // Scan a batch of keys, add matched keys to *keys*, and return the next cursor.
+    std::string _scan(RedisModuleCtx *ctx,
+            const std::string &cursor,
+            const Args &args,
+            KeyNames &keys) const;
+
+    bool _match(RedisModuleCtx *ctx, RedisModuleString *key_name, const Args &args) const;
+
+    bool _compare(const std::string &lhs, const Predicate &where) const;
+
+    void _reply(RedisModuleCtx *ctx,
+            const std::string &cursor,
+            const KeyNames &keys,
+            const Args &args) const;
+
+    GetCommand _get_cmd;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_SCAN_COMMANDS_H
@@ -19,6 +19,8 @@
 #include "redis_protobuf.h"
 #include "utils.h"
 #include "field_ref.h"
+#include "worker_pool.h"
+#include "metrics.h"
 
 namespace sw {
 
@@ -26,13 +28,68 @@ namespace redis {
 
 namespace pb {
 
+class SetCommand::JsonSetTask : public AsyncTask {
+public:
+    JsonSetTask(const Args &args, ProtoValueUPtr value, bool replicate_binary) :
+        _args(args),
+        _json(args.val.data(), args.val.size()),
+        _value(std::move(value)),
+        _replicate_binary(replicate_binary) {
+        // The argument might be freed before the task runs,
+        // and we only use the copy in *_json*.
+        _args.val = StringView();
+        _args.path_name = nullptr;
+    }
+
+private:
+    virtual void run() override {
+        util::json_to_msg(_json, _value->msg());
+
+        std::string().swap(_json);
+
+        if (_replicate_binary) {
+            // Also serialize it in the worker thread.
+            _binary = Optional<std::string>(util::msg_to_binary(_value->msg()));
+        }
+    }
+
+    virtual int reply(RedisModuleCtx *ctx) override {
+        SetCommand set_cmd;
+        auto res = set_cmd._set_value(ctx, _args, std::move(_value));
+
+        RedisModule_ReplyWithLongLong(ctx, res);
+
+        set_cmd._replicate(ctx, _args, res, _binary);
+
+        return REDISMODULE_OK;
+    }
+
+    Args _args;
+
+    std::string _json;
+
+    ProtoValueUPtr _value;
+
+    bool _replicate_binary;
+
+    Optional<std::string> _binary;
+};
+
 int SetCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
     try {
-        auto res = _run(ctx, argv, argc);
+        assert(ctx != nullptr);
+
+        auto args = _parse_args(argv, argc);
+        if (_async_set(ctx, args)) {
+            return REDISMODULE_OK;
+        }
+
+        Optional<std::string> binary;
+        auto res = _run(ctx, args, binary);
 
         RedisModule_ReplyWithLongLong(ctx, res);
 
-        RedisModule_ReplicateVerbatim(ctx);
+        _replicate(ctx, args, res, binary);
 
         return REDISMODULE_OK;
     } catch (const WrongArityError &err) {
@@ -44,12 +101,9 @@ int SetCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) con
     return REDISMODULE_ERR;
 }
 
-int SetCommand::_run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
-    assert(ctx != nullptr);
-
+int SetCommand::_run(RedisModuleCtx *ctx, const Args &args, Optional<std::string> &binary) const {
     // TODO: if the ByteSize is too large, serialization might fail.
 
-    auto args = _parse_args(argv, argc);
     const auto &path = args.path;
 
     auto key = api::open_key(ctx, args.key_name, api::KeyMode::WRITEONLY);
@@ -69,6 +123,145 @@ int SetCommand::_run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) co
         _set_msg(*key, path, args.val);
     }
 
+    auto &module = RedisProtobuf::instance();
+    auto *value = api::get_value_by_key(key.get());
+    assert(value != nullptr);
+
+    // Serialize it before *after_write*, which might compact the value.
+    if (module.replicate_binary(args.val)) {
+        binary = _binary_msg(*value, path);
+    }
+
+    module.after_write(ctx, args.key_name, *value);
+    module.notify(ctx, "set", args.key_name, path);
+
+    auto expire = args.expire.count();
+    if (expire > 0) {
+        RedisModule_SetExpire(key.get(), expire);
+    }
+
+    return 1;
+}
+
+bool SetCommand::_async_set(RedisModuleCtx *ctx, const Args &args) const {
+    auto &module = RedisProtobuf::instance();
+    auto *pool = module.worker_pool();
+    if (pool == nullptr
+            || !args.path.empty()
+            || args.val.size() < module.options().async_json_threshold
+            || !util::is_json(args.val)
+            || !api::can_block(ctx)) {
+        return false;
+    }
+
+    // Create the value in main thread, since ProtoFactory is not thread-safe.
+    auto value = module.proto_factory()->create_value(args.path.type());
+
+    api::block_and_run(ctx,
+            *pool,
+            AsyncTaskUPtr(new JsonSetTask(args, std::move(value), module.replicate_binary(args.val))));
+
+    return true;
+}
+
+Optional<std::string> SetCommand::_binary_msg(ProtoValue &value, const Path &path) const {
+    if (path.empty()) {
+        return Optional<std::string>(util::msg_to_binary(value.msg()));
+    }
+
+    ConstFieldRef field(&(value.msg()), path);
+
+    const gp::Message *msg = nullptr;
+    if (field.is_map_element()) {
+        if (field.map_value_type() == gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+            msg = &(field.get_mapped_msg());
+        }
+    } else if (field.type() == gp::FieldDescriptor::CPPTYPE_MESSAGE) {
+        if (field.is_array_element()) {
+            msg = &(field.get_repeated_msg());
+        } else if (!field.is_array()) {
+            msg = &(field.get_msg());
+        }
+    }
+
+    if (msg == nullptr) {
+        // A JSON-like string set to a string field.
+        return Optional<std::string>();
+    }
+
+    return Optional<std::string>(util::msg_to_binary(*msg));
+}
+
+void SetCommand::_replicate(RedisModuleCtx *ctx,
+        const Args &args,
+        int res,
+        const Optional<std::string> &binary) const {
+    if (res == 0 || !binary) {
+        RedisModule_ReplicateVerbatim(ctx);
+        return;
+    }
+
+    // The message has been set, so --NX and --XX are not needed.
+    const auto &bin = *binary;
+    auto expire = static_cast<long long>(args.expire.count());
+    if (args.path.empty()) {
+        // Path of the whole message is its type, and async set only sets the whole message.
+        const auto *type = args.path.type().c_str();
+        if (expire > 0) {
+            RedisModule_Replicate(ctx, "PB.SET", "sclcb",
+                    args.key_name, "--PX", expire, type, bin.data(), bin.size());
+        } else {
+            RedisModule_Replicate(ctx, "PB.SET", "scb",
+                    args.key_name, type, bin.data(), bin.size());
+        }
+    } else {
+        assert(args.path_name != nullptr);
+
+        if (expire > 0) {
+            RedisModule_Replicate(ctx, "PB.SET", "sclsb",
+                    args.key_name, "--PX", expire, args.path_name, bin.data(), bin.size());
+        } else {
+            RedisModule_Replicate(ctx, "PB.SET", "ssb",
+                    args.key_name, args.path_name, bin.data(), bin.size());
+        }
+    }
+}
+
+int SetCommand::_set_value(RedisModuleCtx *ctx, const Args &args, ProtoValueUPtr value) const {
+    assert(value);
+
+    auto &module = RedisProtobuf::instance();
+
+    auto key = api::open_key(ctx, args.key_name, api::KeyMode::WRITEONLY);
+    assert(key);
+
+    if (!api::key_exists(key.get(), module.type())) {
+        if (args.opt == Args::Opt::XX) {
+            return 0;
+        }
+    } else {
+        if (args.opt == Args::Opt::NX) {
+            return 0;
+        }
+
+        auto *old_value = api::get_value_by_key(key.get());
+        assert(old_value != nullptr);
+
+        if (old_value->descriptor()->full_name() != args.path.type()) {
+            throw Error("type mismatch");
+        }
+    }
+
+    module.after_write(ctx, args.key_name, *value);
+
+    if (RedisModule_ModuleTypeSetValue(key.get(), module.type(), value.get()) != REDISMODULE_OK) {
+        throw Error("failed to set message");
+    }
+
+    value.release();
+
+    module.notify(ctx, "set", args.key_name, args.path);
+
     auto expire = args.expire.count();
     if (expire > 0) {
         RedisModule_SetExpire(key.get(), expire);
@@ -93,6 +286,7 @@ SetCommand::Args SetCommand::_parse_args(RedisModuleString **argv, int argc) con
     }
 
     args.path = Path(argv[pos]);
+    args.path_name = argv[pos];
     args.val = argv[pos + 1];
 
     return args;
@@ -158,415 +352,55 @@ int64_t SetCommand::_parse_expire(const StringView &sv) const {
 void SetCommand::_create_msg(RedisModuleKey &key,
         const Path &path,
         const StringView &val) const {
-    MsgUPtr msg;
+    ProtoValueUPtr value;
     auto &module = RedisProtobuf::instance();
     if (path.empty()) {
-        msg = module.proto_factory()->create(path.type(), val);
+        value = module.proto_factory()->create_value(path.type(), val);
     } else {
-        msg = module.proto_factory()->create(path.type());
-        MutableFieldRef field(msg.get(), path);
+        value = module.proto_factory()->create_value(path.type());
+        MutableFieldRef field(&(value->msg()), path);
         _set_field(field, val);
     }
 
-    if (RedisModule_ModuleTypeSetValue(&key, module.type(), msg.get()) != REDISMODULE_OK) {
+    if (RedisModule_ModuleTypeSetValue(&key, module.type(), value.get()) != REDISMODULE_OK) {
         throw Error("failed to set message");
     }
 
-    msg.release();
+    value.release();
 }
 
 void SetCommand::_set_msg(RedisModuleKey &key,
         const Path &path,
         const StringView &val) const {
-    auto *msg = api::get_msg_by_key(&key);
-    assert(msg != nullptr);
+    auto *value = api::get_value_by_key(&key);
+    assert(value != nullptr);
 
     if (path.empty()) {
-        // Set the whole message.
-        if (msg->GetTypeName() != path.type()) {
+        // Set the whole message. Check type without parsing a lazy value.
+        if (value->descriptor()->full_name() != path.type()) {
             throw Error("type mismatch");
         }
 
         auto &module = RedisProtobuf::instance();
-        auto msg = module.proto_factory()->create(path.type(), val);
-        if (RedisModule_ModuleTypeSetValue(&key, module.type(), msg.get()) != REDISMODULE_OK) {
+        auto new_value = module.proto_factory()->create_value(path.type(), val);
+        if (RedisModule_ModuleTypeSetValue(&key, module.type(), new_value.get()) != REDISMODULE_OK) {
             throw Error("failed to set message");
         }
 
-        msg.release();
+        new_value.release();
     } else {
         // Set field.
-        MutableFieldRef field(msg, path);
+        MutableFieldRef field(&(value->msg()), path);
         _set_field(field, val);
     }
 }
 
 void SetCommand::_set_field(MutableFieldRef &field, const StringView &val) const {
-    if (field.is_map_element()) {
-        return _set_map_element(field, val);
-    } else if (field.is_map()) {
-        throw Error("cannot set the whole map field");
-    } else if (field.is_array_element()) {
-        return _set_array_element(field, val);
-    } else if (field.is_array()) {
-        throw Error("cannot set the whole array field");
-    }
-
-    _set_scalar_field(field, val);
-}
-
-void SetCommand::_set_scalar_field(MutableFieldRef &field, const StringView &val) const {
-    switch (field.type()) {
-    case gp::FieldDescriptor::CPPTYPE_INT32:
-        _set_int32(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_INT64:
-        _set_int64(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_UINT32:
-        _set_uint32(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_UINT64:
-        _set_uint64(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_DOUBLE:
-        _set_double(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_FLOAT:
-        _set_float(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_BOOL:
-        _set_bool(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_ENUM:
-        _set_enum(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_STRING:
-        _set_string(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_MESSAGE:
-        _set_msg(field, val);
-        break;
-
-    default:
-        throw Error("unknown type");
-    }
-}
-
-void SetCommand::_set_map_element(MutableFieldRef &field, const StringView &val) const {
-    switch (field.map_value_type()) {
-    case gp::FieldDescriptor::CPPTYPE_INT32:
-        _set_mapped_int32(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_INT64:
-        _set_mapped_int64(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_UINT32:
-        _set_mapped_uint32(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_UINT64:
-        _set_mapped_uint64(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_DOUBLE:
-        _set_mapped_double(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_FLOAT:
-        _set_mapped_float(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_BOOL:
-        _set_mapped_bool(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_ENUM:
-        _set_mapped_enum(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_STRING:
-        _set_mapped_string(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_MESSAGE:
-        _set_mapped_msg(field, val);
-        break;
-
-    default:
-        throw Error("unknown type");
-    }
-}
-
-void SetCommand::_set_array_element(MutableFieldRef &field, const StringView &val) const {
-    switch (field.type()) {
-    case gp::FieldDescriptor::CPPTYPE_INT32:
-        _set_repeated_int32(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_INT64:
-        _set_repeated_int64(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_UINT32:
-        _set_repeated_uint32(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_UINT64:
-        _set_repeated_uint64(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_DOUBLE:
-        _set_repeated_double(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_FLOAT:
-        _set_repeated_float(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_BOOL:
-        _set_repeated_bool(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_ENUM:
-        _set_repeated_enum(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_STRING:
-        _set_repeated_string(field, val);
-        break;
-
-    case gp::FieldDescriptor::CPPTYPE_MESSAGE:
-        _set_repeated_msg(field, val);
-        break;
-
-    default:
-        throw Error("unknown type");
-    }
-}
-
-void SetCommand::_set_int32(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_INT32);
-
-    auto val = util::sv_to_int32(sv);
-    field.set_int32(val);
-}
-
-void SetCommand::_set_int64(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_INT64);
-
-    auto val = util::sv_to_int64(sv);
-    field.set_int64(val);
-}
-
-void SetCommand::_set_uint32(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_UINT32);
-
-    auto val = util::sv_to_uint32(sv);
-    field.set_uint32(val);
-}
-
-void SetCommand::_set_uint64(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_UINT64);
-
-    auto val = util::sv_to_uint64(sv);
-    field.set_uint64(val);
-}
-
-void SetCommand::_set_double(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_DOUBLE);
-
-    auto val = util::sv_to_double(sv);
-    field.set_double(val);
-}
-
-void SetCommand::_set_float(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_FLOAT);
-
-    auto val = util::sv_to_float(sv);
-    field.set_float(val);
-}
-
-void SetCommand::_set_bool(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_BOOL);
-
-    auto val = util::sv_to_bool(sv);
-    field.set_bool(val);
-}
-
-void SetCommand::_set_enum(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_ENUM);
-
-    auto val = util::sv_to_int32(sv);
-    field.set_enum(val);
-}
-
-void SetCommand::_set_string(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_STRING);
-
-    field.set_string(util::sv_to_string(sv));
-}
-
-void SetCommand::_set_msg(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_MESSAGE);
-
-    auto new_msg = RedisProtobuf::instance().proto_factory()->create(field.msg_type(), sv);
-    assert(new_msg);
-
-    field.set_msg(*new_msg);
-}
-
-void SetCommand::_set_repeated_int32(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_INT32);
-
-    auto val = util::sv_to_int32(sv);
-    field.set_repeated_int32(val);
-}
-
-void SetCommand::_set_repeated_int64(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_INT64);
-
-    auto val = util::sv_to_int64(sv);
-    field.set_repeated_int64(val);
-}
-
-void SetCommand::_set_repeated_uint32(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_UINT32);
-
-    auto val = util::sv_to_uint32(sv);
-    field.set_repeated_uint32(val);
-}
-
-void SetCommand::_set_repeated_uint64(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_UINT64);
-
-    auto val = util::sv_to_uint64(sv);
-    field.set_repeated_uint64(val);
-}
-
-void SetCommand::_set_repeated_double(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_DOUBLE);
-
-    auto val = util::sv_to_double(sv);
-    field.set_repeated_double(val);
-}
-
-void SetCommand::_set_repeated_float(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_FLOAT);
-
-    auto val = util::sv_to_float(sv);
-    field.set_repeated_float(val);
-}
-
-void SetCommand::_set_repeated_bool(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_BOOL);
-
-    auto val = util::sv_to_bool(sv);
-    field.set_repeated_bool(val);
-}
-
-void SetCommand::_set_repeated_enum(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_ENUM);
-
-    auto val = util::sv_to_int32(sv);
-    field.set_repeated_enum(val);
-}
-
-void SetCommand::_set_repeated_string(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_STRING);
-
-    field.set_repeated_string(util::sv_to_string(sv));
-}
-
-void SetCommand::_set_repeated_msg(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.type() == gp::FieldDescriptor::CPPTYPE_MESSAGE);
-
-    auto new_msg = RedisProtobuf::instance().proto_factory()->create(field.msg_type(), sv);
-    assert(new_msg);
-
-    field.set_repeated_msg(*new_msg);
-}
-
-void SetCommand::_set_mapped_int32(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.map_value_type() == gp::FieldDescriptor::CPPTYPE_INT32);
-
-    auto val = util::sv_to_int32(sv);
-    field.set_mapped_int32(val);
-}
-
-void SetCommand::_set_mapped_int64(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.map_value_type() == gp::FieldDescriptor::CPPTYPE_INT64);
-
-    auto val = util::sv_to_int64(sv);
-    field.set_mapped_int64(val);
-}
-
-void SetCommand::_set_mapped_uint32(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.map_value_type() == gp::FieldDescriptor::CPPTYPE_UINT32);
-
-    auto val = util::sv_to_uint32(sv);
-    field.set_mapped_uint32(val);
-}
-
-void SetCommand::_set_mapped_uint64(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.map_value_type() == gp::FieldDescriptor::CPPTYPE_UINT64);
-
-    auto val = util::sv_to_uint64(sv);
-    field.set_mapped_uint64(val);
-}
-
-void SetCommand::_set_mapped_double(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.map_value_type() == gp::FieldDescriptor::CPPTYPE_DOUBLE);
-
-    auto val = util::sv_to_double(sv);
-    field.set_mapped_double(val);
-}
-
-void SetCommand::_set_mapped_float(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.map_value_type() == gp::FieldDescriptor::CPPTYPE_FLOAT);
-
-    auto val = util::sv_to_float(sv);
-    field.set_mapped_float(val);
-}
-
-void SetCommand::_set_mapped_bool(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.map_value_type() == gp::FieldDescriptor::CPPTYPE_BOOL);
-
-    auto val = util::sv_to_bool(sv);
-    field.set_mapped_bool(val);
-}
-
-void SetCommand::_set_mapped_enum(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.map_value_type() == gp::FieldDescriptor::CPPTYPE_ENUM);
-
-    auto val = util::sv_to_int32(sv);
-    field.set_mapped_enum(val);
-}
-
-void SetCommand::_set_mapped_string(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.map_value_type() == gp::FieldDescriptor::CPPTYPE_STRING);
-
-    field.set_mapped_string(util::sv_to_string(sv));
-}
-
-void SetCommand::_set_mapped_msg(MutableFieldRef &field, const StringView &sv) const {
-    assert(field.map_value_type() == gp::FieldDescriptor::CPPTYPE_MESSAGE);
-
-    auto new_msg = RedisProtobuf::instance().proto_factory()->create(field.mapped_msg_type(), sv);
-    assert(new_msg);
+    LatencyTimer timer(Phase::MUTATE);
 
-    field.set_mapped_msg(*new_msg);
+    // The setter has been selected with the kind and type of the field,
+    // when resolving the path.
+    field.accessor().set(field, val);
 }
 
 }
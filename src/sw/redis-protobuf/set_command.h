@@ -23,6 +23,7 @@
 #include <chrono>
 #include "utils.h"
 #include "field_ref.h"
+#include "proto_value.h"
 
 namespace sw {
 
@@ -55,12 +56,42 @@ private:
 
         Path path;
         StringView val;
+
+        // Argument of *path*. It's only used in the main thread.
+        RedisModuleString *path_name = nullptr;
     };
 
-    int _run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+    // If a message is set with a JSON value, and --REPLICATE-EFFECTS is enabled,
+    // *binary* is set to the binary form of the message.
+    int _run(RedisModuleCtx *ctx, const Args &args, Optional<std::string> &binary) const;
+
+    // Return the binary form of the message at *path*, or nothing if *path*
+    // is not a message.
+    Optional<std::string> _binary_msg(ProtoValue &value, const Path &path) const;
+
+    // Replicate the command verbatim, or if *binary* is set, replicate it as
+    // PB.SET with the binary form of the message, so that replicas don't parse JSON.
+    void _replicate(RedisModuleCtx *ctx,
+            const Args &args,
+            int res,
+            const Optional<std::string> &binary) const;
+
+    class JsonSetTask;
+
+    // If the whole message is set with a large JSON string, parse it in
+    // a worker thread. Return true, if the reply is deferred to the worker thread.
+    bool _async_set(RedisModuleCtx *ctx, const Args &args) const;
+
+    // Set *value* as the value of the key, with options in *args*. Return 1,
+    // if *value* has been set, 0 otherwise.
+    int _set_value(RedisModuleCtx *ctx, const Args &args, ProtoValueUPtr value) const;
 
     friend class MergeCommand;
 
+    friend class MSetCommand;
+
+    friend class PatchCommand;
+
     Args _parse_args(RedisModuleString **argv, int argc) const;
 
     // Return the position of the first non-option argument.
@@ -76,73 +107,7 @@ private:
             const Path &path,
             const StringView &val) const;
 
-    void _set_scalar_field(MutableFieldRef &field, const StringView &val) const;
-
-    void _set_map_element(MutableFieldRef &field, const StringView &val) const;
-
-    void _set_array_element(MutableFieldRef &field, const StringView &val) const;
-
     void _set_field(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_int32(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_int64(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_uint32(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_uint64(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_double(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_float(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_bool(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_enum(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_string(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_msg(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_repeated_int32(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_repeated_int64(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_repeated_uint32(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_repeated_uint64(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_repeated_double(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_repeated_float(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_repeated_bool(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_repeated_enum(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_repeated_string(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_repeated_msg(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_mapped_int32(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_mapped_int64(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_mapped_uint32(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_mapped_uint64(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_mapped_double(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_mapped_float(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_mapped_bool(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_mapped_enum(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_mapped_string(MutableFieldRef &field, const StringView &sv) const;
-
-    void _set_mapped_msg(MutableFieldRef &field, const StringView &sv) const;
 };
 
 }
@@ -0,0 +1,187 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "stats_command.h"
+#include "errors.h"
+#include "redis_protobuf.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+int StatsCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const {
+    try {
+        assert(ctx != nullptr);
+
+        _parse_args(argv, argc);
+
+        auto stats = sections();
+
+        RedisModule_ReplyWithArray(ctx, stats.size() * 2);
+
+        for (const auto &section : stats) {
+            _reply_with_section(ctx, section.first, section.second);
+        }
+
+        return REDISMODULE_OK;
+    } catch (const WrongArityError &err) {
+        return RedisModule_WrongArity(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+
+    return REDISMODULE_ERR;
+}
+
+std::vector<std::pair<std::string, StatsCommand::Section>> StatsCommand::sections() const {
+    return {
+        {"path_cache", _path_cache_stats()},
+        {"arena", _arena_stats()},
+        {"prototype_cache", _prototype_cache_stats()},
+        {"storage", _storage_stats()},
+        {"compression", _compression_stats()},
+        {"schema", _schema_stats()}
+    };
+}
+
+void StatsCommand::_parse_args(RedisModuleString **argv, int argc) const {
+    assert(argv != nullptr);
+
+    if (argc != 1) {
+        throw WrongArityError();
+    }
+}
+
+StatsCommand::Section StatsCommand::_path_cache_stats() const {
+    PathCache::Stats stats;
+
+    auto *cache = RedisProtobuf::instance().path_cache();
+    if (cache != nullptr) {
+        stats = cache->stats();
+    }
+
+    return {
+        {"capacity", stats.capacity},
+        {"size", stats.size},
+        {"hits", stats.hits},
+        {"misses", stats.misses},
+        {"evictions", stats.evictions}
+    };
+}
+
+StatsCommand::Section StatsCommand::_arena_stats() const {
+    auto &module = RedisProtobuf::instance();
+    auto stats = ProtoValue::arena_stats();
+
+    return {
+        {"enabled", module.options().use_arena},
+        {"messages", stats.messages},
+        {"blocks", stats.blocks},
+        {"allocated_bytes", stats.allocated_bytes}
+    };
+}
+
+StatsCommand::Section StatsCommand::_prototype_cache_stats() const {
+    ProtoFactory::PrototypeCacheStats stats;
+
+    auto *factory = RedisProtobuf::instance().proto_factory();
+    if (factory != nullptr) {
+        stats = factory->prototype_cache_stats();
+    }
+
+    return {
+        {"size", stats.size},
+        {"hits", stats.hits},
+        {"misses", stats.misses}
+    };
+}
+
+StatsCommand::Section StatsCommand::_storage_stats() const {
+    auto &module = RedisProtobuf::instance();
+    auto stats = ProtoValue::storage_stats();
+    const auto &write_stats = module.write_stats();
+
+    return {
+        {"compact", module.options().compact},
+        {"values", stats.values},
+        {"serialized_values", stats.serialized_values},
+        {"serialized_bytes", stats.serialized_bytes},
+        {"compactions", stats.compactions},
+        {"cache_serialized", module.options().cache_serialized},
+        {"cached_values", stats.cached_values},
+        {"cached_bytes", stats.cached_bytes},
+        {"writes", write_stats.writes},
+        {"writes_with_child", write_stats.writes_with_child}
+    };
+}
+
+StatsCommand::Section StatsCommand::_compression_stats() const {
+    auto stats = ProtoValue::compression_stats();
+
+    // Memory saved by compression, excluding cached decompressed messages.
+    long long saved_bytes = static_cast<long long>(stats.uncompressed_bytes)
+        - static_cast<long long>(stats.compressed_bytes);
+
+    return {
+        {"compress_threshold", RedisProtobuf::instance().options().compress_threshold},
+        {"compressed_values", stats.compressed_values},
+        {"compressed_bytes", stats.compressed_bytes},
+        {"uncompressed_bytes", stats.uncompressed_bytes},
+        {"saved_bytes", saved_bytes},
+        {"decompressed_values", stats.decompressed_values},
+        {"decompressed_bytes", stats.decompressed_bytes},
+        {"decompressions", stats.decompressions},
+        {"decompressed_hits", stats.hits},
+        {"decompressed_evictions", stats.evictions}
+    };
+}
+
+StatsCommand::Section StatsCommand::_schema_stats() const {
+    ProtoFactory::SchemaStats stats;
+
+    auto *factory = RedisProtobuf::instance().proto_factory();
+    if (factory != nullptr) {
+        stats = factory->schema_stats();
+    }
+
+    return {
+        {"generation", stats.generation},
+        {"files", stats.files},
+        {"migrations", stats.migrations},
+        {"plugin_types", stats.plugin_types}
+    };
+}
+
+void StatsCommand::_reply_with_section(RedisModuleCtx *ctx,
+        const std::string &name,
+        const Section &section) const {
+    RedisModule_ReplyWithSimpleString(ctx, name.data());
+
+    RedisModule_ReplyWithArray(ctx, section.size() * 2);
+
+    for (const auto &metric : section) {
+        RedisModule_ReplyWithSimpleString(ctx, metric.first.data());
+        RedisModule_ReplyWithLongLong(ctx, metric.second);
+    }
+}
+
+}
+
+}
+
+}
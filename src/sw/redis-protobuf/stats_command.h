@@ -0,0 +1,71 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_STATS_COMMANDS_H
+#define SEWENEW_REDISPROTOBUF_STATS_COMMANDS_H
+
+#include "module_api.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include "utils.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// command: PB.STATS
+// return:  Array reply: return the statistics of the module as pairs of
+//          section name and section, and each section is an array of
+//          metric name and integer value pairs.
+class StatsCommand {
+public:
+    int run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) const;
+
+    using Section = std::vector<std::pair<std::string, long long>>;
+
+    // Sections of statistics with their names, which are also shown in INFO.
+    std::vector<std::pair<std::string, Section>> sections() const;
+
+private:
+    void _parse_args(RedisModuleString **argv, int argc) const;
+
+    Section _path_cache_stats() const;
+
+    Section _arena_stats() const;
+
+    Section _prototype_cache_stats() const;
+
+    Section _storage_stats() const;
+
+    Section _compression_stats() const;
+
+    Section _schema_stats() const;
+
+    void _reply_with_section(RedisModuleCtx *ctx,
+            const std::string &name,
+            const Section &section) const;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_STATS_COMMANDS_H
@@ -36,10 +36,10 @@ int TypeCommand::run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) co
             return RedisModule_ReplyWithNull(ctx);
         }
 
-        auto *msg = api::get_msg_by_key(key.get());
-        assert(msg != nullptr);
+        auto *value = api::get_value_by_key(key.get());
+        assert(value != nullptr);
 
-        auto type = _format_type(msg->GetTypeName());
+        auto type = _format_type(value->descriptor()->full_name());
 
         return RedisModule_ReplyWithSimpleString(ctx, type.data());
     } catch (const WrongArityError &err) {
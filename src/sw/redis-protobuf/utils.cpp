@@ -19,13 +19,63 @@
 #include <dirent.h>
 #include <cassert>
 #include <cctype>
-#include <google/protobuf/util/json_util.h>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/util/type_resolver_util.h>
 #include "errors.h"
+#include "metrics.h"
 
 namespace {
 
 mode_t file_type(const std::string &file);
 
+// The following parsers neither allocate memory nor throw exceptions.
+// They return false, if *sv* is not a valid number, which must NOT have
+// leading spaces or trailing characters, or the number is out of range.
+
+bool parse_uint(const sw::redis::pb::StringView &sv, uint64_t max, uint64_t &val);
+
+bool parse_int(const sw::redis::pb::StringView &sv, int64_t min, int64_t max, int64_t &val);
+
+template <typename T>
+bool parse_floating(const sw::redis::pb::StringView &sv, T (*strtox)(const char *, char **), T &val);
+
+using TypeResolverSPtr = std::shared_ptr<google::protobuf::util::TypeResolver>;
+
+// Type resolvers registered by descriptor pools. Resolvers are shared, so that
+// a conversion in a worker thread keeps its resolver alive, even if the pool
+// is unregistered in the meantime.
+class TypeResolverRegistry {
+public:
+    static TypeResolverRegistry& instance() {
+        static TypeResolverRegistry registry;
+
+        return registry;
+    }
+
+    void add(const google::protobuf::DescriptorPool &pool);
+
+    void remove(const google::protobuf::DescriptorPool &pool);
+
+    // Return nullptr, if the pool has not been registered.
+    TypeResolverSPtr find(const google::protobuf::DescriptorPool &pool);
+
+private:
+    std::mutex _mutex;
+
+    std::unordered_map<const google::protobuf::DescriptorPool *, TypeResolverSPtr> _resolvers;
+};
+
+// Resolver of *desc*'s pool. If the pool has not been registered, e.g. it's
+// the generated pool, create a temporary one.
+TypeResolverSPtr type_resolver(const google::protobuf::Descriptor &desc);
+
+std::string type_url(const google::protobuf::Descriptor &desc);
+
 }
 
 namespace sw {
@@ -44,87 +94,168 @@ StringView::StringView(RedisModuleString *str) {
 
 namespace util {
 
-std::string msg_to_json(const gp::Message &msg) {
+void register_type_resolver(const gp::DescriptorPool &pool) {
+    TypeResolverRegistry::instance().add(pool);
+}
+
+void unregister_type_resolver(const gp::DescriptorPool &pool) {
+    TypeResolverRegistry::instance().remove(pool);
+}
+
+std::string msg_to_json(const gp::Message &msg, const JsonPrintOptions &opts) {
+    std::string binary;
+    {
+        LatencyTimer timer(Phase::SERIALIZE);
+
+        if (!msg.SerializeToString(&binary)) {
+            throw Error("failed to parse message to json");
+        }
+    }
+
+    return binary_to_json(*msg.GetDescriptor(), binary, opts);
+}
+
+std::string binary_to_json(const gp::Descriptor &desc,
+        const StringView &binary,
+        const JsonPrintOptions &opts) {
     std::string json;
-    auto status = gp::util::MessageToJsonString(msg, &json);
+    binary_to_json(desc, binary, opts, json);
+
+    return json;
+}
+
+void binary_to_json(const gp::Descriptor &desc,
+        const StringView &binary,
+        const JsonPrintOptions &opts,
+        std::string &json) {
+    LatencyTimer timer(Phase::SERIALIZE);
+
+    auto resolver = type_resolver(desc);
+
+    // Write JSON to the end of the string directly. The output stream must be
+    // destroyed before returning, so that the string is trimmed to size.
+    gp::util::Status status;
+    {
+        gp::io::ArrayInputStream input(binary.data(), binary.size());
+        gp::io::StringOutputStream output(&json);
+        status = gp::util::BinaryToJsonStream(resolver.get(), type_url(desc), &input, &output, opts);
+    }
+
     if (!status.ok()) {
         throw Error("failed to parse message to json");
     }
+}
 
-    return json;
+std::string msg_to_binary(const gp::Message &msg) {
+    LatencyTimer timer(Phase::SERIALIZE);
+
+    std::string binary;
+    if (!msg.SerializeToString(&binary)) {
+        throw Error("failed to serialize message to binary string");
+    }
+
+    return binary;
+}
+
+void json_to_msg(const StringView &json, gp::Message &msg) {
+    LatencyTimer timer(Phase::PARSE);
+
+    const auto &desc = *msg.GetDescriptor();
+    auto resolver = type_resolver(desc);
+
+    std::string binary;
+    gp::util::Status status;
+    {
+        gp::io::ArrayInputStream input(json.data(), json.size());
+        gp::io::StringOutputStream output(&binary);
+        status = gp::util::JsonToBinaryStream(resolver.get(), type_url(desc), &input, &output);
+    }
+
+    if (!status.ok()) {
+        throw Error("failed to parse json to " + msg.GetTypeName() + ": " + status.ToString());
+    }
+
+    if (!msg.ParseFromString(binary)) {
+        throw Error("failed to parse json to " + msg.GetTypeName());
+    }
 }
 
 int32_t sv_to_int32(const StringView &sv) {
-    try {
-        return std::stoi(std::string(sv.data(), sv.size()));
-    } catch (const std::exception &e) {
+    int64_t val = 0;
+    if (!parse_int(sv,
+                std::numeric_limits<int32_t>::min(),
+                std::numeric_limits<int32_t>::max(),
+                val)) {
         throw Error("not int32");
     }
+
+    return static_cast<int32_t>(val);
 }
 
 int64_t sv_to_int64(const StringView &sv) {
-    try {
-        return std::stoll(std::string(sv.data(), sv.size()));
-    } catch (const std::exception &e) {
+    int64_t val = 0;
+    if (!parse_int(sv,
+                std::numeric_limits<int64_t>::min(),
+                std::numeric_limits<int64_t>::max(),
+                val)) {
         throw Error("not int64");
     }
+
+    return val;
 }
 
 uint32_t sv_to_uint32(const StringView &sv) {
-    try {
-        // TODO: check if it's overflow
-        return std::stoul(std::string(sv.data(), sv.size()));
-    } catch (const std::exception &e) {
+    uint64_t val = 0;
+    if (!parse_uint(sv, std::numeric_limits<uint32_t>::max(), val)) {
         throw Error("not uint32");
     }
+
+    return static_cast<uint32_t>(val);
 }
 
 uint64_t sv_to_uint64(const StringView &sv) {
-    try {
-        return std::stoull(std::string(sv.data(), sv.size()));
-    } catch (const std::exception &e) {
+    uint64_t val = 0;
+    if (!parse_uint(sv, std::numeric_limits<uint64_t>::max(), val)) {
         throw Error("not uint64");
     }
+
+    return val;
 }
 
 double sv_to_double(const StringView &sv) {
-    try {
-        return std::stod(std::string(sv.data(), sv.size()));
-    } catch (const std::exception &e) {
+    double val = 0;
+    if (!parse_floating(sv, std::strtod, val)) {
         throw Error("not double");
     }
+
+    return val;
 }
 
 float sv_to_float(const StringView &sv) {
-    try {
-        return std::stof(std::string(sv.data(), sv.size()));
-    } catch (const std::exception &e) {
+    float val = 0;
+    if (!parse_floating(sv, std::strtof, val)) {
         throw Error("not float");
     }
+
+    return val;
 }
 
 bool sv_to_bool(const StringView &sv) {
-    bool b = false;
-    auto s = std::string(sv.data(), sv.size());
-    // TODO: make it case insensitive
-    if (s == "true") {
-        b = true;
-    } else if (s == "false") {
-        b = false;
-    } else {
-        try {
-            auto val = std::stoi(s);
-            if (val == 0) {
-                b = false;
-            } else {
-                b = true;
-            }
-        } catch (const std::exception &e) {
-            throw Error("not bool");
-        }
+    if (str_case_equal(sv, "true")) {
+        return true;
+    } else if (str_case_equal(sv, "false")) {
+        return false;
+    }
+
+    int64_t val = 0;
+    if (!parse_int(sv,
+                std::numeric_limits<int64_t>::min(),
+                std::numeric_limits<int64_t>::max(),
+                val)) {
+        throw Error("not bool");
     }
 
-    return b;
+    return val != 0;
 }
 
 std::string sv_to_string(const StringView &sv) {
@@ -213,6 +344,49 @@ std::string extension(const std::string &file) {
 
 namespace {
 
+const char *TYPE_URL_PREFIX = "type.googleapis.com";
+
+void TypeResolverRegistry::add(const google::protobuf::DescriptorPool &pool) {
+    TypeResolverSPtr resolver(google::protobuf::util::NewTypeResolverForDescriptorPool(
+                TYPE_URL_PREFIX, &pool));
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _resolvers[&pool] = std::move(resolver);
+}
+
+void TypeResolverRegistry::remove(const google::protobuf::DescriptorPool &pool) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _resolvers.erase(&pool);
+}
+
+TypeResolverSPtr TypeResolverRegistry::find(const google::protobuf::DescriptorPool &pool) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto iter = _resolvers.find(&pool);
+    if (iter == _resolvers.end()) {
+        return nullptr;
+    }
+
+    return iter->second;
+}
+
+TypeResolverSPtr type_resolver(const google::protobuf::Descriptor &desc) {
+    const auto &pool = *desc.file()->pool();
+    auto resolver = TypeResolverRegistry::instance().find(pool);
+    if (!resolver) {
+        resolver.reset(google::protobuf::util::NewTypeResolverForDescriptorPool(
+                    TYPE_URL_PREFIX, &pool));
+    }
+
+    return resolver;
+}
+
+std::string type_url(const google::protobuf::Descriptor &desc) {
+    return std::string(TYPE_URL_PREFIX) + "/" + desc.full_name();
+}
+
 mode_t file_type(const std::string &file) {
     struct stat buf;
     if (stat(file.c_str(), &buf) < 0) {
@@ -222,4 +396,101 @@ mode_t file_type(const std::string &file) {
     return buf.st_mode;
 }
 
+bool parse_digits(const char *ptr, const char *end, uint64_t max, uint64_t &val) {
+    if (ptr == end) {
+        return false;
+    }
+
+    uint64_t res = 0;
+    for (; ptr != end; ++ptr) {
+        auto ch = *ptr;
+        if (ch < '0' || ch > '9') {
+            return false;
+        }
+
+        uint64_t digit = ch - '0';
+        if (res > (max - digit) / 10) {
+            // Overflow.
+            return false;
+        }
+
+        res = res * 10 + digit;
+    }
+
+    val = res;
+
+    return true;
+}
+
+bool parse_uint(const sw::redis::pb::StringView &sv, uint64_t max, uint64_t &val) {
+    const auto *ptr = sv.data();
+    const auto *end = ptr + sv.size();
+    if (ptr != end && *ptr == '+') {
+        ++ptr;
+    }
+
+    return parse_digits(ptr, end, max, val);
+}
+
+bool parse_int(const sw::redis::pb::StringView &sv, int64_t min, int64_t max, int64_t &val) {
+    assert(min < 0 && max > 0);
+
+    const auto *ptr = sv.data();
+    const auto *end = ptr + sv.size();
+
+    auto negative = false;
+    if (ptr != end && (*ptr == '-' || *ptr == '+')) {
+        negative = (*ptr == '-');
+        ++ptr;
+    }
+
+    // Absolute value of *min* might be larger than the max value of int64_t.
+    auto limit = negative ? static_cast<uint64_t>(-(min + 1)) + 1 : static_cast<uint64_t>(max);
+
+    uint64_t abs_val = 0;
+    if (!parse_digits(ptr, end, limit, abs_val)) {
+        return false;
+    }
+
+    if (negative && abs_val != 0) {
+        val = -static_cast<int64_t>(abs_val - 1) - 1;
+    } else {
+        val = static_cast<int64_t>(abs_val);
+    }
+
+    return true;
+}
+
+template <typename T>
+bool parse_floating(const sw::redis::pb::StringView &sv, T (*strtox)(const char *, char **), T &val) {
+    if (sv.size() == 0 || std::isspace(static_cast<unsigned char>(sv.data()[0]))) {
+        return false;
+    }
+
+    // strtod requires a null-terminated string. Copy short numbers, which
+    // are the common case, to a buffer on stack to avoid allocation.
+    char buf[64];
+    std::string long_str;
+    const char *str = nullptr;
+    if (sv.size() < sizeof(buf)) {
+        std::memcpy(buf, sv.data(), sv.size());
+        buf[sv.size()] = '\0';
+        str = buf;
+    } else {
+        long_str.assign(sv.data(), sv.size());
+        str = long_str.c_str();
+    }
+
+    char *end = nullptr;
+    errno = 0;
+    auto res = strtox(str, &end);
+    if (end != str + sv.size() || errno == ERANGE) {
+        return false;
+    }
+
+    val = res;
+
+    return true;
+}
+
 }
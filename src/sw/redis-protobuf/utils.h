@@ -22,6 +22,8 @@
 #include <vector>
 #include <memory>
 #include <google/protobuf/message.h>
+#include <google/protobuf/util/json_util.h>
+#include <google/protobuf/util/type_resolver.h>
 #include "module_api.h"
 
 namespace sw {
@@ -119,7 +121,39 @@ private:
 
 namespace util {
 
-std::string msg_to_json(const gp::Message &msg);
+using JsonPrintOptions = gp::util::JsonPrintOptions;
+
+// Register a type resolver for messages of *pool*, so that JSON conversion
+// reuses it, instead of building a new one for each message. Both functions
+// are thread-safe.
+void register_type_resolver(const gp::DescriptorPool &pool);
+
+void unregister_type_resolver(const gp::DescriptorPool &pool);
+
+std::string msg_to_json(const gp::Message &msg, const JsonPrintOptions &opts = JsonPrintOptions());
+
+// Convert the serialized message of type *desc* to JSON, without parsing it
+// into a message. It's thread-safe.
+std::string binary_to_json(const gp::Descriptor &desc,
+        const StringView &binary,
+        const JsonPrintOptions &opts = JsonPrintOptions());
+
+// Same as above, except that the JSON string is appended to *json*, so that
+// JSON strings of many messages can be written to a single buffer.
+void binary_to_json(const gp::Descriptor &desc,
+        const StringView &binary,
+        const JsonPrintOptions &opts,
+        std::string &json);
+
+std::string msg_to_binary(const gp::Message &msg);
+
+// Parse *json* into *msg*. It's thread-safe, as long as *msg* is not shared.
+void json_to_msg(const StringView &json, gp::Message &msg);
+
+// Whether *sv* looks like a JSON object, i.e. enclosed by '{' and '}'.
+inline bool is_json(const StringView &sv) {
+    return sv.size() >= 2 && sv.data()[0] == '{' && sv.data()[sv.size() - 1] == '}';
+}
 
 int32_t sv_to_int32(const StringView &sv);
 
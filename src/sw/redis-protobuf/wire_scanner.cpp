@@ -0,0 +1,341 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "wire_scanner.h"
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <google/protobuf/wire_format_lite.h>
+#include "errors.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+namespace {
+
+using WireFormat = gp::internal::WireFormatLite;
+
+uint32_t field_tag(const gp::FieldDescriptor &desc);
+
+// Another member of the oneof containing *desc*, which is tagged with *tag*,
+// or nullptr if there's no such member.
+const gp::FieldDescriptor* oneof_sibling(const gp::FieldDescriptor &desc, uint32_t tag);
+
+// Whether *val* is a known value of a closed enum, i.e. an enum defined in
+// a proto2 file. The parser moves unknown values to unknown fields.
+bool is_known_enum_value(const gp::FieldDescriptor &desc, int val);
+
+}
+
+bool WireScanner::scannable(const std::vector<PathField> &fields) {
+    if (fields.empty()) {
+        return false;
+    }
+
+    for (const auto &field : fields) {
+        assert(field.desc != nullptr);
+
+        if (field.desc->is_repeated()
+                || field.arr_idx >= 0
+                || field.desc->type() == gp::FieldDescriptor::TYPE_GROUP) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+WireField WireScanner::scan(const StringView &wire) const {
+    assert(scannable(_fields));
+
+    if (wire.size() > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+        throw Error("serialized message is too large to scan");
+    }
+
+    gp::io::CodedInputStream input(reinterpret_cast<const gp::uint8 *>(wire.data()),
+            static_cast<int>(wire.size()));
+    input.SetTotalBytesLimit(std::numeric_limits<int>::max());
+
+    WireField field;
+    _scan(input, 0, field);
+
+    if (!field.present) {
+        _set_default(*(_fields.back().desc), field);
+    }
+
+    return field;
+}
+
+void WireScanner::_scan(gp::io::CodedInputStream &input,
+        std::size_t depth,
+        WireField &field) const {
+    assert(depth < _fields.size());
+
+    const auto &desc = *(_fields[depth].desc);
+    auto expected_tag = field_tag(desc);
+
+    while (true) {
+        auto tag = input.ReadTag();
+        if (tag == 0) {
+            if (!input.ConsumedEntireMessage()) {
+                throw Error("invalid serialized message");
+            }
+
+            break;
+        }
+
+        if (tag != expected_tag) {
+            const auto *sibling = oneof_sibling(desc, tag);
+            if (sibling != nullptr) {
+                // The parser clears the field, when another member of its oneof is set.
+                WireField sibling_field;
+                _read_value(input, *sibling, sibling_field);
+                if (sibling_field.present) {
+                    field = WireField();
+                }
+
+                continue;
+            }
+
+            // Unrelated field, or field with mismatched wire type, which is
+            // an unknown field for the parser.
+            if (!WireFormat::SkipField(&input, tag)) {
+                throw Error("invalid serialized message");
+            }
+
+            continue;
+        }
+
+        if (depth + 1 == _fields.size()) {
+            _read_value(input, desc, field);
+            continue;
+        }
+
+        // Step into the sub-message.
+        uint32_t len = 0;
+        if (!input.ReadVarint32(&len)) {
+            throw Error("invalid serialized message");
+        }
+
+        auto limit = input.PushLimit(static_cast<int>(len));
+
+        _scan(input, depth + 1, field);
+
+        input.PopLimit(limit);
+    }
+}
+
+void WireScanner::_read_value(gp::io::CodedInputStream &input,
+        const gp::FieldDescriptor &desc,
+        WireField &field) const {
+    uint64_t varint = 0;
+    uint32_t fixed32 = 0;
+    uint64_t fixed64 = 0;
+    bool ok = true;
+
+    switch (WireFormat::WireTypeForFieldType(static_cast<WireFormat::FieldType>(desc.type()))) {
+    case WireFormat::WIRETYPE_VARINT:
+        ok = input.ReadVarint64(&varint);
+        break;
+
+    case WireFormat::WIRETYPE_FIXED32:
+        ok = input.ReadLittleEndian32(&fixed32);
+        break;
+
+    case WireFormat::WIRETYPE_FIXED64:
+        ok = input.ReadLittleEndian64(&fixed64);
+        break;
+
+    case WireFormat::WIRETYPE_LENGTH_DELIMITED: {
+        uint32_t len = 0;
+        ok = input.ReadVarint32(&len);
+        if (ok) {
+            std::string bytes;
+            ok = input.ReadString(&bytes, static_cast<int>(len));
+            if (desc.type() == gp::FieldDescriptor::TYPE_MESSAGE) {
+                field.bytes += bytes;
+            } else {
+                field.bytes.swap(bytes);
+            }
+        }
+        break;
+    }
+
+    default:
+        ok = false;
+    }
+
+    if (!ok) {
+        throw Error("invalid serialized message");
+    }
+
+    if (desc.type() == gp::FieldDescriptor::TYPE_ENUM
+            && !is_known_enum_value(desc, static_cast<int32_t>(varint))) {
+        // Ignore it, as the parser does, and keep the previous value.
+        return;
+    }
+
+    field.present = true;
+
+    switch (desc.type()) {
+    case gp::FieldDescriptor::TYPE_INT32:
+    case gp::FieldDescriptor::TYPE_ENUM:
+        field.int_val = static_cast<int32_t>(varint);
+        break;
+
+    case gp::FieldDescriptor::TYPE_INT64:
+        field.int_val = static_cast<int64_t>(varint);
+        break;
+
+    case gp::FieldDescriptor::TYPE_SINT32:
+        field.int_val = WireFormat::ZigZagDecode32(static_cast<uint32_t>(varint));
+        break;
+
+    case gp::FieldDescriptor::TYPE_SINT64:
+        field.int_val = WireFormat::ZigZagDecode64(varint);
+        break;
+
+    case gp::FieldDescriptor::TYPE_SFIXED32:
+        field.int_val = static_cast<int32_t>(fixed32);
+        break;
+
+    case gp::FieldDescriptor::TYPE_SFIXED64:
+        field.int_val = static_cast<int64_t>(fixed64);
+        break;
+
+    case gp::FieldDescriptor::TYPE_UINT32:
+        field.uint_val = static_cast<uint32_t>(varint);
+        break;
+
+    case gp::FieldDescriptor::TYPE_UINT64:
+        field.uint_val = varint;
+        break;
+
+    case gp::FieldDescriptor::TYPE_FIXED32:
+        field.uint_val = fixed32;
+        break;
+
+    case gp::FieldDescriptor::TYPE_FIXED64:
+        field.uint_val = fixed64;
+        break;
+
+    case gp::FieldDescriptor::TYPE_BOOL:
+        field.int_val = (varint != 0);
+        break;
+
+    case gp::FieldDescriptor::TYPE_DOUBLE:
+        std::memcpy(&field.double_val, &fixed64, sizeof(field.double_val));
+        break;
+
+    case gp::FieldDescriptor::TYPE_FLOAT:
+        std::memcpy(&field.float_val, &fixed32, sizeof(field.float_val));
+        break;
+
+    default:
+        // String, bytes and message have been read.
+        break;
+    }
+}
+
+void WireScanner::_set_default(const gp::FieldDescriptor &desc, WireField &field) const {
+    switch (desc.cpp_type()) {
+    case gp::FieldDescriptor::CPPTYPE_INT32:
+        field.int_val = desc.default_value_int32();
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_INT64:
+        field.int_val = desc.default_value_int64();
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_UINT32:
+        field.uint_val = desc.default_value_uint32();
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_UINT64:
+        field.uint_val = desc.default_value_uint64();
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_DOUBLE:
+        field.double_val = desc.default_value_double();
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_FLOAT:
+        field.float_val = desc.default_value_float();
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_BOOL:
+        field.int_val = desc.default_value_bool();
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_ENUM:
+        field.int_val = desc.default_value_enum()->number();
+        break;
+
+    case gp::FieldDescriptor::CPPTYPE_STRING:
+        field.bytes = desc.default_value_string();
+        break;
+
+    default:
+        // A message not present is an empty message.
+        break;
+    }
+}
+
+namespace {
+
+uint32_t field_tag(const gp::FieldDescriptor &desc) {
+    return WireFormat::MakeTag(desc.number(),
+            WireFormat::WireTypeForFieldType(static_cast<WireFormat::FieldType>(desc.type())));
+}
+
+const gp::FieldDescriptor* oneof_sibling(const gp::FieldDescriptor &desc, uint32_t tag) {
+    const auto *oneof = desc.containing_oneof();
+    if (oneof == nullptr) {
+        return nullptr;
+    }
+
+    for (int idx = 0; idx != oneof->field_count(); ++idx) {
+        const auto *member = oneof->field(idx);
+        if (member != &desc && field_tag(*member) == tag) {
+            return member;
+        }
+    }
+
+    return nullptr;
+}
+
+bool is_known_enum_value(const gp::FieldDescriptor &desc, int val) {
+    const auto *enum_desc = desc.enum_type();
+    assert(enum_desc != nullptr);
+
+    if (enum_desc->file()->syntax() != gp::FileDescriptor::SYNTAX_PROTO2) {
+        // Open enum keeps unknown values.
+        return true;
+    }
+
+    return enum_desc->FindValueByNumber(val) != nullptr;
+}
+
+}
+
+}
+
+}
+
+}
@@ -0,0 +1,91 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_WIRE_SCANNER_H
+#define SEWENEW_REDISPROTOBUF_WIRE_SCANNER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <google/protobuf/io/coded_stream.h>
+#include "utils.h"
+#include "field_ref.h"
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// Value of a field scanned from a serialized message.
+struct WireField {
+    // Integer, enum and bool types.
+    int64_t int_val = 0;
+
+    uint64_t uint_val = 0;
+
+    double double_val = 0;
+
+    float float_val = 0;
+
+    // String field, or serialized sub-message. Since occurrences of a
+    // sub-message should be merged, they're concatenated, which is also
+    // a valid serialization of the merged message.
+    std::string bytes;
+
+    // Whether the field has been found on the wire.
+    bool present = false;
+};
+
+// Get a field from a serialized message, without parsing the whole message.
+// It only walks the tags on the path, and skips other fields. Since proto3
+// parser keeps the last occurrence of a scalar field, and merges occurrences
+// of a message field, the scanner does the same. A field not present has
+// the default value of its descriptor, e.g. proto2 `[default = ...]`, or
+// the first value of an enum. Also like the parser, a field on the path is
+// cleared, when another member of its oneof shows up later, and an unknown
+// value of a closed enum, i.e. a proto2 enum, is ignored.
+class WireScanner {
+public:
+    // *fields* must outlive the scanner.
+    explicit WireScanner(const std::vector<PathField> &fields) : _fields(fields) {}
+
+    // Whether fields can be scanned, i.e. none of them is repeated or map,
+    // and the path is not empty.
+    static bool scannable(const std::vector<PathField> &fields);
+
+    // Throw Error, if *wire* is not a valid serialized message.
+    WireField scan(const StringView &wire) const;
+
+private:
+    void _scan(gp::io::CodedInputStream &input, std::size_t depth, WireField &field) const;
+
+    void _read_value(gp::io::CodedInputStream &input,
+            const gp::FieldDescriptor &desc,
+            WireField &field) const;
+
+    void _set_default(const gp::FieldDescriptor &desc, WireField &field) const;
+
+    const std::vector<PathField> &_fields;
+};
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_WIRE_SCANNER_H
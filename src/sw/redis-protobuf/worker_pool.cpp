@@ -0,0 +1,201 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "worker_pool.h"
+#include <cassert>
+#include "errors.h"
+
+namespace {
+
+int async_reply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+
+void async_free(RedisModuleCtx *ctx, void *privdata);
+
+}
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+WorkerPool::WorkerPool(std::size_t pool_size) {
+    if (pool_size == 0) {
+        throw Error("worker pool size must be larger than 0");
+    }
+
+    _workers.reserve(pool_size);
+    for (std::size_t idx = 0; idx != pool_size; ++idx) {
+        _workers.emplace_back(&WorkerPool::_run, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+
+    _cv.notify_all();
+
+    for (auto &worker : _workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+void WorkerPool::submit(std::function<void ()> task) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stop) {
+            throw Error("worker pool has been stopped");
+        }
+
+        _tasks.push_back(std::move(task));
+    }
+
+    _cv.notify_one();
+}
+
+void WorkerPool::_run() {
+    while (true) {
+        std::function<void ()> task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+
+            if (_tasks.empty()) {
+                // Stopped, and all tasks have been done.
+                break;
+            }
+
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+void AsyncTask::execute() {
+    try {
+        run();
+    } catch (const std::exception &e) {
+        _failed = true;
+        _err = e.what();
+    }
+}
+
+int AsyncTask::finish(RedisModuleCtx *ctx) {
+    try {
+        if (_failed) {
+            throw Error(_err);
+        }
+
+        return reply(ctx);
+    } catch (const Error &err) {
+        return api::reply_with_error(ctx, err);
+    }
+}
+
+namespace api {
+
+bool can_block(RedisModuleCtx *ctx) {
+    if (RedisModule_BlockClient == nullptr || RedisModule_GetContextFlags == nullptr) {
+        return false;
+    }
+
+    auto flags = RedisModule_GetContextFlags(ctx);
+
+    // Commands loaded from AOF or sent by the master must be applied in order,
+    // so they always run synchronously. Older Redis never sets these flags.
+    const int no_block_flags = REDISMODULE_CTX_FLAGS_MULTI
+        | REDISMODULE_CTX_FLAGS_LUA
+        | REDISMODULE_CTX_FLAGS_LOADING
+        | REDISMODULE_CTX_FLAGS_REPLICATED
+        | REDISMODULE_CTX_FLAGS_DENY_BLOCKING;
+
+    return (flags & no_block_flags) == 0;
+}
+
+void block_and_run(RedisModuleCtx *ctx, WorkerPool &pool, AsyncTaskUPtr task) {
+    assert(ctx != nullptr && task);
+
+    auto *bc = RedisModule_BlockClient(ctx, async_reply, nullptr, async_free, 0);
+    if (bc == nullptr) {
+        throw Error("failed to block client");
+    }
+
+    // std::function must be copyable, so we cannot capture the unique_ptr.
+    auto *raw_task = task.release();
+
+    try {
+        pool.submit([bc, raw_task]() {
+                    raw_task->execute();
+
+                    // *raw_task* is freed by async_free.
+                    RedisModule_UnblockClient(bc, raw_task);
+                });
+    } catch (const Error &) {
+        delete raw_task;
+
+        RedisModule_AbortBlock(bc);
+
+        throw;
+    }
+}
+
+RedisModuleBlockedClient* block(RedisModuleCtx *ctx) {
+    assert(ctx != nullptr);
+
+    auto *bc = RedisModule_BlockClient(ctx, async_reply, nullptr, async_free, 0);
+    if (bc == nullptr) {
+        throw Error("failed to block client");
+    }
+
+    return bc;
+}
+
+void unblock(RedisModuleBlockedClient *bc, AsyncTaskUPtr task) {
+    assert(bc != nullptr && task);
+
+    // *task* is freed by async_free.
+    RedisModule_UnblockClient(bc, task.release());
+}
+
+}
+
+}
+
+}
+
+}
+
+namespace {
+
+int async_reply(RedisModuleCtx *ctx, RedisModuleString ** /*argv*/, int /*argc*/) {
+    auto *task = static_cast<sw::redis::pb::AsyncTask *>(RedisModule_GetBlockedClientPrivateData(ctx));
+    assert(task != nullptr);
+
+    return task->finish(ctx);
+}
+
+void async_free(RedisModuleCtx * /*ctx*/, void *privdata) {
+    delete static_cast<sw::redis::pb::AsyncTask *>(privdata);
+}
+
+}
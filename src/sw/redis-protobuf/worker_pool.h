@@ -0,0 +1,117 @@
+/**************************************************************************
+   Copyright (c) 2019 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPROTOBUF_WORKER_POOL_H
+#define SEWENEW_REDISPROTOBUF_WORKER_POOL_H
+
+#include "module_api.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sw {
+
+namespace redis {
+
+namespace pb {
+
+// Fixed size thread pool, which runs the CPU intensive part of a command,
+// e.g. JSON serialization, out of the Redis main thread.
+class WorkerPool {
+public:
+    explicit WorkerPool(std::size_t pool_size);
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool& operator=(const WorkerPool &) = delete;
+
+    WorkerPool(WorkerPool &&) = delete;
+    WorkerPool& operator=(WorkerPool &&) = delete;
+
+    ~WorkerPool();
+
+    void submit(std::function<void ()> task);
+
+private:
+    void _run();
+
+    std::vector<std::thread> _workers;
+
+    std::deque<std::function<void ()>> _tasks;
+
+    std::mutex _mutex;
+
+    std::condition_variable _cv;
+
+    bool _stop = false;
+};
+
+// A command that is split into two parts: *run* is called in a worker thread,
+// and *reply* is called in the main thread, after *run* finishes. *run* must
+// NOT call any Redis Module API, and must NOT access the keyspace.
+class AsyncTask {
+public:
+    virtual ~AsyncTask() = default;
+
+    // Call *run* and save the error, if any. Called in a worker thread.
+    void execute();
+
+    // Reply with the error of *run*, or call *reply*. Called in the main thread.
+    int finish(RedisModuleCtx *ctx);
+
+private:
+    virtual void run() = 0;
+
+    virtual int reply(RedisModuleCtx *ctx) = 0;
+
+    bool _failed = false;
+
+    std::string _err;
+};
+
+using AsyncTaskUPtr = std::unique_ptr<AsyncTask>;
+
+namespace api {
+
+// Whether the client of *ctx* can be blocked, i.e. the blocking API is
+// available, and the command is not called in a MULTI block or a Lua script,
+// not loaded from AOF, not sent by the master, and the client allows blocking.
+bool can_block(RedisModuleCtx *ctx);
+
+// Block the client, and run *task* with *pool*. The client is unblocked,
+// and replied, when *task* finishes.
+void block_and_run(RedisModuleCtx *ctx, WorkerPool &pool, AsyncTaskUPtr task);
+
+// Block the client, until *unblock* is called with a task, whose *reply* is
+// called to reply the client. It's used by commands waiting for events of
+// the main thread, e.g. replies from other nodes, and *run* is never called.
+RedisModuleBlockedClient* block(RedisModuleCtx *ctx);
+
+void unblock(RedisModuleBlockedClient *bc, AsyncTaskUPtr task);
+
+}
+
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPROTOBUF_WORKER_POOL_H